@@ -2,17 +2,49 @@
 
 import subprocess
 import glob
+import json
 import os
+import shutil
 import sys
+import tempfile
 
 script_dir = os.path.dirname(os.path.realpath(__file__))
 os.chdir(script_dir)
 
 subprocess.run(['tup'])
 
+# Imported modules are cached under $XDG_CACHE_HOME/malang, see Module_Cache. The tests get a
+# cache of their own instead of the user's.
+cache_dir = tempfile.mkdtemp()
+mal_env = dict(os.environ, XDG_CACHE_HOME=cache_dir)
+
 def run_mal_with(args):
-    res = subprocess.run(['./mal'] + args, stdout=subprocess.PIPE)
-    return res.stdout
+    # stdin is empty so a debug build's debugger doesn't wait on a panic
+    res = subprocess.run(['./mal'] + args, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE, env=mal_env)
+    return panic_message(res.stdout)
+
+# A panic dumps the VM's stacks after its message. They hold addresses that change from run to
+# run, so the output of a test that panics is only compared up to them.
+def panic_message(output):
+    dump = output.find(b"\nDATA STACK:\n")
+    return output if dump == -1 else output[:dump]
+
+# The flags a test runs with past --quiet, from `<test>.args' if it has one.
+def flags_of(filename):
+    if not os.path.exists(filename + ".args"):
+        return []
+    with open(filename + ".args") as f:
+        return f.read().split()
+
+# Compiles a test to an image with `mal --compile' and runs that, which should print the same as
+# running the test. A test that doesn't compile prints its errors and leaves no image to run.
+def run_image_of(filename, image):
+    if os.path.exists(image):
+        os.remove(image)
+    output = run_mal_with(['--quiet'] + flags_of(filename) + ['--compile', filename, '-o', image])
+    if os.path.exists(image):
+        output += run_mal_with(['--quiet'] + flags_of(filename) + [image])
+    return output
 
 def passed(filename):
     sys.stdout.write("\033[1;32m PASS: {}\033[0;0m\n".format(filename))
@@ -21,10 +53,24 @@ def failed(filename):
     sys.stdout.write("\033[1;31m FAIL: {}\033[0;0m\n".format(filename))
 
 test_dir = 'examples/tests/'
+# Every test is run again with each of these, which mustn't change what it prints.
+variants = [
+    # the same as without it unless mal is built with USE_COMPUTED_GOTO=1
+    ['--threaded'],
+    ['--jit'],
+    # no IR passes at all, and the passes with the bigger inlining budgets. Tests are written
+    # against the default -O1.
+    ['-O0'],
+    ['-O2'],
+]
+image_dir = tempfile.mkdtemp()
 files = glob.glob(test_dir + "*.ma")
 for f in files:
     expected = ""
-    actual = run_mal_with(['--quiet', f])
+    # the first run parses what the test imports and caches it, the second loads it from there
+    shutil.rmtree(cache_dir, ignore_errors=True)
+    actual = run_mal_with(['--quiet'] + flags_of(f) + [f])
+    cached = run_mal_with(['--quiet'] + flags_of(f) + [f])
     with open(f + ".output", "rb") as exp:
         expected = exp.read()
     #print(actual)
@@ -33,3 +79,34 @@ for f in files:
         passed(f)
     else:
         failed(f)
+    if expected == cached:
+        passed(f + " (cached modules)")
+    else:
+        failed(f + " (cached modules)")
+    image = os.path.join(image_dir, os.path.basename(f)[:-len(".ma")] + ".mbc")
+    if expected == run_image_of(f, image):
+        passed(f + " (image)")
+    else:
+        failed(f + " (image)")
+    for variant in variants:
+        name = "{} ({})".format(f, " ".join(variant))
+        if expected == run_mal_with(['--quiet'] + flags_of(f) + variant + [f]):
+            passed(name)
+        else:
+            failed(name)
+    # Counting instructions mustn't change what it prints either. A test that runs to the end
+    # leaves a profile behind, one that panics doesn't.
+    profile = os.path.join(image_dir, "ops.json")
+    if os.path.exists(profile):
+        os.remove(profile)
+    output = run_mal_with(['--quiet'] + flags_of(f) + ['--profile-ops=' + profile, f])
+    profiled = expected == output
+    if os.path.exists(profile):
+        with open(profile) as p:
+            profiled = profiled and len(json.load(p)["instructions"]) > 0
+    if profiled:
+        passed(f + " (--profile-ops)")
+    else:
+        failed(f + " (--profile-ops)")
+shutil.rmtree(image_dir)
+shutil.rmtree(cache_dir, ignore_errors=True)
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <sstream>
+#include <utility>
 #include "ast.hpp"
 #include "nodes.hpp"
 
@@ -10,6 +11,25 @@ Ast_Node::~Ast_Node()
 
 METADATA_OVERRIDES_IMPL(Ast_Node)
 
+Ast::Ast(Ast &&other)
+    : imports(std::move(other.imports))
+    , first(std::move(other.first))
+    , second(std::move(other.second))
+{
+    other.imports.clear();
+    other.first.clear();
+    other.second.clear();
+}
+
+Ast &Ast::operator=(Ast &&other)
+{
+    // what this had is deleted with `other'
+    std::swap(imports, other.imports);
+    std::swap(first, other.first);
+    std::swap(second, other.second);
+    return *this;
+}
+
 Ast::~Ast()
 {
     for (auto &&n : imports)
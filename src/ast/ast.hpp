@@ -37,6 +37,9 @@ using Ast_Nodes = std::vector<Ast_Node*>;
 struct Ast
 {
     ~Ast();
+    Ast() = default;
+    Ast(Ast &&other);
+    Ast &operator=(Ast &&other);
     std::vector<struct Import_Node*> imports;
     //std::vector<struct Type_Def_Node*> type_defs;
     //std::vector<struct Extend_Node*> extensions;
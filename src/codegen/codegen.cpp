@@ -2,21 +2,97 @@
 #include "codegen.hpp"
 
 #define SHORT_INSTRUCTIONS_WHEN_POSSIBLE 1
+#define SUPERINSTRUCTIONS_WHEN_POSSIBLE 1
 
 void Codegen::push_back_instruction(Instruction instruction)
 {
+    if (m_num_recent == max_peephole)
+    {
+        for (size_t i = 1; i < max_peephole; ++i)
+        {
+            m_recent[i-1] = m_recent[i];
+        }
+        --m_num_recent;
+    }
+    m_recent[m_num_recent++] = code.size();
     code.push_back(static_cast<byte>(instruction));
 }
+Instruction Codegen::recent(size_t n) const
+{
+    assert(n < m_num_recent);
+    return static_cast<Instruction>(code[m_recent[m_num_recent-1-n]]);
+}
+bool Codegen::recent_is(size_t n, Instruction instruction) const
+{
+#if SUPERINSTRUCTIONS_WHEN_POSSIBLE
+    return n < m_num_recent && recent(n) == instruction;
+#else
+    return false;
+#endif
+}
+bool Codegen::recent_load_local(size_t n, uint16_t &local) const
+{
+#if SUPERINSTRUCTIONS_WHEN_POSSIBLE
+    if (n >= m_num_recent)
+    {
+        return false;
+    }
+    auto ins = recent(n);
+    if (ins >= Instruction::Load_Local_0 && ins <= Instruction::Load_Local_9)
+    {
+        local = static_cast<uint16_t>(ins) - static_cast<uint16_t>(Instruction::Load_Local_0);
+        return true;
+    }
+    if (ins == Instruction::Load_Local)
+    {
+        auto at = m_recent[m_num_recent-1-n] + 1;
+        local = *reinterpret_cast<const int16_t*>(code.data() + at);
+        return true;
+    }
+#endif
+    return false;
+}
+void Codegen::fuse(size_t n, Instruction superinstruction)
+{
+    // The last `n' instructions are replaced by `superinstruction', their operands must be
+    // read before this is called.
+    assert(n <= m_num_recent);
+    m_num_recent -= n;
+    code.resize(m_recent[m_num_recent]);
+    push_back_instruction(superinstruction);
+    num_fused[static_cast<size_t>(superinstruction)]++;
+}
+size_t Codegen::jump_target()
+{
+    m_num_recent = 0;
+    return code.size();
+}
 void Codegen::push_back_halt()
 {
     push_back_instruction(Instruction::Halt);
 }
 void Codegen::push_back_fixnum_add()
 {
+    uint16_t a, b;
+    if (recent_load_local(1, a) && recent_load_local(0, b))
+    {
+        fuse(2, Instruction::Fixnum_Add_Locals);
+        push_back_raw_16(a);
+        push_back_raw_16(b);
+        return;
+    }
     push_back_instruction(Instruction::Fixnum_Add);
 }
 void Codegen::push_back_fixnum_subtract()
 {
+    uint16_t a, b;
+    if (recent_load_local(1, a) && recent_load_local(0, b))
+    {
+        fuse(2, Instruction::Fixnum_Subtract_Locals);
+        push_back_raw_16(a);
+        push_back_raw_16(b);
+        return;
+    }
     push_back_instruction(Instruction::Fixnum_Subtract);
 }
 void Codegen::push_back_fixnum_multiply()
@@ -83,6 +159,58 @@ void Codegen::push_back_fixnum_invert()
 {
     push_back_instruction(Instruction::Fixnum_Invert);
 }
+void Codegen::push_back_double_add()
+{
+    push_back_instruction(Instruction::Double_Add);
+}
+void Codegen::push_back_double_subtract()
+{
+    push_back_instruction(Instruction::Double_Subtract);
+}
+void Codegen::push_back_double_multiply()
+{
+    push_back_instruction(Instruction::Double_Multiply);
+}
+void Codegen::push_back_double_divide()
+{
+    push_back_instruction(Instruction::Double_Divide);
+}
+void Codegen::push_back_double_modulo()
+{
+    push_back_instruction(Instruction::Double_Modulo);
+}
+void Codegen::push_back_double_equals()
+{
+    push_back_instruction(Instruction::Double_Equals);
+}
+void Codegen::push_back_double_not_equals()
+{
+    push_back_instruction(Instruction::Double_Not_Equals);
+}
+void Codegen::push_back_double_greater_than()
+{
+    push_back_instruction(Instruction::Double_Greater_Than);
+}
+void Codegen::push_back_double_greater_than_equals()
+{
+    push_back_instruction(Instruction::Double_Greater_Than_Equals);
+}
+void Codegen::push_back_double_less_than()
+{
+    push_back_instruction(Instruction::Double_Less_Than);
+}
+void Codegen::push_back_double_less_than_equals()
+{
+    push_back_instruction(Instruction::Double_Less_Than_Equals);
+}
+void Codegen::push_back_double_negate()
+{
+    push_back_instruction(Instruction::Double_Negate);
+}
+void Codegen::push_back_fixnum_to_double()
+{
+    push_back_instruction(Instruction::Fixnum_To_Double);
+}
 void Codegen::push_back_fixnum_add(Fixnum a, Fixnum b)
 {
     push_back_literal_value(a);
@@ -105,7 +233,7 @@ void Codegen::push_back_fixnum_divide(Fixnum a, Fixnum b)
 {
     push_back_literal_value(a);
     push_back_literal_value(b);
-    push_back_fixnum_multiply();
+    push_back_fixnum_divide();
 }
 void Codegen::push_back_fixnum_modulo(Fixnum a, Fixnum b)
 {
@@ -340,6 +468,13 @@ void Codegen::push_back_call_code(int32_t code)
 {
     push_back_instruction(Instruction::Call);
     push_back_raw_32(code);
+    add_dead_locals();
+}
+void Codegen::push_back_tail_call(int32_t code, uint16_t num_args)
+{
+    push_back_instruction(Instruction::Tail_Call);
+    push_back_raw_32(code);
+    push_back_raw_16(num_args);
 }
 void Codegen::push_back_call_code_dyn(int32_t code)
 {
@@ -349,8 +484,10 @@ void Codegen::push_back_call_code_dyn(int32_t code)
 void Codegen::push_back_call_code_dyn()
 {
     push_back_instruction(Instruction::Call_Dyn);
+    push_back_raw_32(-1); // the inline cache starts empty
+    add_dead_locals();
 }
-void Codegen::push_back_return(bool fast)
+void Codegen::push_back_return(bool fast, byte num_results)
 {
     if (fast)
     {
@@ -359,6 +496,7 @@ void Codegen::push_back_return(bool fast)
     else
     {
         push_back_instruction(Instruction::Return);
+        push_back_raw_8(num_results);
     }
 }
 
@@ -370,12 +508,32 @@ void Codegen::push_back_store_field(uint16_t n)
 
 void Codegen::push_back_load_field(uint16_t n)
 {
+    if (recent_is(0, Instruction::Load_Local_0))
+    {
+        fuse(1, Instruction::Load_Local_0_Field);
+        push_back_raw_16(n);
+        return;
+    }
     push_back_instruction(Instruction::Load_Field);
     push_back_raw_16(n);
 }
 
 void Codegen::push_back_store_local(uint16_t n)
 {
+    if (recent_is(1, Instruction::Literal_Fixnum_1) && recent_is(0, Instruction::Fixnum_Add))
+    {
+        uint16_t m;
+        if (recent_load_local(2, m) && m == n)
+        {
+            fuse(3, Instruction::Fixnum_Increment_Local);
+        }
+        else
+        {
+            fuse(2, Instruction::Fixnum_Increment_Store_Local);
+        }
+        push_back_raw_16(n);
+        return;
+    }
     switch (n)
     {
 #if SHORT_INSTRUCTIONS_WHEN_POSSIBLE
@@ -523,16 +681,54 @@ size_t Codegen::make_dummy_32()
 size_t Codegen::push_back_call_code()
 {
     push_back_instruction(Instruction::Call);
-    return make_dummy_32();
+    auto idx = make_dummy_32();
+    add_dead_locals();
+    return idx;
+}
+size_t Codegen::push_back_tail_call(uint16_t num_args)
+{
+    push_back_instruction(Instruction::Tail_Call);
+    auto idx = make_dummy_32();
+    push_back_raw_16(num_args);
+    return idx;
 }
 size_t Codegen::push_back_branch()
 {
     push_back_instruction(Instruction::Branch);
     return make_dummy_32();
 }
-size_t Codegen::push_back_pop_branch_if_false()
+void Codegen::add_dead_locals()
+{
+    if (dead_at_calls)
+    {
+        dead_locals.add(code.size(), *dead_at_calls);
+    }
+}
+
+void Codegen::push_back_pop_branch_if_false_instruction()
 {
+    static const struct { Instruction compare, superinstruction; } fusable[] =
+    {
+        {Instruction::Fixnum_Equals, Instruction::Fixnum_Equals_Pop_Branch_If_False},
+        {Instruction::Fixnum_Not_Equals, Instruction::Fixnum_Not_Equals_Pop_Branch_If_False},
+        {Instruction::Fixnum_Greater_Than, Instruction::Fixnum_Greater_Than_Pop_Branch_If_False},
+        {Instruction::Fixnum_Greater_Than_Equals, Instruction::Fixnum_Greater_Than_Equals_Pop_Branch_If_False},
+        {Instruction::Fixnum_Less_Than, Instruction::Fixnum_Less_Than_Pop_Branch_If_False},
+        {Instruction::Fixnum_Less_Than_Equals, Instruction::Fixnum_Less_Than_Equals_Pop_Branch_If_False},
+    };
+    for (auto &&f : fusable)
+    {
+        if (recent_is(0, f.compare))
+        {
+            fuse(1, f.superinstruction);
+            return;
+        }
+    }
     push_back_instruction(Instruction::Pop_Branch_If_False);
+}
+size_t Codegen::push_back_pop_branch_if_false()
+{
+    push_back_pop_branch_if_false_instruction();
     return make_dummy_32();
 }
 size_t Codegen::push_back_pop_branch_if_true()
@@ -557,7 +753,7 @@ void Codegen::push_back_branch(int32_t n)
 }
 void Codegen::push_back_pop_branch_if_false(int32_t n)
 {
-    push_back_instruction(Instruction::Pop_Branch_If_False);
+    push_back_pop_branch_if_false_instruction();
     push_back_raw_32(n);
 }
 void Codegen::push_back_pop_branch_if_true(int32_t n)
@@ -595,9 +791,10 @@ void Codegen::set_raw_32(size_t index, int32_t value)
     *reinterpret_cast<decltype(value)*>(slot) = value;
 }
 
-void Codegen::push_back_alloc_locals(uint16_t num_to_alloc)
+void Codegen::push_back_alloc_locals(uint16_t num_args, uint16_t num_to_alloc)
 {
     push_back_instruction(Instruction::Alloc_Locals);
+    push_back_raw_16(num_args);
     push_back_raw_16(num_to_alloc);
 }
 
@@ -627,7 +824,7 @@ void Codegen::push_back_array_load(bool checked)
     }
     else
     {
-        push_back_instruction(Instruction::Array_Store_Checked);
+        push_back_instruction(Instruction::Array_Load_Unchecked);
     }
 }
 
@@ -639,7 +836,7 @@ void Codegen::push_back_array_store(bool checked)
     }
     else
     {
-        push_back_instruction(Instruction::Array_Store_Checked);
+        push_back_instruction(Instruction::Array_Store_Unchecked);
     }
 }
 
@@ -672,7 +869,7 @@ void Codegen::push_back_buffer_load(bool checked)
     }
     else
     {
-        push_back_instruction(Instruction::Buffer_Load_Checked);
+        push_back_instruction(Instruction::Buffer_Load_Unchecked);
     }
 }
 
@@ -684,7 +881,7 @@ void Codegen::push_back_buffer_store(bool checked)
     }
     else
     {
-        push_back_instruction(Instruction::Buffer_Store_Checked);
+        push_back_instruction(Instruction::Buffer_Store_Unchecked);
     }
 }
 
@@ -3,11 +3,20 @@
 
 #include "../vm/vm.hpp"
 #include "../vm/instruction.hpp"
+#include "../vm/debug_info.hpp"
+#include "../vm/dead_locals.hpp"
 #include "../vm/runtime/primitive_types.hpp"
 
 struct Codegen
 {
     std::vector<byte> code;
+    Debug_Info debug_info;
+    Dead_Locals dead_locals;
+    // The locals dead after the calls pushed back now, set by IR_To_Code, or nullptr.
+    const std::vector<uint16_t> *dead_at_calls = nullptr;
+
+    // How many times each superinstruction has been emitted by the peephole.
+    size_t num_fused[static_cast<size_t>(Instruction::INSTRUCTION_ENUM_SIZE)] = {};
 
     void push_back_instruction(Instruction instruction);
     void push_back_halt();
@@ -50,6 +59,20 @@ struct Codegen
     void push_back_fixnum_negate(Fixnum n);
     void push_back_fixnum_invert(Fixnum n);
 
+    void push_back_double_add();
+    void push_back_double_subtract();
+    void push_back_double_multiply();
+    void push_back_double_divide();
+    void push_back_double_modulo();
+    void push_back_double_equals();
+    void push_back_double_not_equals();
+    void push_back_double_greater_than();
+    void push_back_double_greater_than_equals();
+    void push_back_double_less_than();
+    void push_back_double_less_than_equals();
+    void push_back_double_negate();
+    void push_back_fixnum_to_double();
+
     void push_back_noop();
 
     void push_back_literal_8(byte n);
@@ -67,9 +90,10 @@ struct Codegen
     void push_back_call_native_dyn(int32_t index);
     void push_back_call_native_dyn();
     void push_back_call_code(int32_t code);
+    void push_back_tail_call(int32_t code, uint16_t num_args);
     void push_back_call_code_dyn(int32_t code);
     void push_back_call_code_dyn();
-    void push_back_return(bool fast);
+    void push_back_return(bool fast, byte num_results);
 
     void push_back_store_field(uint16_t n);
     void push_back_store_local(uint16_t n);
@@ -86,6 +110,7 @@ struct Codegen
 
     // Returns the index into the code where the dummy value is.
     size_t push_back_call_code();
+    size_t push_back_tail_call(uint16_t num_args);
     size_t push_back_branch();
     size_t push_back_pop_branch_if_false();
     size_t push_back_pop_branch_if_true();
@@ -97,12 +122,16 @@ struct Codegen
     void push_back_branch_if_false_or_pop(int32_t n);
     void push_back_branch_if_true_or_pop(int32_t n);
 
+    // Returns the address of the next instruction. The peephole will not fuse instructions
+    // across this address so it must be used for anything that may be jumped to.
+    size_t jump_target();
+
     size_t make_dummy_32();
     void set_raw_8(size_t index, byte value);
     void set_raw_16(size_t index, int16_t value);
     void set_raw_32(size_t index, int32_t value);
 
-    void push_back_alloc_locals(uint16_t num_to_alloc);
+    void push_back_alloc_locals(uint16_t num_args, uint16_t num_to_alloc);
     void push_back_alloc_object(Type_Token type);
 
     void push_back_array_new(Type_Token type, int32_t length);
@@ -119,6 +148,20 @@ struct Codegen
     void push_back_buffer_length();
     void push_back_load_string_constant(int32_t index);
 
+private:
+    static constexpr size_t max_peephole = 4;
+    // Offsets of the most recently emitted instructions since the last jump target, the
+    // last one being the most recent.
+    size_t m_recent[max_peephole];
+    size_t m_num_recent = 0;
+
+    Instruction recent(size_t n) const;
+    bool recent_is(size_t n, Instruction instruction) const;
+    bool recent_load_local(size_t n, uint16_t &local) const;
+    void fuse(size_t n, Instruction superinstruction);
+    void push_back_pop_branch_if_false_instruction();
+    // Records `dead_at_calls' for the call that was just pushed back.
+    void add_dead_locals();
 };
 
 #endif /* MALANG_CODEGEN_CODEGEN_HPP */
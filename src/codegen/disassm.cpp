@@ -52,6 +52,7 @@ byte *Disassembler::dis1(byte *p, int offset, std::string &out)
     switch (ins)
     {
         case Instruction::Literal_8:
+        case Instruction::Return:
         {
             ss << get_n_bytes(p, 2);
             ++p;
@@ -62,10 +63,12 @@ byte *Disassembler::dis1(byte *p, int offset, std::string &out)
         case Instruction::Literal_16:
         case Instruction::Load_Local:
         case Instruction::Store_Local:
-        case Instruction::Alloc_Locals:
         case Instruction::Load_Field:
         case Instruction::Store_Field:
         case Instruction::Drop_N:
+        case Instruction::Load_Local_0_Field:
+        case Instruction::Fixnum_Increment_Store_Local:
+        case Instruction::Fixnum_Increment_Local:
         {
             ss << get_n_bytes(p, 3);
             ++p;
@@ -78,6 +81,9 @@ byte *Disassembler::dis1(byte *p, int offset, std::string &out)
         case Instruction::Literal_32:
         case Instruction::Call:
         case Instruction::Call_Native:
+        case Instruction::Call_Dyn:
+        case Instruction::Call_Dyn_Mono:
+        case Instruction::Call_Dyn_Poly:
         case Instruction::Array_New:
         case Instruction::Alloc_Object:
         case Instruction::Load_String_Constant:
@@ -93,6 +99,12 @@ byte *Disassembler::dis1(byte *p, int offset, std::string &out)
         case Instruction::Pop_Branch_If_False:
         case Instruction::Branch_If_True_Or_Pop:
         case Instruction::Pop_Branch_If_True:
+        case Instruction::Fixnum_Equals_Pop_Branch_If_False:
+        case Instruction::Fixnum_Not_Equals_Pop_Branch_If_False:
+        case Instruction::Fixnum_Greater_Than_Pop_Branch_If_False:
+        case Instruction::Fixnum_Greater_Than_Equals_Pop_Branch_If_False:
+        case Instruction::Fixnum_Less_Than_Pop_Branch_If_False:
+        case Instruction::Fixnum_Less_Than_Equals_Pop_Branch_If_False:
         {
             ss << get_n_bytes(p, 5);
             ++p;
@@ -101,6 +113,28 @@ byte *Disassembler::dis1(byte *p, int offset, std::string &out)
             ss << offset + n;
             p += sizeof(n);
         } break;
+        case Instruction::Alloc_Locals:
+        case Instruction::Fixnum_Add_Locals:
+        case Instruction::Fixnum_Subtract_Locals:
+        {
+            ss << get_n_bytes(p, 5);
+            ++p;
+            auto n = fetch16(p);
+            p += sizeof(n);
+            auto m = fetch16(p);
+            p += sizeof(m);
+            ss << ins_str << " <" << std::hex << static_cast<int>(n) << "> <" << static_cast<int>(m) << ">";
+        } break;
+        case Instruction::Tail_Call:
+        {
+            ss << get_n_bytes(p, 7);
+            ++p;
+            auto n = fetch32(p);
+            p += sizeof(n);
+            auto m = fetch16(p);
+            p += sizeof(m);
+            ss << ins_str << " <" << std::hex << n << "> <" << static_cast<int>(m) << ">";
+        } break;
         case Instruction::Literal_value:
         {
             ss << get_n_bytes(p, 9);
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "ir_to_code.hpp"
 #include "../ir/nodes.hpp"
 #include "../vm/runtime/reflection.hpp"
@@ -33,7 +34,8 @@ void IR_To_Code::visit(IR_Boolean &n)
 
 void IR_To_Code::visit(IR_Fixnum &n)
 {
-    if (static_cast<int8_t>(n.value) == n.value)
+    // Literal_8 isn't sign extended
+    if (static_cast<uint8_t>(n.value) == n.value)
     {
         cg->push_back_literal_8(n.value);
     }
@@ -126,6 +128,20 @@ void backfill_label(Codegen *cg, IR_Label *label)
     }
 }
 
+static
+void backfill_tail_call(Codegen *cg, IR_Label *label, uint16_t num_args)
+{
+    if (label->is_resolved())
+    {
+        cg->push_back_tail_call(label->address(), num_args);
+    }
+    else
+    {
+        auto idx = cg->push_back_tail_call(num_args);
+        label->please_backfill_on_resolve(cg, idx);
+    }
+}
+
 void IR_To_Code::visit(IR_Indexable &n)
 {
     convert_one(*n.thing);
@@ -141,11 +157,11 @@ void IR_To_Code::visit(IR_Indexable &n)
     assert(thing_ty);
     if (thing_ty == ir->types->get_buffer())
     {
-        cg->push_back_buffer_load();
+        cg->push_back_buffer_load(n.bounds_checked);
     }
     else if (dynamic_cast<Array_Type_Info*>(thing_ty))
     {
-        cg->push_back_array_load();
+        cg->push_back_array_load(n.bounds_checked);
     }
     else
     {
@@ -190,23 +206,66 @@ void IR_To_Code::visit(IR_Member_Access &n)
     cg->push_back_load_field(field_idx);
 }
 
-void IR_To_Code::visit(IR_Call &n)
+// The arguments are left on the stack where the callee's Alloc_Locals turns them into its
+// first locals, self first for methods, which is `self' or local 0 if that's null. Returns how
+// many there are.
+uint16_t IR_To_Code::push_arguments(bool is_method, IR_Value *self, const std::vector<IR_Value*> &arguments)
 {
-    if (auto method = dynamic_cast<IR_Method*>(n.callee))
+    uint16_t num_args = 0;
+    if (is_method)
     {
-        if (method->thing)
+        if (self)
         {
-            convert_one(*method->thing);
+            convert_one(*self);
         }
         else
         {
             cg->push_back_load_local(0);
         }
+        ++num_args;
     }
-    for (auto &&a : n.arguments)
+    for (auto &&a : arguments)
     {
         convert_one(*a);
+        ++num_args;
     }
+    return num_args;
+}
+
+// A call whose results are returned as they are can reuse the caller's locals and call frame
+// when it's to code at a known address. Returns false without converting anything otherwise.
+bool IR_To_Code::convert_tail_call(IR_Value &n)
+{
+    if (auto call_method = dynamic_cast<IR_Call_Method*>(&n))
+    {
+        if (call_method->method->is_native())
+        {
+            return false;
+        }
+        auto num_args = push_arguments(true, call_method->thing, call_method->arguments);
+        backfill_tail_call(cg, call_method->method->code_function(), num_args);
+        return true;
+    }
+    auto call = dynamic_cast<IR_Call*>(&n);
+    if (!call || dynamic_cast<IR_Call_Virtual_Method*>(call))
+    {
+        return false;
+    }
+    auto callable = dynamic_cast<IR_Callable*>(call->callee);
+    if (!callable || callable->fn_type->is_native())
+    {
+        return false;
+    }
+    auto method = dynamic_cast<IR_Method*>(callable);
+    auto num_args = push_arguments(method, method ? method->thing : nullptr, call->arguments);
+    backfill_tail_call(cg, callable->u.label, num_args);
+    return true;
+}
+
+void IR_To_Code::visit(IR_Call &n)
+{
+    auto method = dynamic_cast<IR_Method*>(n.callee);
+    push_arguments(method, method ? method->thing : nullptr, n.arguments);
 
     // Simple optimization if we know ahead of time the thing we're calling is literally
     // a callable. This is most useful for calling native builtin functions directly
@@ -240,18 +299,7 @@ void IR_To_Code::visit(IR_Call &n)
 
 void IR_To_Code::visit(IR_Call_Method &n)
 {
-    if (n.thing)
-    {
-        convert_one(*n.thing);
-    }
-    else
-    {
-        cg->push_back_load_local(0);
-    }
-    for (auto &&a : n.arguments)
-    {
-        convert_one(*a);
-    }
+    push_arguments(true, n.thing, n.arguments);
     if (n.method->is_native())
     {
         cg->push_back_call_native(n.method->native_function()->index);
@@ -269,101 +317,91 @@ void IR_To_Code::visit(IR_Call_Virtual_Method &n)
 
 void IR_To_Code::visit(IR_Return &n)
 {
+    // Only a function with locals of its own has a frame to give to the callee.
+    if (n.is_tail_call && n.should_leave && convert_tail_call(*n.values[0]))
+    {
+        return;
+    }
     for (auto &&v : n.values)
     {
         convert_one(*v);
     }
     bool fast = !n.should_leave;
-    cg->push_back_return(fast);
+    cg->push_back_return(fast, static_cast<byte>(n.values.size()));
 }
 
 void IR_To_Code::visit(IR_Label &n)
 {
     assert(!n.is_resolved());
-    auto address = cg->code.size();
+    auto address = cg->jump_target();
     n.address(address);
 }
 
 void IR_To_Code::visit(IR_Named_Block &n)
 {
+    // a function doesn't share the dead locals of the one it's defined in
+    auto outer_dead = cg->dead_at_calls;
+    if (!n.function_name.empty())
+    {
+        cg->dead_at_calls = nullptr;
+    }
     visit(static_cast<IR_Label&>(n));
     convert_many(n.body());
     convert_one(*n.end());
+    cg->dead_at_calls = outer_dead;
+    if (!n.function_name.empty())
+    {
+        cg->debug_info.functions.push_back({static_cast<uintptr_t>(n.address()),
+                                            static_cast<uintptr_t>(n.end()->address()),
+                                            n.function_name, n.src_loc});
+    }
 }
 
-void IR_To_Code::visit(IR_Branch &n)
+static
+void backfill_branch(Codegen *cg, IR_Label *destination, size_t idx)
 {
-    assert(n.destination);
-    auto from = cg->code.size();
-    if (n.destination->is_resolved())
+    // Branches are relative to the start of the instruction and the peephole may have fused
+    // the branch with the instruction before it so the start is only known now: it is the
+    // opcode directly before the offset at `idx'.
+    auto from = idx - 1;
+    if (destination->is_resolved())
     {
-        cg->push_back_branch(n.destination->address() - from);
+        cg->set_raw_32(idx, destination->address() - from);
     }
     else
     {
-        auto idx = cg->push_back_branch();
-        n.destination->please_backfill_on_resolve_rel(cg, idx, from);
+        destination->please_backfill_on_resolve_rel(cg, idx, from);
     }
 }
 
+void IR_To_Code::visit(IR_Branch &n)
+{
+    assert(n.destination);
+    backfill_branch(cg, n.destination, cg->push_back_branch());
+}
+
 void IR_To_Code::visit(IR_Pop_Branch_If_True &n)
 {
     assert(n.destination);
-    if (n.destination->is_resolved())
-    {
-        cg->push_back_pop_branch_if_true(n.destination->address());
-    }
-    else
-    {
-        auto from = cg->code.size();
-        auto idx = cg->push_back_pop_branch_if_true();
-        n.destination->please_backfill_on_resolve_rel(cg, idx, from);
-    }
+    backfill_branch(cg, n.destination, cg->push_back_pop_branch_if_true());
 }
 
 void IR_To_Code::visit(IR_Pop_Branch_If_False &n)
 {
     assert(n.destination);
-    if (n.destination->is_resolved())
-    {
-        cg->push_back_pop_branch_if_false(n.destination->address());
-    }
-    else
-    {
-        auto from = cg->code.size();
-        auto idx = cg->push_back_pop_branch_if_false();
-        n.destination->please_backfill_on_resolve_rel(cg, idx, from);
-    }
+    backfill_branch(cg, n.destination, cg->push_back_pop_branch_if_false());
 }
 
 void IR_To_Code::visit(IR_Branch_If_True_Or_Pop &n)
 {
     assert(n.destination);
-    if (n.destination->is_resolved())
-    {
-        cg->push_back_branch_if_true_or_pop(n.destination->address());
-    }
-    else
-    {
-        auto from = cg->code.size();
-        auto idx = cg->push_back_branch_if_true_or_pop();
-        n.destination->please_backfill_on_resolve_rel(cg, idx, from);
-    }
+    backfill_branch(cg, n.destination, cg->push_back_branch_if_true_or_pop());
 }
 
 void IR_To_Code::visit(IR_Branch_If_False_Or_Pop &n)
 {
     assert(n.destination);
-    if (n.destination->is_resolved())
-    {
-        cg->push_back_branch_if_false_or_pop(n.destination->address());
-    }
-    else
-    {
-        auto from = cg->code.size();
-        auto idx = cg->push_back_branch_if_false_or_pop();
-        n.destination->please_backfill_on_resolve_rel(cg, idx, from);
-    }
+    backfill_branch(cg, n.destination, cg->push_back_branch_if_false_or_pop());
 }
 
 void IR_To_Code::visit(IR_Assignment &n)
@@ -409,11 +447,11 @@ void IR_To_Code::visit(IR_Assignment &n)
         auto thing_ty = idx->thing->get_type();
         if (thing_ty == ir->types->get_buffer())
         {
-            cg->push_back_buffer_store();
+            cg->push_back_buffer_store(idx->bounds_checked);
         }
         else if (dynamic_cast<Array_Type_Info*>(thing_ty))
         {
-            cg->push_back_array_store();
+            cg->push_back_array_store(idx->bounds_checked);
         }
         else
         {
@@ -526,6 +564,35 @@ void IR_To_Code::binary_op_helper(IR_Binary_Operation &bop)
     }
 }
 
+// Emits `bop' as a double instruction when both operands are ints or doubles and at least one
+// is a double, an int operand is converted right after it's pushed. Returns false otherwise.
+inline
+bool IR_To_Code::double_op_helper(IR_Binary_Operation &bop, void (Codegen::*push_back_op)())
+{
+    auto _int = ir->types->get_int();
+    auto _double = ir->types->get_double();
+    auto lhs_is_double = bop.lhs->get_type()->is_alias_to(_double);
+    auto rhs_is_double = bop.rhs->get_type()->is_alias_to(_double);
+    auto lhs_is_number = lhs_is_double || bop.lhs->get_type()->is_alias_to(_int);
+    auto rhs_is_number = rhs_is_double || bop.rhs->get_type()->is_alias_to(_int);
+    if (!lhs_is_number || !rhs_is_number || !(lhs_is_double || rhs_is_double))
+    {
+        return false;
+    }
+    convert_one(*bop.lhs);
+    if (!lhs_is_double)
+    {
+        cg->push_back_fixnum_to_double();
+    }
+    convert_one(*bop.rhs);
+    if (!rhs_is_double)
+    {
+        cg->push_back_fixnum_to_double();
+    }
+    (cg->*push_back_op)();
+    return true;
+}
+
 void IR_To_Code::visit(IR_B_Add &n)
 {
     auto _int = ir->types->get_int();
@@ -535,7 +602,7 @@ void IR_To_Code::visit(IR_B_Add &n)
         convert_one(*n.rhs);
         cg->push_back_fixnum_add();
     }
-    else
+    else if (!double_op_helper(n, &Codegen::push_back_double_add))
     {
         binary_op_helper(n);
     }
@@ -550,7 +617,7 @@ void IR_To_Code::visit(IR_B_Subtract &n)
         convert_one(*n.rhs);
         cg->push_back_fixnum_subtract();
     }
-    else
+    else if (!double_op_helper(n, &Codegen::push_back_double_subtract))
     {
         binary_op_helper(n);
     }
@@ -565,7 +632,7 @@ void IR_To_Code::visit(IR_B_Multiply &n)
         convert_one(*n.rhs);
         cg->push_back_fixnum_multiply();
     }
-    else
+    else if (!double_op_helper(n, &Codegen::push_back_double_multiply))
     {
         binary_op_helper(n);
     }
@@ -580,7 +647,7 @@ void IR_To_Code::visit(IR_B_Divide &n)
         convert_one(*n.rhs);
         cg->push_back_fixnum_divide();
     }
-    else
+    else if (!double_op_helper(n, &Codegen::push_back_double_divide))
     {
         binary_op_helper(n);
     }
@@ -595,7 +662,7 @@ void IR_To_Code::visit(IR_B_Modulo &n)
         convert_one(*n.rhs);
         cg->push_back_fixnum_modulo();
     }
-    else
+    else if (!double_op_helper(n, &Codegen::push_back_double_modulo))
     {
         binary_op_helper(n);
     }
@@ -685,7 +752,7 @@ void IR_To_Code::visit(IR_B_Less_Than &n)
         convert_one(*n.rhs);
         cg->push_back_fixnum_less_than();
     }
-    else
+    else if (!double_op_helper(n, &Codegen::push_back_double_less_than))
     {
         binary_op_helper(n);
     }
@@ -700,7 +767,7 @@ void IR_To_Code::visit(IR_B_Less_Than_Equals &n)
         convert_one(*n.rhs);
         cg->push_back_fixnum_less_than_equals();
     }
-    else
+    else if (!double_op_helper(n, &Codegen::push_back_double_less_than_equals))
     {
         binary_op_helper(n);
     }
@@ -715,7 +782,7 @@ void IR_To_Code::visit(IR_B_Greater_Than &n)
         convert_one(*n.rhs);
         cg->push_back_fixnum_greater_than();
     }
-    else
+    else if (!double_op_helper(n, &Codegen::push_back_double_greater_than))
     {
         binary_op_helper(n);
     }
@@ -730,7 +797,7 @@ void IR_To_Code::visit(IR_B_Greater_Than_Equals &n)
         convert_one(*n.rhs);
         cg->push_back_fixnum_greater_than_equals();
     }
-    else
+    else if (!double_op_helper(n, &Codegen::push_back_double_greater_than_equals))
     {
         binary_op_helper(n);
     }
@@ -745,7 +812,7 @@ void IR_To_Code::visit(IR_B_Equals &n)
         convert_one(*n.rhs);
         cg->push_back_fixnum_equals();
     }
-    else
+    else if (!double_op_helper(n, &Codegen::push_back_double_equals))
     {
         binary_op_helper(n);
     }
@@ -760,7 +827,7 @@ void IR_To_Code::visit(IR_B_Not_Equals &n)
         convert_one(*n.rhs);
         cg->push_back_fixnum_not_equals();
     }
-    else
+    else if (!double_op_helper(n, &Codegen::push_back_double_not_equals))
     {
         binary_op_helper(n);
     }
@@ -813,6 +880,11 @@ void IR_To_Code::visit(IR_U_Negate &n)
         convert_one(*n.operand);
         cg->push_back_fixnum_negate();
     }
+    else if (n.operand->get_type()->is_alias_to(ir->types->get_double()))
+    {
+        convert_one(*n.operand);
+        cg->push_back_double_negate();
+    }
     else
     {
         unary_op_helper(n);
@@ -822,7 +894,8 @@ void IR_To_Code::visit(IR_U_Negate &n)
 void IR_To_Code::visit(IR_U_Positive &n)
 {
     auto _int = ir->types->get_int();
-    if (n.operand->get_type()->is_alias_to(_int))
+    auto _double = ir->types->get_double();
+    if (n.operand->get_type()->is_alias_to(_int) || n.operand->get_type()->is_alias_to(_double))
     {
         convert_one(*n.operand);
         // noop
@@ -893,15 +966,19 @@ void IR_To_Code::visit(IR_Deallocate_Object &n)
 }
 void IR_To_Code::visit(IR_Allocate_Locals &n)
 {
-    cg->push_back_alloc_locals(n.num_to_alloc);
+    cg->push_back_alloc_locals(n.num_args, n.num_to_alloc);
 }
 
 void IR_To_Code::convert_many(const std::vector<IR_Node*> &n)
 {
+    auto outer_dead = cg->dead_at_calls;
     for (auto &&one : n)
     {
+        auto dead = ir->dead_locals.find(one);
+        cg->dead_at_calls = dead != ir->dead_locals.end() ? &dead->second : outer_dead;
         convert_one(*one);
     }
+    cg->dead_at_calls = outer_dead;
 }
 
 Codegen *IR_To_Code::convert(Malang_IR &ir)
@@ -911,10 +988,48 @@ Codegen *IR_To_Code::convert(Malang_IR &ir)
     convert_many(ir.first);
     convert_many(ir.second);
     cg->push_back_halt();
+    cg->debug_info.finish(cg->code.size());
+    // functions were added as they ended, so the nested ones are before the ones containing them
+    std::sort(cg->debug_info.functions.begin(), cg->debug_info.functions.end(),
+              [](const Function_Symbol &a, const Function_Symbol &b)
+              { return a.begin < b.begin || (a.begin == b.begin && a.end > b.end); });
     return cg;
 }
 
 void IR_To_Code::convert_one(IR_Node &n)
 {
+    // A symbol is the same node everywhere it's used so its location is where it was declared,
+    // loading it is better attributed to whatever uses it.
+    if (dynamic_cast<IR_Symbol*>(&n))
+    {
+        n.accept(*this);
+        return;
+    }
+    auto outer = cur_node;
+    auto begin = cg->code.size();
+    cur_node = &n;
+    cg->debug_info.add_location(begin, n.src_loc);
     n.accept(*this);
+    cur_node = outer;
+    // Inlined code is in the function it came from as far as panics and the sampler are
+    // concerned. The range is added where the copy starts, the nodes in it are in it already.
+    auto fn = n.inlined_from;
+    if (fn && (!outer || outer->inlined_from != fn) && cg->code.size() > begin)
+    {
+        auto &&functions = cg->debug_info.functions;
+        auto end = cg->code.size();
+        if (!functions.empty() && functions.back().name == fn->function_name && functions.back().end == begin)
+        {   // the next statement of the same copy
+            functions.back().end = end;
+        }
+        else
+        {
+            functions.push_back({begin, end, fn->function_name, fn->src_loc});
+        }
+    }
+    // whatever the outer node emits after this one is its own again
+    if (outer)
+    {
+        cg->debug_info.add_location(cg->code.size(), outer->src_loc);
+    }
 }
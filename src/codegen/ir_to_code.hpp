@@ -70,9 +70,14 @@ struct IR_To_Code : IR_Visitor
 private:
     Codegen *cg;
     Malang_IR *ir;
+    // The node being converted, for the Debug_Info's line table.
+    IR_Node *cur_node = nullptr;
     void convert_one(IR_Node &n);
     void convert_many(const std::vector<IR_Node*> &n);
+    uint16_t push_arguments(bool is_method, struct IR_Value *self, const std::vector<struct IR_Value*> &arguments);
+    bool convert_tail_call(struct IR_Value &n);
     void binary_op_helper(struct IR_Binary_Operation &bop);
+    bool double_op_helper(struct IR_Binary_Operation &bop, void (Codegen::*push_back_op)());
     void unary_op_helper(struct IR_Unary_Operation &bop);
 };
 
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include "embedded_modules.hpp"
+
+// The table write_embedded_modules writes. They're weak since the mal that writes it is linked
+// without one, in which case they're null.
+extern "C" const unsigned char malang_embedded_modules[] __attribute__((weak));
+extern "C" const size_t malang_embedded_modules_size __attribute__((weak));
+
+// The table is the number of modules and then each module's name, filename, source and what it's
+// parsed into, each as its size and then its bytes. Everything is in the byte order of the
+// machine that built mal.
+static void put(std::vector<uint8_t> &out, const void *data, size_t size)
+{
+    uint32_t n = size;
+    auto p = reinterpret_cast<const uint8_t*>(&n);
+    out.insert(out.end(), p, p + sizeof(n));
+    p = static_cast<const uint8_t*>(data);
+    out.insert(out.end(), p, p + size);
+}
+
+static const uint8_t *get(const uint8_t *&at, size_t &size)
+{
+    uint32_t n;
+    memcpy(&n, at, sizeof(n));
+    auto data = at + sizeof(n);
+    at = data + n;
+    size = n;
+    return data;
+}
+
+static std::vector<Embedded_Module> read_embedded_modules()
+{
+    std::vector<Embedded_Module> modules;
+    if (!&malang_embedded_modules_size)
+    {
+        return modules;
+    }
+    const uint8_t *at = malang_embedded_modules;
+    uint32_t count;
+    memcpy(&count, at, sizeof(count));
+    at += sizeof(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        Embedded_Module m;
+        size_t size;
+        auto name = get(at, size);
+        m.name.assign(reinterpret_cast<const char*>(name), size);
+        auto filename = get(at, size);
+        m.filename.assign(reinterpret_cast<const char*>(filename), size);
+        m.source = reinterpret_cast<const char*>(get(at, m.source_size));
+        m.parsed = get(at, m.parsed_size);
+        modules.push_back(std::move(m));
+    }
+    assert(at == malang_embedded_modules + malang_embedded_modules_size);
+    return modules;
+}
+
+const Embedded_Module *find_embedded_module(const std::string &name)
+{
+    static const std::vector<Embedded_Module> modules = read_embedded_modules();
+    for (auto &&m : modules)
+    {
+        if (m.name == name)
+        {
+            return &m;
+        }
+    }
+    return nullptr;
+}
+
+bool write_embedded_modules(const std::string &path, const std::vector<Embedded_Module> &modules)
+{
+    std::vector<uint8_t> table;
+    uint32_t count = modules.size();
+    auto p = reinterpret_cast<const uint8_t*>(&count);
+    table.insert(table.end(), p, p + sizeof(count));
+    for (auto &&m : modules)
+    {
+        put(table, m.name.data(), m.name.size());
+        put(table, m.filename.data(), m.filename.size());
+        put(table, m.source, m.source_size);
+        put(table, m.parsed, m.parsed_size);
+    }
+
+    auto f = fopen(path.c_str(), "w");
+    if (!f)
+    {
+        printf("couldn't write `%s'\n", path.c_str());
+        return false;
+    }
+    fprintf(f, "// Made by `mal --embed' from");
+    for (auto &&m : modules)
+    {
+        fprintf(f, " %s", m.filename.c_str());
+    }
+    fprintf(f, ", don't edit.\n");
+    fprintf(f, "#include <stddef.h>\n\n");
+    fprintf(f, "extern \"C\" const unsigned char malang_embedded_modules[] = {");
+    for (size_t i = 0; i < table.size(); ++i)
+    {
+        fprintf(f, "%s0x%02x,", i % 16 == 0 ? "\n    " : "", table[i]);
+    }
+    fprintf(f, "\n};\n");
+    fprintf(f, "extern \"C\" const size_t malang_embedded_modules_size = sizeof(malang_embedded_modules);\n");
+    if (fclose(f) != 0)
+    {
+        printf("couldn't write `%s'\n", path.c_str());
+        return false;
+    }
+    return true;
+}
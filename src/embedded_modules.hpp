@@ -0,0 +1,32 @@
+#ifndef MALANG_EMBEDDED_MODULES_HPP
+#define MALANG_EMBEDDED_MODULES_HPP
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// A module built into mal so importing it doesn't look for its file or parse it, which is how
+// the standard library in lib/ comes with mal. The build links mal without them first and runs
+// that as `mal --embed -o stdlib.cpp lib/*.ma' to write them out as C++ it links into mal.
+struct Embedded_Module
+{
+    // what it's imported as
+    std::string name;
+    // what it was made from, errors in it are reported there
+    std::string filename;
+    const char *source;
+    size_t source_size;
+    // what it's parsed into, see Module_Cache::encode
+    const uint8_t *parsed;
+    size_t parsed_size;
+};
+
+// The module built into mal that's imported as `name', null if there isn't one.
+const Embedded_Module *find_embedded_module(const std::string &name);
+
+// Writes `modules' to `path' as the C++ that builds them into mal. Says why and returns false if
+// it couldn't.
+bool write_embedded_modules(const std::string &path, const std::vector<Embedded_Module> &modules);
+
+#endif /* MALANG_EMBEDDED_MODULES_HPP */
@@ -4,6 +4,7 @@
 #include "../defer.hpp"
 #include "../platform/dir.hpp"
 #include "../parser.hpp"
+#include "../embedded_modules.hpp"
 #include "../ast/nodes.hpp"
 #include "../vm/runtime/reflection.hpp"
 #include "../visitors/ast_pretty_printer.hpp"
@@ -78,27 +79,41 @@ void Ast_To_IR::visit(Import_Node &n)
         });
 
     n.mod_info->color(n.mod_info->grey);
-    std::string filename, rel_path;
+    // A file next to the importing source comes first, so a program's own string.ma isn't replaced
+    // by the one built into mal. After that it's a module built in, then the search directories.
+    std::string filename;
     // @TODO: move realpath to plat::
     auto this_source_file = realpath(n.src_loc.filename.c_str(), NULL);
-    auto this_source_dir = plat::get_directory(this_source_file);
+    auto this_source_dir = this_source_file ? plat::get_directory(this_source_file) : "";
     if (noisy)
     {
-        printf("from: %s\n", this_source_file);
+        printf("from: %s\n", this_source_file ? this_source_file : n.src_loc.filename.c_str());
         printf("dir: %s\n", this_source_dir.c_str());
     }
     free(this_source_file);
-    if (!mod_map->find_file_rel(this_source_dir, n.mod_info, filename))
+    Source_Code *src;
+    const Embedded_Module *embedded = nullptr;
+    if (!this_source_dir.empty() && mod_map->find_file_rel(this_source_dir, n.mod_info, filename))
     {
-        if (!mod_map->find_file(n.mod_info, filename))
-        {
-            n.src_loc.report("error", "Cannot find file to import.");
-            abort();
-        }
+        src = new Source_Code(filename); // @Leak
+    }
+    else if ((embedded = mod_map->find_embedded(n.mod_info)))
+    {
+        filename = embedded->filename;
+        src = new Source_Code(embedded->filename, {embedded->source, embedded->source_size}); // @Leak
+    }
+    else if (mod_map->find_file(n.mod_info, filename))
+    {
+        src = new Source_Code(filename); // @Leak
+    }
+    else
+    {
+        n.src_loc.report("error", "Cannot find file to import.");
+        abort();
     }
     if (noisy)
     {
-        printf("importing %s\n", filename.c_str());
+        printf("importing %s%s\n", filename.c_str(), embedded ? " built into mal" : "");
     }
     if (n.mod_info->locality())
     {
@@ -110,10 +125,8 @@ void Ast_To_IR::visit(Import_Node &n)
     //}
     cur_module = n.mod_info;
     ir->types->module(n.mod_info);
-    Parser parser(ir->types, mod_map);
-    auto src = new Source_Code(filename); // @Leak
-    auto ast = parser.parse(src);
-    if (parser.errors)
+    Ast ast;
+    if (!mod_map->parse(n.mod_info, src, ir->types, ast))
     {
         n.src_loc.report("error", "error parsing module.");
         abort();
@@ -363,6 +376,18 @@ void Ast_To_IR::visit(Fn_Node &n)
     locality->push(true);
     auto fn_body = ir->labels->make_named_block(label_name_gen(), label_name_gen(), n.src_loc);
     assert(fn_body);
+    if (!n.is_bound())
+    {
+        fn_body->function_name = "fn";
+    }
+    else if (is_extending)
+    {
+        fn_body->function_name = is_extending->name() + ":" + n.bound_name;
+    }
+    else
+    {
+        fn_body->function_name = n.bound_name;
+    }
     cur_fn_ep = fn_body;
     // Since code can be free (outside of a function), we opt to define a function wherever we
     // are. We don't want that code to accidently start executing so we just create a branch
@@ -412,12 +437,8 @@ void Ast_To_IR::visit(Fn_Node &n)
         p_sym->is_initialized = true;
         arg_symbols.push_back(p_sym);
     }
-    for (auto &&it = arg_symbols.rbegin(); it != arg_symbols.rend(); ++it)
-    {   // Args are pushed on the stack from left to right so they need to be pulled out
-        // in the reverse order they were declared.
-        auto assign_arg_to_local = ir->alloc<IR_Assign_Top>((*it)->src_loc, *it, cur_symbol_scope);
-        fn_body->body().push_back(assign_arg_to_local);
-    }
+    // Args are pushed on the stack from left to right, which is the order they were declared
+    // in, so Alloc_Locals can make them the first locals where they are.
     if (self_decl)
     {
         delete self_decl; // @XXX this is shite.
@@ -452,7 +473,7 @@ void Ast_To_IR::visit(Fn_Node &n)
     }
     if (cur_locals_count > 0)
     {
-        auto num_locals_to_alloc = ir->alloc<IR_Allocate_Locals>(n.src_loc, cur_locals_count);
+        auto num_locals_to_alloc = ir->alloc<IR_Allocate_Locals>(n.src_loc, arg_symbols.size(), cur_locals_count);
         fn_body->body().insert(fn_body->body().begin(), num_locals_to_alloc);
         for (auto &&ret : *all_returns_this_fn)
         {
@@ -945,6 +966,7 @@ void Ast_To_IR::visit(Constructor_Node &n)
     auto ctor_body =
         ir->labels->make_named_block(label_name_gen(), label_name_gen(), n.src_loc);
     assert(ctor_body);
+    ctor_body->function_name = is_extending->name() + ":constructor";
     auto branch_over_body = ir->alloc<IR_Branch>(n.src_loc, ctor_body->end());
 
     cur_symbol_scope = Symbol_Scope::Local;
@@ -981,12 +1003,7 @@ void Ast_To_IR::visit(Constructor_Node &n)
         p_sym->is_initialized = true;
         arg_symbols.push_back(p_sym);
     }
-    for (auto &&it = arg_symbols.rbegin(); it != arg_symbols.rend(); ++it)
-    {   // Args are pushed on the stack from left to right so they need to be pulled out
-        // in the reverse order they were declared.
-        auto assign_arg_to_local = ir->alloc<IR_Assign_Top>((*it)->src_loc, *it, cur_symbol_scope);
-        ctor_body->body().push_back(assign_arg_to_local);
-    }
+    // Args become the first locals, see Fn_Node
     if (self_decl)
     {
         delete self_decl; // @XXX this is shite.
@@ -1009,7 +1026,7 @@ void Ast_To_IR::visit(Constructor_Node &n)
     }
     if (cur_locals_count > 0)
     {
-        auto num_locals_to_alloc = ir->alloc<IR_Allocate_Locals>(n.src_loc, cur_locals_count);
+        auto num_locals_to_alloc = ir->alloc<IR_Allocate_Locals>(n.src_loc, arg_symbols.size(), cur_locals_count);
         ctor_body->body().insert(ctor_body->body().begin(), num_locals_to_alloc);
         for (auto &&ret : *all_returns_this_fn)
         {
@@ -1097,15 +1114,11 @@ void Ast_To_IR::visit(Type_Def_Node &n)
     cur_symbol_scope = Symbol_Scope::Field;
     auto init = ir->labels->make_named_block(label_name_gen(), label_name_gen(), n.src_loc);
     assert(init);
+    init->function_name = n.type->name() + ":init";
     auto branch_over_body = ir->alloc<IR_Branch>(n.src_loc, init->end());
-    auto alloc = ir->alloc<IR_Allocate_Locals>(n.src_loc, 1);
+    // self is the only argument
+    auto alloc = ir->alloc<IR_Allocate_Locals>(n.src_loc, 1, 1);
     init->body().push_back(alloc);
-    auto store_self =
-        ir->alloc<IR_Assign_Top>(
-            n.src_loc,
-            ir->alloc<IR_Fixnum>(n.src_loc, ir->types->get_int(), 0),
-            Symbol_Scope::Local);
-    init->body().push_back(store_self);
 
     for (auto &&field : n.fields)
     {
@@ -1273,6 +1286,12 @@ void Ast_To_IR::visit(Return_Node &n)
     }
     */
     auto retn = ir->alloc<IR_Return>(n.src_loc, values, cur_locals_count != 0);
+    if (values.size() == 1
+        && (dynamic_cast<IR_Call*>(values[0]) || dynamic_cast<IR_Call_Method*>(values[0])))
+    {   // `return f(...)' doesn't need this function's frame after the call, whether the call
+        // can be made without it is left to IR_To_Code.
+        retn->is_tail_call = true;
+    }
     all_returns_this_fn->push_back(retn);
     _return(retn);
 }
@@ -1321,7 +1340,10 @@ void Ast_To_IR::convert_body(const std::vector<Ast_Node*> &src, std::vector<IR_N
         {
             if (!is_last_iter || !collecting_last_node)
             {
-                if (val->get_type() != ir->types->get_void())
+                // a bound function definition doesn't leave anything on the stack.
+                auto callable = dynamic_cast<IR_Callable*>(val);
+                if (val->get_type() != ir->types->get_void() &&
+                    !(callable && callable->is_special_bound))
                 {
                     auto discard = ir->alloc<IR_Discard_Result>(ast_node->src_loc, 1);
                     dst.push_back(discard);
@@ -26,6 +26,7 @@ bool Bound_Function_Map::add_constructor(Type_Info *to_type, Function_Type_Info
         //return false;
     }
     m_all_natives.push_back(native);
+    m_all_native_names.push_back(ctor_name + " " + fn_type->name());
     return true;
 }
 
@@ -62,6 +63,7 @@ bool Bound_Function_Map::add_method(Type_Info *to_type, const std::string &name,
         //return false;
     }
     m_all_natives.push_back(native);
+    m_all_native_names.push_back(to_type->name() + "." + name + " " + fn_type->name());
     return true;
 }
 
@@ -99,6 +101,7 @@ bool Bound_Function_Map::add(const std::string &name, Function_Type_Info *fn_typ
         auto pfn = new Native_Function{name, index, native, fn_type};
         m_free_functions[name][fn_type->parameter_types()] = new Bound_Function(pfn);
         m_all_natives.push_back(native);
+        m_all_native_names.push_back(name + " " + fn_type->name());
         m_natives_to_free.push_back(pfn);
     }
     else
@@ -107,6 +110,7 @@ bool Bound_Function_Map::add(const std::string &name, Function_Type_Info *fn_typ
         auto pfn = new Native_Function{name, index, native, fn_type};
         m_free_functions[name] = {{fn_type->parameter_types(), new Bound_Function(pfn)}};
         m_all_natives.push_back(native);
+        m_all_native_names.push_back(name + " " + fn_type->name());
         m_natives_to_free.push_back(pfn);
     }
     return true;
@@ -168,6 +172,11 @@ std::vector<Native_Code> Bound_Function_Map::natives() const
     return m_all_natives;
 }
 
+std::vector<std::string> Bound_Function_Map::native_names() const
+{
+    return m_all_native_names;
+}
+
 bool Bound_Function_Map::any(const std::string &name) const
 {
     return m_free_functions.find(name) != m_free_functions.end();
@@ -86,11 +86,15 @@ struct Bound_Function_Map
     void dump() const;
 
     std::vector<Native_Code> natives() const;
+    // What each of natives() is called, "type.name fn-type" for methods and "name fn-type"
+    // otherwise, these stay the same as long as the native does while its index may not.
+    std::vector<std::string> native_names() const;
 private:
     using Params_To_Function_Map = std::unordered_map<Function_Parameters, Bound_Function*>;
     using Name_To_Params_To_Bound_Function_Map = std::map<std::string, Params_To_Function_Map>;
     Name_To_Params_To_Bound_Function_Map m_free_functions;
     std::vector<Native_Code> m_all_natives;
+    std::vector<std::string> m_all_native_names;
     std::vector<Native_Function*> m_natives_to_free;
 };
 
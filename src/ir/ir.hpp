@@ -2,6 +2,8 @@
 #define MALANG_IR_IR_HPP
 
 #include <vector>
+#include <unordered_map>
+#include <stdint.h>
 #include "../metadata.hpp"
 #include "../type_map.hpp"
 #include "../source_code.hpp"
@@ -26,6 +28,9 @@ struct IR_Node : public Metadata
     METADATA_OVERRIDES;
 
     Source_Location src_loc;
+    // The function this node was copied from by IR_Inline, its code is reported as that
+    // function's rather than the caller's.
+    struct IR_Named_Block *inlined_from = nullptr;
 protected:
     friend struct Malang_IR;
     //void * operator new(size_t);
@@ -43,6 +48,9 @@ struct Malang_IR
     Label_Map *labels;
     std::vector<IR_Node*> first;
     std::vector<IR_Node*> second;
+    // The local slots of a function that nothing reads from the start of a statement in it on,
+    // by the statement, see IR_Pack_Locals.
+    std::unordered_map<const IR_Node*, std::vector<uint16_t>> dead_locals;
 
     // This scheme has been adopted because some IR_Nodes are shared (e.g labels) as the
     // base type IR_Node* which leads to a horrible ownership problem. The simplest solution
@@ -57,13 +57,16 @@ struct IR_Call_Virtual_Method : IR_Call
 struct IR_Allocate_Locals : IR_Node
 {
     virtual ~IR_Allocate_Locals() = default;
-    IR_Allocate_Locals(const Source_Location &src_loc, uint16_t num_to_alloc)
+    IR_Allocate_Locals(const Source_Location &src_loc, uint16_t num_args, uint16_t num_to_alloc)
         : IR_Node(src_loc)
+        , num_args(num_args)
         , num_to_alloc(num_to_alloc)
         {}
 
     IR_NODE_OVERRIDES;
 
+    // The arguments are already on the stack and become the first `num_args' locals.
+    uint16_t num_args;
     uint16_t num_to_alloc;
 };
 
@@ -129,6 +132,8 @@ struct IR_Indexable : IR_LValue
     IR_Value *thing;
     Type_Info *value_type;
     std::vector<IR_Value*> arguments;
+    // Cleared for arrays and buffers when the index is known to be in bounds.
+    bool bounds_checked = true;
     virtual Type_Info *get_type() const override { return value_type; };
 };
 
@@ -0,0 +1,297 @@
+#include "ir_clone.hpp"
+#include "nodes.hpp"
+#include "../vm/runtime/reflection.hpp"
+
+// Statements, and the statements in the blocks and loops that are statements themselves, are
+// run with nothing of the function's on the stack, so only a return there can be a jump.
+static
+size_t count_statement_returns(const std::vector<IR_Node*> &nodes)
+{
+    size_t n = 0;
+    for (auto &&node : nodes)
+    {
+        if (dynamic_cast<IR_Return*>(node))
+        {
+            ++n;
+        }
+        else if (auto block = dynamic_cast<IR_Named_Block*>(node))
+        {
+            n += count_statement_returns(block->body());
+        }
+        else if (auto block = dynamic_cast<IR_Block*>(node))
+        {
+            n += count_statement_returns(block->nodes);
+        }
+    }
+    return n;
+}
+
+bool IR_Body_Scan::scan(std::vector<IR_Node*> &body, IR_Label *fn)
+{
+    m_fn = fn;
+    if (body.empty() || !dynamic_cast<IR_Return*>(body.back()))
+    {
+        return false;
+    }
+    walk(body);
+    return !m_bad && count_statement_returns(body) == num_returns;
+}
+
+void IR_Body_Scan::visit(IR_Assign_Top &) { m_bad = true; }
+void IR_Body_Scan::visit(IR_Method &) { m_bad = true; }
+void IR_Body_Scan::visit(IR_Call_Virtual_Method &) { m_bad = true; }
+void IR_Body_Scan::visit(IR_Deallocate_Object &) { m_bad = true; }
+void IR_Body_Scan::visit(IR_Allocate_Locals &) { m_bad = true; }
+
+void IR_Body_Scan::visit(IR_Named_Block &n)
+{
+    if (!n.function_name.empty())
+    {   // a function defined in the body
+        m_bad = true;
+        return;
+    }
+    IR_Pass::visit(n);
+}
+
+void IR_Body_Scan::visit(IR_Return &n)
+{
+    IR_Pass::visit(n);
+    ++num_returns;
+    if (n.values.size() > 1)
+    {
+        m_bad = true;
+    }
+}
+
+void IR_Body_Scan::visit(IR_Symbol &n)
+{
+    if (n.scope == Symbol_Scope::Local && !locals.count(n.index))
+    {
+        locals[n.index] = &n;
+    }
+}
+
+void IR_Body_Scan::visit(IR_Callable &n)
+{
+    if (!n.fn_type->is_native() && n.u.label == m_fn)
+    {
+        m_bad = true;
+    }
+}
+
+void IR_Body_Scan::visit(IR_Call_Method &n)
+{
+    IR_Pass::visit(n);
+    if (!n.method->is_native() && n.method->code_function() == m_fn)
+    {
+        m_bad = true;
+    }
+}
+
+std::vector<IR_Node*> IR_Cloner::clone(Malang_IR &ir, const std::vector<IR_Node*> &body)
+{
+    this->ir = &ir;
+    auto copy = body;
+    walk(copy);
+    return copy;
+}
+
+bool IR_Cloner::lower_returns(std::vector<IR_Node*> &body, IR_Label *end)
+{
+    return lower_returns(body, end, true);
+}
+
+bool IR_Cloner::lower_returns(std::vector<IR_Node*> &nodes, IR_Label *end, bool is_body)
+{
+    bool jumps = false;
+    std::vector<IR_Node*> lowered;
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        auto node = nodes[i];
+        if (auto ret = dynamic_cast<IR_Return*>(node))
+        {
+            lowered.insert(lowered.end(), ret->values.begin(), ret->values.end());
+            if (!is_body || i + 1 != nodes.size())
+            {
+                lowered.push_back(ir->alloc<IR_Branch>(ret->src_loc, end));
+                jumps = true;
+            }
+            continue;
+        }
+        if (auto block = dynamic_cast<IR_Named_Block*>(node))
+        {
+            jumps |= lower_returns(block->body(), end, false);
+        }
+        else if (auto block = dynamic_cast<IR_Block*>(node))
+        {
+            jumps |= lower_returns(block->nodes, end, false);
+        }
+        lowered.push_back(node);
+    }
+    nodes = std::move(lowered);
+    return jumps;
+}
+
+template <typename T>
+T *IR_Cloner::copy(T &n)
+{
+    auto c = ir->alloc<T>(n);
+    if (!c->inlined_from)
+    {
+        c->inlined_from = inlined_from;
+    }
+    IR_Pass::visit(*c);
+    replace(c);
+    return c;
+}
+
+template <typename T>
+void IR_Cloner::copy_branch(T &n)
+{
+    auto c = ir->alloc<T>(n);
+    if (!c->inlined_from)
+    {
+        c->inlined_from = inlined_from;
+    }
+    c->destination = label(n.destination);
+    replace(c);
+}
+
+IR_Label *IR_Cloner::label(IR_Label *l)
+{
+    auto it = m_labels.find(l);
+    if (it != m_labels.end())
+    {
+        return it->second;
+    }
+    IR_Label *copy;
+    if (auto block = dynamic_cast<IR_Named_Block*>(l))
+    {
+        copy = ir->alloc<IR_Named_Block>(block->src_loc, block->name() + ".inl", label(block->end()));
+    }
+    else
+    {
+        copy = ir->alloc<IR_Label>(l->src_loc, l->name() + ".inl");
+    }
+    copy->inlined_from = l->inlined_from ? l->inlined_from : inlined_from;
+    m_labels[l] = copy;
+    return copy;
+}
+
+#define CLONE(class_name) void IR_Cloner::visit(class_name &n) { copy(n); }
+CLONE(IR_Assign_Top)
+CLONE(IR_Noop)
+CLONE(IR_Discard_Result)
+CLONE(IR_Duplicate_Result)
+CLONE(IR_Block)
+CLONE(IR_Boolean)
+CLONE(IR_Fixnum)
+CLONE(IR_Single)
+CLONE(IR_Double)
+CLONE(IR_New_Array)
+CLONE(IR_String)
+CLONE(IR_Callable)
+CLONE(IR_Method)
+CLONE(IR_Indexable)
+CLONE(IR_Call)
+CLONE(IR_Return)
+CLONE(IR_Assignment)
+CLONE(IR_B_Add)
+CLONE(IR_B_Subtract)
+CLONE(IR_B_Multiply)
+CLONE(IR_B_Divide)
+CLONE(IR_B_Modulo)
+CLONE(IR_B_And)
+CLONE(IR_B_Or)
+CLONE(IR_B_Xor)
+CLONE(IR_B_Left_Shift)
+CLONE(IR_B_Right_Shift)
+CLONE(IR_B_Less_Than)
+CLONE(IR_B_Less_Than_Equals)
+CLONE(IR_B_Greater_Than)
+CLONE(IR_B_Greater_Than_Equals)
+CLONE(IR_B_Equals)
+CLONE(IR_B_Not_Equals)
+CLONE(IR_U_Not)
+CLONE(IR_U_Invert)
+CLONE(IR_U_Negate)
+CLONE(IR_U_Positive)
+CLONE(IR_Allocate_Object)
+CLONE(IR_Deallocate_Object)
+CLONE(IR_Allocate_Locals)
+#undef CLONE
+
+void IR_Cloner::visit(IR_Branch &n) { copy_branch(n); }
+void IR_Cloner::visit(IR_Pop_Branch_If_True &n) { copy_branch(n); }
+void IR_Cloner::visit(IR_Pop_Branch_If_False &n) { copy_branch(n); }
+void IR_Cloner::visit(IR_Branch_If_True_Or_Pop &n) { copy_branch(n); }
+void IR_Cloner::visit(IR_Branch_If_False_Or_Pop &n) { copy_branch(n); }
+
+void IR_Cloner::visit(IR_Label &n)
+{
+    replace(label(&n));
+}
+
+void IR_Cloner::visit(IR_Named_Block &n)
+{
+    auto block = static_cast<IR_Named_Block*>(label(&n));
+    block->body() = n.body();
+    walk(block->body());
+    replace(block);
+}
+
+static inline
+bool is_local_0(IR_Value *v)
+{
+    auto sym = dynamic_cast<IR_Symbol*>(v);
+    return sym && sym->scope == Symbol_Scope::Local && sym->index == 0;
+}
+
+void IR_Cloner::visit(IR_Symbol &n)
+{
+    switch (n.scope)
+    {
+        default:
+            break;
+        case Symbol_Scope::Local:
+            if (!keeps_self || n.index != 0)
+            {
+                assert(locals.count(n.index));
+                replace(locals[n.index]);
+            }
+            break;
+        case Symbol_Scope::Field:
+            if (!fields.empty())
+            {
+                assert(fields.count(n.symbol));
+                replace(fields[n.symbol]);
+            }
+            else if (!keeps_self)
+            {
+                assert(self);
+                replace(ir->alloc<IR_Member_Access>(n.src_loc, self, n.symbol));
+            }
+            break;
+    }
+}
+
+void IR_Cloner::visit(IR_Member_Access &n)
+{
+    if (!fields.empty() && is_local_0(n.thing))
+    {
+        assert(fields.count(n.member_name));
+        replace(fields[n.member_name]);
+        return;
+    }
+    copy(n);
+}
+
+void IR_Cloner::visit(IR_Call_Method &n)
+{
+    auto call = copy(n);
+    if (!call->thing && !keeps_self)
+    {
+        assert(self);
+        call->thing = self;
+    }
+}
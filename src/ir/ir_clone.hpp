@@ -0,0 +1,123 @@
+#ifndef MALANG_IR_IR_CLONE_HPP
+#define MALANG_IR_IR_CLONE_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "ir_pass.hpp"
+
+// Looks over the body of a function, without its IR_Allocate_Locals, to decide whether a
+// copy of it can be put in place of a call to it, and finds the symbols of its locals.
+struct IR_Body_Scan : IR_Pass
+{
+    virtual const char *name() const override { return "body-scan"; }
+    // Whether `body' of the function `fn' can be copied: it ends with a return, doesn't call
+    // `fn' or define functions, returns at most one value and only returns from statements.
+    bool scan(std::vector<IR_Node*> &body, struct IR_Label *fn);
+
+    virtual void visit(struct IR_Assign_Top &n) override;
+    virtual void visit(struct IR_Method &n) override;
+    virtual void visit(struct IR_Call_Virtual_Method &n) override;
+    virtual void visit(struct IR_Deallocate_Object &n) override;
+    virtual void visit(struct IR_Allocate_Locals &n) override;
+    virtual void visit(struct IR_Named_Block &n) override;
+    virtual void visit(struct IR_Return &n) override;
+    virtual void visit(struct IR_Symbol &n) override;
+    virtual void visit(struct IR_Callable &n) override;
+    virtual void visit(struct IR_Call_Method &n) override;
+
+    size_t num_returns = 0;
+    // The first symbol seen for each local slot.
+    std::unordered_map<size_t, struct IR_Symbol*> locals;
+
+private:
+    struct IR_Label *m_fn = nullptr;
+    bool m_bad = false;
+};
+
+// Copies a function body to put in place of a call to it. Every node is copied, the locals
+// are swapped for the symbols in `locals' and the fields of `self' are read through `self',
+// or through `fields' when the object itself is being replaced by a variable for each field.
+struct IR_Cloner : IR_Pass
+{
+    virtual const char *name() const override { return "clone"; }
+    std::vector<IR_Node*> clone(Malang_IR &ir, const std::vector<IR_Node*> &body);
+    // Replaces the returns in a copied body with their values and a jump to `end', except
+    // the last statement which falls through to it. Returns whether anything jumps to `end'.
+    bool lower_returns(std::vector<IR_Node*> &body, struct IR_Label *end);
+
+    // If `keeps_self' the function's local 0 is the caller's too, and so are its fields.
+    bool keeps_self = false;
+    struct IR_Symbol *self = nullptr;
+    std::unordered_map<size_t, struct IR_Symbol*> locals;
+    std::unordered_map<std::string, struct IR_Symbol*> fields;
+    // Set as the `inlined_from' of the copies that don't have one yet.
+    struct IR_Named_Block *inlined_from = nullptr;
+
+    virtual void visit(struct IR_Assign_Top&) override;
+    virtual void visit(struct IR_Noop&) override;
+    virtual void visit(struct IR_Discard_Result&) override;
+    virtual void visit(struct IR_Duplicate_Result&) override;
+    virtual void visit(struct IR_Block&) override;
+
+    virtual void visit(struct IR_Boolean&) override;
+    virtual void visit(struct IR_Fixnum&) override;
+    virtual void visit(struct IR_Single&) override;
+    virtual void visit(struct IR_Double&) override;
+    virtual void visit(struct IR_New_Array&) override;
+    virtual void visit(struct IR_String&) override;
+    virtual void visit(struct IR_Symbol&) override;
+    virtual void visit(struct IR_Callable&) override;
+    virtual void visit(struct IR_Method&) override;
+    virtual void visit(struct IR_Indexable&) override;
+    virtual void visit(struct IR_Member_Access&) override;
+
+    virtual void visit(struct IR_Call&) override;
+    virtual void visit(struct IR_Call_Method&) override;
+    virtual void visit(struct IR_Return&) override;
+    virtual void visit(struct IR_Label&) override;
+    virtual void visit(struct IR_Named_Block&) override;
+    virtual void visit(struct IR_Branch&) override;
+    virtual void visit(struct IR_Pop_Branch_If_True&) override;
+    virtual void visit(struct IR_Pop_Branch_If_False&) override;
+    virtual void visit(struct IR_Branch_If_True_Or_Pop&) override;
+    virtual void visit(struct IR_Branch_If_False_Or_Pop&) override;
+    virtual void visit(struct IR_Assignment&) override;
+
+    virtual void visit(struct IR_B_Add&) override;
+    virtual void visit(struct IR_B_Subtract&) override;
+    virtual void visit(struct IR_B_Multiply&) override;
+    virtual void visit(struct IR_B_Divide&) override;
+    virtual void visit(struct IR_B_Modulo&) override;
+    virtual void visit(struct IR_B_And&) override;
+    virtual void visit(struct IR_B_Or&) override;
+    virtual void visit(struct IR_B_Xor&) override;
+    virtual void visit(struct IR_B_Left_Shift&) override;
+    virtual void visit(struct IR_B_Right_Shift&) override;
+    virtual void visit(struct IR_B_Less_Than&) override;
+    virtual void visit(struct IR_B_Less_Than_Equals&) override;
+    virtual void visit(struct IR_B_Greater_Than&) override;
+    virtual void visit(struct IR_B_Greater_Than_Equals&) override;
+    virtual void visit(struct IR_B_Equals&) override;
+    virtual void visit(struct IR_B_Not_Equals&) override;
+
+    virtual void visit(struct IR_U_Not&) override;
+    virtual void visit(struct IR_U_Invert&) override;
+    virtual void visit(struct IR_U_Negate&) override;
+    virtual void visit(struct IR_U_Positive&) override;
+
+    virtual void visit(struct IR_Allocate_Object&) override;
+    virtual void visit(struct IR_Deallocate_Object&) override;
+    virtual void visit(struct IR_Allocate_Locals&) override;
+
+private:
+    std::unordered_map<struct IR_Label*, struct IR_Label*> m_labels;
+    template <typename T>
+    T *copy(T &n);
+    template <typename T>
+    void copy_branch(T &n);
+    struct IR_Label *label(struct IR_Label *l);
+    bool lower_returns(std::vector<IR_Node*> &nodes, struct IR_Label *end, bool is_body);
+};
+
+#endif /* MALANG_IR_IR_CLONE_HPP */
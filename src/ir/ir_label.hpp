@@ -52,6 +52,10 @@ struct IR_Named_Block : IR_Label
     std::vector<IR_Node*> &body();
     IR_Label *end() const;
 
+    // Set when the block is the body of a function, it's the name the function goes by in
+    // the Debug_Info.
+    std::string function_name;
+
 private:
     IR_Label *m_end;
     std::vector<IR_Node*> m_body;
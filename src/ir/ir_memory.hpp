@@ -9,6 +9,7 @@ struct IR_Deallocate_Object : IR_Node
     virtual ~IR_Deallocate_Object();
     IR_Deallocate_Object(const Source_Location &src_loc)
         : IR_Node(src_loc)
+        , thing_to_deallocate(nullptr)
         {}
     IR_Value *thing_to_deallocate;
 
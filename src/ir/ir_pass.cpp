@@ -0,0 +1,222 @@
+#include "ir_pass.hpp"
+#include "nodes.hpp"
+
+bool IR_Pass::run(Malang_IR &ir)
+{
+    this->ir = &ir;
+    changed = false;
+    num_visited = 0;
+    walk(ir.first);
+    walk(ir.second);
+    return changed;
+}
+
+void IR_Pass::walk_one(IR_Node *&node)
+{
+    ++num_visited;
+    auto outer = m_replacement;
+    auto outer_visiting = m_visiting;
+    auto outer_parent = m_parent;
+    auto replacement = node;
+    m_replacement = &replacement;
+    m_parent = m_visiting;
+    m_visiting = node;
+    node->accept(*this);
+    m_replacement = outer;
+    m_visiting = outer_visiting;
+    m_parent = outer_parent;
+    if (replacement != node)
+    {
+        node = replacement;
+        changed = true;
+    }
+}
+
+void IR_Pass::walk(std::vector<IR_Node*> &nodes)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        auto node = nodes[i];
+        walk_one(node);
+        if (node)
+        {
+            nodes[kept++] = node;
+        }
+    }
+    nodes.resize(kept);
+}
+
+void IR_Pass::replace(IR_Node *with)
+{
+    assert(m_replacement);
+    *m_replacement = with;
+}
+
+void IR_Pass::remove()
+{
+    replace(nullptr);
+}
+
+void IR_Pass::walk_binary(IR_Binary_Operation &n)
+{
+    walk(n.lhs);
+    walk(n.rhs);
+}
+
+void IR_Pass::walk_unary(IR_Unary_Operation &n)
+{
+    walk(n.operand);
+}
+
+void IR_Pass::visit(IR_Assign_Top &n)
+{
+    walk(n.lhs);
+}
+void IR_Pass::visit(IR_Noop &) {}
+void IR_Pass::visit(IR_Discard_Result &) {}
+void IR_Pass::visit(IR_Duplicate_Result &) {}
+void IR_Pass::visit(IR_Block &n)
+{
+    walk(n.nodes);
+}
+
+void IR_Pass::visit(IR_Boolean &) {}
+void IR_Pass::visit(IR_Fixnum &) {}
+void IR_Pass::visit(IR_Single &) {}
+void IR_Pass::visit(IR_Double &) {}
+void IR_Pass::visit(IR_New_Array &n)
+{
+    walk(n.size);
+}
+void IR_Pass::visit(IR_String &) {}
+void IR_Pass::visit(IR_Symbol &) {}
+void IR_Pass::visit(IR_Callable &) {}
+void IR_Pass::visit(IR_Method &n)
+{
+    walk(n.thing);
+}
+void IR_Pass::visit(IR_Indexable &n)
+{
+    walk(n.thing);
+    for (auto &&a : n.arguments)
+    {
+        walk(a);
+    }
+}
+void IR_Pass::visit(IR_Member_Access &n)
+{
+    walk(n.thing);
+}
+
+void IR_Pass::visit(IR_Call &n)
+{
+    walk(n.callee);
+    for (auto &&a : n.arguments)
+    {
+        walk(a);
+    }
+}
+void IR_Pass::visit(IR_Call_Method &n)
+{
+    walk(n.thing);
+    for (auto &&a : n.arguments)
+    {
+        walk(a);
+    }
+}
+void IR_Pass::visit(IR_Call_Virtual_Method &n)
+{
+    visit(static_cast<IR_Call&>(n));
+}
+void IR_Pass::visit(IR_Return &n)
+{
+    for (auto &&v : n.values)
+    {
+        walk(v);
+    }
+}
+void IR_Pass::visit(IR_Label &) {}
+void IR_Pass::visit(IR_Named_Block &n)
+{
+    walk(n.body());
+    IR_Node *end = n.end();
+    walk_one(end);
+    assert(end == n.end() && "the end of a named block can't be replaced");
+}
+void IR_Pass::visit(IR_Branch &) {}
+void IR_Pass::visit(IR_Pop_Branch_If_True &) {}
+void IR_Pass::visit(IR_Pop_Branch_If_False &) {}
+void IR_Pass::visit(IR_Branch_If_True_Or_Pop &) {}
+void IR_Pass::visit(IR_Branch_If_False_Or_Pop &) {}
+void IR_Pass::visit(IR_Assignment &n)
+{
+    walk(n.lhs);
+    walk(n.rhs);
+}
+
+void IR_Pass::visit(IR_B_Add &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Subtract &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Multiply &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Divide &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Modulo &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_And &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Or &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Xor &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Left_Shift &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Right_Shift &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Less_Than &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Less_Than_Equals &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Greater_Than &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Greater_Than_Equals &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Equals &n) { walk_binary(n); }
+void IR_Pass::visit(IR_B_Not_Equals &n) { walk_binary(n); }
+
+void IR_Pass::visit(IR_U_Not &n) { walk_unary(n); }
+void IR_Pass::visit(IR_U_Invert &n) { walk_unary(n); }
+void IR_Pass::visit(IR_U_Negate &n) { walk_unary(n); }
+void IR_Pass::visit(IR_U_Positive &n) { walk_unary(n); }
+
+void IR_Pass::visit(IR_Allocate_Object &n)
+{
+    for (auto &&a : n.args)
+    {
+        walk(a);
+    }
+}
+void IR_Pass::visit(IR_Deallocate_Object &n)
+{
+    walk(n.thing_to_deallocate);
+}
+void IR_Pass::visit(IR_Allocate_Locals &) {}
+
+size_t IR_Node_Counter::count(Malang_IR &ir)
+{
+    run(ir);
+    return num_visited;
+}
+
+size_t IR_Global_Finder::find_unused(Malang_IR &ir)
+{
+    m_unused = 0;
+    run(ir);
+    return m_unused;
+}
+
+void IR_Global_Finder::visit(IR_Symbol &n)
+{
+    if (n.scope == Symbol_Scope::Global && n.index >= m_unused)
+    {
+        m_unused = n.index + 1;
+    }
+}
+
+void IR_Global_Finder::visit(IR_Assign_Top &n)
+{
+    IR_Pass::visit(n);
+    auto index = dynamic_cast<IR_Fixnum*>(n.lhs);
+    if (index && n.scope == Symbol_Scope::Global && static_cast<size_t>(index->value) >= m_unused)
+    {
+        m_unused = index->value + 1;
+    }
+}
@@ -0,0 +1,143 @@
+#ifndef MALANG_IR_IR_PASS_HPP
+#define MALANG_IR_IR_PASS_HPP
+
+#include <assert.h>
+#include <vector>
+#include "ir.hpp"
+#include "ir_visitor.hpp"
+
+// An optimization over the IR between Ast_To_IR and IR_To_Code.
+//
+// The visits walk a node's children before doing anything else and nothing more, so a pass
+// overrides the nodes it's interested in, calls IR_Pass::visit(n) first if it wants the
+// children already done, and then may replace() the node it's visiting or remove() it from the
+// list it's in. The targets of branches and the functions of IR_Callables are not children,
+// they're reached where they're defined in the lists.
+//
+// Symbols are shared by every use of the variable so they must never be changed in place.
+struct IR_Pass : IR_Visitor
+{
+    virtual ~IR_Pass() = default;
+    virtual const char *name() const = 0;
+    // Walks ir.first and then ir.second, returns whether anything was changed.
+    virtual bool run(Malang_IR &ir);
+
+    virtual void visit(struct IR_Assign_Top&) override;
+    virtual void visit(struct IR_Noop&) override;
+    virtual void visit(struct IR_Discard_Result&) override;
+    virtual void visit(struct IR_Duplicate_Result&) override;
+    virtual void visit(struct IR_Block&) override;
+
+    virtual void visit(struct IR_Boolean&) override;
+    virtual void visit(struct IR_Fixnum&) override;
+    virtual void visit(struct IR_Single&) override;
+    virtual void visit(struct IR_Double&) override;
+    virtual void visit(struct IR_New_Array&) override;
+    virtual void visit(struct IR_String&) override;
+    virtual void visit(struct IR_Symbol&) override;
+    virtual void visit(struct IR_Callable&) override;
+    virtual void visit(struct IR_Method&) override;
+    virtual void visit(struct IR_Indexable&) override;
+    virtual void visit(struct IR_Member_Access&) override;
+
+    virtual void visit(struct IR_Call&) override;
+    virtual void visit(struct IR_Call_Method&) override;
+    virtual void visit(struct IR_Call_Virtual_Method&) override;
+    virtual void visit(struct IR_Return&) override;
+    virtual void visit(struct IR_Label&) override;
+    virtual void visit(struct IR_Named_Block&) override;
+    virtual void visit(struct IR_Branch&) override;
+    virtual void visit(struct IR_Pop_Branch_If_True&) override;
+    virtual void visit(struct IR_Pop_Branch_If_False&) override;
+    virtual void visit(struct IR_Branch_If_True_Or_Pop&) override;
+    virtual void visit(struct IR_Branch_If_False_Or_Pop&) override;
+    virtual void visit(struct IR_Assignment&) override;
+
+    virtual void visit(struct IR_B_Add&) override;
+    virtual void visit(struct IR_B_Subtract&) override;
+    virtual void visit(struct IR_B_Multiply&) override;
+    virtual void visit(struct IR_B_Divide&) override;
+    virtual void visit(struct IR_B_Modulo&) override;
+    virtual void visit(struct IR_B_And&) override;
+    virtual void visit(struct IR_B_Or&) override;
+    virtual void visit(struct IR_B_Xor&) override;
+    virtual void visit(struct IR_B_Left_Shift&) override;
+    virtual void visit(struct IR_B_Right_Shift&) override;
+    virtual void visit(struct IR_B_Less_Than&) override;
+    virtual void visit(struct IR_B_Less_Than_Equals&) override;
+    virtual void visit(struct IR_B_Greater_Than&) override;
+    virtual void visit(struct IR_B_Greater_Than_Equals&) override;
+    virtual void visit(struct IR_B_Equals&) override;
+    virtual void visit(struct IR_B_Not_Equals&) override;
+
+    virtual void visit(struct IR_U_Not&) override;
+    virtual void visit(struct IR_U_Invert&) override;
+    virtual void visit(struct IR_U_Negate&) override;
+    virtual void visit(struct IR_U_Positive&) override;
+
+    virtual void visit(struct IR_Allocate_Object&) override;
+    virtual void visit(struct IR_Deallocate_Object&) override;
+    virtual void visit(struct IR_Allocate_Locals&) override;
+
+    // How many nodes the last run() visited.
+    size_t num_visited = 0;
+
+protected:
+    Malang_IR *ir = nullptr;
+    bool changed = false;
+
+    void walk(std::vector<IR_Node*> &nodes);
+    template <typename T>
+    void walk(T *&node)
+    {
+        if (!node)
+        {
+            return;
+        }
+        IR_Node *n = node;
+        walk_one(n);
+        if (n != node)
+        {
+            auto replacement = dynamic_cast<T*>(n);
+            assert(replacement && "a node was replaced with something that can't go there");
+            node = replacement;
+        }
+    }
+    // Replaces the node being visited with `with' once the visit returns.
+    void replace(IR_Node *with);
+    // Takes the node being visited out of the list it's in, it can't be a child of another node.
+    void remove();
+    // The node whose children are being walked, nullptr for the nodes in ir.first and ir.second.
+    IR_Node *parent() const { return m_parent; }
+
+private:
+    void walk_one(IR_Node *&node);
+    void walk_binary(struct IR_Binary_Operation &n);
+    void walk_unary(struct IR_Unary_Operation &n);
+    IR_Node **m_replacement = nullptr;
+    IR_Node *m_visiting = nullptr;
+    IR_Node *m_parent = nullptr;
+};
+
+// Counts the nodes in the IR, it doesn't change anything.
+struct IR_Node_Counter : IR_Pass
+{
+    virtual const char *name() const override { return "count"; }
+    size_t count(Malang_IR &ir);
+};
+
+// Finds the globals used in the IR, it doesn't change anything.
+struct IR_Global_Finder : IR_Pass
+{
+    virtual const char *name() const override { return "find-globals"; }
+    // The first global index after all of those used.
+    size_t find_unused(Malang_IR &ir);
+
+    virtual void visit(struct IR_Symbol &n) override;
+    virtual void visit(struct IR_Assign_Top &n) override;
+
+private:
+    size_t m_unused = 0;
+};
+
+#endif /* MALANG_IR_IR_PASS_HPP */
@@ -11,9 +11,12 @@ struct IR_Return : IR_Node
         : IR_Node(src_loc)
         , values(std::move(values))
         , should_leave(should_leave)
+        , is_tail_call(false)
         {}
     std::vector<struct IR_Value*> values;
     bool should_leave;
+    // The value returned is a call, which may reuse this function's frame.
+    bool is_tail_call;
 
     IR_NODE_OVERRIDES;
 };
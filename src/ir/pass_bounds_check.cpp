@@ -0,0 +1,834 @@
+#include <set>
+#include <tuple>
+#include "passes.hpp"
+#include "nodes.hpp"
+#include "../vm/runtime/reflection.hpp"
+
+// A variable by its scope and slot, fields are those of self.
+using Var = std::pair<Symbol_Scope, size_t>;
+static const Var No_Var{Symbol_Scope::None, 0};
+
+enum class Fact_Kind
+{
+    Nonneg,     // x >= 0
+    Below,      // x < y.length
+    At_Most,    // x <= y.length
+    Length,     // x == y.length
+    Succ,       // x == y + 1
+    Const,      // x == c
+    Min_Length, // x.length >= c
+};
+
+struct Fact
+{
+    Fact_Kind kind;
+    Var x;
+    Var y;
+    Fixnum c;
+
+    bool mentions(const Var &v) const { return x == v || y == v; }
+    bool operator<(const Fact &o) const
+    {
+        return std::tie(kind, x, y, c) < std::tie(o.kind, o.x, o.y, o.c);
+    }
+};
+
+static inline
+Fact fact(Fact_Kind kind, Var x, Var y = No_Var, Fixnum c = 0)
+{
+    return Fact{kind, x, y, c};
+}
+
+struct IR_Bounds_Check::Facts
+{
+    // Nothing is known about code that can't be reached, everything holds there.
+    bool reachable = true;
+    std::set<Fact> facts;
+
+    bool constant(const Var &x, Fixnum &c) const
+    {
+        for (auto &&f : facts)
+        {
+            if (f.kind == Fact_Kind::Const && f.x == x)
+            {
+                c = f.c;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Fixnum min_length(const Var &x) const
+    {
+        Fixnum longest = 0;
+        for (auto &&f : facts)
+        {
+            if (f.kind == Fact_Kind::Min_Length && f.x == x && f.c > longest)
+            {
+                longest = f.c;
+            }
+        }
+        return longest;
+    }
+
+    bool holds(const Fact &f) const
+    {
+        if (!reachable || facts.count(f))
+        {
+            return true;
+        }
+        Fixnum c;
+        switch (f.kind)
+        {
+            case Fact_Kind::Nonneg:
+                return constant(f.x, c) && c >= 0;
+            case Fact_Kind::Below:
+                return constant(f.x, c) && c < min_length(f.y);
+            case Fact_Kind::At_Most:
+                return facts.count(fact(Fact_Kind::Below, f.x, f.y))
+                    || facts.count(fact(Fact_Kind::Length, f.x, f.y))
+                    || (constant(f.x, c) && c <= min_length(f.y));
+            case Fact_Kind::Min_Length:
+                return min_length(f.x) >= f.c;
+            default:
+                return false;
+        }
+    }
+
+    // Whether everything known here is known in `other' too.
+    bool hold_in(const Facts &other) const
+    {
+        if (!other.reachable)
+        {
+            return true;
+        }
+        if (!reachable)
+        {
+            return false;
+        }
+        for (auto &&f : facts)
+        {
+            if (!other.holds(f))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Keeps what's known both here and in `other'.
+    void meet(const Facts &other)
+    {
+        if (!other.reachable)
+        {
+            return;
+        }
+        if (!reachable)
+        {
+            *this = other;
+            return;
+        }
+        std::set<Fact> kept;
+        for (auto &&f : facts)
+        {
+            if (other.holds(f))
+            {
+                kept.insert(f);
+            }
+        }
+        for (auto &&f : other.facts)
+        {
+            if (holds(f))
+            {
+                kept.insert(f);
+            }
+        }
+        facts.swap(kept);
+    }
+
+    void add(const Fact &f)
+    {
+        if (reachable)
+        {
+            facts.insert(f);
+        }
+    }
+
+    void forget(const Var &v)
+    {
+        for (auto it = facts.begin(); it != facts.end();)
+        {
+            it = it->mentions(v) ? facts.erase(it) : std::next(it);
+        }
+    }
+
+    // Anything that's called can change the fields of self.
+    void forget_fields()
+    {
+        forget(Symbol_Scope::Field);
+    }
+
+    // Code that's called can also assign any global.
+    void forget_called()
+    {
+        forget(Symbol_Scope::Field);
+        forget(Symbol_Scope::Global);
+    }
+
+    void forget(Symbol_Scope scope)
+    {
+        for (auto it = facts.begin(); it != facts.end();)
+        {
+            auto in_scope = it->x.first == scope || it->y.first == scope;
+            it = in_scope ? facts.erase(it) : std::next(it);
+        }
+    }
+
+    void unreachable()
+    {
+        reachable = false;
+        facts.clear();
+    }
+};
+
+// The value a block leaves is its last node's.
+static
+IR_Value *value_of(IR_Node *n)
+{
+    while (auto block = dynamic_cast<IR_Block*>(n))
+    {
+        if (block->nodes.empty())
+        {
+            return nullptr;
+        }
+        n = block->nodes.back();
+    }
+    return dynamic_cast<IR_Value*>(n);
+}
+
+static
+bool as_var(IR_Value *v, Var &var)
+{
+    auto sym = dynamic_cast<IR_Symbol*>(value_of(v));
+    if (!sym || sym->scope == Symbol_Scope::None)
+    {
+        return false;
+    }
+    var = Var{sym->scope, sym->index};
+    return true;
+}
+
+static
+bool is_sequence(Malang_IR &ir, Type_Info *type)
+{
+    return type == ir.types->get_buffer() || dynamic_cast<Array_Type_Info*>(type);
+}
+
+static
+bool as_int_var(Malang_IR &ir, IR_Value *v, Var &var)
+{
+    auto value = value_of(v);
+    return value && value->get_type() == ir.types->get_int() && as_var(value, var);
+}
+
+static
+bool as_sequence_var(Malang_IR &ir, IR_Value *v, Var &var)
+{
+    auto value = value_of(v);
+    return value && is_sequence(ir, value->get_type()) && as_var(value, var);
+}
+
+static
+bool as_constant(IR_Value *v, Fixnum &c)
+{
+    auto fixnum = dynamic_cast<IR_Fixnum*>(value_of(v));
+    if (fixnum)
+    {
+        c = fixnum->value;
+    }
+    return fixnum;
+}
+
+// The sequences whose length `v' is at most, and whether it's less than it.
+static
+std::vector<std::pair<Var, bool>> bounds(Malang_IR &ir, const IR_Bounds_Check::Facts &facts, IR_Value *v)
+{
+    std::vector<std::pair<Var, bool>> seqs;
+    Var var;
+    auto access = dynamic_cast<IR_Member_Access*>(value_of(v));
+    if (access && access->member_name == "length" && as_sequence_var(ir, access->thing, var))
+    {
+        seqs.push_back({var, false});
+    }
+    else if (as_int_var(ir, v, var))
+    {
+        for (auto &&f : facts.facts)
+        {
+            if (f.x != var)
+            {
+                continue;
+            }
+            if (f.kind == Fact_Kind::Length || f.kind == Fact_Kind::At_Most)
+            {
+                seqs.push_back({f.y, false});
+            }
+            else if (f.kind == Fact_Kind::Below)
+            {
+                seqs.push_back({f.y, true});
+            }
+        }
+    }
+    return seqs;
+}
+
+// The sequences whose length `v' is.
+static
+std::vector<Var> lengths(Malang_IR &ir, const IR_Bounds_Check::Facts &facts, IR_Value *v)
+{
+    std::vector<Var> seqs;
+    Var var;
+    auto access = dynamic_cast<IR_Member_Access*>(value_of(v));
+    if (access && access->member_name == "length" && as_sequence_var(ir, access->thing, var))
+    {
+        seqs.push_back(var);
+    }
+    else if (as_int_var(ir, v, var))
+    {
+        for (auto &&f : facts.facts)
+        {
+            if (f.kind == Fact_Kind::Length && f.x == var)
+            {
+                seqs.push_back(f.y);
+            }
+        }
+    }
+    return seqs;
+}
+
+// What's known where `x < a.length'.
+static
+void learn_below(IR_Bounds_Check::Facts &facts, const Var &x, const Var &a)
+{
+    facts.add(fact(Fact_Kind::Below, x, a));
+    // what's one more than x can't overflow now
+    if (!facts.holds(fact(Fact_Kind::Nonneg, x)))
+    {
+        return;
+    }
+    std::vector<Var> succs;
+    for (auto &&f : facts.facts)
+    {
+        if (f.kind == Fact_Kind::Succ && f.y == x)
+        {
+            succs.push_back(f.x);
+        }
+    }
+    for (auto &&v : succs)
+    {
+        facts.add(fact(Fact_Kind::Nonneg, v));
+        facts.add(fact(Fact_Kind::At_Most, v, a));
+    }
+}
+
+// What's known where `lhs < rhs', or `lhs <= rhs' if not `strictly'.
+static
+void learn_less(Malang_IR &ir, IR_Bounds_Check::Facts &facts, IR_Value *lhs, IR_Value *rhs, bool strictly)
+{
+    Var x;
+    Fixnum c;
+    if (as_constant(lhs, c) && as_int_var(ir, rhs, x))
+    {
+        if (c >= (strictly ? -1 : 0))
+        {
+            facts.add(fact(Fact_Kind::Nonneg, x));
+        }
+        return;
+    }
+    if (!as_int_var(ir, lhs, x))
+    {
+        return;
+    }
+    for (auto &&bound : bounds(ir, facts, rhs))
+    {
+        auto a = bound.first;
+        if (!strictly && !bound.second)
+        {
+            facts.add(fact(Fact_Kind::At_Most, x, a));
+            continue;
+        }
+        learn_below(facts, x, a);
+    }
+}
+
+// What's known where `lhs != rhs'. Something at most a length that isn't it is less than it.
+static
+void learn_not_equal(Malang_IR &ir, IR_Bounds_Check::Facts &facts, IR_Value *lhs, IR_Value *rhs)
+{
+    Var x;
+    if (!as_int_var(ir, lhs, x))
+    {
+        return;
+    }
+    for (auto &&a : lengths(ir, facts, rhs))
+    {
+        if (facts.holds(fact(Fact_Kind::At_Most, x, a)))
+        {
+            learn_below(facts, x, a);
+        }
+    }
+}
+
+// What's known where `cond' is `when'.
+static
+void learn(Malang_IR &ir, IR_Bounds_Check::Facts &facts, IR_Node *cond, bool when)
+{
+    auto value = value_of(cond);
+    if (auto n = dynamic_cast<IR_U_Not*>(value))
+    {
+        learn(ir, facts, n->operand, !when);
+    }
+    else if (auto n = dynamic_cast<IR_B_Less_Than*>(value))
+    {
+        when ? learn_less(ir, facts, n->lhs, n->rhs, true) : learn_less(ir, facts, n->rhs, n->lhs, false);
+    }
+    else if (auto n = dynamic_cast<IR_B_Less_Than_Equals*>(value))
+    {
+        when ? learn_less(ir, facts, n->lhs, n->rhs, false) : learn_less(ir, facts, n->rhs, n->lhs, true);
+    }
+    else if (auto n = dynamic_cast<IR_B_Greater_Than*>(value))
+    {
+        when ? learn_less(ir, facts, n->rhs, n->lhs, true) : learn_less(ir, facts, n->lhs, n->rhs, false);
+    }
+    else if (auto n = dynamic_cast<IR_B_Greater_Than_Equals*>(value))
+    {
+        when ? learn_less(ir, facts, n->rhs, n->lhs, false) : learn_less(ir, facts, n->lhs, n->rhs, true);
+    }
+    else if (auto n = dynamic_cast<IR_B_Not_Equals*>(value))
+    {
+        if (when)
+        {
+            learn_not_equal(ir, facts, n->lhs, n->rhs);
+            learn_not_equal(ir, facts, n->rhs, n->lhs);
+        }
+    }
+    else if (auto n = dynamic_cast<IR_B_Equals*>(value))
+    {
+        if (!when)
+        {
+            learn_not_equal(ir, facts, n->lhs, n->rhs);
+            learn_not_equal(ir, facts, n->rhs, n->lhs);
+        }
+    }
+}
+
+// What's known about `v' after it's assigned `rhs', from what's known before.
+static
+std::vector<Fact> learn_assignment(Malang_IR &ir, const IR_Bounds_Check::Facts &facts, const Var &v, IR_Value *rhs)
+{
+    std::vector<Fact> learned;
+    auto value = value_of(rhs);
+    Var w;
+    Fixnum c;
+    if (!value)
+    {
+        return learned;
+    }
+    if (as_constant(value, c))
+    {
+        learned.push_back(fact(Fact_Kind::Const, v, No_Var, c));
+        if (c >= 0)
+        {
+            learned.push_back(fact(Fact_Kind::Nonneg, v));
+        }
+    }
+    else if (as_var(value, w))
+    {   // v is w now, but not what it was before
+        for (auto &&f : facts.facts)
+        {
+            if (f.mentions(w) && !f.mentions(v))
+            {
+                learned.push_back(fact(f.kind, f.x == w ? v : f.x, f.y == w ? v : f.y, f.c));
+            }
+        }
+    }
+    else if (auto access = dynamic_cast<IR_Member_Access*>(value))
+    {
+        if (access->member_name == "length" && as_sequence_var(ir, access->thing, w) && w != v)
+        {
+            learned.push_back(fact(Fact_Kind::Length, v, w));
+            learned.push_back(fact(Fact_Kind::Nonneg, v));
+        }
+    }
+    else if (auto add = dynamic_cast<IR_B_Add*>(value))
+    {
+        auto var = add->lhs;
+        if (!as_constant(add->rhs, c))
+        {
+            var = add->rhs;
+            if (!as_constant(add->lhs, c))
+            {
+                return learned;
+            }
+        }
+        if (c != 1 || !as_int_var(ir, var, w))
+        {
+            return learned;
+        }
+        if (w != v)
+        {
+            learned.push_back(fact(Fact_Kind::Succ, v, w));
+        }
+        if (!facts.holds(fact(Fact_Kind::Nonneg, w)))
+        {
+            return learned;
+        }
+        for (auto &&f : facts.facts)
+        {   // one more than what's less than a length is at most it, that can't overflow
+            if (f.kind == Fact_Kind::Below && f.x == w)
+            {
+                learned.push_back(fact(Fact_Kind::Nonneg, v));
+                learned.push_back(fact(Fact_Kind::At_Most, v, f.y));
+            }
+        }
+    }
+    else if (auto sub = dynamic_cast<IR_B_Subtract*>(value))
+    {   // less than what's at most a length is less than it, it can't underflow if it's not negative
+        auto access = dynamic_cast<IR_Member_Access*>(value_of(sub->lhs));
+        if (!as_constant(sub->rhs, c) || c < 1
+            || (!access && !(as_int_var(ir, sub->lhs, w) && facts.holds(fact(Fact_Kind::Nonneg, w)))))
+        {
+            return learned;
+        }
+        for (auto &&bound : bounds(ir, facts, sub->lhs))
+        {
+            learned.push_back(fact(Fact_Kind::Below, v, bound.first));
+        }
+    }
+    else if (is_sequence(ir, value->get_type()))
+    {
+        IR_Value *size = nullptr;
+        if (auto array = dynamic_cast<IR_New_Array*>(value))
+        {
+            size = array->size;
+        }
+        else if (auto alloc = dynamic_cast<IR_Allocate_Object*>(value))
+        {
+            size = alloc->args.size() == 1 ? alloc->args[0] : nullptr;
+        }
+        if (size && as_constant(size, c))
+        {
+            learned.push_back(fact(Fact_Kind::Min_Length, v, No_Var, c));
+        }
+        else if (size && as_int_var(ir, size, w) && w != v)
+        {
+            learned.push_back(fact(Fact_Kind::Length, w, v));
+        }
+    }
+    return learned;
+}
+
+bool IR_Bounds_Check::run(Malang_IR &ir)
+{
+    this->ir = &ir;
+    changed = false;
+    num_visited = 0;
+    // the top level and then each function by itself, they can't see each other's variables
+    std::vector<std::vector<IR_Node*>*> bodies{&ir.first, &ir.second};
+    for (size_t i = 0; i < bodies.size(); ++i)
+    {
+        frame(*bodies[i]);
+        for (auto &&fn : m_functions)
+        {
+            bodies.push_back(&fn->body());
+        }
+    }
+    for (auto &&f : m_owned)
+    {
+        delete f;
+    }
+    m_owned.clear();
+    return changed;
+}
+
+IR_Bounds_Check::Facts *IR_Bounds_Check::make(const Facts *from)
+{
+    auto facts = from ? new Facts(*from) : new Facts;
+    m_owned.push_back(facts);
+    return facts;
+}
+
+void IR_Bounds_Check::frame(std::vector<IR_Node*> &body)
+{
+    // Each walk assumes at the start of a loop what was known at the jumps back to it the
+    // walk before, until that holds. Those are the same after one more walk for each loop
+    // nested in another, a loop that's still changing after this many is assumed nothing.
+    static constexpr int Max_Walks = 8;
+    m_assumed.clear();
+    m_give_up = false;
+    for (int walks = 1; ; ++walks)
+    {
+        m_facts = make();
+        m_jumps.clear();
+        m_jumps_back.clear();
+        m_at.clear();
+        m_proven.clear();
+        m_functions.clear();
+        walk_list(body);
+
+        bool holds = true;
+        for (auto &&back : m_jumps_back)
+        {
+            if (m_at[back.first]->hold_in(*back.second))
+            {
+                continue;
+            }
+            holds = false;
+            auto &assumed = m_assumed[back.first];
+            if (m_give_up)
+            {
+                assumed = make();
+            }
+            else if (assumed)
+            {
+                assumed->meet(*back.second);
+            }
+            else
+            {
+                assumed = make(back.second);
+            }
+        }
+        if (holds)
+        {
+            break;
+        }
+        m_give_up = walks >= Max_Walks;
+    }
+    for (auto &&n : m_proven)
+    {
+        n->bounds_checked = false;
+        changed = true;
+    }
+}
+
+void IR_Bounds_Check::walk_list(std::vector<IR_Node*> &nodes)
+{
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        m_before = i == 0 ? nullptr : nodes[i - 1];
+        walk(nodes[i]);
+    }
+}
+
+void IR_Bounds_Check::jump(IR_Label *to, const Facts &facts)
+{
+    auto &jumps = m_at.count(to) ? m_jumps_back : m_jumps;
+    auto &at = jumps[to];
+    if (at)
+    {
+        at->meet(facts);
+    }
+    else
+    {
+        at = make(&facts);
+    }
+}
+
+void IR_Bounds_Check::branch(IR_Branch &n, bool when)
+{
+    auto cond = m_before;
+    auto taken = make(m_facts);
+    learn(*ir, *taken, cond, when);
+    jump(n.destination, *taken);
+    learn(*ir, *m_facts, cond, !when);
+}
+
+void IR_Bounds_Check::visit(IR_Assign_Top &n)
+{
+    IR_Pass::visit(n);
+    if (m_facts->reachable)
+    {
+        m_facts->facts.clear();
+    }
+}
+
+void IR_Bounds_Check::visit(IR_Block &n)
+{
+    walk_list(n.nodes);
+}
+
+void IR_Bounds_Check::visit(IR_Indexable &n)
+{
+    IR_Pass::visit(n);
+    if (!is_sequence(*ir, n.thing->get_type()))
+    {   // it's a call to `[]'
+        m_facts->forget_called();
+        return;
+    }
+    Var seq, index;
+    Fixnum c;
+    if (n.arguments.size() != 1 || !as_sequence_var(*ir, n.thing, seq))
+    {
+        return;
+    }
+    auto arg = n.arguments[0];
+    if (as_int_var(*ir, arg, index))
+    {
+        if (m_facts->holds(fact(Fact_Kind::Nonneg, index))
+            && m_facts->holds(fact(Fact_Kind::Below, index, seq)))
+        {
+            m_proven.push_back(&n);
+        }
+    }
+    else if (as_constant(arg, c) && c >= 0 && c < m_facts->min_length(seq))
+    {
+        m_proven.push_back(&n);
+    }
+}
+
+// Natives don't call back into the code, they can only change self if they're given it.
+static
+bool native_changes_fields(IR_Value *thing, const std::vector<IR_Value*> &arguments)
+{
+    Var var;
+    if (thing && as_var(thing, var) && var == Var{Symbol_Scope::Local, 0})
+    {
+        return true;
+    }
+    for (auto &&a : arguments)
+    {
+        if (as_var(a, var) && var == Var{Symbol_Scope::Local, 0})
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void IR_Bounds_Check::visit(IR_Call &n)
+{
+    IR_Pass::visit(n);
+    auto callable = dynamic_cast<IR_Callable*>(n.callee);
+    auto is_native = callable && !dynamic_cast<IR_Call_Virtual_Method*>(&n) && callable->fn_type->is_native();
+    if (!is_native)
+    {
+        m_facts->forget_called();
+    }
+    else if (native_changes_fields(nullptr, n.arguments))
+    {
+        m_facts->forget_fields();
+    }
+}
+
+void IR_Bounds_Check::visit(IR_Call_Method &n)
+{
+    IR_Pass::visit(n);
+    if (!n.method->is_native())
+    {
+        m_facts->forget_called();
+    }
+    else if (native_changes_fields(n.thing, n.arguments))
+    {
+        m_facts->forget_fields();
+    }
+}
+
+void IR_Bounds_Check::visit(IR_Return &n)
+{
+    IR_Pass::visit(n);
+    m_facts->unreachable();
+}
+
+void IR_Bounds_Check::visit(IR_Label &n)
+{
+    auto jumps = m_jumps.find(&n);
+    if (jumps != m_jumps.end())
+    {
+        m_facts->meet(*jumps->second);
+    }
+    auto assumed = m_assumed.find(&n);
+    if (assumed != m_assumed.end())
+    {
+        m_facts->meet(*assumed->second);
+    }
+    m_at[&n] = make(m_facts);
+}
+
+void IR_Bounds_Check::visit(IR_Named_Block &n)
+{
+    if (!n.function_name.empty())
+    {   // it's its own frame, walked after this one
+        m_functions.push_back(&n);
+        return;
+    }
+    visit(static_cast<IR_Label&>(n));
+    walk_list(n.body());
+    IR_Node *end = n.end();
+    walk(end);
+}
+
+void IR_Bounds_Check::visit(IR_Branch &n)
+{
+    jump(n.destination, *m_facts);
+    m_facts->unreachable();
+}
+
+void IR_Bounds_Check::visit(IR_Pop_Branch_If_True &n)
+{
+    branch(n, true);
+}
+
+void IR_Bounds_Check::visit(IR_Pop_Branch_If_False &n)
+{
+    branch(n, false);
+}
+
+void IR_Bounds_Check::visit(IR_Branch_If_True_Or_Pop &n)
+{
+    branch(n, true);
+}
+
+void IR_Bounds_Check::visit(IR_Branch_If_False_Or_Pop &n)
+{
+    branch(n, false);
+}
+
+void IR_Bounds_Check::visit(IR_Assignment &n)
+{
+    Var v;
+    if (!dynamic_cast<IR_Symbol*>(n.lhs) || !as_var(n.lhs, v))
+    {   // stores into an element or a field, in the order they're done
+        IR_Pass::visit(n);
+        auto idx = dynamic_cast<IR_Indexable*>(n.lhs);
+        if (!idx || !is_sequence(*ir, idx->thing->get_type()))
+        {
+            m_facts->forget_fields();
+        }
+        return;
+    }
+    walk(n.rhs);
+    auto learned = learn_assignment(*ir, *m_facts, v, n.rhs);
+    m_facts->forget(v);
+    if (v == Var{Symbol_Scope::Local, 0})
+    {   // a new self
+        m_facts->forget_fields();
+    }
+    for (auto &&f : learned)
+    {
+        m_facts->add(f);
+    }
+}
+
+void IR_Bounds_Check::visit(IR_Allocate_Object &n)
+{
+    IR_Pass::visit(n);
+    if (n.for_type != ir->types->get_buffer())
+    {   // the constructor is called
+        m_facts->forget_called();
+    }
+}
+
+void IR_Bounds_Check::visit(IR_Deallocate_Object &n)
+{
+    IR_Pass::visit(n);
+    m_facts->forget_called();
+}
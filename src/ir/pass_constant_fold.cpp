@@ -0,0 +1,395 @@
+#include <stdint.h>
+#include <cmath>
+#include <unordered_set>
+#include "passes.hpp"
+#include "nodes.hpp"
+#include "../vm/runtime/reflection.hpp"
+
+enum class IR_Constant_Fold::Op
+{
+    Add, Subtract, Multiply, Divide, Modulo,
+    And, Or, Xor, Left_Shift, Right_Shift,
+    Less_Than, Less_Than_Equals, Greater_Than, Greater_Than_Equals, Equals, Not_Equals,
+    Invert, Negate, Positive,
+};
+using Op = IR_Constant_Fold::Op;
+
+static inline
+bool is_constant(IR_Node *n)
+{
+    return dynamic_cast<IR_Fixnum*>(n) || dynamic_cast<IR_Double*>(n) || dynamic_cast<IR_Boolean*>(n);
+}
+
+// Finds the readonly variables that are assigned a constant once and nothing else.
+struct Constant_Finder : IR_Pass
+{
+    virtual const char *name() const override { return "find-constants"; }
+
+    virtual void visit(IR_Assignment &n) override
+    {
+        IR_Pass::visit(n);
+        if (auto sym = dynamic_cast<IR_Symbol*>(n.lhs))
+        {
+            if (sym->is_readonly && sym->scope != Symbol_Scope::Field
+                && is_constant(n.rhs) && !constants.count(sym))
+            {
+                constants[sym] = n.rhs;
+            }
+            else
+            {
+                not_constant.insert(sym);
+            }
+        }
+    }
+
+    virtual void visit(IR_Assign_Top &n) override
+    {
+        if (auto sym = dynamic_cast<IR_Symbol*>(n.lhs))
+        {
+            not_constant.insert(sym);
+        }
+    }
+
+    std::unordered_map<IR_Symbol*, IR_Value*> find(Malang_IR &ir)
+    {
+        run(ir);
+        for (auto &&sym : not_constant)
+        {
+            constants.erase(sym);
+        }
+        return constants;
+    }
+
+    std::unordered_map<IR_Symbol*, IR_Value*> constants;
+    std::unordered_set<IR_Symbol*> not_constant;
+};
+
+static inline
+Fixnum wrap(int64_t n)
+{
+    return static_cast<Fixnum>(static_cast<uint32_t>(n));
+}
+
+static inline
+bool is_comparison(Op op)
+{
+    return op >= Op::Less_Than && op <= Op::Not_Equals;
+}
+
+// What the Fixnum_* instructions and the natives for int and char do, false if it would trap or
+// the result depends on the machine.
+static
+bool fold_fixnum(Op op, Fixnum a, Fixnum b, Fixnum &res)
+{
+    switch (op)
+    {
+        case Op::Add:         res = wrap(static_cast<int64_t>(a) + b); return true;
+        case Op::Subtract:    res = wrap(static_cast<int64_t>(a) - b); return true;
+        case Op::Multiply:    res = wrap(static_cast<int64_t>(a) * b); return true;
+        case Op::Divide:
+        case Op::Modulo:
+            if (b == 0 || (a == INT32_MIN && b == -1))
+            {
+                return false;
+            }
+            res = op == Op::Divide ? a / b : a % b;
+            return true;
+        case Op::And:         res = a & b; return true;
+        case Op::Or:          res = a | b; return true;
+        case Op::Xor:         res = a ^ b; return true;
+        case Op::Left_Shift:
+        case Op::Right_Shift:
+            if (b < 0 || b > 31)
+            {
+                return false;
+            }
+            res = op == Op::Left_Shift ? wrap(static_cast<uint32_t>(a) << b) : a >> b;
+            return true;
+        case Op::Less_Than:           res = a < b; return true;
+        case Op::Less_Than_Equals:    res = a <= b; return true;
+        case Op::Greater_Than:        res = a > b; return true;
+        case Op::Greater_Than_Equals: res = a >= b; return true;
+        case Op::Equals:              res = a == b; return true;
+        case Op::Not_Equals:          res = a != b; return true;
+        case Op::Invert:              res = ~a; return true;
+        case Op::Negate:              res = wrap(-static_cast<int64_t>(a)); return true;
+        case Op::Positive:            res = a; return true;
+    }
+    return false;
+}
+
+// What the Double_* instructions do. A NaN is left for the VM, a constant can't hold one.
+static
+bool fold_double(Op op, Double a, Double b, Double &res)
+{
+    switch (op)
+    {
+        case Op::Add:                 res = a + b; break;
+        case Op::Subtract:            res = a - b; break;
+        case Op::Multiply:            res = a * b; break;
+        case Op::Divide:              res = a / b; break;
+        case Op::Modulo:              res = std::fmod(a, b); break;
+        case Op::Less_Than:           res = a < b; break;
+        case Op::Less_Than_Equals:    res = a <= b; break;
+        case Op::Greater_Than:        res = a > b; break;
+        case Op::Greater_Than_Equals: res = a >= b; break;
+        case Op::Equals:              res = a == b; break;
+        case Op::Not_Equals:          res = a != b; break;
+        case Op::Negate:              res = -a; break;
+        case Op::Positive:            res = a; break;
+        default:                      return false;
+    }
+    return !std::isnan(res);
+}
+
+bool IR_Constant_Fold::run(Malang_IR &ir)
+{
+    bool any_changes = false;
+    // Folding an assignment can make a new constant so this goes until nothing changes, each
+    // round replaces nodes with fewer of them so it ends.
+    do
+    {
+        Constant_Finder finder;
+        m_constants = finder.find(ir);
+        IR_Pass::run(ir);
+        fold_branches(ir.first);
+        fold_branches(ir.second);
+        any_changes |= changed;
+    } while (changed);
+    m_constants.clear();
+    return any_changes;
+}
+
+void IR_Constant_Fold::visit(IR_Assign_Top &)
+{
+    // the target isn't read
+}
+
+void IR_Constant_Fold::visit(IR_Block &n)
+{
+    IR_Pass::visit(n);
+    fold_branches(n.nodes);
+}
+
+void IR_Constant_Fold::visit(IR_Symbol &n)
+{
+    auto it = m_constants.find(&n);
+    if (it == m_constants.end())
+    {
+        return;
+    }
+    // The symbol is where it was declared, the constant is attributed to what uses it. The type
+    // is the symbol's since it might be an alias to the constant's with its own methods.
+    auto &&src_loc = parent() ? parent()->src_loc : n.src_loc;
+    auto value = it->second;
+    if (auto fixnum = dynamic_cast<IR_Fixnum*>(value))
+    {
+        replace(ir->alloc<IR_Fixnum>(src_loc, n.type, fixnum->value));
+    }
+    else if (auto real = dynamic_cast<IR_Double*>(value))
+    {
+        replace(ir->alloc<IR_Double>(src_loc, n.type, real->value));
+    }
+    else if (auto boolean = dynamic_cast<IR_Boolean*>(value))
+    {
+        replace(ir->alloc<IR_Boolean>(src_loc, n.type, boolean->value));
+    }
+}
+
+void IR_Constant_Fold::visit(IR_Named_Block &n)
+{
+    IR_Pass::visit(n);
+    fold_branches(n.body());
+}
+
+void IR_Constant_Fold::visit(IR_Assignment &n)
+{
+    if (dynamic_cast<IR_Symbol*>(n.lhs))
+    {
+        walk(n.rhs);
+    }
+    else
+    {
+        IR_Pass::visit(n);
+    }
+}
+
+void IR_Constant_Fold::fold(IR_Binary_Operation &n, Op op)
+{
+    auto lhs_fixnum = dynamic_cast<IR_Fixnum*>(n.lhs);
+    auto rhs_fixnum = dynamic_cast<IR_Fixnum*>(n.rhs);
+    auto lhs_double = dynamic_cast<IR_Double*>(n.lhs);
+    auto rhs_double = dynamic_cast<IR_Double*>(n.rhs);
+    if (!(lhs_fixnum || lhs_double) || !(rhs_fixnum || rhs_double))
+    {
+        return;
+    }
+    // This mirrors how IR_To_Code picks the instructions for the operation.
+    auto _int = ir->types->get_int();
+    auto _double = ir->types->get_double();
+    auto _char = ir->types->get_char();
+    auto lhs_ty = n.lhs->get_type();
+    auto rhs_ty = n.rhs->get_type();
+    auto lhs_is_double = lhs_ty->is_alias_to(_double);
+    auto rhs_is_double = rhs_ty->is_alias_to(_double);
+    auto lhs_is_int = lhs_ty->is_alias_to(_int);
+    auto rhs_is_int = rhs_ty->is_alias_to(_int);
+    auto type = n.get_type();
+    if (lhs_fixnum && rhs_fixnum && !(lhs_is_int && rhs_is_int))
+    {
+        // Otherwise it calls a method, only the natives for int and char are known and the
+        // ones for `%' push the double std::fmod returns.
+        auto method = n.get_method_to_call();
+        if (!method->is_native() || op == Op::Modulo
+            || !(lhs_is_int || lhs_ty->is_alias_to(_char))
+            || !(rhs_is_int || rhs_ty->is_alias_to(_char)))
+        {
+            return;
+        }
+        lhs_is_int = rhs_is_int = true;
+    }
+    if (lhs_is_int && rhs_is_int)
+    {
+        assert(lhs_fixnum && rhs_fixnum);
+        Fixnum res;
+        if (!fold_fixnum(op, lhs_fixnum->value, rhs_fixnum->value, res))
+        {
+            return;
+        }
+        if (is_comparison(op))
+        {
+            replace(ir->alloc<IR_Boolean>(n.src_loc, type, res != 0));
+        }
+        else
+        {
+            replace(ir->alloc<IR_Fixnum>(n.src_loc, type, res));
+        }
+    }
+    else if ((lhs_is_double || lhs_is_int) && (rhs_is_double || rhs_is_int))
+    {
+        auto a = lhs_double ? lhs_double->value : static_cast<Double>(lhs_fixnum->value);
+        auto b = rhs_double ? rhs_double->value : static_cast<Double>(rhs_fixnum->value);
+        Double res;
+        if (!fold_double(op, a, b, res))
+        {
+            return;
+        }
+        if (is_comparison(op))
+        {
+            replace(ir->alloc<IR_Boolean>(n.src_loc, type, res != 0));
+        }
+        else
+        {
+            replace(ir->alloc<IR_Double>(n.src_loc, type, res));
+        }
+    }
+}
+
+void IR_Constant_Fold::fold(IR_Unary_Operation &n, Op op)
+{
+    auto type = n.get_type();
+    auto operand_ty = n.operand->get_type();
+    if (auto fixnum = dynamic_cast<IR_Fixnum*>(n.operand))
+    {
+        if (!operand_ty->is_alias_to(ir->types->get_int()))
+        {
+            auto method = n.get_method_to_call();
+            if (!method->is_native() || !operand_ty->is_alias_to(ir->types->get_char()))
+            {
+                return;
+            }
+        }
+        Fixnum res;
+        if (fold_fixnum(op, fixnum->value, 0, res))
+        {
+            replace(ir->alloc<IR_Fixnum>(n.src_loc, type, res));
+        }
+    }
+    else if (auto real = dynamic_cast<IR_Double*>(n.operand))
+    {
+        Double res;
+        if (operand_ty->is_alias_to(ir->types->get_double()) && fold_double(op, real->value, 0, res))
+        {
+            replace(ir->alloc<IR_Double>(n.src_loc, type, res));
+        }
+    }
+}
+
+void IR_Constant_Fold::fold_branches(std::vector<IR_Node*> &nodes)
+{
+    std::vector<IR_Node*> res;
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        auto cond = dynamic_cast<IR_Boolean*>(nodes[i]);
+        auto branch = i + 1 < nodes.size() ? dynamic_cast<IR_Branch*>(nodes[i + 1]) : nullptr;
+        bool jumps, pops;
+        if (!cond || !branch)
+        {
+            res.push_back(nodes[i]);
+            continue;
+        }
+        else if (dynamic_cast<IR_Pop_Branch_If_True*>(branch))
+        {
+            jumps = cond->value;
+            pops = true;
+        }
+        else if (dynamic_cast<IR_Pop_Branch_If_False*>(branch))
+        {
+            jumps = !cond->value;
+            pops = true;
+        }
+        else if (dynamic_cast<IR_Branch_If_True_Or_Pop*>(branch))
+        {
+            jumps = cond->value;
+            pops = !jumps;
+        }
+        else if (dynamic_cast<IR_Branch_If_False_Or_Pop*>(branch))
+        {
+            jumps = !cond->value;
+            pops = !jumps;
+        }
+        else
+        {
+            res.push_back(nodes[i]);
+            continue;
+        }
+        if (!pops)
+        {
+            res.push_back(cond);
+        }
+        if (jumps)
+        {
+            res.push_back(ir->alloc<IR_Branch>(branch->src_loc, branch->destination));
+        }
+        ++i;
+        changed = true;
+    }
+    nodes = std::move(res);
+}
+
+#define FOLD(class_name, op)                    \
+    void IR_Constant_Fold::visit(class_name &n) \
+    {                                           \
+        IR_Pass::visit(n);                      \
+        fold(n, op);                            \
+    }
+
+FOLD(IR_B_Add,                 Op::Add)
+FOLD(IR_B_Subtract,            Op::Subtract)
+FOLD(IR_B_Multiply,            Op::Multiply)
+FOLD(IR_B_Divide,              Op::Divide)
+FOLD(IR_B_Modulo,              Op::Modulo)
+FOLD(IR_B_And,                 Op::And)
+FOLD(IR_B_Or,                  Op::Or)
+FOLD(IR_B_Xor,                 Op::Xor)
+FOLD(IR_B_Left_Shift,          Op::Left_Shift)
+FOLD(IR_B_Right_Shift,         Op::Right_Shift)
+FOLD(IR_B_Less_Than,           Op::Less_Than)
+FOLD(IR_B_Less_Than_Equals,    Op::Less_Than_Equals)
+FOLD(IR_B_Greater_Than,        Op::Greater_Than)
+FOLD(IR_B_Greater_Than_Equals, Op::Greater_Than_Equals)
+FOLD(IR_B_Equals,              Op::Equals)
+FOLD(IR_B_Not_Equals,          Op::Not_Equals)
+FOLD(IR_U_Invert,              Op::Invert)
+FOLD(IR_U_Negate,              Op::Negate)
+FOLD(IR_U_Positive,            Op::Positive)
@@ -0,0 +1,268 @@
+#include <typeinfo>
+#include "passes.hpp"
+#include "nodes.hpp"
+#include "../vm/runtime/reflection.hpp"
+
+// Finds the code functions the nodes it's given call or take the address of, through calls,
+// the methods of operators and indexing, and the init and constructors of allocations. It
+// doesn't walk the bodies of the functions defined in them.
+struct Reference_Finder : IR_Pass
+{
+    virtual const char *name() const override { return "find-references"; }
+
+    void find(Malang_IR &ir, std::vector<IR_Node*> &nodes)
+    {
+        this->ir = &ir;
+        walk(nodes);
+    }
+
+    std::vector<IR_Label*> referenced;
+
+    virtual void visit(IR_Named_Block &n) override
+    {
+        if (n.function_name.empty())
+        {
+            IR_Pass::visit(n);
+        }
+    }
+
+    virtual void visit(IR_Callable &n) override
+    {
+        IR_Pass::visit(n);
+        callable(n);
+    }
+
+    virtual void visit(IR_Method &n) override
+    {
+        IR_Pass::visit(n);
+        callable(n);
+    }
+
+    virtual void visit(IR_Call_Method &n) override
+    {
+        IR_Pass::visit(n);
+        method(n.method);
+    }
+
+    virtual void visit(IR_Indexable &n) override
+    {
+        IR_Pass::visit(n);
+        method(index_method(n, "[]", nullptr));
+    }
+
+    virtual void visit(IR_Assignment &n) override
+    {
+        IR_Pass::visit(n);
+        if (auto idx = dynamic_cast<IR_Indexable*>(n.lhs))
+        {
+            method(index_method(*idx, "[]=", n.rhs));
+        }
+    }
+
+    virtual void visit(IR_Allocate_Object &n) override
+    {
+        IR_Pass::visit(n);
+        if (n.for_type->init())
+        {
+            method(n.for_type->init());
+        }
+        if (n.which_ctor && !n.which_ctor->is_the_default_ctor())
+        {
+            method(n.which_ctor);
+        }
+    }
+
+#define OPERATOR(class_name)                    \
+    virtual void visit(class_name &n) override  \
+    {                                           \
+        IR_Pass::visit(n);                      \
+        method(n.get_method_to_call());         \
+    }
+
+    OPERATOR(IR_B_Add)
+    OPERATOR(IR_B_Subtract)
+    OPERATOR(IR_B_Multiply)
+    OPERATOR(IR_B_Divide)
+    OPERATOR(IR_B_Modulo)
+    OPERATOR(IR_B_And)
+    OPERATOR(IR_B_Or)
+    OPERATOR(IR_B_Xor)
+    OPERATOR(IR_B_Left_Shift)
+    OPERATOR(IR_B_Right_Shift)
+    OPERATOR(IR_B_Less_Than)
+    OPERATOR(IR_B_Less_Than_Equals)
+    OPERATOR(IR_B_Greater_Than)
+    OPERATOR(IR_B_Greater_Than_Equals)
+    OPERATOR(IR_B_Equals)
+    OPERATOR(IR_B_Not_Equals)
+    OPERATOR(IR_U_Not)
+    OPERATOR(IR_U_Invert)
+    OPERATOR(IR_U_Negate)
+    OPERATOR(IR_U_Positive)
+#undef OPERATOR
+
+private:
+    // A bound function where it's defined isn't used yet, it's only named there.
+    void callable(IR_Callable &n)
+    {
+        if (!n.fn_type->is_native() && !n.is_special_bound && n.u.label)
+        {
+            referenced.push_back(n.u.label);
+        }
+    }
+
+    template <typename T>
+    void method(T *m)
+    {
+        if (m && !m->is_native())
+        {
+            referenced.push_back(m->code_function());
+        }
+    }
+
+    // The method of the type being indexed, arrays and buffers are indexed by the VM.
+    Method_Info *index_method(IR_Indexable &n, const std::string &name, IR_Value *value)
+    {
+        auto type = n.thing->get_type();
+        if (type == ir->types->get_buffer() || dynamic_cast<Array_Type_Info*>(type))
+        {
+            return nullptr;
+        }
+        std::vector<Type_Info*> arg_types;
+        for (auto &&a : n.arguments)
+        {
+            arg_types.push_back(a->get_type());
+        }
+        if (value)
+        {
+            arg_types.push_back(value->get_type());
+        }
+        return type->get_method(name, arg_types);
+    }
+};
+
+// The labels the branches go to. Any other label, like the start of an if's consequence after
+// constant folding took out the branch there, is only a name for a place nothing jumps to.
+struct Target_Finder : IR_Pass
+{
+    virtual const char *name() const override { return "find-targets"; }
+
+    virtual void visit(IR_Branch &n) override { targets.insert(n.destination); }
+    virtual void visit(IR_Pop_Branch_If_True &n) override { targets.insert(n.destination); }
+    virtual void visit(IR_Pop_Branch_If_False &n) override { targets.insert(n.destination); }
+    virtual void visit(IR_Branch_If_True_Or_Pop &n) override { targets.insert(n.destination); }
+    virtual void visit(IR_Branch_If_False_Or_Pop &n) override { targets.insert(n.destination); }
+
+    std::unordered_set<IR_Label*> targets;
+};
+
+// Whether `n' is a label something jumps to or has one in it.
+struct Label_Finder : IR_Pass
+{
+    virtual const char *name() const override { return "find-labels"; }
+
+    Label_Finder(const std::unordered_set<IR_Label*> &targets)
+        : targets(targets)
+        {}
+
+    bool find(IR_Node *n)
+    {
+        found = false;
+        walk(n);
+        return found;
+    }
+
+    virtual void visit(IR_Label &n) override { found |= targets.count(&n) != 0; }
+    virtual void visit(IR_Named_Block &) override { found = true; }
+
+    const std::unordered_set<IR_Label*> &targets;
+    bool found = false;
+};
+
+bool IR_Dead_Code::run(Malang_IR &ir)
+{
+    this->ir = &ir;
+    // Code that's taken out may have been all that called a function, so it goes around again
+    // until nothing more is taken out.
+    bool any_changes = false;
+    for (;;)
+    {
+        Reference_Finder finder;
+        finder.find(ir, ir.first);
+        finder.find(ir, ir.second);
+        m_reached.clear();
+        for (size_t i = 0; i < finder.referenced.size(); ++i)
+        {
+            auto fn = dynamic_cast<IR_Named_Block*>(finder.referenced[i]);
+            if (fn && !fn->function_name.empty() && m_reached.insert(fn).second)
+            {
+                finder.find(ir, fn->body());
+            }
+        }
+        Target_Finder targets;
+        targets.run(ir);
+        m_targets = std::move(targets.targets);
+        bool swept = sweep(ir.first);
+        swept |= sweep(ir.second);
+        swept |= IR_Pass::run(ir);
+        if (!swept)
+        {
+            break;
+        }
+        any_changes = true;
+    }
+    m_reached.clear();
+    m_targets.clear();
+    return any_changes;
+}
+
+void IR_Dead_Code::visit(IR_Block &n)
+{
+    changed |= sweep(n.nodes);
+    IR_Pass::visit(n);
+}
+
+void IR_Dead_Code::visit(IR_Named_Block &n)
+{
+    changed |= sweep(n.body());
+    IR_Pass::visit(n);
+}
+
+// Takes out the functions that aren't reached with the branch over them, the statements after
+// a return or a jump up to the next label something jumps to, and the jumps to the label right
+// after them.
+bool IR_Dead_Code::sweep(std::vector<IR_Node*> &nodes)
+{
+    Label_Finder labels{m_targets};
+    std::vector<IR_Node*> kept;
+    bool unreachable = false;
+    for (auto &&n : nodes)
+    {
+        auto fn = dynamic_cast<IR_Named_Block*>(n);
+        if (fn && !fn->function_name.empty() && !m_reached.count(fn) && !kept.empty()
+            && typeid(*kept.back()) == typeid(IR_Branch)
+            && static_cast<IR_Branch*>(kept.back())->destination == fn->end())
+        {
+            kept.pop_back();
+            unreachable = false;
+            continue;
+        }
+        if (unreachable && !labels.find(n))
+        {
+            continue;
+        }
+        if (!kept.empty() && typeid(*kept.back()) == typeid(IR_Branch)
+            && static_cast<IR_Branch*>(kept.back())->destination == n)
+        {   // it would jump to where it goes anyway
+            kept.pop_back();
+        }
+        unreachable = dynamic_cast<IR_Return*>(n) || typeid(*n) == typeid(IR_Branch);
+        kept.push_back(n);
+    }
+    if (kept.size() == nodes.size())
+    {
+        return false;
+    }
+    nodes = kept;
+    return true;
+}
@@ -0,0 +1,41 @@
+#include "passes.hpp"
+#include "nodes.hpp"
+
+bool IR_Flatten_Blocks::run(Malang_IR &ir)
+{
+    IR_Pass::run(ir);
+    flatten(ir.first);
+    flatten(ir.second);
+    return changed;
+}
+
+void IR_Flatten_Blocks::visit(IR_Block &n)
+{
+    IR_Pass::visit(n);
+    flatten(n.nodes);
+}
+
+void IR_Flatten_Blocks::visit(IR_Named_Block &n)
+{
+    IR_Pass::visit(n);
+    flatten(n.body());
+}
+
+void IR_Flatten_Blocks::flatten(std::vector<IR_Node*> &nodes)
+{
+    // the blocks inside these blocks were already flattened when they were visited
+    std::vector<IR_Node*> flat;
+    for (auto &&node : nodes)
+    {
+        if (auto block = dynamic_cast<IR_Block*>(node))
+        {
+            flat.insert(flat.end(), block->nodes.begin(), block->nodes.end());
+            changed = true;
+        }
+        else
+        {
+            flat.push_back(node);
+        }
+    }
+    nodes = std::move(flat);
+}
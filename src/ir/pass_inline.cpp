@@ -0,0 +1,203 @@
+#include <stdint.h>
+#include <unordered_map>
+#include "passes.hpp"
+#include "ir_clone.hpp"
+#include "nodes.hpp"
+#include "../vm/runtime/reflection.hpp"
+
+// Finds the returns of a function, not those of the functions defined in it.
+struct Return_Finder : IR_Pass
+{
+    virtual const char *name() const override { return "find-returns"; }
+
+    std::vector<IR_Return*> find(std::vector<IR_Node*> &body)
+    {
+        walk(body);
+        return returns;
+    }
+
+    virtual void visit(IR_Named_Block &n) override
+    {
+        if (n.function_name.empty())
+        {
+            IR_Pass::visit(n);
+        }
+    }
+
+    virtual void visit(IR_Return &n) override
+    {
+        IR_Pass::visit(n);
+        returns.push_back(&n);
+    }
+
+    std::vector<IR_Return*> returns;
+};
+
+bool IR_Inline::run(Malang_IR &ir)
+{
+    IR_Global_Finder globals;
+    m_next_global = globals.find_unused(ir);
+    m_frames.clear();
+    m_depth = 0;
+    return IR_Pass::run(ir);
+}
+
+void IR_Inline::visit(IR_Named_Block &n)
+{
+    if (n.function_name.empty())
+    {
+        IR_Pass::visit(n);
+        return;
+    }
+    auto &body = n.body();
+    auto alloc_locals = body.empty() ? nullptr : dynamic_cast<IR_Allocate_Locals*>(body[0]);
+    size_t num_locals = alloc_locals ? alloc_locals->num_to_alloc : 0;
+    m_frames.push_back({&n, alloc_locals, num_locals});
+    IR_Pass::visit(n);
+    auto frame = m_frames.back();
+    m_frames.pop_back();
+    if (frame.num_locals == num_locals)
+    {
+        return;
+    }
+    if (alloc_locals)
+    {
+        alloc_locals->num_to_alloc = frame.num_locals;
+    }
+    else
+    {   // it had no frame of its own so it has to make one and leave it when it returns
+        body.insert(body.begin(), ir->alloc<IR_Allocate_Locals>(n.src_loc, 0, frame.num_locals));
+        Return_Finder finder;
+        for (auto &&ret : finder.find(body))
+        {
+            ret->should_leave = true;
+        }
+    }
+}
+
+void IR_Inline::visit(IR_Call &n)
+{
+    IR_Pass::visit(n);
+    if (dynamic_cast<IR_Call_Virtual_Method*>(&n))
+    {
+        return;
+    }
+    auto callable = dynamic_cast<IR_Callable*>(n.callee);
+    if (!callable || dynamic_cast<IR_Method*>(callable) || callable->fn_type->is_native())
+    {
+        return;
+    }
+    inline_call(n, callable->u.label, false, nullptr, n.arguments);
+}
+
+void IR_Inline::visit(IR_Call_Method &n)
+{
+    IR_Pass::visit(n);
+    if (n.method->is_native())
+    {
+        return;
+    }
+    inline_call(n, n.method->code_function(), true, n.thing, n.arguments);
+}
+
+void IR_Inline::inline_call(IR_Value &call, IR_Label *callee, bool is_method,
+                            IR_Value *self, const std::vector<IR_Value*> &arguments)
+{
+    auto fn = dynamic_cast<IR_Named_Block*>(callee);
+    if (m_depth >= max_depth || !fn || fn->function_name.empty())
+    {
+        return;
+    }
+    // a null self is the caller's local 0, there's none at the top level
+    const bool keeps_self = is_method && !self;
+    if (keeps_self && m_frames.empty())
+    {
+        return;
+    }
+    for (auto &&f : m_frames)
+    {
+        if (f.fn == fn)
+        {
+            return;
+        }
+    }
+
+    auto &fn_body = fn->body();
+    size_t first = 0;
+    size_t num_locals = 0;
+    if (!fn_body.empty())
+    {
+        if (auto alloc_locals = dynamic_cast<IR_Allocate_Locals*>(fn_body[0]))
+        {
+            first = 1;
+            num_locals = alloc_locals->num_to_alloc;
+        }
+    }
+    std::vector<IR_Node*> body(fn_body.begin() + first, fn_body.end());
+    IR_Body_Scan scan;
+    if (!scan.scan(body, fn) || scan.num_visited > max_size)
+    {
+        return;
+    }
+    const size_t num_args = arguments.size() + is_method;
+    assert(num_locals >= num_args);
+
+    const bool at_top_level = m_frames.empty();
+    const auto scope = at_top_level ? Symbol_Scope::Global : Symbol_Scope::Local;
+    if (!at_top_level && m_frames.back().num_locals + num_locals > UINT16_MAX)
+    {
+        return;
+    }
+
+    IR_Cloner cloner;
+    cloner.keeps_self = keeps_self;
+    cloner.inlined_from = fn;
+    for (size_t i = keeps_self ? 1 : 0; i < num_locals; ++i)
+    {
+        auto original = scan.locals.count(i) ? scan.locals[i] : nullptr;
+        Type_Info *type = nullptr;
+        if (original)
+        {
+            type = original->type;
+        }
+        else if (i < num_args)
+        {   // an argument the callee doesn't use, it's still evaluated
+            type = is_method && i == 0 ? self->get_type() : arguments[i - is_method]->get_type();
+        }
+        else
+        {
+            continue;
+        }
+        size_t index = at_top_level ? m_next_global++ : m_frames.back().num_locals++;
+        cloner.locals[i] = ir->alloc<IR_Symbol>(original ? original->src_loc : call.src_loc,
+                                                original ? original->symbol : ".arg",
+                                                index, type,
+                                                original ? original->is_readonly : false,
+                                                false, scope, true);
+    }
+
+    std::vector<IR_Node*> nodes;
+    if (is_method && !keeps_self)
+    {
+        cloner.self = cloner.locals[0];
+        nodes.push_back(ir->alloc<IR_Assignment>(self->src_loc, cloner.self, self, scope));
+    }
+    for (size_t i = 0; i < arguments.size(); ++i)
+    {
+        nodes.push_back(ir->alloc<IR_Assignment>(arguments[i]->src_loc, cloner.locals[i + is_method],
+                                                 arguments[i], scope));
+    }
+    auto inlined = cloner.clone(*ir, body);
+    ++m_depth;
+    walk(inlined);
+    --m_depth;
+    auto end = ir->alloc<IR_Label>(fn->end()->src_loc, fn->end()->name() + ".inl");
+    auto jumps = cloner.lower_returns(inlined, end);
+    nodes.insert(nodes.end(), inlined.begin(), inlined.end());
+    if (jumps)
+    {
+        nodes.push_back(end);
+    }
+
+    replace(ir->alloc<IR_Block>(call.src_loc, nodes, call.get_type()));
+}
@@ -0,0 +1,639 @@
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include "passes.hpp"
+#include "nodes.hpp"
+#include "../vm/runtime/reflection.hpp"
+
+// A variable by its scope and slot, fields are those of self.
+using Var = std::pair<Symbol_Scope, size_t>;
+
+static inline
+IR_Symbol *as_var(IR_Value *v)
+{
+    auto sym = dynamic_cast<IR_Symbol*>(v);
+    if (sym && (sym->scope == Symbol_Scope::Local || sym->scope == Symbol_Scope::Global))
+    {
+        return sym;
+    }
+    return nullptr;
+}
+
+static inline
+bool is_local_0(IR_Value *v)
+{
+    auto sym = dynamic_cast<IR_Symbol*>(v);
+    return sym && sym->scope == Symbol_Scope::Local && sym->index == 0;
+}
+
+// What a loop, its condition and its body, assigns and whether anything in it could change
+// the fields of an object.
+struct IR_Loop_Invariants::Loop : IR_Pass
+{
+    virtual const char *name() const override { return "loop-scan"; }
+
+    void scan(IR_Node *cond, IR_Named_Block &body)
+    {
+        IR_Node *n = cond;
+        walk(n);
+        visit(body);
+    }
+
+    bool assigned(IR_Symbol *sym) const
+    {
+        return assignments.count(Var{sym->scope, sym->index});
+    }
+
+    // Whether the variable is the same every time around, anything called could assign a
+    // global.
+    bool kept(IR_Symbol *sym) const
+    {
+        return !assigned(sym) && (sym->scope != Symbol_Scope::Global || !calls);
+    }
+
+    // Whether the fields read in the loop are the same every time around.
+    bool fields_kept() const
+    {
+        return !calls && !member_stores;
+    }
+
+    // The assignments to each variable and field and the lists they're in.
+    std::map<Var, std::vector<std::pair<IR_Assignment*, std::vector<IR_Node*>*>>> assignments;
+    bool calls = false;
+    bool member_stores = false;
+    // It has an IR_Assign_Top, what it assigns isn't known.
+    bool bad = false;
+
+    virtual void visit(IR_Assign_Top &n) override
+    {
+        IR_Pass::visit(n);
+        bad = true;
+    }
+
+    virtual void visit(IR_Block &n) override
+    {
+        auto outer = m_list;
+        m_list = &n.nodes;
+        IR_Pass::visit(n);
+        m_list = outer;
+    }
+
+    virtual void visit(IR_Named_Block &n) override
+    {
+        if (!n.function_name.empty())
+        {
+            return;
+        }
+        auto outer = m_list;
+        m_list = &n.body();
+        IR_Pass::visit(n);
+        m_list = outer;
+    }
+
+    virtual void visit(IR_Indexable &n) override
+    {
+        IR_Pass::visit(n);
+        auto type = n.thing->get_type();
+        if (type != ir_types->get_buffer() && !dynamic_cast<Array_Type_Info*>(type))
+        {   // the [] of a type is a method
+            calls = true;
+        }
+    }
+
+    virtual void visit(IR_Call &n) override
+    {
+        IR_Pass::visit(n);
+        auto callable = dynamic_cast<IR_Callable*>(n.callee);
+        bool is_native = callable && !dynamic_cast<IR_Call_Virtual_Method*>(&n)
+            && callable->fn_type->is_native();
+        call(is_native, nullptr, n.arguments);
+    }
+
+    virtual void visit(IR_Call_Method &n) override
+    {
+        IR_Pass::visit(n);
+        call(n.method->is_native(), n.thing ? n.thing : &self, n.arguments);
+    }
+
+    virtual void visit(IR_Assignment &n) override
+    {
+        IR_Pass::visit(n);
+        if (auto sym = dynamic_cast<IR_Symbol*>(n.lhs))
+        {
+            assignments[Var{sym->scope, sym->index}].push_back({&n, m_list});
+        }
+        else if (dynamic_cast<IR_Member_Access*>(n.lhs))
+        {
+            member_stores = true;
+        }
+    }
+
+    virtual void visit(IR_Allocate_Object &n) override
+    {
+        IR_Pass::visit(n);
+        if (n.for_type != ir_types->get_buffer())
+        {   // the init and constructor
+            calls = true;
+        }
+    }
+
+    virtual void visit(IR_Deallocate_Object &n) override
+    {
+        IR_Pass::visit(n);
+        calls = true;
+    }
+
+    Type_Map *ir_types = nullptr;
+    // Stands for local 0 as the self of a method called without one.
+    IR_Symbol self{Source_Location{}, "self", 0, nullptr, true, false, Symbol_Scope::Local, true};
+
+private:
+    std::vector<IR_Node*> *m_list = nullptr;
+
+    // Natives don't call back into code, they can only change the fields of self if they're
+    // given it.
+    void call(bool is_native, IR_Value *thing, const std::vector<IR_Value*> &arguments)
+    {
+        if (!is_native || (thing && is_local_0(thing)))
+        {
+            calls = true;
+            return;
+        }
+        for (auto &&a : arguments)
+        {
+            if (is_local_0(a))
+            {
+                calls = true;
+            }
+        }
+    }
+};
+
+// Puts the variables in place of the expressions of a loop that are the same every time
+// around, their assignments go in `before' in the order they have to be done.
+struct Invariant_Rewriter : IR_Pass
+{
+    virtual const char *name() const override { return "hoist"; }
+
+    Invariant_Rewriter(Malang_IR &ir, const IR_Loop_Invariants::Loop &loop)
+        : loop(loop)
+    {
+        this->ir = &ir;
+    }
+
+    void rewrite(IR_Node *&cond, IR_Named_Block &body)
+    {
+        walk(cond);
+        IR_Pass::visit(body);
+    }
+
+    // Every invariant expression that isn't just a variable or a constant has a key that's
+    // the same for all of those that are the same, "" if it isn't invariant.
+    std::string key(IR_Value *v) const
+    {
+        if (auto fixnum = dynamic_cast<IR_Fixnum*>(v))
+        {
+            return fixnum->type == ir->types->get_int() ? std::to_string(fixnum->value) : "";
+        }
+        if (auto sym = dynamic_cast<IR_Symbol*>(v))
+        {
+            switch (sym->scope)
+            {
+                case Symbol_Scope::Local:
+                    return loop.kept(sym) ? "l" + std::to_string(sym->index) : "";
+                case Symbol_Scope::Global:
+                    return loop.kept(sym) ? "g" + std::to_string(sym->index) : "";
+                case Symbol_Scope::Field:
+                    return loop.assigned(sym) || !loop.fields_kept() || loop.assignments.count(self)
+                        ? "" : "f" + std::to_string(sym->index);
+                default:
+                    return "";
+            }
+        }
+        if (auto access = dynamic_cast<IR_Member_Access*>(v))
+        {
+            auto thing = key(access->thing);
+            auto type = access->thing->get_type();
+            if (thing.empty() || !type)
+            {
+                return "";
+            }
+            // lengths are kept by the object
+            if (access->member_name == "length"
+                && (type == ir->types->get_buffer() || type == ir->types->get_string()
+                    || dynamic_cast<Array_Type_Info*>(type)))
+            {
+                return "(" + thing + ").length";
+            }
+            uint16_t field_idx;
+            if (!loop.fields_kept() || has_field_stores() || !type->get_field_index(access->member_name, field_idx))
+            {
+                return "";
+            }
+            return "(" + thing + ")." + access->member_name;
+        }
+        if (auto binary = dynamic_cast<IR_Binary_Operation*>(v))
+        {
+            // those that can't trap
+            const char *op = dynamic_cast<IR_B_Add*>(v) ? "+"
+                : dynamic_cast<IR_B_Subtract*>(v) ? "-"
+                : dynamic_cast<IR_B_Multiply*>(v) ? "*"
+                : dynamic_cast<IR_B_And*>(v) ? "&"
+                : dynamic_cast<IR_B_Or*>(v) ? "|"
+                : dynamic_cast<IR_B_Xor*>(v) ? "^"
+                : nullptr;
+            if (!op || !is_number(binary->lhs) || !is_number(binary->rhs))
+            {
+                return "";
+            }
+            auto lhs = key(binary->lhs);
+            auto rhs = lhs.empty() ? "" : key(binary->rhs);
+            return rhs.empty() ? "" : "(" + lhs + op + rhs + ")";
+        }
+        if (auto unary = dynamic_cast<IR_Unary_Operation*>(v))
+        {
+            const char *op = dynamic_cast<IR_U_Negate*>(v) ? "-"
+                : dynamic_cast<IR_U_Invert*>(v) ? "~"
+                : nullptr;
+            if (!op || !is_number(unary->operand))
+            {
+                return "";
+            }
+            auto operand = key(unary->operand);
+            return operand.empty() ? "" : op + ("(" + operand + ")");
+        }
+        return "";
+    }
+
+    // The variables and the assignments to them that go before the loop.
+    std::map<std::string, IR_Symbol*> hoisted;
+    std::vector<IR_Node*> before;
+    // Gets a new variable in the frame, or a global if it's nullptr.
+    std::function<IR_Symbol*(const Source_Location&, Type_Info*)> new_variable;
+
+    virtual void visit(IR_Named_Block &n) override
+    {
+        if (n.function_name.empty())
+        {
+            IR_Pass::visit(n);
+        }
+    }
+
+    virtual void visit(IR_Assignment &n) override
+    {
+        // what's stored to stays where it is
+        if (auto access = dynamic_cast<IR_Member_Access*>(n.lhs))
+        {
+            walk(access->thing);
+        }
+        else if (dynamic_cast<IR_Indexable*>(n.lhs))
+        {
+            walk(n.lhs);
+        }
+        walk(n.rhs);
+    }
+
+    virtual void visit(IR_Symbol &n) override { hoist(n); }
+    virtual void visit(IR_Member_Access &n) override { if (!hoist(n)) IR_Pass::visit(n); }
+    virtual void visit(IR_B_Add &n) override { if (!hoist(n)) IR_Pass::visit(n); }
+    virtual void visit(IR_B_Subtract &n) override { if (!hoist(n)) IR_Pass::visit(n); }
+    virtual void visit(IR_B_Multiply &n) override { if (!hoist(n)) IR_Pass::visit(n); }
+    virtual void visit(IR_B_And &n) override { if (!hoist(n)) IR_Pass::visit(n); }
+    virtual void visit(IR_B_Or &n) override { if (!hoist(n)) IR_Pass::visit(n); }
+    virtual void visit(IR_B_Xor &n) override { if (!hoist(n)) IR_Pass::visit(n); }
+    virtual void visit(IR_U_Invert &n) override { if (!hoist(n)) IR_Pass::visit(n); }
+    virtual void visit(IR_U_Negate &n) override { if (!hoist(n)) IR_Pass::visit(n); }
+
+private:
+    const IR_Loop_Invariants::Loop &loop;
+    const Var self{Symbol_Scope::Local, 0};
+    IR_Value *m_expanding = nullptr;
+
+    bool is_number(IR_Value *v) const
+    {
+        auto type = v->get_type();
+        return type == ir->types->get_int() || type == ir->types->get_double();
+    }
+
+    bool has_field_stores() const
+    {
+        for (auto &&it : loop.assignments)
+        {
+            if (it.first.first == Symbol_Scope::Field)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Replaces `n' with the variable for it if it's invariant, the first time it's seen the
+    // expression is moved before the loop after those it's made of.
+    bool hoist(IR_Value &n)
+    {
+        if (&n == m_expanding)
+        {   // its children are being walked
+            m_expanding = nullptr;
+            return false;
+        }
+        if (as_var(&n) || dynamic_cast<IR_Fixnum*>(&n))
+        {
+            return false;
+        }
+        auto k = key(&n);
+        if (k.empty())
+        {
+            return false;
+        }
+        auto it = hoisted.find(k);
+        if (it == hoisted.end())
+        {
+            auto var = new_variable(n.src_loc, n.get_type());
+            if (!var)
+            {
+                return false;
+            }
+            m_expanding = &n;
+            n.accept(*this);
+            it = hoisted.insert({k, var}).first;
+            before.push_back(ir->alloc<IR_Assignment>(n.src_loc, var, &n, var->scope));
+        }
+        replace(it->second);
+        return true;
+    }
+};
+
+// Finds the multiplies of a variable that's only ever added a constant to in a loop by
+// something that's the same every time around, and replaces those in `products'.
+struct Multiply_Finder : IR_Pass
+{
+    virtual const char *name() const override { return "find-multiplies"; }
+
+    Multiply_Finder(const IR_Loop_Invariants::Loop &loop, const std::map<Var, Fixnum> &steps)
+        : loop(loop)
+        , steps(steps)
+        {}
+
+    void find(IR_Node *&cond, IR_Named_Block &body)
+    {
+        walk(cond);
+        IR_Pass::visit(body);
+    }
+
+    // By the variable that's stepped and the key of what it's multiplied by.
+    std::map<std::pair<Var, std::string>, std::vector<IR_B_Multiply*>> found;
+    std::unordered_map<IR_B_Multiply*, IR_Symbol*> products;
+
+    virtual void visit(IR_Named_Block &n) override
+    {
+        if (n.function_name.empty())
+        {
+            IR_Pass::visit(n);
+        }
+    }
+
+    virtual void visit(IR_B_Multiply &n) override
+    {
+        IR_Pass::visit(n);
+        auto it = products.find(&n);
+        if (it != products.end())
+        {
+            replace(it->second);
+            return;
+        }
+        if (!products.empty())
+        {
+            return;
+        }
+        auto var = as_var(n.lhs);
+        auto by = n.rhs;
+        if (!var || !steps.count(Var{var->scope, var->index}))
+        {
+            var = as_var(n.rhs);
+            by = n.lhs;
+        }
+        if (!var || !steps.count(Var{var->scope, var->index}) || var->type != n.get_type())
+        {
+            return;
+        }
+        std::string key;
+        if (auto fixnum = dynamic_cast<IR_Fixnum*>(by))
+        {
+            key = std::to_string(fixnum->value);
+        }
+        else if (auto sym = as_var(by))
+        {
+            if (!loop.kept(sym))
+            {
+                return;
+            }
+            key = std::string(sym->scope == Symbol_Scope::Local ? "l" : "g") + std::to_string(sym->index);
+        }
+        else
+        {
+            return;
+        }
+        found[{Var{var->scope, var->index}, key}].push_back(&n);
+    }
+
+private:
+    const IR_Loop_Invariants::Loop &loop;
+    const std::map<Var, Fixnum> &steps;
+};
+
+bool IR_Loop_Invariants::run(Malang_IR &ir)
+{
+    IR_Global_Finder globals;
+    m_next_global = globals.find_unused(ir);
+    m_frames.clear();
+    this->ir = &ir;
+    changed = false;
+    loops(ir.first);
+    loops(ir.second);
+    // IR_Pass::run() starts over with `changed'
+    auto hoisted = changed;
+    return IR_Pass::run(ir) || hoisted;
+}
+
+void IR_Loop_Invariants::visit(IR_Block &n)
+{
+    loops(n.nodes);
+    IR_Pass::visit(n);
+}
+
+void IR_Loop_Invariants::visit(IR_Named_Block &n)
+{
+    if (n.function_name.empty())
+    {
+        loops(n.body());
+        IR_Pass::visit(n);
+        return;
+    }
+    m_frames.push_back(&n);
+    loops(n.body());
+    IR_Pass::visit(n);
+    m_frames.pop_back();
+}
+
+IR_Symbol *IR_Loop_Invariants::new_variable(const Source_Location &src_loc, Type_Info *type)
+{
+    if (m_frames.empty())
+    {
+        return ir->alloc<IR_Symbol>(src_loc, ".loop", m_next_global++, type,
+                                    false, false, Symbol_Scope::Global, true);
+    }
+    auto &body = m_frames.back()->body();
+    auto alloc_locals = body.empty() ? nullptr : dynamic_cast<IR_Allocate_Locals*>(body[0]);
+    if (!alloc_locals || alloc_locals->num_to_alloc == UINT16_MAX)
+    {
+        return nullptr;
+    }
+    return ir->alloc<IR_Symbol>(src_loc, ".loop", alloc_locals->num_to_alloc++, type,
+                                false, false, Symbol_Scope::Local, true);
+}
+
+// A while loop is its label, the condition, the branch out of it to the end of its body and
+// the body, which jumps back to the label.
+void IR_Loop_Invariants::loops(std::vector<IR_Node*> &nodes)
+{
+    for (size_t i = 0; i + 3 < nodes.size(); ++i)
+    {
+        auto head = dynamic_cast<IR_Label*>(nodes[i]);
+        auto exit = dynamic_cast<IR_Pop_Branch_If_False*>(nodes[i + 2]);
+        auto body = dynamic_cast<IR_Named_Block*>(nodes[i + 3]);
+        if (!head || dynamic_cast<IR_Named_Block*>(head) || !dynamic_cast<IR_Value*>(nodes[i + 1])
+            || !exit || !body || !body->function_name.empty() || exit->destination != body->end()
+            || body->body().empty())
+        {
+            continue;
+        }
+        auto back = body->body().back();
+        if (typeid(*back) != typeid(IR_Branch) || static_cast<IR_Branch*>(back)->destination != head)
+        {
+            continue;
+        }
+        auto before = hoist(nodes[i + 1], *body);
+        nodes.insert(nodes.begin() + i, before.begin(), before.end());
+        i += before.size() + 3;
+    }
+}
+
+// Moves what's invariant in the loop before it and strength reduces the multiplies by the
+// variables it steps, returns the assignments that go before it.
+std::vector<IR_Node*> IR_Loop_Invariants::hoist(IR_Node *&cond, IR_Named_Block &body)
+{
+    Loop loop;
+    loop.ir_types = ir->types;
+    loop.scan(cond, body);
+    if (loop.bad)
+    {
+        return {};
+    }
+    Invariant_Rewriter rewriter(*ir, loop);
+    rewriter.new_variable = [this](const Source_Location &src_loc, Type_Info *type)
+    {
+        return new_variable(src_loc, type);
+    };
+    rewriter.rewrite(cond, body);
+    auto before = rewriter.before;
+
+    // the variables whose only assignment is adding a constant to themselves
+    std::map<Var, Fixnum> steps;
+    for (auto &&it : loop.assignments)
+    {
+        auto &assignments = it.second;
+        auto var = as_var(dynamic_cast<IR_Symbol*>(assignments[0].first->lhs));
+        auto add = dynamic_cast<IR_B_Add*>(assignments[0].first->rhs);
+        if (assignments.size() != 1 || !var || !add || !assignments[0].second
+            || var->type != ir->types->get_int() || (var->scope == Symbol_Scope::Global && loop.calls))
+        {
+            continue;
+        }
+        auto lhs = as_var(add->lhs);
+        auto fixnum = dynamic_cast<IR_Fixnum*>(add->rhs);
+        if (!fixnum)
+        {
+            lhs = as_var(add->rhs);
+            fixnum = dynamic_cast<IR_Fixnum*>(add->lhs);
+        }
+        if (lhs && fixnum && lhs->scope == var->scope && lhs->index == var->index
+            && fixnum->type == ir->types->get_int())
+        {
+            steps[it.first] = fixnum->value;
+        }
+    }
+    Multiply_Finder finder(loop, steps);
+    finder.find(cond, body);
+    for (auto &&it : finder.found)
+    {
+        // a multiply costs what an add does, it's only worth it for more than one
+        auto &multiplies = it.second;
+        if (multiplies.size() < 2)
+        {
+            continue;
+        }
+        auto first = multiplies[0];
+        auto &src_loc = first->src_loc;
+        auto stepped = loop.assignments[it.first.first][0];
+        auto var = static_cast<IR_Symbol*>(stepped.first->lhs);
+        auto by = as_var(first->lhs) && as_var(first->lhs)->index == var->index
+            && as_var(first->lhs)->scope == var->scope ? first->rhs : first->lhs;
+        auto product = new_variable(src_loc, var->type);
+        if (!product)
+        {
+            continue;
+        }
+        auto int_type = ir->types->get_int();
+        auto c = steps[it.first.first];
+        auto initial = ir->alloc<IR_B_Multiply>(src_loc);
+        initial->lhs = var;
+        initial->rhs = by;
+        before.push_back(ir->alloc<IR_Assignment>(src_loc, product, initial, product->scope));
+        // what it goes up by each time `var' does
+        IR_Value *step = by;
+        if (auto fixnum = dynamic_cast<IR_Fixnum*>(by))
+        {
+            auto value = static_cast<uint32_t>(c) * static_cast<uint32_t>(fixnum->value);
+            step = ir->alloc<IR_Fixnum>(src_loc, int_type, static_cast<Fixnum>(value));
+        }
+        else if (c != 1)
+        {
+            auto step_var = new_variable(src_loc, var->type);
+            if (!step_var)
+            {
+                before.pop_back();
+                continue;
+            }
+            auto multiply = ir->alloc<IR_B_Multiply>(src_loc);
+            multiply->lhs = ir->alloc<IR_Fixnum>(src_loc, int_type, c);
+            multiply->rhs = by;
+            before.push_back(ir->alloc<IR_Assignment>(src_loc, step_var, multiply, step_var->scope));
+            step = step_var;
+        }
+
+        auto add = ir->alloc<IR_B_Add>(src_loc);
+        add->lhs = product;
+        add->rhs = step;
+        auto &list = *stepped.second;
+        auto at = std::find(list.begin(), list.end(), stepped.first);
+        assert(at != list.end());
+        list.insert(at + 1, ir->alloc<IR_Assignment>(src_loc, product, add, product->scope));
+        for (auto &&m : multiplies)
+        {
+            finder.products[m] = product;
+        }
+    }
+    if (!finder.products.empty())
+    {
+        finder.find(cond, body);
+    }
+    if (!before.empty())
+    {
+        changed = true;
+    }
+    return before;
+}
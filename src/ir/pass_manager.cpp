@@ -0,0 +1,75 @@
+#include <chrono>
+#include "pass_manager.hpp"
+#include "passes.hpp"
+
+IR_Pass_Manager::~IR_Pass_Manager()
+{
+    for (auto &&p : m_passes)
+    {
+        delete p;
+    }
+}
+
+IR_Pass_Manager::IR_Pass_Manager(int opt_level)
+    : opt_level(opt_level)
+{
+    if (opt_level >= 1)
+    {
+        if (opt_level >= 2)
+        {
+            add(new IR_Inline{40, 3});
+        }
+        else
+        {
+            add(new IR_Inline{16, 1});
+        }
+        add(new IR_Scalar_Replace);
+        add(new IR_Flatten_Blocks);
+        add(new IR_Constant_Fold);
+        add(new IR_Dead_Code);
+        add(new IR_Loop_Invariants);
+        add(new IR_Bounds_Check);
+        add(new IR_Pack_Locals);
+    }
+}
+
+void IR_Pass_Manager::add(IR_Pass *pass)
+{
+    assert(pass);
+    m_passes.push_back(pass);
+}
+
+void IR_Pass_Manager::run(Malang_IR &ir)
+{
+    IR_Node_Counter counter;
+    auto nodes = counter.count(ir);
+    for (auto &&p : m_passes)
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto changed = p->run(ir);
+        std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+        auto nodes_after = counter.count(ir);
+        stats.push_back({p->name(), took.count(), nodes, nodes_after, changed});
+        nodes = nodes_after;
+    }
+}
+
+void IR_Pass_Manager::print_stats(FILE *out) const
+{
+    fprintf(out, "IR passes at -O%d:\n", opt_level);
+    if (stats.empty())
+    {
+        fprintf(out, "    none\n");
+        return;
+    }
+    double total_ms = 0;
+    for (auto &&s : stats)
+    {
+        auto delta = static_cast<long long>(s.nodes_after) - static_cast<long long>(s.nodes_before);
+        fprintf(out, "    %-24s %9.3f ms  %8zu -> %-8zu nodes (%+lld)%s\n",
+                s.name, s.ms, s.nodes_before, s.nodes_after, delta, s.changed ? "" : "  unchanged");
+        total_ms += s.ms;
+    }
+    fprintf(out, "    %-24s %9.3f ms  %8zu -> %-8zu nodes\n",
+            "total", total_ms, stats.front().nodes_before, stats.back().nodes_after);
+}
@@ -0,0 +1,37 @@
+#ifndef MALANG_IR_PASS_MANAGER_HPP
+#define MALANG_IR_PASS_MANAGER_HPP
+
+#include <stdio.h>
+#include <vector>
+#include "ir_pass.hpp"
+
+// Runs the IR_Passes for an optimization level in order and keeps track of what each did.
+struct IR_Pass_Manager
+{
+    ~IR_Pass_Manager();
+    // -O0 runs nothing, -O1 the passes that are cheap and only inlines the tiniest functions,
+    // -O2 everything and inlines bigger functions deeper.
+    explicit IR_Pass_Manager(int opt_level);
+
+    struct Pass_Stats
+    {
+        const char *name;
+        double ms;
+        size_t nodes_before;
+        size_t nodes_after;
+        bool changed;
+    };
+
+    // Takes ownership of `pass'.
+    void add(IR_Pass *pass);
+    void run(Malang_IR &ir);
+    void print_stats(FILE *out) const;
+
+    int opt_level;
+    std::vector<Pass_Stats> stats;
+
+private:
+    std::vector<IR_Pass*> m_passes;
+};
+
+#endif /* MALANG_IR_PASS_MANAGER_HPP */
@@ -0,0 +1,491 @@
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include "passes.hpp"
+#include "nodes.hpp"
+
+// A set of local slots.
+struct Live_Slots
+{
+    explicit Live_Slots(size_t n = 0)
+        : words((n + 63) / 64, 0)
+        {}
+
+    bool has(size_t i) const { return words[i / 64] & (UINT64_C(1) << (i % 64)); }
+    void add(size_t i) { words[i / 64] |= UINT64_C(1) << (i % 64); }
+    void take(size_t i) { words[i / 64] &= ~(UINT64_C(1) << (i % 64)); }
+    void add(const Live_Slots &o)
+    {
+        for (size_t i = 0; i < words.size(); ++i)
+        {
+            words[i] |= o.words[i];
+        }
+    }
+    bool operator!=(const Live_Slots &o) const { return words != o.words; }
+
+    std::vector<uint64_t> words;
+};
+
+// Something a function's code does with its locals or where it goes next.
+struct Local_Event
+{
+    enum Kind { Use, Def, Label, Jump, Branch, Exit } kind;
+    size_t var;
+    IR_Label *label;
+};
+
+// The events of a function's body in the order its code does them, and which of them each
+// statement is. The functions defined in it are only the label after them.
+struct Local_Linearizer : IR_Pass
+{
+    virtual const char *name() const override { return "linearize"; }
+
+    bool linearize(Malang_IR &ir, std::vector<IR_Node*> &body, size_t num_locals)
+    {
+        this->ir = &ir;
+        this->num_locals = num_locals;
+        list(body);
+        return !bad;
+    }
+
+    struct Statement
+    {
+        IR_Node *node;
+        size_t begin;
+        size_t end;
+    };
+    std::vector<Local_Event> events;
+    std::vector<Statement> statements;
+    size_t num_locals = 0;
+    bool bad = false;
+
+    virtual void visit(IR_Block &n) override
+    {
+        list(n.nodes);
+    }
+
+    virtual void visit(IR_Named_Block &n) override
+    {
+        if (n.function_name.empty())
+        {
+            label(&n);
+            list(n.body());
+        }
+        label(n.end());
+    }
+
+    virtual void visit(IR_Label &n) override { label(&n); }
+    virtual void visit(IR_Branch &n) override { jump(Local_Event::Jump, n.destination); }
+    virtual void visit(IR_Pop_Branch_If_True &n) override { jump(Local_Event::Branch, n.destination); }
+    virtual void visit(IR_Pop_Branch_If_False &n) override { jump(Local_Event::Branch, n.destination); }
+    virtual void visit(IR_Branch_If_True_Or_Pop &n) override { jump(Local_Event::Branch, n.destination); }
+    virtual void visit(IR_Branch_If_False_Or_Pop &n) override { jump(Local_Event::Branch, n.destination); }
+
+    virtual void visit(IR_Return &n) override
+    {
+        IR_Pass::visit(n);
+        events.push_back({Local_Event::Exit, 0, nullptr});
+    }
+
+    virtual void visit(IR_Symbol &n) override
+    {
+        if (n.scope == Symbol_Scope::Local)
+        {
+            var(Local_Event::Use, n.index);
+        }
+        else if (n.scope == Symbol_Scope::Field)
+        {
+            var(Local_Event::Use, 0);
+        }
+    }
+
+    virtual void visit(IR_Method &n) override
+    {
+        self(n.thing);
+    }
+
+    virtual void visit(IR_Call &n) override
+    {
+        if (auto method = dynamic_cast<IR_Method*>(n.callee))
+        {
+            self(method->thing);
+        }
+        for (auto &&a : n.arguments)
+        {
+            walk(a);
+        }
+        if (!dynamic_cast<IR_Callable*>(n.callee))
+        {   // called through its value, that's pushed last
+            walk(n.callee);
+        }
+    }
+
+    virtual void visit(IR_Call_Method &n) override
+    {
+        self(n.thing);
+        for (auto &&a : n.arguments)
+        {
+            walk(a);
+        }
+    }
+
+    virtual void visit(IR_Assignment &n) override
+    {
+        if (auto sym = dynamic_cast<IR_Symbol*>(n.lhs))
+        {
+            walk(n.rhs);
+            store(sym->scope, sym->index);
+        }
+        else if (auto mem = dynamic_cast<IR_Member_Access*>(n.lhs))
+        {
+            walk(n.rhs);
+            walk(mem->thing);
+        }
+        else
+        {
+            IR_Pass::visit(n);
+        }
+    }
+
+    virtual void visit(IR_Assign_Top &n) override
+    {
+        if (auto sym = dynamic_cast<IR_Symbol*>(n.lhs))
+        {
+            store(sym->scope, sym->index);
+        }
+        else if (n.scope == Symbol_Scope::Local)
+        {   // a slot by its number, it can't be moved
+            bad = true;
+        }
+        else if (n.scope == Symbol_Scope::Field)
+        {
+            var(Local_Event::Use, 0);
+        }
+    }
+
+private:
+    void list(std::vector<IR_Node*> &nodes)
+    {
+        for (auto &&n : nodes)
+        {
+            auto begin = events.size();
+            walk(n);
+            statements.push_back({n, begin, events.size()});
+        }
+    }
+
+    void label(IR_Label *l) { events.push_back({Local_Event::Label, 0, l}); }
+    void jump(Local_Event::Kind kind, IR_Label *to) { events.push_back({kind, 0, to}); }
+
+    void var(Local_Event::Kind kind, size_t index)
+    {
+        if (index >= num_locals)
+        {
+            bad = true;
+            return;
+        }
+        events.push_back({kind, index, nullptr});
+    }
+
+    void store(Symbol_Scope scope, size_t index)
+    {
+        if (scope == Symbol_Scope::Local)
+        {
+            var(Local_Event::Def, index);
+        }
+        else if (scope == Symbol_Scope::Field)
+        {
+            var(Local_Event::Use, 0);
+        }
+    }
+
+    // A method's self is local 0 when it's not given.
+    void self(IR_Value *&thing)
+    {
+        if (thing)
+        {
+            walk(thing);
+        }
+        else
+        {
+            var(Local_Event::Use, 0);
+        }
+    }
+};
+
+// Swaps the locals of a function for the symbols of their new slots, not those of the functions
+// defined in it.
+struct Local_Renamer : IR_Pass
+{
+    virtual const char *name() const override { return "rename-locals"; }
+
+    void rename(Malang_IR &ir, std::vector<IR_Node*> &body, const std::vector<size_t> &slots)
+    {
+        this->ir = &ir;
+        this->slots = &slots;
+        walk(body);
+    }
+
+    virtual void visit(IR_Named_Block &n) override
+    {
+        if (n.function_name.empty())
+        {
+            IR_Pass::visit(n);
+        }
+    }
+
+    virtual void visit(IR_Symbol &n) override
+    {
+        if (n.scope != Symbol_Scope::Local || (*slots)[n.index] == n.index)
+        {
+            return;
+        }
+        auto &renamed = m_renamed[&n];
+        if (!renamed)
+        {
+            renamed = ir->alloc<IR_Symbol>(n);
+            renamed->index = (*slots)[n.index];
+        }
+        replace(renamed);
+    }
+
+    const std::vector<size_t> *slots = nullptr;
+
+private:
+    std::unordered_map<IR_Symbol*, IR_Symbol*> m_renamed;
+};
+
+bool IR_Pack_Locals::run(Malang_IR &ir)
+{
+    ir.dead_locals.clear();
+    return IR_Pass::run(ir);
+}
+
+void IR_Pack_Locals::visit(IR_Named_Block &n)
+{
+    IR_Pass::visit(n);
+    auto &body = n.body();
+    auto alloc_locals = body.empty() ? nullptr : dynamic_cast<IR_Allocate_Locals*>(body[0]);
+    if (!n.function_name.empty() && alloc_locals)
+    {
+        changed |= pack(body, *alloc_locals);
+    }
+}
+
+bool IR_Pack_Locals::pack(std::vector<IR_Node*> &body, IR_Allocate_Locals &alloc_locals)
+{
+    size_t num_locals = alloc_locals.num_to_alloc;
+    size_t num_args = alloc_locals.num_args;
+    Local_Linearizer code;
+    if (!code.linearize(*ir, body, num_locals) || code.events.empty())
+    {
+        return false;
+    }
+    auto &events = code.events;
+    auto n = events.size();
+
+    std::unordered_map<IR_Label*, size_t> labels;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (events[i].kind == Local_Event::Label)
+        {
+            labels[events[i].label] = i;
+        }
+    }
+    std::vector<size_t> targets(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (events[i].kind == Local_Event::Jump || events[i].kind == Local_Event::Branch)
+        {
+            auto target = labels.find(events[i].label);
+            if (target == labels.end())
+            {   // it leaves the function some other way
+                return false;
+            }
+            targets[i] = target->second;
+        }
+    }
+
+    // What's live before each event, until nothing changes.
+    std::vector<Live_Slots> live_in(n, Live_Slots{num_locals});
+    auto live_out = [&](size_t i)
+    {
+        Live_Slots out{num_locals};
+        auto kind = events[i].kind;
+        if (kind != Local_Event::Jump && kind != Local_Event::Exit && i + 1 < n)
+        {
+            out.add(live_in[i + 1]);
+        }
+        if (kind == Local_Event::Jump || kind == Local_Event::Branch)
+        {
+            out.add(live_in[targets[i]]);
+        }
+        return out;
+    };
+    for (bool again = true; again;)
+    {
+        again = false;
+        for (size_t i = n; i-- != 0;)
+        {
+            auto live = live_out(i);
+            if (events[i].kind == Local_Event::Def)
+            {
+                live.take(events[i].var);
+            }
+            else if (events[i].kind == Local_Event::Use)
+            {
+                live.add(events[i].var);
+            }
+            if (live != live_in[i])
+            {
+                live_in[i] = live;
+                again = true;
+            }
+        }
+    }
+
+    // Each variable is weighed by how often it's used, ten times as much in each loop it's in.
+    std::vector<size_t> depth(n, 0);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if ((events[i].kind == Local_Event::Jump || events[i].kind == Local_Event::Branch) && targets[i] <= i)
+        {
+            for (auto j = targets[i]; j <= i; ++j)
+            {
+                ++depth[j];
+            }
+        }
+    }
+    std::vector<bool> used(num_locals, false);
+    std::vector<double> weight(num_locals, 0);
+    std::vector<Live_Slots> interferes(num_locals, Live_Slots{num_locals});
+    for (size_t i = 0; i < n; ++i)
+    {
+        auto &e = events[i];
+        if (e.kind != Local_Event::Use && e.kind != Local_Event::Def)
+        {
+            continue;
+        }
+        used[e.var] = true;
+        weight[e.var] += std::pow(10.0, std::min<size_t>(depth[i], 6));
+        if (e.kind == Local_Event::Def)
+        {   // storing it mustn't clobber what's still to be read
+            auto out = live_out(i);
+            for (size_t w = 0; w < num_locals; ++w)
+            {
+                if (w != e.var && out.has(w))
+                {
+                    interferes[e.var].add(w);
+                    interferes[w].add(e.var);
+                }
+            }
+        }
+    }
+
+    // The arguments and self stay where they are, and so does anything that may be read before
+    // it's assigned, which is kept apart from everything.
+    std::vector<size_t> slots(num_locals, SIZE_MAX);
+    std::vector<size_t> order;
+    for (size_t v = 0; v < num_locals; ++v)
+    {
+        if (v < num_args || v == 0)
+        {
+            slots[v] = v;
+        }
+        else if (live_in[0].has(v))
+        {
+            slots[v] = v;
+            for (size_t w = 0; w < num_locals; ++w)
+            {
+                if (w != v)
+                {
+                    interferes[v].add(w);
+                    interferes[w].add(v);
+                }
+            }
+        }
+        else if (used[v])
+        {
+            order.push_back(v);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return weight[a] > weight[b]; });
+    for (auto &&v : order)
+    {
+        std::vector<bool> taken(num_locals, false);
+        for (size_t w = 0; w < num_locals; ++w)
+        {
+            if (slots[w] != SIZE_MAX && interferes[v].has(w))
+            {
+                taken[slots[w]] = true;
+            }
+        }
+        size_t slot = 0;
+        while (taken[slot])
+        {
+            ++slot;
+        }
+        slots[v] = slot;
+    }
+
+    size_t num_slots = num_args;
+    for (size_t v = 0; v < num_locals; ++v)
+    {
+        if (slots[v] == SIZE_MAX)
+        {   // nothing uses it
+            slots[v] = v;
+        }
+        else if (used[v])
+        {
+            num_slots = std::max(num_slots, slots[v] + 1);
+        }
+    }
+    bool any_changes = num_slots != num_locals;
+    for (size_t v = 0; v < num_locals; ++v)
+    {
+        any_changes |= used[v] && slots[v] != v;
+    }
+    if (any_changes)
+    {
+        Local_Renamer renamer;
+        renamer.rename(*ir, body, slots);
+        alloc_locals.num_to_alloc = static_cast<uint16_t>(num_slots);
+    }
+
+    // The slots that nothing reads from the start of each statement on, for the calls in it.
+    for (auto &&s : code.statements)
+    {
+        if (s.begin == s.end)
+        {
+            continue;
+        }
+        auto live = live_out(s.end - 1);
+        for (auto i = s.begin; i < s.end; ++i)
+        {
+            live.add(live_in[i]);
+        }
+        std::vector<bool> live_slots(num_slots, false);
+        for (size_t v = 0; v < num_locals; ++v)
+        {
+            if (live.has(v))
+            {
+                live_slots[slots[v]] = true;
+            }
+        }
+        std::vector<uint16_t> dead;
+        for (size_t slot = 0; slot < num_slots; ++slot)
+        {
+            if (!live_slots[slot])
+            {
+                dead.push_back(static_cast<uint16_t>(slot));
+            }
+        }
+        if (!dead.empty())
+        {
+            ir->dead_locals[s.node] = dead;
+        }
+    }
+    return any_changes;
+}
@@ -0,0 +1,571 @@
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_map>
+#include "passes.hpp"
+#include "ir_clone.hpp"
+#include "nodes.hpp"
+#include "../vm/runtime/reflection.hpp"
+
+using Var = std::tuple<IR_Node*, Symbol_Scope, size_t>;
+
+struct IR_Scalar_Replace::Object
+{
+    IR_Assignment *allocation = nullptr;
+    // Where the variables for the fields and the constructor's locals go, nullptr for globals.
+    IR_Named_Block *frame = nullptr;
+    Symbol_Scope scope = Symbol_Scope::Local;
+    std::unordered_map<std::string, IR_Symbol*> fields;
+};
+
+// How a variable that could hold an object is used.
+struct Var_Uses
+{
+    IR_Symbol *symbol = nullptr;
+    IR_Assignment *allocation = nullptr;
+    size_t num_allocations = 0;
+    bool allocated_in_loop = false;
+    // Used as it is or assigned something that isn't an allocation or another variable.
+    bool escapes = false;
+    std::vector<Var> copied_from;
+    std::vector<std::string> loads;
+    std::vector<std::string> stores;
+    // The variables read by the arguments of the allocation.
+    std::vector<Var> read_by_allocation;
+    // The block a variable that's copied to once is copied to first thing in, like the slot
+    // for self of an inlined method, and whether it's used outside of it.
+    IR_Block *scope = nullptr;
+    bool unscoped = false;
+};
+
+// A symbol that's a variable in a frame, not a field of self.
+static inline
+IR_Symbol *as_var(IR_Value *v)
+{
+    auto sym = dynamic_cast<IR_Symbol*>(v);
+    if (sym && (sym->scope == Symbol_Scope::Local || sym->scope == Symbol_Scope::Global))
+    {
+        return sym;
+    }
+    return nullptr;
+}
+
+static inline
+bool is_local_0(IR_Value *v)
+{
+    auto sym = dynamic_cast<IR_Symbol*>(v);
+    return sym && sym->scope == Symbol_Scope::Local && sym->index == 0;
+}
+
+// Finds how every variable is used.
+struct Escape_Scan : IR_Pass
+{
+    virtual const char *name() const override { return "escape-scan"; }
+
+    Var var(IR_Symbol *sym) const
+    {
+        // globals are the same everywhere
+        IR_Node *frame = sym->scope == Symbol_Scope::Global || frames.empty() ? nullptr : frames.back();
+        return Var{frame, sym->scope, sym->index};
+    }
+
+    void self_escapes()
+    {
+        vars[Var{frames.empty() ? nullptr : frames.back(), Symbol_Scope::Local, 0}].escapes = true;
+    }
+
+    Var_Uses &use(IR_Symbol *sym)
+    {
+        auto v = var(sym);
+        if (reads)
+        {
+            reads->push_back(v);
+        }
+        auto &uses = vars[v];
+        if (!uses.scope || std::find(blocks.begin(), blocks.end(), uses.scope) == blocks.end())
+        {
+            uses.unscoped = true;
+        }
+        return uses;
+    }
+
+    virtual void visit(IR_Block &n) override
+    {
+        blocks.push_back(&n);
+        IR_Pass::visit(n);
+        blocks.pop_back();
+    }
+
+    virtual void visit(IR_Named_Block &n) override
+    {
+        if (n.function_name.empty())
+        {
+            ++loops;
+            IR_Pass::visit(n);
+            --loops;
+            return;
+        }
+        auto outer_loops = loops;
+        loops = 0;
+        frames.push_back(&n);
+        IR_Pass::visit(n);
+        frames.pop_back();
+        loops = outer_loops;
+    }
+
+    virtual void visit(IR_Assignment &n) override
+    {
+        if (auto sym = as_var(n.lhs))
+        {
+            auto &uses = vars[var(sym)];
+            uses.symbol = sym;
+            if (dynamic_cast<IR_Allocate_Object*>(n.rhs))
+            {
+                ++uses.num_allocations;
+                uses.allocation = &n;
+                uses.allocated_in_loop |= loops > 0;
+                auto outer_reads = reads;
+                reads = &uses.read_by_allocation;
+                walk(n.rhs);
+                reads = outer_reads;
+            }
+            else if (auto from = as_var(n.rhs))
+            {
+                uses.copied_from.push_back(var(from));
+                auto block = dynamic_cast<IR_Block*>(parent());
+                if (uses.copied_from.size() == 1 && block && block->nodes[0] == &n)
+                {
+                    uses.scope = block;
+                }
+                else
+                {
+                    uses.unscoped = true;
+                }
+                if (reads)
+                {
+                    reads->push_back(var(from));
+                }
+            }
+            else
+            {
+                uses.escapes = true;
+                walk(n.rhs);
+            }
+            return;
+        }
+        if (auto mem = dynamic_cast<IR_Member_Access*>(n.lhs))
+        {
+            if (auto sym = as_var(mem->thing))
+            {
+                use(sym).stores.push_back(mem->member_name);
+                walk(n.rhs);
+                return;
+            }
+        }
+        IR_Pass::visit(n);
+    }
+
+    virtual void visit(IR_Member_Access &n) override
+    {
+        if (auto sym = as_var(n.thing))
+        {
+            use(sym).loads.push_back(n.member_name);
+            return;
+        }
+        IR_Pass::visit(n);
+    }
+
+    virtual void visit(IR_Symbol &n) override
+    {
+        if (n.scope == Symbol_Scope::Field)
+        {
+            self_escapes();
+        }
+        else if (as_var(&n))
+        {
+            use(&n).escapes = true;
+        }
+    }
+
+    virtual void visit(IR_Call_Method &n) override
+    {
+        if (!n.thing)
+        {
+            self_escapes();
+        }
+        IR_Pass::visit(n);
+    }
+
+    std::map<Var, Var_Uses> vars;
+    std::vector<IR_Named_Block*> frames;
+    std::vector<IR_Block*> blocks;
+    std::vector<Var> *reads = nullptr;
+    int loops = 0;
+};
+
+// Whether the body of an init or constructor only uses self to get at its fields.
+struct Self_Scan : IR_Pass
+{
+    virtual const char *name() const override { return "self-scan"; }
+
+    bool scan(std::vector<IR_Node*> &body, Type_Info *type)
+    {
+        m_type = type;
+        walk(body);
+        return !m_bad;
+    }
+
+    virtual void visit(IR_Member_Access &n) override
+    {
+        if (is_local_0(n.thing))
+        {
+            m_bad |= !m_type->get_field(n.member_name);
+            return;
+        }
+        IR_Pass::visit(n);
+    }
+
+    virtual void visit(IR_Symbol &n) override
+    {
+        if (n.scope == Symbol_Scope::Field)
+        {
+            m_bad |= !m_type->get_field(n.symbol);
+        }
+        else if (is_local_0(&n))
+        {
+            m_bad = true;
+        }
+    }
+
+    virtual void visit(IR_Call_Method &n) override
+    {
+        m_bad |= !n.thing;
+        IR_Pass::visit(n);
+    }
+
+    virtual void visit(IR_Return &n) override
+    {
+        m_bad |= !n.values.empty();
+    }
+
+private:
+    Type_Info *m_type = nullptr;
+    bool m_bad = false;
+};
+
+// The body of a code constructor or init, without its IR_Allocate_Locals, and how many locals
+// it has. nullptr if it can't be copied for an object that's being replaced.
+static
+IR_Named_Block *copyable_constructor(IR_Label *fn, Type_Info *type,
+                                     std::vector<IR_Node*> &body, size_t &num_locals)
+{
+    auto block = dynamic_cast<IR_Named_Block*>(fn);
+    if (!block)
+    {
+        return nullptr;
+    }
+    auto &fn_body = block->body();
+    size_t first = 0;
+    num_locals = 0;
+    if (!fn_body.empty())
+    {
+        if (auto alloc_locals = dynamic_cast<IR_Allocate_Locals*>(fn_body[0]))
+        {
+            first = 1;
+            num_locals = alloc_locals->num_to_alloc;
+        }
+    }
+    body.assign(fn_body.begin() + first, fn_body.end());
+    IR_Body_Scan scan;
+    Self_Scan self_scan;
+    if (!scan.scan(body, fn) || !self_scan.scan(body, type))
+    {
+        return nullptr;
+    }
+    return block;
+}
+
+// Whether the init and constructor of the object `alloc' makes can be copied, and the fields
+// used exist and aren't readonly where they're stored to.
+static
+bool can_replace(Malang_IR &ir, IR_Allocate_Object &alloc, const std::vector<Var_Uses*> &uses,
+                 size_t &num_locals)
+{
+    auto type = alloc.for_type;
+    if (type == ir.types->get_buffer() || type->has_no_init() || !alloc.which_ctor
+        || !type->init() || type->init()->is_native())
+    {
+        return false;
+    }
+    std::vector<IR_Node*> body;
+    size_t init_locals;
+    if (!copyable_constructor(type->init()->code_function(), type, body, init_locals))
+    {
+        return false;
+    }
+    num_locals = init_locals;
+    if (!alloc.which_ctor->is_the_default_ctor())
+    {
+        size_t ctor_locals;
+        if (alloc.which_ctor->is_native()
+            || !copyable_constructor(alloc.which_ctor->code_function(), type, body, ctor_locals))
+        {
+            return false;
+        }
+        num_locals += ctor_locals;
+    }
+    for (auto &&u : uses)
+    {
+        for (auto &&load : u->loads)
+        {
+            if (!type->get_field(load))
+            {
+                return false;
+            }
+        }
+        for (auto &&store : u->stores)
+        {
+            auto field = type->get_field(store);
+            if (!field || field->is_readonly())
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool IR_Scalar_Replace::run(Malang_IR &ir)
+{
+    this->ir = &ir;
+    Escape_Scan scan;
+    scan.run(ir);
+    IR_Global_Finder globals;
+    m_next_global = globals.find_unused(ir);
+
+    std::map<Var, std::vector<Var>> copied_to;
+    for (auto &&it : scan.vars)
+    {
+        for (auto &&from : it.second.copied_from)
+        {
+            copied_to[from].push_back(it.first);
+        }
+    }
+    for (auto &&it : scan.vars)
+    {
+        auto &root = it.second;
+        if (root.num_allocations != 1 || root.escapes
+            || !root.copied_from.empty() || m_objects.count(it.first))
+        {
+            continue;
+        }
+        // the variables it's copied to, and those they're copied to, must only ever hold it
+        std::vector<Var> vars{it.first};
+        std::vector<Var_Uses*> uses{&root};
+        bool good = true;
+        for (size_t i = 0; good && i < vars.size(); ++i)
+        {
+            for (auto &&to : copied_to[vars[i]])
+            {
+                if (std::find(vars.begin(), vars.end(), to) != vars.end())
+                {
+                    continue;
+                }
+                auto &to_uses = scan.vars[to];
+                good &= !to_uses.escapes && to_uses.num_allocations == 0 && !m_objects.count(to);
+                vars.push_back(to);
+                uses.push_back(&to_uses);
+            }
+        }
+        for (auto &&u : uses)
+        {   // everything they're copied from must be one of them
+            for (auto &&from : u->copied_from)
+            {
+                good &= std::find(vars.begin(), vars.end(), from) != vars.end();
+            }
+            // When it's allocated again the variables it was copied to before mustn't be used
+            // anymore, they all share the fields.
+            good &= !root.allocated_in_loop || u == &root || !u->unscoped;
+        }
+        for (auto &&read : root.read_by_allocation)
+        {   // the constructor's arguments are evaluated after the fields have been initialized
+            good &= std::find(vars.begin(), vars.end(), read) == vars.end();
+        }
+        auto alloc = static_cast<IR_Allocate_Object*>(root.allocation->rhs);
+        size_t num_locals = 0;
+        if (!good || !can_replace(ir, *alloc, uses, num_locals))
+        {
+            continue;
+        }
+        auto frame = static_cast<IR_Named_Block*>(std::get<0>(it.first));
+        auto fields = alloc->for_type->all_fields();
+        if (frame)
+        {
+            auto &body = frame->body();
+            auto alloc_locals = body.empty() ? nullptr : dynamic_cast<IR_Allocate_Locals*>(body[0]);
+            if (!alloc_locals || alloc_locals->num_to_alloc + fields.size() + num_locals > UINT16_MAX)
+            {
+                continue;
+            }
+        }
+
+        auto object = new Object;
+        m_owned.push_back(object);
+        object->allocation = root.allocation;
+        object->frame = frame;
+        object->scope = std::get<1>(it.first);
+        for (auto &&field : fields)
+        {
+            object->fields[field->name()] =
+                ir.alloc<IR_Symbol>(root.symbol->src_loc, root.symbol->symbol + "." + field->name(),
+                                    new_slot(*object), field->type(), false, false, object->scope, true);
+        }
+        for (auto &&v : vars)
+        {
+            m_objects[v] = object;
+        }
+    }
+
+    bool replaced = false;
+    if (!m_objects.empty())
+    {
+        replaced = IR_Pass::run(ir);
+    }
+    for (auto &&object : m_owned)
+    {
+        delete object;
+    }
+    m_owned.clear();
+    m_objects.clear();
+    m_frames.clear();
+    return replaced;
+}
+
+void IR_Scalar_Replace::visit(IR_Named_Block &n)
+{
+    if (n.function_name.empty())
+    {
+        IR_Pass::visit(n);
+        return;
+    }
+    m_frames.push_back(&n);
+    IR_Pass::visit(n);
+    m_frames.pop_back();
+}
+
+void IR_Scalar_Replace::visit(IR_Assignment &n)
+{
+    if (auto object = object_of(n.lhs))
+    {
+        if (&n == object->allocation)
+        {
+            walk(n.rhs);
+            replace_allocation(*object, n);
+        }
+        else
+        {   // the copies from one of its variables to another
+            remove();
+        }
+        return;
+    }
+    IR_Pass::visit(n);
+}
+
+void IR_Scalar_Replace::visit(IR_Member_Access &n)
+{
+    if (auto object = object_of(n.thing))
+    {
+        assert(object->fields.count(n.member_name));
+        replace(object->fields[n.member_name]);
+        return;
+    }
+    IR_Pass::visit(n);
+}
+
+IR_Scalar_Replace::Object *IR_Scalar_Replace::object_of(IR_Value *v) const
+{
+    auto sym = as_var(v);
+    if (!sym)
+    {
+        return nullptr;
+    }
+    IR_Node *frame = sym->scope == Symbol_Scope::Global || m_frames.empty() ? nullptr : m_frames.back();
+    auto it = m_objects.find(Var{frame, sym->scope, sym->index});
+    return it == m_objects.end() ? nullptr : it->second;
+}
+
+size_t IR_Scalar_Replace::new_slot(Object &object)
+{
+    if (!object.frame)
+    {
+        return m_next_global++;
+    }
+    auto alloc_locals = static_cast<IR_Allocate_Locals*>(object.frame->body()[0]);
+    return alloc_locals->num_to_alloc++;
+}
+
+// Copies the body of the init or constructor `fn' for `object' after storing the arguments in
+// new variables for its locals.
+void IR_Scalar_Replace::copy_constructor(Object &object, IR_Label *fn,
+                                         const std::vector<IR_Value*> &arguments,
+                                         std::vector<IR_Node*> &nodes)
+{
+    auto type = static_cast<IR_Allocate_Object*>(object.allocation->rhs)->for_type;
+    std::vector<IR_Node*> body;
+    size_t num_locals;
+    auto block = copyable_constructor(fn, type, body, num_locals);
+    assert(block);
+    IR_Body_Scan scan;
+    scan.scan(body, fn);
+
+    IR_Cloner cloner;
+    cloner.keeps_self = true;
+    cloner.fields = object.fields;
+    // local 0 is self which is only used for its fields
+    for (size_t i = 1; i < num_locals; ++i)
+    {
+        auto original = scan.locals.count(i) ? scan.locals[i] : nullptr;
+        Type_Info *local_type = nullptr;
+        if (original)
+        {
+            local_type = original->type;
+        }
+        else if (i <= arguments.size())
+        {
+            local_type = arguments[i - 1]->get_type();
+        }
+        else
+        {
+            continue;
+        }
+        cloner.locals[i] = ir->alloc<IR_Symbol>(original ? original->src_loc : block->src_loc,
+                                                original ? original->symbol : ".arg",
+                                                new_slot(object), local_type,
+                                                original ? original->is_readonly : false,
+                                                false, object.scope, true);
+    }
+    for (size_t i = 0; i < arguments.size(); ++i)
+    {
+        nodes.push_back(ir->alloc<IR_Assignment>(arguments[i]->src_loc, cloner.locals[i + 1],
+                                                 arguments[i], object.scope));
+    }
+    auto copy = cloner.clone(*ir, body);
+    auto end = ir->alloc<IR_Label>(block->end()->src_loc, block->end()->name() + ".inl");
+    auto jumps = cloner.lower_returns(copy, end);
+    nodes.insert(nodes.end(), copy.begin(), copy.end());
+    if (jumps)
+    {
+        nodes.push_back(end);
+    }
+}
+
+void IR_Scalar_Replace::replace_allocation(Object &object, IR_Assignment &n)
+{
+    auto alloc = static_cast<IR_Allocate_Object*>(n.rhs);
+    std::vector<IR_Node*> nodes;
+    copy_constructor(object, alloc->for_type->init()->code_function(), {}, nodes);
+    if (!alloc->which_ctor->is_the_default_ctor())
+    {
+        copy_constructor(object, alloc->which_ctor->code_function(), alloc->args, nodes);
+    }
+    replace(ir->alloc<IR_Block>(n.src_loc, nodes, ir->types->get_void()));
+}
@@ -0,0 +1,250 @@
+#ifndef MALANG_IR_PASSES_HPP
+#define MALANG_IR_PASSES_HPP
+
+#include <map>
+#include <tuple>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "ir_pass.hpp"
+#include "symbol_scope.hpp"
+
+// Splices blocks that are statements into the list they're in so the passes after it see
+// straight lists of statements, the code generated for them is the same.
+struct IR_Flatten_Blocks : IR_Pass
+{
+    virtual const char *name() const override { return "flatten-blocks"; }
+    virtual bool run(Malang_IR &ir) override;
+    virtual void visit(struct IR_Block &n) override;
+    virtual void visit(struct IR_Named_Block &n) override;
+
+private:
+    void flatten(std::vector<IR_Node*> &nodes);
+};
+
+// Substitutes the bodies of small code functions and methods that aren't recursive for the
+// calls to them. The callee's locals get slots of their own at the end of the caller's frame,
+// or globals at the top level, the arguments are stored into them in the order they were
+// pushed and each return becomes a jump to the end of the inlined block with its value left
+// on the stack. Calls in the inlined bodies are inlined in turn up to `max_depth' deep.
+struct IR_Inline : IR_Pass
+{
+    // `max_size' is how many nodes a body may have to be inlined.
+    IR_Inline(size_t max_size, int max_depth)
+        : max_size(max_size)
+        , max_depth(max_depth)
+        {}
+    virtual const char *name() const override { return "inline"; }
+    virtual bool run(Malang_IR &ir) override;
+
+    virtual void visit(struct IR_Named_Block &n) override;
+    virtual void visit(struct IR_Call &n) override;
+    virtual void visit(struct IR_Call_Method &n) override;
+
+    size_t max_size;
+    int max_depth;
+
+private:
+    // A function whose body is being walked, the inlined calls in it get their slots here.
+    struct Frame
+    {
+        struct IR_Named_Block *fn;
+        struct IR_Allocate_Locals *alloc_locals;
+        size_t num_locals;
+    };
+    std::vector<Frame> m_frames;
+    size_t m_next_global = 0;
+    int m_depth = 0;
+    void inline_call(struct IR_Value &call, struct IR_Label *callee, bool is_method,
+                     struct IR_Value *self, const std::vector<struct IR_Value*> &arguments);
+};
+
+// Replaces the objects that never leave the function, or the top level, they're allocated in
+// with a variable for each of their fields. That's an object allocated in one place whose
+// variables are only ever assigned it and only used to get at its fields; its init and
+// constructor are copied in place of the allocation. If that's in a loop, the variables it's
+// copied to must be used only in the block they're copied to at the start of, which is how an
+// inlined method sees its self.
+struct IR_Scalar_Replace : IR_Pass
+{
+    struct Object;
+    virtual const char *name() const override { return "scalar-replace"; }
+    virtual bool run(Malang_IR &ir) override;
+
+    virtual void visit(struct IR_Named_Block &n) override;
+    virtual void visit(struct IR_Assignment &n) override;
+    virtual void visit(struct IR_Member_Access &n) override;
+
+private:
+    // The variables holding each object, by where they're declared.
+    std::map<std::tuple<IR_Node*, Symbol_Scope, size_t>, Object*> m_objects;
+    std::vector<Object*> m_owned;
+    std::vector<struct IR_Named_Block*> m_frames;
+    size_t m_next_global = 0;
+    Object *object_of(struct IR_Value *v) const;
+    size_t new_slot(Object &object);
+    void copy_constructor(Object &object, struct IR_Label *fn,
+                          const std::vector<struct IR_Value*> &arguments, std::vector<IR_Node*> &nodes);
+    void replace_allocation(Object &object, struct IR_Assignment &n);
+};
+
+// Evaluates the operations on int, char, double and bool constants the same way the VM would,
+// replaces the uses of readonly variables that are only ever assigned a constant with it, and
+// turns branches on constant conditions into jumps or nothing. Whatever the VM would trap on,
+// dividing by zero or shifting by more than 31, is left for the VM to do.
+struct IR_Constant_Fold : IR_Pass
+{
+    enum class Op;
+    virtual const char *name() const override { return "constant-fold"; }
+    virtual bool run(Malang_IR &ir) override;
+
+    virtual void visit(struct IR_Assign_Top &n) override;
+    virtual void visit(struct IR_Block &n) override;
+    virtual void visit(struct IR_Symbol &n) override;
+    virtual void visit(struct IR_Named_Block &n) override;
+    virtual void visit(struct IR_Assignment &n) override;
+
+    virtual void visit(struct IR_B_Add &n) override;
+    virtual void visit(struct IR_B_Subtract &n) override;
+    virtual void visit(struct IR_B_Multiply &n) override;
+    virtual void visit(struct IR_B_Divide &n) override;
+    virtual void visit(struct IR_B_Modulo &n) override;
+    virtual void visit(struct IR_B_And &n) override;
+    virtual void visit(struct IR_B_Or &n) override;
+    virtual void visit(struct IR_B_Xor &n) override;
+    virtual void visit(struct IR_B_Left_Shift &n) override;
+    virtual void visit(struct IR_B_Right_Shift &n) override;
+    virtual void visit(struct IR_B_Less_Than &n) override;
+    virtual void visit(struct IR_B_Less_Than_Equals &n) override;
+    virtual void visit(struct IR_B_Greater_Than &n) override;
+    virtual void visit(struct IR_B_Greater_Than_Equals &n) override;
+    virtual void visit(struct IR_B_Equals &n) override;
+    virtual void visit(struct IR_B_Not_Equals &n) override;
+
+    virtual void visit(struct IR_U_Invert &n) override;
+    virtual void visit(struct IR_U_Negate &n) override;
+    virtual void visit(struct IR_U_Positive &n) override;
+
+private:
+    // The readonly variables and the constant each is assigned.
+    std::unordered_map<struct IR_Symbol*, struct IR_Value*> m_constants;
+    void fold(struct IR_Binary_Operation &n, Op op);
+    void fold(struct IR_Unary_Operation &n, Op op);
+    void fold_branches(std::vector<IR_Node*> &nodes);
+};
+
+// Takes out the functions that can't be called: those the top level doesn't call, take the
+// address of or use as a method, init or constructor, or the functions it calls don't,
+// and so on. And the statements after a return or a jump that nothing can jump to, and the
+// jumps to where they'd go anyway.
+struct IR_Dead_Code : IR_Pass
+{
+    virtual const char *name() const override { return "dead-code"; }
+    virtual bool run(Malang_IR &ir) override;
+
+    virtual void visit(struct IR_Block &n) override;
+    virtual void visit(struct IR_Named_Block &n) override;
+
+private:
+    std::unordered_set<struct IR_Named_Block*> m_reached;
+    std::unordered_set<struct IR_Label*> m_targets;
+    bool sweep(std::vector<IR_Node*> &nodes);
+};
+
+// Moves what a while loop works out the same way every time around to just before it, into a
+// new variable that the loop reads instead: the int and double arithmetic that can't trap on
+// the variables it doesn't assign, the lengths of arrays, buffers and strings, and the fields
+// it reads if nothing in it can store to a field. Then the multiplies of a variable that the
+// loop only adds a constant to, by a constant or an invariant, get a variable of their own
+// that's added to right after it is, if there's more than one of them.
+struct IR_Loop_Invariants : IR_Pass
+{
+    struct Loop;
+    virtual const char *name() const override { return "loop-invariants"; }
+    virtual bool run(Malang_IR &ir) override;
+
+    virtual void visit(struct IR_Block &n) override;
+    virtual void visit(struct IR_Named_Block &n) override;
+
+private:
+    std::vector<struct IR_Named_Block*> m_frames;
+    size_t m_next_global = 0;
+    // A new variable in the innermost function or a global, nullptr if it can't have one.
+    struct IR_Symbol *new_variable(const Source_Location &src_loc, struct Type_Info *type);
+    void loops(std::vector<IR_Node*> &nodes);
+    std::vector<IR_Node*> hoist(IR_Node *&cond, struct IR_Named_Block &body);
+};
+
+// Clears the bounds check of the array and buffer indexes that are proven to be in bounds. It
+// follows what's known about the int variables of each function, and of the top level, from the
+// start of it to the end: that one is never negative, is less than or at most the length of an
+// array, is the length of one or is one more than another, and what it is if it's a constant,
+// and which arrays are at least how long. Those come from assignments and from the conditions of
+// branches, and an assignment to a variable forgets everything about it. Where jumps meet only
+// what's known on every way there is kept, loops are walked again until what's known at their
+// start holds at the jumps back to it too.
+struct IR_Bounds_Check : IR_Pass
+{
+    struct Facts;
+    virtual const char *name() const override { return "bounds-check"; }
+    virtual bool run(Malang_IR &ir) override;
+
+    virtual void visit(struct IR_Assign_Top &n) override;
+    virtual void visit(struct IR_Block &n) override;
+    virtual void visit(struct IR_Indexable &n) override;
+    virtual void visit(struct IR_Call &n) override;
+    virtual void visit(struct IR_Call_Method &n) override;
+    virtual void visit(struct IR_Return &n) override;
+    virtual void visit(struct IR_Label &n) override;
+    virtual void visit(struct IR_Named_Block &n) override;
+    virtual void visit(struct IR_Branch &n) override;
+    virtual void visit(struct IR_Pop_Branch_If_True &n) override;
+    virtual void visit(struct IR_Pop_Branch_If_False &n) override;
+    virtual void visit(struct IR_Branch_If_True_Or_Pop &n) override;
+    virtual void visit(struct IR_Branch_If_False_Or_Pop &n) override;
+    virtual void visit(struct IR_Assignment &n) override;
+    virtual void visit(struct IR_Allocate_Object &n) override;
+    virtual void visit(struct IR_Deallocate_Object &n) override;
+
+private:
+    Facts *m_facts = nullptr;
+    // What's known where the jumps forward to a label come from, and back to it.
+    std::unordered_map<struct IR_Label*, Facts*> m_jumps;
+    std::unordered_map<struct IR_Label*, Facts*> m_jumps_back;
+    // What's known at each label that's been passed, and what was known at the jumps back to
+    // it last time around.
+    std::unordered_map<struct IR_Label*, Facts*> m_at;
+    std::unordered_map<struct IR_Label*, Facts*> m_assumed;
+    // The node before the one being walked in its list, the condition of a branch.
+    IR_Node *m_before = nullptr;
+    bool m_give_up = false;
+    std::vector<struct IR_Indexable*> m_proven;
+    std::vector<struct IR_Named_Block*> m_functions;
+    std::vector<Facts*> m_owned;
+
+    Facts *make(const Facts *from = nullptr);
+    void frame(std::vector<IR_Node*> &body);
+    void walk_list(std::vector<IR_Node*> &nodes);
+    void jump(struct IR_Label *to, const Facts &facts);
+    // Jumps where the condition before `n' is `when', and goes on where it isn't.
+    void branch(struct IR_Branch &n, bool when);
+};
+
+// Lets the variables of a function that are never live at the same time share a local slot and
+// shrinks its frame to the slots that are left. The arguments keep theirs and the rest go to the
+// lowest slot free, the most used first, counting the uses in loops more, so those are the ones
+// with the short forms of the local instructions. The slots that are dead from the start of each
+// statement on are kept in Malang_IR::dead_locals for the calls made in it, the GC doesn't mark
+// them in the frames waiting on those calls.
+struct IR_Pack_Locals : IR_Pass
+{
+    virtual const char *name() const override { return "pack-locals"; }
+    virtual bool run(Malang_IR &ir) override;
+
+    virtual void visit(struct IR_Named_Block &n) override;
+
+private:
+    bool pack(std::vector<IR_Node*> &body, struct IR_Allocate_Locals &alloc_locals);
+};
+
+#endif /* MALANG_IR_PASSES_HPP */
@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
 #include <string>
 #include <sstream>
 #include <streambuf>
@@ -8,15 +11,21 @@
 
 #include "system_args.hpp"
 #include "parser.hpp"
+#include "module_cache.hpp"
+#include "embedded_modules.hpp"
 #include "visitors/ast_pretty_printer.hpp"
 #include "platform/dir.hpp"
 #include "vm/vm.hpp"
 #include "vm/runtime.hpp"
+#include "vm/op_profile.hpp"
+#include "vm/sampler.hpp"
+#include "vm/image.hpp"
 #include "codegen/codegen.hpp"
 #include "codegen/disassm.hpp"
 #include "codegen/ir_to_code.hpp"
 #include "ir/ast_to_ir.hpp"
 #include "ir/scope_lookup.hpp"
+#include "ir/pass_manager.hpp"
 
 struct Parse_Test
 {
@@ -478,6 +487,74 @@ void parse_tests()
     printf(" %d/%d\n", total_run-errors, total_run);
 }
 
+// Runs `code' to the end, with the profiling `args' asks for.
+static void run_program(Args *args, Type_Map &types, const std::vector<Native_Code> &natives,
+                        const std::vector<String_Constant> &string_constants, byte *code, size_t code_size,
+                        const Debug_Info &debug_info, const Dead_Locals &dead_locals)
+{
+    Malang_VM vm{args, &types, natives, string_constants, 500, 100000};
+    vm.load_code(code, code_size, &debug_info, &dead_locals);
+    Malang_Sampler *sampler = nullptr;
+    if (vm.use_sampler)
+    {
+        sampler = new Malang_Sampler{&vm, &debug_info};
+        if (!sampler->start())
+        {
+            printf("couldn't start the profiler\n");
+        }
+    }
+    vm.run();
+    if (sampler)
+    {
+        sampler->stop();
+        if (!sampler->write_folded(args->profile_file.c_str()))
+        {
+            printf("couldn't write the profile to `%s'\n", args->profile_file.c_str());
+        }
+        else if (sampler->num_dropped)
+        {
+            printf("the profile is missing the last %zu samples, there were too many\n",
+                   sampler->num_dropped);
+        }
+        delete sampler;
+    }
+    if (vm.op_profile && args->profile_ops_file.empty())
+    {
+        vm.op_profile->print();
+    }
+    else if (vm.op_profile && !vm.op_profile->write_json(args->profile_ops_file.c_str()))
+    {
+        printf("couldn't write the op profile to `%s'\n", args->profile_ops_file.c_str());
+    }
+    if (args->noisy)
+    {
+        printf("code ran successfully.\n");
+        if (vm.jit)
+        {
+            printf("JIT compiled %zu functions, %zu were left to the interpreter.\n",
+                   vm.jit->num_compiled, vm.jit->num_failed);
+        }
+        vm.stack_trace();
+    }
+}
+
+// Where `mal --compile' writes the image of args->filename.
+static std::string image_path(const Args *args)
+{
+    if (!args->output_file.empty())
+    {
+        return args->output_file;
+    }
+    auto path = args->filename;
+    auto dot = path.find_last_of('.');
+    auto slash = path.find_last_of('/');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+    {
+        path.erase(dot);
+    }
+    return path + ".mbc";
+}
+
 int parse_to_code(Args *args)
 {
     int res = 0;
@@ -488,7 +565,8 @@ int parse_to_code(Args *args)
     Scope_Lookup global_scope{&ir};
     Module_Map modules{&ir};
     // Search order:
-    //  0. Relative to source file containing the import
+    //  0. Relative to source file containing the import,
+    //     then the modules built into mal
     //  1. Relative to CWD
     //  2. Relative to mal_exe
     //  3. Relative to mal_exe/lib
@@ -498,7 +576,12 @@ int parse_to_code(Args *args)
     modules.add_search_directory(plat::get_cwd());
     modules.add_search_directory(exe_dir);
     modules.add_search_directory(exe_dir + "/lib");
-    
+    Module_Cache module_cache{Module_Cache::default_dir()};
+    if (args->module_cache)
+    {
+        modules.use_cache(&module_cache);
+    }
+
     Malang_Runtime::init_types(global_scope.current().bound_functions(), types);
     Malang_Runtime::init_builtins(global_scope.current().bound_functions(), types);
     Malang_Runtime::init_modules(global_scope.current().bound_functions(), types, modules);
@@ -533,24 +616,53 @@ int parse_to_code(Args *args)
         Ast_To_IR ast_to_ir;
         ast_to_ir.is_noisy(args->noisy);
         ast_to_ir.convert(ast, &ir, &modules, &global_scope, &string_constants);
+        IR_Pass_Manager passes{args->opt_level};
+        passes.run(ir);
+        if (args->noisy)
+        {
+            passes.print_stats(stdout);
+            printf("\n");
+        }
+        else if (args->pass_stats)
+        {
+            passes.print_stats(stderr);
+        }
         IR_To_Code ir_to_code;
         auto cg = ir_to_code.convert(ir);
         if (args->noisy)
         {
             auto disassembly = Disassembler::dis(cg->code);
             printf("Generated bytecode disassembly:\n%s\n", disassembly.c_str());
+            printf("Superinstructions fused by the peephole:\n");
+            for (size_t i = 0; i < static_cast<size_t>(Instruction::INSTRUCTION_ENUM_SIZE); ++i)
+            {
+                if (cg->num_fused[i])
+                {
+                    printf("%8zu  %s\n", cg->num_fused[i], to_string(static_cast<Instruction>(i)).c_str());
+                }
+            }
+            printf("Debug info: %zu functions, %zu byte line table for %zu bytes of code.\n",
+                   cg->debug_info.functions.size(), cg->debug_info.line_table.size(), cg->code.size());
+            printf("\n");
         }
-        Malang_VM vm{args,
-                     &types,
-                     global_scope.current().bound_functions().natives(),
-                     string_constants,
-                     500, 100000};
-        vm.load_code(cg->code);
-        vm.run();
-        if (args->noisy)
+        if (args->compile)
+        {
+            Malang_Image image;
+            image.code = cg->code.data();
+            image.code_size = cg->code.size();
+            image.string_constants = std::move(string_constants);
+            image.debug_info = std::move(cg->debug_info);
+            image.dead_locals = std::move(cg->dead_locals);
+            image.native_names = global_scope.current().bound_functions().native_names();
+            if (!image.write(image_path(args), types))
+            {
+                res = -1;
+            }
+        }
+        else
         {
-            printf("code ran successfully.\n");
-            vm.stack_trace();
+            run_program(args, types, global_scope.current().bound_functions().natives(), string_constants,
+                        cg->code.data(), cg->code.size(), cg->debug_info, cg->dead_locals);
         }
         delete cg;
     }
@@ -558,6 +670,140 @@ int parse_to_code(Args *args)
     return res;
 }
 
+// Runs an image made by `mal --compile', which only needs the runtime and not the front end.
+int run_image(Args *args)
+{
+    Type_Map types;
+    Malang_IR ir{&types};
+    Scope_Lookup global_scope{&ir};
+    Module_Map modules{&ir};
+    auto &&bound_functions = global_scope.current().bound_functions();
+    Malang_Runtime::init_types(bound_functions, types);
+    Malang_Runtime::init_builtins(bound_functions, types);
+    Malang_Runtime::init_modules(bound_functions, types, modules);
+
+    Malang_Image image;
+    std::vector<Native_Code> natives;
+    if (!image.read(args->filename, types, bound_functions, natives))
+    {
+        return -1;
+    }
+    if (args->noisy)
+    {
+        auto disassembly = Disassembler::dis({image.code, image.code + image.code_size});
+        printf("Loaded bytecode disassembly:\n%s\n", disassembly.c_str());
+    }
+    run_program(args, types, natives, image.string_constants, image.code, image.code_size,
+                image.debug_info, image.dead_locals);
+    return 0;
+}
+
+// Writes the modules at `paths' to args->output_file as the C++ that builds them into mal, each
+// named after its file, see `mal --embed'.
+int embed_modules(Args *args, const std::vector<std::string> &paths)
+{
+    std::vector<std::string> names(paths.size());
+    std::vector<std::string> sources(paths.size());
+    std::vector<std::vector<uint8_t>> parsed(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        auto &&path = paths[i];
+        auto slash = path.find_last_of('/');
+        auto name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+        if (name.size() <= 3 || name.compare(name.size() - 3, 3, ".ma") != 0)
+        {
+            printf("`%s' isn't a module, they end in .ma\n", path.c_str());
+            return -1;
+        }
+        name.erase(name.size() - 3);
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (names[j] == name)
+            {
+                printf("`%s' and `%s' would both be module `%s'\n",
+                       paths[j].c_str(), path.c_str(), name.c_str());
+                return -1;
+            }
+        }
+        names[i] = name;
+
+        Source_Code src{path};
+        if (!src.good())
+        {
+            printf("couldn't read `%s'\n", path.c_str());
+            return -1;
+        }
+        Type_Map types;
+        Malang_IR ir{&types};
+        Scope_Lookup global_scope{&ir};
+        Module_Map modules{&ir};
+        Malang_Runtime::init_types(global_scope.current().bound_functions(), types);
+        Malang_Runtime::init_builtins(global_scope.current().bound_functions(), types);
+        Malang_Runtime::init_modules(global_scope.current().bound_functions(), types, modules);
+        auto module = modules.get({name});
+        types.module(module);
+
+        // parsed the way Module_Map::parse does for the cache
+        std::vector<Type_Request> requests;
+        types.requests = &requests;
+        Parser parser(&types, &modules);
+        auto ast = parser.parse(&src);
+        types.requests = nullptr;
+        if (parser.errors)
+        {
+            printf("there were parsing errors in `%s'...\n", path.c_str());
+            return -1;
+        }
+        if (!Module_Cache::encode(src, *module, requests, ast, parsed[i]))
+        {
+            printf("`%s' uses types that aren't its own or builtin, it can't be built into mal.\n",
+                   path.c_str());
+            return -1;
+        }
+        sources[i] = src.code();
+    }
+
+    std::vector<Embedded_Module> embedded;
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        embedded.push_back({names[i], paths[i], sources[i].data(), sources[i].size(),
+                            parsed[i].data(), parsed[i].size()});
+    }
+    return write_embedded_modules(args->output_file, embedded) ? 0 : -1;
+}
+
+// No stack can be this big, there isn't the address space to reserve it. Keeping sizes below it
+// also keeps working out a stack's bytes from them from overflowing.
+static constexpr size_t max_stack_bytes = size_t(1) << 46;
+
+// Parses the N of `--flag=N' where N may end in k or m, for the stack sizes. N counts entries of
+// `entry_size' bytes each, which all have to fit in max_stack_bytes.
+static bool parse_size_flag(const std::string &arg, const char *flag, size_t entry_size, size_t &out)
+{
+    auto prefix = std::string(flag) + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0)
+    {
+        return false;
+    }
+    auto n = arg.c_str() + prefix.size();
+    char *end;
+    errno = 0;
+    auto size = strtoull(n, &end, 10);
+    auto shift = 0;
+    switch (*end)
+    {
+        case 'k': case 'K': shift = 10; ++end; break;
+        case 'm': case 'M': shift = 20; ++end; break;
+    }
+    auto max = max_stack_bytes / entry_size;
+    if (!isdigit(*n) || *end != '\0' || errno == ERANGE || size == 0 || size > (max >> shift))
+    {
+        printf("%s expects a size from 1 to %zu like 4096, 64k or 1m, got `%s'\n", flag, max, n);
+        exit(-1);
+    }
+    out = size << shift;
+    return true;
+}
 
 int main(int argc, char **argv)
 {
@@ -570,6 +816,7 @@ int main(int argc, char **argv)
     }
 
     Args args;
+    std::vector<std::string> inputs;
     for (int i = 0; i < argc; ++i)
     {
         std::string arg(argv[i]);
@@ -577,13 +824,96 @@ int main(int argc, char **argv)
         {
             args.noisy = false;
         }
+        else if (arg == "--threaded")
+        {
+            args.threaded_code = true;
+        }
+        else if (arg == "--jit")
+        {
+            args.jit = true;
+        }
+        else if (arg == "-O0" || arg == "-O1" || arg == "-O2")
+        {
+            args.opt_level = arg[2] - '0';
+        }
+        else if (arg == "--compile")
+        {
+            args.compile = true;
+        }
+        else if (arg == "--embed")
+        {
+            args.embed = true;
+        }
+        else if (arg == "-o")
+        {
+            if (i + 1 == argc)
+            {
+                printf("-o expects the file to write to\n");
+                return -1;
+            }
+            args.output_file = argv[++i];
+        }
+        else if (arg == "--no-module-cache")
+        {
+            args.module_cache = false;
+        }
+        else if (arg == "--pass-stats")
+        {
+            args.pass_stats = true;
+        }
+        else if (arg == "--profile-ops")
+        {
+            args.profile_ops = true;
+        }
+        else if (arg.compare(0, 14, "--profile-ops=") == 0)
+        {
+            args.profile_ops = true;
+            args.profile_ops_file = arg.substr(14);
+        }
+        else if (arg.compare(0, 10, "--profile=") == 0)
+        {
+            args.profile_file = arg.substr(10);
+        }
+        else if (parse_size_flag(arg, "--call-depth", Malang_JIT::stack_per_call, args.max_call_depth) ||
+                 parse_size_flag(arg, "--data-stack", sizeof(Malang_Value), args.data_stack_size) ||
+                 parse_size_flag(arg, "--globals", sizeof(Malang_Value), args.globals_size))
+        {
+        }
         else
         {
             args.filename = arg;
+            inputs.push_back(arg);
         }
     }
 
-    
+    if (args.profile_ops && !args.profile_file.empty())
+    {
+        printf("--profile-ops and --profile can't be used together.\n");
+        return -1;
+    }
+    if (!args.output_file.empty() && !args.compile && !args.embed)
+    {
+        printf("-o is only for --compile and --embed.\n");
+        return -1;
+    }
+    if (args.embed)
+    {
+        if (args.compile || args.output_file.empty() || inputs.empty())
+        {
+            printf("--embed expects -o and the modules to write to it.\n");
+            return -1;
+        }
+        return embed_modules(&args, inputs);
+    }
+    if (!args.filename.empty() && Malang_Image::is_image(args.filename))
+    {
+        if (args.compile)
+        {
+            printf("`%s' is already compiled.\n", args.filename.c_str());
+            return -1;
+        }
+        return run_image(&args);
+    }
     if (!args.filename.empty())
     {
         return parse_to_code(&args);
@@ -0,0 +1,953 @@
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <unordered_map>
+#include "module_cache.hpp"
+#include "module_map.hpp"
+#include "type_map.hpp"
+#include "source_code.hpp"
+#include "defer.hpp"
+#include "ast/nodes.hpp"
+#include "platform/dir.hpp"
+#include "platform/map_file.hpp"
+
+// A cached module is the header, then the names of the builtin types it uses, then what its parse
+// asked Type_Map for and then its AST, see Cache_Writer. Everything is in the byte order of the
+// machine that wrote it.
+static const char cache_magic[4] = {'\x7f', 'M', 'M', 'C'};
+
+struct Cache_Header
+{
+    char magic[4];
+    uint32_t version;
+    // of the source it was parsed from, to tell it from another with the same hash
+    uint64_t source_size;
+    uint64_t source_hash;
+    // of everything after the header, so one that's been damaged isn't loaded
+    uint64_t hash;
+};
+
+enum class Cache_Request : uint8_t
+{
+    Named,
+    Function,
+    Array,
+};
+
+enum class Cache_Node : uint8_t
+{
+    None,
+    Import,
+    Variable,
+    Assign,
+    Decl,
+    Fn,
+    List,
+    Integer,
+    Real,
+    String,
+    Boolean,
+    Character,
+    Logical_Or,
+    Logical_And,
+    Inclusive_Or,
+    Exclusive_Or,
+    And,
+    Equals,
+    Not_Equals,
+    Less_Than,
+    Less_Than_Equals,
+    Greater_Than,
+    Greater_Than_Equals,
+    Left_Shift,
+    Right_Shift,
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Modulo,
+    Call,
+    Index,
+    Member_Accessor,
+    Negate,
+    Positive,
+    Not,
+    Invert,
+    Constructor,
+    Type_Def,
+    Type_Alias,
+    Unalias,
+    Extend,
+    Type,
+    Decl_Assign,
+    Return,
+    Break,
+    Continue,
+    While,
+    For,
+    If_Else,
+    Array_Literal,
+    New_Array,
+};
+
+static uint64_t fnv1a(const void *data, size_t size)
+{
+    auto p = static_cast<const uint8_t*>(data);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= p[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Writes the AST as each node's kind and where it is in the source followed by its fields. A type
+// is written as a reference to the first request that got it, or to a builtin type by name.
+// Those are 0 for none, n for the nth request and -n for the nth builtin.
+struct Cache_Writer : Ast_Visitor
+{
+    std::vector<uint8_t> out;
+    std::vector<std::string> builtins;
+    // Cleared if the module can't be cached.
+    bool ok = true;
+
+    template<typename T>
+    void put(T value)
+    {
+        auto p = reinterpret_cast<const uint8_t*>(&value);
+        out.insert(out.end(), p, p + sizeof(value));
+    }
+    void put(const std::string &s)
+    {
+        put<uint32_t>(s.size());
+        out.insert(out.end(), s.begin(), s.end());
+    }
+    void put_type(Type_Info *type)
+    {
+        if (!type)
+        {
+            put<int32_t>(0);
+            return;
+        }
+        auto it = m_refs.find(type);
+        if (it == m_refs.end())
+        {
+            if (!type->is_builtin())
+            {   // the parser didn't get it in this module, it's from the program importing it
+                ok = false;
+                put<int32_t>(0);
+                return;
+            }
+            builtins.push_back(type->name());
+            it = m_refs.emplace(type, -static_cast<int32_t>(builtins.size())).first;
+        }
+        put<int32_t>(it->second);
+    }
+    void put_requests(Module &module, const std::vector<Type_Request> &requests)
+    {
+        auto own = module.fully_qualified_name() + "::";
+        std::unordered_map<Type_Info*, std::string> names;
+        put<uint32_t>(requests.size());
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            auto &&r = requests[i];
+            if (!r.name.empty())
+            {   // Another program could have another type by the name of one that isn't the
+                // module's own, and the same for one it asked for by two names.
+                auto &&first_name = names.emplace(r.type, r.name).first->second;
+                if (first_name != r.name
+                    || (!r.type->is_builtin() && r.type->name().compare(0, own.size(), own) != 0))
+                {
+                    ok = false;
+                }
+                put(Cache_Request::Named);
+                put(r.name);
+            }
+            else if (auto fn = dynamic_cast<Function_Type_Info*>(r.type))
+            {
+                put(Cache_Request::Function);
+                put<uint8_t>(fn->is_native());
+                put_type(fn->return_type());
+                put<uint32_t>(fn->parameter_types().size());
+                for (auto &&p : fn->parameter_types())
+                {
+                    put_type(p);
+                }
+            }
+            else
+            {
+                auto arr = dynamic_cast<Array_Type_Info*>(r.type);
+                assert(arr);
+                put(Cache_Request::Array);
+                put_type(arr->of_type());
+            }
+            m_refs.emplace(r.type, static_cast<int32_t>(i + 1));
+        }
+    }
+    void put_node(Ast_Node *n)
+    {
+        if (n)
+        {
+            n->accept(*this);
+        }
+        else
+        {
+            put(Cache_Node::None);
+        }
+    }
+    template<typename T>
+    void put_nodes(const std::vector<T*> &nodes)
+    {
+        put<uint32_t>(nodes.size());
+        for (auto &&n : nodes)
+        {
+            put_node(n);
+        }
+    }
+
+    virtual void visit(Import_Node &n) override
+    {
+        begin(Cache_Node::Import, n);
+        std::vector<std::string> name;
+        for (auto m = n.mod_info; m; m = m->parent())
+        {
+            name.insert(name.begin(), m->name());
+        }
+        put<uint32_t>(name.size());
+        for (auto &&s : name)
+        {
+            put(s);
+        }
+    }
+    virtual void visit(Variable_Node &n) override
+    {
+        begin(Cache_Node::Variable, n);
+        put(n.local_name());
+        put<uint32_t>(n.qualifiers().size());
+        for (auto &&q : n.qualifiers())
+        {
+            put(q);
+        }
+    }
+    virtual void visit(Assign_Node &n) override
+    {
+        begin(Cache_Node::Assign, n);
+        put_node(n.lhs);
+        put_node(n.rhs);
+    }
+    virtual void visit(Decl_Node &n) override
+    {
+        begin(Cache_Node::Decl, n);
+        put<uint8_t>(n.is_readonly);
+        put<uint8_t>(n.is_private);
+        put(n.variable_name);
+        put_node(n.type);
+    }
+    virtual void visit(Fn_Node &n) override
+    {
+        begin(Cache_Node::Fn, n);
+        put(n.bound_name);
+        put_nodes(n.params);
+        put_node(n.return_type);
+        put_nodes(n.body);
+        put_type(n.fn_type);
+    }
+    virtual void visit(List_Node &n) override
+    {
+        begin(Cache_Node::List, n);
+        put_nodes(n.contents);
+    }
+
+#define VALUE(class_name, kind, value_type)             \
+    virtual void visit(class_name &n) override          \
+    {                                                   \
+        begin(Cache_Node::kind, n);                     \
+        put(static_cast<value_type>(n.value));          \
+        put_type(n.type);                               \
+    }
+
+    VALUE(Integer_Node, Integer, int64_t)
+    VALUE(Real_Node, Real, double)
+    VALUE(String_Node, String, std::string)
+    VALUE(Boolean_Node, Boolean, uint8_t)
+    VALUE(Character_Node, Character, char)
+#undef VALUE
+
+#define BINARY(class_name, kind)                        \
+    virtual void visit(class_name &n) override          \
+    {                                                   \
+        begin(Cache_Node::kind, n);                     \
+        put_node(n.lhs);                                \
+        put_node(n.rhs);                                \
+    }
+
+    BINARY(Logical_Or_Node, Logical_Or)
+    BINARY(Logical_And_Node, Logical_And)
+    BINARY(Inclusive_Or_Node, Inclusive_Or)
+    BINARY(Exclusive_Or_Node, Exclusive_Or)
+    BINARY(And_Node, And)
+    BINARY(Equals_Node, Equals)
+    BINARY(Not_Equals_Node, Not_Equals)
+    BINARY(Less_Than_Node, Less_Than)
+    BINARY(Less_Than_Equals_Node, Less_Than_Equals)
+    BINARY(Greater_Than_Node, Greater_Than)
+    BINARY(Greater_Than_Equals_Node, Greater_Than_Equals)
+    BINARY(Left_Shift_Node, Left_Shift)
+    BINARY(Right_Shift_Node, Right_Shift)
+    BINARY(Add_Node, Add)
+    BINARY(Subtract_Node, Subtract)
+    BINARY(Multiply_Node, Multiply)
+    BINARY(Divide_Node, Divide)
+    BINARY(Modulo_Node, Modulo)
+#undef BINARY
+
+#define PREFIX(class_name, kind)                        \
+    virtual void visit(class_name &n) override          \
+    {                                                   \
+        begin(Cache_Node::kind, n);                     \
+        put_node(n.operand);                            \
+    }
+
+    PREFIX(Negate_Node, Negate)
+    PREFIX(Positive_Node, Positive)
+    PREFIX(Not_Node, Not)
+    PREFIX(Invert_Node, Invert)
+#undef PREFIX
+
+    virtual void visit(Call_Node &n) override
+    {
+        begin(Cache_Node::Call, n);
+        put_node(n.callee);
+        put_node(n.args);
+    }
+    virtual void visit(Index_Node &n) override
+    {
+        begin(Cache_Node::Index, n);
+        put_node(n.thing);
+        put_node(n.subscript);
+    }
+    virtual void visit(Member_Accessor_Node &n) override
+    {
+        begin(Cache_Node::Member_Accessor, n);
+        put_node(n.thing);
+        put_node(n.member);
+    }
+    virtual void visit(Constructor_Node &n) override
+    {
+        begin(Cache_Node::Constructor, n);
+        put_nodes(n.params);
+        put_nodes(n.body);
+        put_type(n.fn_type);
+    }
+    virtual void visit(Type_Def_Node &n) override
+    {
+        begin(Cache_Node::Type_Def, n);
+        put_type(n.type);
+        put_nodes(n.constructors);
+        put_nodes(n.fields);
+        put_nodes(n.methods);
+    }
+    virtual void visit(Type_Alias_Node &n) override
+    {   // what it's aliased to was set by the parser, it's set again when it's loaded
+        begin(Cache_Node::Type_Alias, n);
+        put_type(n.alias);
+        put_type(n.alias->aliased_to());
+    }
+    virtual void visit(Unalias_Node &n) override
+    {
+        begin(Cache_Node::Unalias, n);
+        put_node(n.value);
+    }
+    virtual void visit(Extend_Node &n) override
+    {
+        begin(Cache_Node::Extend, n);
+        put_node(n.for_type);
+        put_nodes(n.body);
+    }
+    virtual void visit(Type_Node &n) override
+    {
+        begin(Cache_Node::Type, n);
+        put_type(n.type);
+    }
+    virtual void visit(Decl_Assign_Node &n) override
+    {
+        begin(Cache_Node::Decl_Assign, n);
+        put_node(n.decl);
+        put_node(n.value);
+    }
+    virtual void visit(Return_Node &n) override
+    {
+        begin(Cache_Node::Return, n);
+        put_node(n.values);
+    }
+    virtual void visit(Break_Node &n) override
+    {
+        begin(Cache_Node::Break, n);
+        put_node(n.values);
+    }
+    virtual void visit(Continue_Node &n) override
+    {
+        begin(Cache_Node::Continue, n);
+    }
+    virtual void visit(While_Node &n) override
+    {
+        begin(Cache_Node::While, n);
+        put_node(n.condition);
+        put_nodes(n.body);
+    }
+    virtual void visit(For_Node &n) override
+    {
+        begin(Cache_Node::For, n);
+        put(n.it);
+        put_node(n.iterable);
+        put_nodes(n.body);
+    }
+    virtual void visit(If_Else_Node &n) override
+    {
+        begin(Cache_Node::If_Else, n);
+        put_node(n.condition);
+        put_nodes(n.consequence);
+        put_nodes(n.alternative);
+        put_type(n.void_type);
+    }
+    virtual void visit(Array_Literal_Node &n) override
+    {
+        begin(Cache_Node::Array_Literal, n);
+        put_node(n.values);
+    }
+    virtual void visit(New_Array_Node &n) override
+    {
+        begin(Cache_Node::New_Array, n);
+        put_type(n.array_type);
+        put_node(n.of_type);
+        put_node(n.size);
+    }
+
+private:
+    std::unordered_map<Type_Info*, int32_t> m_refs;
+
+    void begin(Cache_Node kind, Ast_Node &n)
+    {
+        put(kind);
+        put<int32_t>(n.src_loc.line_no);
+        put<int32_t>(n.src_loc.char_no);
+    }
+};
+
+// Reads what Cache_Writer wrote, running past the end or reading something that isn't what it
+// should be clears `ok'.
+struct Cache_Reader
+{
+    const uint8_t *at;
+    const uint8_t *end;
+    bool ok;
+    const Source_Code &src;
+    Type_Map &types;
+    Module_Map &modules;
+    std::vector<Type_Info*> builtins;
+    std::vector<Type_Info*> requested;
+
+    template<typename T>
+    T get()
+    {
+        T value{};
+        if (static_cast<size_t>(end - at) < sizeof(value))
+        {
+            ok = false;
+            at = end;
+            return value;
+        }
+        memcpy(&value, at, sizeof(value));
+        at += sizeof(value);
+        return value;
+    }
+    std::string get_string()
+    {
+        auto n = get<uint32_t>();
+        if (static_cast<size_t>(end - at) < n)
+        {
+            ok = false;
+            at = end;
+            return {};
+        }
+        std::string s(reinterpret_cast<const char*>(at), n);
+        at += n;
+        return s;
+    }
+    Type_Info *get_type()
+    {
+        auto ref = get<int32_t>();
+        if (ref > 0 && static_cast<size_t>(ref) <= requested.size())
+        {
+            return requested[ref - 1];
+        }
+        if (ref < 0 && static_cast<size_t>(-static_cast<int64_t>(ref)) <= builtins.size())
+        {
+            return builtins[-static_cast<int64_t>(ref) - 1];
+        }
+        ok &= ref == 0;
+        return nullptr;
+    }
+    template<typename T>
+    T *get_type()
+    {
+        auto type = get_type();
+        auto t = dynamic_cast<T*>(type);
+        ok &= t || !type;
+        return t;
+    }
+    void get_builtins()
+    {
+        auto n = get<uint32_t>();
+        for (uint32_t i = 0; ok && i < n; ++i)
+        {
+            auto type = types.get_type(get_string());
+            ok &= type && type->is_builtin();
+            builtins.push_back(type);
+        }
+    }
+    void get_requests()
+    {
+        auto n = get<uint32_t>();
+        for (uint32_t i = 0; ok && i < n; ++i)
+        {
+            Type_Info *type = nullptr;
+            auto kind = get<Cache_Request>();
+            if (kind == Cache_Request::Named)
+            {
+                auto name = get_string();
+                ok &= !name.empty();
+                if (ok)
+                {
+                    type = types.get_or_declare_type(name);
+                }
+            }
+            else if (kind == Cache_Request::Function)
+            {
+                auto is_native = get<uint8_t>() != 0;
+                auto return_type = get_type();
+                Types parameter_types(get<uint32_t>());
+                for (auto &&p : parameter_types)
+                {
+                    p = get_type();
+                    ok &= p != nullptr;
+                }
+                ok &= return_type != nullptr;
+                if (ok)
+                {
+                    type = types.declare_function(parameter_types, return_type, is_native);
+                }
+            }
+            else if (kind == Cache_Request::Array)
+            {
+                auto of_type = get_type();
+                ok &= of_type != nullptr;
+                if (ok)
+                {
+                    type = types.get_array_type(of_type);
+                }
+            }
+            else
+            {
+                ok = false;
+            }
+            requested.push_back(type);
+        }
+    }
+
+    Ast_Node *get_node();
+    template<typename T>
+    T *get_node()
+    {
+        auto n = get_node();
+        auto t = dynamic_cast<T*>(n);
+        if (n && !t)
+        {
+            delete n;
+            ok = false;
+        }
+        return t;
+    }
+    template<typename T>
+    std::vector<T*> get_nodes()
+    {
+        std::vector<T*> nodes;
+        auto n = get<uint32_t>();
+        for (uint32_t i = 0; ok && i < n; ++i)
+        {
+            auto node = get_node<T>();
+            ok &= node != nullptr;
+            nodes.push_back(node);
+        }
+        return nodes;
+    }
+    std::vector<std::string> get_strings()
+    {
+        std::vector<std::string> strings;
+        auto n = get<uint32_t>();
+        for (uint32_t i = 0; ok && i < n; ++i)
+        {
+            strings.push_back(get_string());
+        }
+        return strings;
+    }
+};
+
+Ast_Node *Cache_Reader::get_node()
+{
+    auto kind = get<Cache_Node>();
+    if (kind == Cache_Node::None || !ok)
+    {
+        return nullptr;
+    }
+    Source_Location src_loc;
+    src_loc.source_code = &src;
+    src_loc.filename = src.filename();
+    src_loc.line_no = get<int32_t>();
+    src_loc.char_no = get<int32_t>();
+    switch (kind)
+    {
+        case Cache_Node::Import:
+        {
+            auto name = get_strings();
+            ok &= !name.empty();
+            return ok ? new Import_Node(src_loc, modules.get(name)) : nullptr;
+        }
+        case Cache_Node::Variable:
+        {
+            auto name = get_string();
+            auto qualifiers = get_strings();
+            return new Variable_Node(src_loc, name, qualifiers);
+        }
+        case Cache_Node::Assign:
+        {
+            auto lhs = get_node<Ast_LValue>();
+            auto rhs = get_node<Ast_Value>();
+            return new Assign_Node(src_loc, lhs, rhs);
+        }
+        case Cache_Node::Decl:
+        {
+            auto is_readonly = get<uint8_t>() != 0;
+            auto is_private = get<uint8_t>() != 0;
+            auto name = get_string();
+            auto type = get_node<Type_Node>();
+            auto decl = new Decl_Node(src_loc, name, type);
+            decl->is_readonly = is_readonly;
+            decl->is_private = is_private;
+            return decl;
+        }
+        case Cache_Node::Fn:
+        {
+            auto bound_name = get_string();
+            auto params = get_nodes<Decl_Node>();
+            auto return_type = get_node<Type_Node>();
+            auto body = get_nodes<Ast_Node>();
+            auto fn_type = get_type<Function_Type_Info>();
+            return new Fn_Node(src_loc, bound_name, params, return_type, body, fn_type);
+        }
+        case Cache_Node::List:
+        {
+            auto contents = get_nodes<Ast_Value>();
+            return new List_Node(src_loc, contents);
+        }
+
+#define VALUE(class_name, kind, value)                          \
+        case Cache_Node::kind:                                  \
+        {                                                       \
+            auto v = value;                                     \
+            auto type = get_type();                             \
+            return new class_name(src_loc, v, type);            \
+        }
+
+        VALUE(Integer_Node, Integer, get<int64_t>())
+        VALUE(Real_Node, Real, get<double>())
+        VALUE(String_Node, String, get_string())
+        VALUE(Boolean_Node, Boolean, get<uint8_t>() != 0)
+        VALUE(Character_Node, Character, get<char>())
+#undef VALUE
+
+#define BINARY(class_name, kind)                                \
+        case Cache_Node::kind:                                  \
+        {                                                       \
+            auto lhs = get_node<Ast_Value>();                   \
+            auto rhs = get_node<Ast_Value>();                   \
+            return new class_name(src_loc, lhs, rhs);           \
+        }
+
+        BINARY(Logical_Or_Node, Logical_Or)
+        BINARY(Logical_And_Node, Logical_And)
+        BINARY(Inclusive_Or_Node, Inclusive_Or)
+        BINARY(Exclusive_Or_Node, Exclusive_Or)
+        BINARY(And_Node, And)
+        BINARY(Equals_Node, Equals)
+        BINARY(Not_Equals_Node, Not_Equals)
+        BINARY(Less_Than_Node, Less_Than)
+        BINARY(Less_Than_Equals_Node, Less_Than_Equals)
+        BINARY(Greater_Than_Node, Greater_Than)
+        BINARY(Greater_Than_Equals_Node, Greater_Than_Equals)
+        BINARY(Left_Shift_Node, Left_Shift)
+        BINARY(Right_Shift_Node, Right_Shift)
+        BINARY(Add_Node, Add)
+        BINARY(Subtract_Node, Subtract)
+        BINARY(Multiply_Node, Multiply)
+        BINARY(Divide_Node, Divide)
+        BINARY(Modulo_Node, Modulo)
+#undef BINARY
+
+#define PREFIX(class_name, kind)                                \
+        case Cache_Node::kind:                                  \
+        {                                                       \
+            auto operand = get_node<Ast_Value>();               \
+            return new class_name(src_loc, operand);            \
+        }
+
+        PREFIX(Negate_Node, Negate)
+        PREFIX(Positive_Node, Positive)
+        PREFIX(Not_Node, Not)
+        PREFIX(Invert_Node, Invert)
+#undef PREFIX
+
+        case Cache_Node::Call:
+        {
+            auto callee = get_node<Ast_Value>();
+            auto args = get_node<List_Node>();
+            return new Call_Node(src_loc, callee, args);
+        }
+        case Cache_Node::Index:
+        {
+            auto thing = get_node<Ast_Value>();
+            auto subscript = get_node<List_Node>();
+            return new Index_Node(src_loc, thing, subscript);
+        }
+        case Cache_Node::Member_Accessor:
+        {
+            auto thing = get_node<Ast_Value>();
+            auto member = get_node<Variable_Node>();
+            return new Member_Accessor_Node(src_loc, thing, member);
+        }
+        case Cache_Node::Constructor:
+        {
+            auto params = get_nodes<Decl_Node>();
+            auto body = get_nodes<Ast_Node>();
+            auto fn_type = get_type<Function_Type_Info>();
+            return new Constructor_Node(src_loc, params, body, fn_type);
+        }
+        case Cache_Node::Type_Def:
+        {
+            auto type_def = new Type_Def_Node(src_loc, get_type());
+            type_def->constructors = get_nodes<Constructor_Node>();
+            type_def->fields = get_nodes<Ast_Node>();
+            type_def->methods = get_nodes<Fn_Node>();
+            return type_def;
+        }
+        case Cache_Node::Type_Alias:
+        {
+            auto alias = get_type();
+            auto to = get_type();
+            ok &= alias && to;
+            if (!ok)
+            {
+                return nullptr;
+            }
+            alias->aliased_to(to);
+            return new Type_Alias_Node(src_loc, alias);
+        }
+        case Cache_Node::Unalias:
+        {
+            auto value = get_node<Ast_Value>();
+            return new Unalias_Node(src_loc, value);
+        }
+        case Cache_Node::Extend:
+        {
+            auto for_type = get_node<Type_Node>();
+            auto body = get_nodes<Fn_Node>();
+            return new Extend_Node(src_loc, for_type, body);
+        }
+        case Cache_Node::Type:
+        {
+            return new Type_Node(src_loc, get_type());
+        }
+        case Cache_Node::Decl_Assign:
+        {
+            auto decl = get_node<Decl_Node>();
+            auto value = get_node<Ast_Value>();
+            return new Decl_Assign_Node(src_loc, decl, value);
+        }
+        case Cache_Node::Return:
+        {
+            return new Return_Node(src_loc, get_node<List_Node>());
+        }
+        case Cache_Node::Break:
+        {
+            return new Break_Node(src_loc, get_node<List_Node>());
+        }
+        case Cache_Node::Continue:
+        {
+            return new Continue_Node(src_loc);
+        }
+        case Cache_Node::While:
+        {
+            auto condition = get_node<Ast_Value>();
+            auto body = get_nodes<Ast_Node>();
+            return new While_Node(src_loc, condition, body);
+        }
+        case Cache_Node::For:
+        {
+            auto it = get_string();
+            auto iterable = get_node<Ast_Value>();
+            auto body = get_nodes<Ast_Node>();
+            return new For_Node(src_loc, it, iterable, body);
+        }
+        case Cache_Node::If_Else:
+        {
+            auto condition = get_node<Ast_Value>();
+            auto consequence = get_nodes<Ast_Node>();
+            auto alternative = get_nodes<Ast_Node>();
+            auto void_type = get_type();
+            return new If_Else_Node(src_loc, condition, consequence, alternative, void_type);
+        }
+        case Cache_Node::Array_Literal:
+        {
+            auto values = get_node<List_Node>();
+            ok &= values && !values->contents.empty();
+            if (!ok)
+            {
+                delete values;
+                return nullptr;
+            }
+            return new Array_Literal_Node(src_loc, values);
+        }
+        case Cache_Node::New_Array:
+        {
+            auto array_type = get_type<Array_Type_Info>();
+            auto of_type = get_node<Type_Node>();
+            auto size = get_node<Ast_Value>();
+            return new New_Array_Node(src_loc, array_type, of_type, size);
+        }
+        case Cache_Node::None:
+            break;
+    }
+    ok = false;
+    return nullptr;
+}
+
+Module_Cache::Module_Cache(const std::string &dir)
+    : m_dir(dir)
+{}
+
+std::string Module_Cache::default_dir()
+{
+    auto dir = plat::get_user_cache_dir();
+    return dir.empty() ? dir : dir + "/malang";
+}
+
+std::string Module_Cache::path(const std::string &source) const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/%016llx-%u.mmc",
+             static_cast<unsigned long long>(fnv1a(source.data(), source.size())),
+             static_cast<unsigned>(version));
+    return m_dir + name;
+}
+
+bool Module_Cache::load(const Source_Code &src, Type_Map &types, Module_Map &modules, Ast &ast)
+{
+    if (m_dir.empty())
+    {
+        return false;
+    }
+    size_t size;
+    auto mapping = static_cast<const uint8_t*>(plat::map_file(path(src.code()).c_str(), size));
+    if (!mapping)
+    {
+        return false;
+    }
+    defer({plat::unmap_file(const_cast<uint8_t*>(mapping), size);});
+    return decode(mapping, size, src, types, modules, ast);
+}
+
+void Module_Cache::save(const Source_Code &src, Module &module, const std::vector<Type_Request> &requests, Ast &ast)
+{
+    if (m_dir.empty())
+    {
+        return;
+    }
+    std::vector<uint8_t> data;
+    if (!encode(src, module, requests, ast, data))
+    {
+        return;
+    }
+    // it's only a cache, if it can't be saved the module is parsed again next time
+    if (!m_made_dir)
+    {
+        m_made_dir = plat::make_directories(m_dir);
+    }
+    plat::replace_file(path(src.code()), data.data(), data.size());
+}
+
+bool Module_Cache::decode(const uint8_t *data, size_t size, const Source_Code &src, Type_Map &types,
+                          Module_Map &modules, Ast &ast)
+{
+    Cache_Header header;
+    if (size < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0
+        || header.version != version
+        || header.source_size != src.code().size()
+        || header.source_hash != fnv1a(src.code().data(), src.code().size())
+        || header.hash != fnv1a(data + sizeof(header), size - sizeof(header)))
+    {
+        return false;
+    }
+
+    Cache_Reader r{data + sizeof(header), data + size, true, src, types, modules, {}, {}};
+    r.get_builtins();
+    r.get_requests();
+    Ast loaded;
+    loaded.imports = r.get_nodes<Import_Node>();
+    loaded.first = r.get_nodes<Ast_Node>();
+    loaded.second = r.get_nodes<Ast_Node>();
+    if (!r.ok || r.at != r.end)
+    {
+        return false;
+    }
+    ast = std::move(loaded);
+    return true;
+}
+
+bool Module_Cache::encode(const Source_Code &src, Module &module, const std::vector<Type_Request> &requests,
+                          Ast &ast, std::vector<uint8_t> &out)
+{
+    Cache_Writer body;
+    body.put_requests(module, requests);
+    body.put_nodes(ast.imports);
+    body.put_nodes(ast.first);
+    body.put_nodes(ast.second);
+    if (!body.ok)
+    {
+        return false;
+    }
+
+    Cache_Writer w;
+    w.out.resize(sizeof(Cache_Header));
+    w.put<uint32_t>(body.builtins.size());
+    for (auto &&name : body.builtins)
+    {
+        w.put(name);
+    }
+    w.out.insert(w.out.end(), body.out.begin(), body.out.end());
+
+    Cache_Header header;
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = version;
+    header.source_size = src.code().size();
+    header.source_hash = fnv1a(src.code().data(), src.code().size());
+    header.hash = fnv1a(w.out.data() + sizeof(header), w.out.size() - sizeof(header));
+    memcpy(w.out.data(), &header, sizeof(header));
+    out = std::move(w.out);
+    return true;
+}
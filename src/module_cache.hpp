@@ -0,0 +1,52 @@
+#ifndef MALANG_MODULE_CACHE_HPP
+#define MALANG_MODULE_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct Ast;
+struct Module;
+struct Module_Map;
+struct Type_Map;
+struct Type_Request;
+class Source_Code;
+
+// Keeps what the parser made of each module imported so a module whose source hasn't changed
+// isn't parsed again, in a file named by the hash of its source and the version below. Its types
+// are kept as what its parse asked Type_Map for, which is asked for again in the same order when
+// it's loaded, so they come out the way parsing it would in the program importing it. Only
+// modules whose types are their own or builtin are kept, the others could parse differently in
+// another program. A module's IR isn't kept since it's lowered into the IR of the program
+// importing it, with that program's globals, labels, strings and type tokens.
+struct Module_Cache
+{
+    // Bumped whenever the AST or what the parser makes of the source changes.
+    static constexpr uint32_t version = 1;
+
+    // Caches in `dir', which is made when the first module is saved. Nothing is if it's empty.
+    Module_Cache(const std::string &dir);
+    // $XDG_CACHE_HOME/malang or ~/.cache/malang, empty if there's neither.
+    static std::string default_dir();
+
+    // Loads the module parsed from `src' into `ast', declaring its types in `types' and the
+    // modules it imports in `modules'. Returns false if it isn't cached.
+    bool load(const Source_Code &src, Type_Map &types, Module_Map &modules, Ast &ast);
+    // Saves `ast', parsed from `src' for `module' while `requests' were made of Type_Map.
+    void save(const Source_Code &src, Module &module, const std::vector<Type_Request> &requests, Ast &ast);
+
+    // What's loaded and saved, for modules kept somewhere other than a cache. encode returns
+    // false if the module can't be kept and decode if `data' wasn't encoded from `src' by this
+    // version.
+    static bool encode(const Source_Code &src, Module &module, const std::vector<Type_Request> &requests,
+                       Ast &ast, std::vector<uint8_t> &out);
+    static bool decode(const uint8_t *data, size_t size, const Source_Code &src, Type_Map &types,
+                       Module_Map &modules, Ast &ast);
+
+private:
+    std::string m_dir;
+    bool m_made_dir = false;
+    std::string path(const std::string &source) const;
+};
+
+#endif /* MALANG_MODULE_CACHE_HPP */
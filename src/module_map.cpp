@@ -1,6 +1,10 @@
 #include <cassert>
 #include <sstream>
 #include "module_map.hpp"
+#include "module_cache.hpp"
+#include "embedded_modules.hpp"
+#include "parser.hpp"
+#include "type_map.hpp"
 #include "platform/dir.hpp"
 #include "ir/scope_lookup.hpp"
 
@@ -266,3 +270,42 @@ bool Module_Map::find_file(Module *module, std::string &filename)
     }
     return false;
 }
+
+const Embedded_Module *Module_Map::find_embedded(Module *module)
+{
+    assert(module);
+    return find_embedded_module(module->fully_qualified_name());
+}
+
+void Module_Map::use_cache(Module_Cache *cache)
+{
+    m_cache = cache;
+}
+
+bool Module_Map::parse(Module *module, Source_Code *src, Type_Map *types, Ast &ast)
+{
+    assert(module);
+    auto embedded = find_embedded(module);
+    if (embedded && Module_Cache::decode(embedded->parsed, embedded->parsed_size, *src, *types, *this, ast))
+    {
+        return true;
+    }
+    if (m_cache && m_cache->load(*src, *types, *this, ast))
+    {
+        return true;
+    }
+    std::vector<Type_Request> requests;
+    types->requests = m_cache ? &requests : nullptr;
+    Parser parser(types, this);
+    ast = parser.parse(src);
+    types->requests = nullptr;
+    if (parser.errors)
+    {
+        return false;
+    }
+    if (m_cache)
+    {
+        m_cache->save(*src, *module, requests, ast);
+    }
+    return true;
+}
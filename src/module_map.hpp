@@ -6,8 +6,13 @@
 #include <map>
 
 struct Module_Map;
+struct Module_Cache;
+struct Embedded_Module;
 struct Scope_Lookup;
 struct Malang_IR;
+struct Type_Map;
+struct Ast;
+class Source_Code;
 
 struct Module
 {
@@ -65,10 +70,20 @@ struct Module_Map
     bool find_file(Module *module, std::string &filename);
     bool find_file_rel(const std::string &rel_path, Module *module, std::string &filename);
     void add_search_directory(const std::string &dir);
+    // The module built into mal that's `module', null if it isn't one. They're found after a file
+    // next to the importing source and before the search directories.
+    const Embedded_Module *find_embedded(Module *module);
+    // Parses `src', the source of `module', into `ast'. It's what's built into mal if it's a
+    // module built in with the same source, otherwise if there's a cache it's loaded from there
+    // when it's the same source parsed by this mal and saved there when it isn't. Returns false if
+    // there were errors parsing it.
+    bool parse(Module *module, Source_Code *src, Type_Map *types, Ast &ast);
+    void use_cache(Module_Cache *cache);
 private:
     Module *get_or_make_mod(const std::vector<std::string> &name, bool can_make);
     Module *make_mod(const std::string &name);
     Malang_IR *m_alloc;
+    Module_Cache *m_cache = nullptr;
     std::vector<Module*> m_all_modules;
     std::vector<std::string> m_search_directories;
     std::map<std::string, Module*> m_root_modules;
@@ -431,7 +431,8 @@ static uptr<Decl_Assign_Node> parse_decl_assign(Parser &parser)
             decl->type = new Type_Node(decl->src_loc, val_ty);
         }
     }
-    return std::make_unique<Decl_Assign_Node>(decl->src_loc, decl.release(), value.release());
+    auto src_loc = decl->src_loc;
+    return std::make_unique<Decl_Assign_Node>(src_loc, decl.release(), value.release());
 }
 
 static uptr<Array_Literal_Node> parse_array_literal(Parser &parser)
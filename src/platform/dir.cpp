@@ -1,4 +1,8 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include "dir.hpp"
 
 std::string plat::get_directory(const std::string &path)
@@ -39,3 +43,52 @@ std::string plat::get_mal_exe_path()
     }
     return buf;
 }
+
+std::string plat::get_user_cache_dir()
+{
+    // the spec says to ignore it if it isn't absolute
+    auto xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && xdg[0] == '/')
+    {
+        return xdg;
+    }
+    auto home = getenv("HOME");
+    if (home && home[0])
+    {
+        return std::string(home) + "/.cache";
+    }
+    return std::string();
+}
+
+bool plat::make_directories(const std::string &path)
+{
+    for (size_t i = 1; i <= path.size(); ++i)
+    {
+        if (i == path.size() || path[i] == '/')
+        {
+            auto dir = path.substr(0, i);
+            if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool plat::replace_file(const std::string &path, const void *data, size_t size)
+{
+    auto tmp = path + "." + std::to_string(getpid()) + ".tmp";
+    auto file = fopen(tmp.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+    auto wrote = fwrite(data, 1, size, file) == size;
+    if (fclose(file) != 0 || !wrote || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
@@ -1,6 +1,7 @@
 #ifndef MALANG_DIR_HPP
 #define MALANG_DIR_HPP
 
+#include <stddef.h>
 #include <string>
 namespace plat
 {
@@ -8,6 +9,13 @@ namespace plat
     std::string get_abs_path(const std::string &path);
     std::string get_cwd();
     std::string get_mal_exe_path();
+    // $XDG_CACHE_HOME, or ~/.cache if that isn't set. Empty if neither can be found.
+    std::string get_user_cache_dir();
+    // Makes the directory at `path' and any of its parents that don't exist yet.
+    bool make_directories(const std::string &path);
+    // Writes a file that then replaces the one at `path' all at once, so no one reading it ever
+    // sees it half written.
+    bool replace_file(const std::string &path, const void *data, size_t size);
 }
 
 #endif /* MALANG_DIR_HPP */
@@ -0,0 +1,34 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "map_file.hpp"
+
+void *plat::map_file(const char *path, size_t &size)
+{
+    auto fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+    size = static_cast<size_t>(st.st_size);
+    auto mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file open
+    close(fd);
+    return mapping == MAP_FAILED ? nullptr : mapping;
+}
+
+void plat::unmap_file(void *mapping, size_t size)
+{
+    if (mapping)
+    {
+        munmap(mapping, size);
+    }
+}
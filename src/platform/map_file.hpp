@@ -0,0 +1,17 @@
+#ifndef MALANG_MAP_FILE_HPP
+#define MALANG_MAP_FILE_HPP
+
+#include <stddef.h>
+
+namespace plat
+{
+    // Maps all of the file at `path' into memory copy on write: its pages are shared with every
+    // other mapping of the file through the page cache, until one is written to which only
+    // changes it for this process. `size' is set to the size of the file. Returns nullptr if it
+    // couldn't be mapped, an empty file can't be.
+    void *map_file(const char *path, size_t &size);
+    // Unmaps a mapping returned by map_file.
+    void unmap_file(void *mapping, size_t size);
+}
+
+#endif /* MALANG_MAP_FILE_HPP */
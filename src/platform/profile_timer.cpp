@@ -0,0 +1,55 @@
+#include <sys/time.h>
+#include <signal.h>
+
+#include "profile_timer.hpp"
+
+namespace
+{
+    void (*volatile g_on_tick)() = nullptr;
+    struct sigaction g_previous_action;
+}
+
+static void on_sigprof(int)
+{
+    if (auto on_tick = g_on_tick)
+    {
+        on_tick();
+    }
+}
+
+bool plat::start_profile_timer(unsigned hz, void (*on_tick)())
+{
+    if (hz == 0 || hz > 1000000)
+    {
+        return false;
+    }
+    g_on_tick = on_tick;
+    struct sigaction action{};
+    action.sa_handler = on_sigprof;
+    // interrupted system calls are restarted so the program doesn't see the ticks
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &g_previous_action) < 0)
+    {
+        return false;
+    }
+    itimerval timer{};
+    auto usec = 1000000 / hz;
+    timer.it_interval.tv_sec = usec / 1000000;
+    timer.it_interval.tv_usec = usec % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) < 0)
+    {
+        sigaction(SIGPROF, &g_previous_action, nullptr);
+        return false;
+    }
+    return true;
+}
+
+void plat::stop_profile_timer()
+{
+    itimerval timer{};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &g_previous_action, nullptr);
+    g_on_tick = nullptr;
+}
@@ -0,0 +1,13 @@
+#ifndef MALANG_PROFILE_TIMER_HPP
+#define MALANG_PROFILE_TIMER_HPP
+
+namespace plat
+{
+    // Calls `on_tick' from a signal handler `hz' times per second of CPU time used by the
+    // process, until stop_profile_timer. `on_tick' may only do what's safe in a signal handler.
+    // Returns false if the timer couldn't be started.
+    bool start_profile_timer(unsigned hz, void (*on_tick)());
+    void stop_profile_timer();
+}
+
+#endif /* MALANG_PROFILE_TIMER_HPP */
@@ -0,0 +1,152 @@
+#include <sys/mman.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "stack.hpp"
+
+namespace
+{
+    struct Guarded_Stack
+    {
+        char *mapping;
+        size_t mapping_size;
+        // [begin, end) is usable, the rest of the mapping are the guard pages.
+        char *begin;
+        char *end;
+        char name[64];
+    };
+
+    // Read from the fault handler so this is a plain array instead of something that allocates.
+    constexpr size_t max_stacks = 32;
+    Guarded_Stack g_stacks[max_stacks];
+    struct sigaction g_previous_action;
+    bool g_handler_installed = false;
+}
+
+static void write_str(const char *s)
+{
+    auto n = write(STDOUT_FILENO, s, strlen(s));
+    (void)n;
+}
+
+static void on_segv(int sig, siginfo_t *info, void *context)
+{
+    auto addr = static_cast<char*>(info->si_addr);
+    for (auto &&s : g_stacks)
+    {
+        if (s.mapping && addr >= s.mapping && addr < s.mapping + s.mapping_size)
+        {
+            // Only the VM pushing onto one of its stacks faults in them, never stdio itself, so
+            // what the program printed is flushed ahead of the panic like Malang_VM::panic does.
+            fflush(stdout);
+            write_str("runtime panic trigger!\n    ");
+            write_str(s.name);
+            write_str(addr < s.begin ? " underflowed.\n" : " overflowed.\n");
+            abort();
+        }
+    }
+
+    // Not one of ours, let whoever was there before deal with it. Returning re-runs the faulting
+    // instruction which faults again with the old handler in place.
+    sigaction(SIGSEGV, &g_previous_action, nullptr);
+    (void)sig; (void)context;
+}
+
+static bool install_handler()
+{
+    if (g_handler_installed)
+    {
+        return true;
+    }
+    // The handler has its own stack so it still runs if the native stack is what overflowed.
+    stack_t alt{};
+    alt.ss_size = 64 * 1024;
+    alt.ss_sp = malloc(alt.ss_size);
+    if (!alt.ss_sp || sigaltstack(&alt, nullptr) < 0)
+    {
+        free(alt.ss_sp);
+        return false;
+    }
+    struct sigaction action{};
+    action.sa_sigaction = on_segv;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &g_previous_action) < 0)
+    {
+        return false;
+    }
+    g_handler_installed = true;
+    return true;
+}
+
+static size_t round_to_pages(size_t n)
+{
+    auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return (n + page - 1) / page * page;
+}
+
+void *plat::stack_reserve(size_t size, size_t guard_size, const char *name)
+{
+    Guarded_Stack *slot = nullptr;
+    for (auto &&s : g_stacks)
+    {
+        if (!s.mapping)
+        {
+            slot = &s;
+            break;
+        }
+    }
+    if (!slot || !install_handler())
+    {
+        return nullptr;
+    }
+
+    auto pages_size = round_to_pages(size ? size : 1);
+    guard_size = round_to_pages(guard_size ? guard_size : 1);
+    auto mapping_size = guard_size + pages_size + guard_size;
+    auto mapping = mmap(nullptr, mapping_size, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    auto pages = static_cast<char*>(mapping) + guard_size;
+    if (mprotect(pages, pages_size, PROT_READ | PROT_WRITE) < 0)
+    {
+        munmap(mapping, mapping_size);
+        return nullptr;
+    }
+
+    // The stack ends right at the guard after it, so it overflows after exactly `size' bytes
+    // rather than after however much rounding up to pages added. What rounding added is before
+    // it instead.
+    auto begin = pages + pages_size - size;
+    slot->begin = begin;
+    slot->end = begin + size;
+    slot->mapping_size = mapping_size;
+    strncpy(slot->name, name, sizeof(slot->name) - 1);
+    slot->name[sizeof(slot->name) - 1] = '\0';
+    slot->mapping = static_cast<char*>(mapping);
+    return begin;
+}
+
+void plat::stack_release(void *stack)
+{
+    if (!stack)
+    {
+        return;
+    }
+    for (auto &&s : g_stacks)
+    {
+        if (s.mapping && s.begin == stack)
+        {
+            munmap(s.mapping, s.mapping_size);
+            s.mapping = nullptr;
+            return;
+        }
+    }
+}
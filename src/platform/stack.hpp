@@ -0,0 +1,18 @@
+#ifndef MALANG_STACK_HPP
+#define MALANG_STACK_HPP
+
+#include <stddef.h>
+
+namespace plat
+{
+    // Reserves address space for a stack of `size' bytes with at least `guard_size' bytes of
+    // inaccessible guard pages on both ends. Nothing is committed up front, pages are backed by
+    // memory the first time they're touched. Touching a guard page prints `name' and aborts. The
+    // guard after the stack starts exactly `size' bytes past what's returned.
+    // Returns nullptr if the space couldn't be reserved.
+    void *stack_reserve(size_t size, size_t guard_size, const char *name);
+    // Releases a stack returned by stack_reserve.
+    void stack_release(void *stack);
+}
+
+#endif /* MALANG_STACK_HPP */
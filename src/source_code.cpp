@@ -54,6 +54,8 @@ void Source_Location::vreport(const char *type, const char *fmt, va_list vargs)
         vprintf(fmt, vargs);
         printf("\n");
     }
+    // most errors abort right after they're reported, which would lose them if stdout is a pipe
+    fflush(stdout);
 }
 
 int Source_Code::next()
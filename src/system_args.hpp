@@ -6,6 +6,33 @@
 struct Args
 {
     bool noisy = true;
+    bool threaded_code = false;
+    bool jit = false;
+    // Which IR passes to run between the front end and the code generator, see IR_Pass_Manager.
+    int opt_level = 1;
+    // Print the time each IR pass took and how it changed the number of nodes to stderr.
+    bool pass_stats = false;
+    // Count the instructions run and print a histogram at exit, or write it as JSON to
+    // `profile_ops_file' if that isn't empty.
+    bool profile_ops = false;
+    std::string profile_ops_file;
+    // Sample which functions are running and write them as folded stacks to this file.
+    std::string profile_file;
+    // Capacities of the VM's stacks, in frames for the call stack and values for the rest.
+    // They're only reserved up front so these can be generous.
+    size_t max_call_depth = 1 << 20;
+    size_t data_stack_size = 1 << 22;
+    size_t globals_size = 1 << 16;
+    // Write the compiled program to `output_file' as a Malang_Image instead of running it, if
+    // that's empty it goes next to `filename' with the extension .mbc.
+    bool compile = false;
+    std::string output_file;
+    // Write the modules given to `output_file' as C++ that builds them into mal instead, see
+    // Embedded_Module.
+    bool embed = false;
+    // Keep what each imported module is parsed into in Module_Cache::default_dir and load it from
+    // there while its source is the same.
+    bool module_cache = true;
     std::string filename;
     std::string code;
 };
@@ -64,12 +64,16 @@ Type_Info *Type_Map::get_buffer() const
 }
 Type_Info *Type_Map::get_or_declare_type(const std::string &name)
 {
-    auto existing = get_type(name);
-    if (existing)
+    auto type = get_type(name);
+    if (!type)
     {
-        return existing;
+        type = declare_type(name, nullptr);
     }
-    return declare_type(name, nullptr);
+    if (requests)
+    {
+        requests->push_back({name, type});
+    }
+    return type;
 }
 Module *Type_Map::module() const
 {
@@ -143,6 +147,18 @@ Function_Type_Info *Type_Map::declare_function(const Types &parameter_types, Typ
 {
     assert(return_type);
     auto type_name = create_function_typename(return_type, parameter_types, is_native);
+    auto fn_type = declare_function(type_name, parameter_types, return_type, is_native);
+    if (requests)
+    {
+        requests->push_back({"", fn_type});
+    }
+    return fn_type;
+}
+
+Function_Type_Info *Type_Map::declare_function(const std::string &type_name, const Types &parameter_types,
+                                               Type_Info *return_type, bool is_native)
+{
+    assert(return_type);
     if (auto exists = get_type(type_name))
     {
         auto fn_ty = dynamic_cast<Function_Type_Info*>(exists);
@@ -171,19 +187,26 @@ std::string create_array_type_name(Type_Info *of_type)
 Array_Type_Info *Type_Map::get_array_type(Type_Info *of_type)
 {
     auto array_type_name = create_array_type_name(of_type);
+    Array_Type_Info *arr_type;
     if (auto exists = get_type(array_type_name))
     {
-        auto arr_ty = dynamic_cast<Array_Type_Info*>(exists);
-        assert(arr_ty);
-        return arr_ty;
+        arr_type = dynamic_cast<Array_Type_Info*>(exists);
+        assert(arr_type);
+    }
+    else
+    {
+        auto type_token = static_cast<Type_Token>(m_types_fast.size());
+        arr_type = new Array_Type_Info{type_token, array_type_name, of_type};
+        auto length_field = new Field_Info{"length", m_int, true, false};
+        arr_type->add_field(length_field);
+        m_types[arr_type->name()] = arr_type;
+        m_types_fast.push_back(arr_type);
+        assert(m_types_fast[arr_type->type_token()] == arr_type);
+    }
+    if (requests)
+    {
+        requests->push_back({"", arr_type});
     }
-    auto type_token = static_cast<Type_Token>(m_types_fast.size());
-    auto arr_type = new Array_Type_Info{type_token, array_type_name, of_type};
-    auto length_field = new Field_Info{"length", m_int, true, false};
-    arr_type->add_field(length_field);
-    m_types[arr_type->name()] = arr_type;
-    m_types_fast.push_back(arr_type);
-    assert(m_types_fast[arr_type->type_token()] == arr_type);
     return arr_type;
 }
 
@@ -212,6 +235,11 @@ Type_Info *Type_Map::get_type(Type_Token type_token)
     return m_types_fast[idx];
 }
 
+Type_Token Type_Map::num_types() const
+{
+    return static_cast<Type_Token>(m_types_fast.size());
+}
+
 void Type_Map::dump() const
 {
     printf(">>>>>>>>>>>>TYPE DUMP<<<<<<<<<<\n");
@@ -6,6 +6,15 @@
 #include "vm/runtime/reflection.hpp"
 
 struct Module;
+
+// A type the parser got from Type_Map, see Type_Map::requests.
+struct Type_Request
+{
+    // What it was asked for by, empty if it's from declare_function or get_array_type.
+    std::string name;
+    Type_Info *type;
+};
+
 struct Type_Map
 {
     ~Type_Map();
@@ -14,10 +23,16 @@ struct Type_Map
     Type_Info *declare_type(const std::string &name, struct Type_Info *parent);
     Type_Info *declare_builtin_type(const std::string &name, Type_Info *parent, bool gc_managed);
     Function_Type_Info *declare_function(const Types &parameter_types, Type_Info *return_type, bool is_native);
+    // The same with the name it's given, which is what it was named when it was declared by
+    // the other one. That's kept by Malang_Image since a name can be of an alias resolved since.
+    Function_Type_Info *declare_function(const std::string &type_name, const Types &parameter_types,
+                                         Type_Info *return_type, bool is_native);
     Array_Type_Info *get_array_type(Type_Info *of_type);
 
     Type_Info *get_type(const std::string &name);
     Type_Info *get_type(Type_Token type_token);
+    // Type tokens go from 0 up to this.
+    Type_Token num_types() const;
 
     Type_Info *get_void() const;
     Type_Info *get_int() const;
@@ -30,6 +45,10 @@ struct Type_Map
     void module(Module *mod);
 
     void dump() const;
+
+    // While it's set each type from get_or_declare_type, declare_function and get_array_type is
+    // added to it in the order they're asked for. That's how Module_Cache asks for them again.
+    std::vector<Type_Request> *requests = nullptr;
 private:
     Type_Info *declare_type(const std::string &name, struct Type_Info *parent, bool is_builtin, bool is_gc_managed);
     std::map<std::string, Type_Info*> m_types;
@@ -0,0 +1,23 @@
+#include <algorithm>
+#include <cassert>
+#include "dead_locals.hpp"
+
+void Dead_Locals::add(uintptr_t return_offset, const std::vector<uint16_t> &dead)
+{
+    assert(calls.empty() || calls.back().return_offset < return_offset);
+    calls.push_back({static_cast<uint32_t>(return_offset), static_cast<uint32_t>(slots.size())});
+    slots.insert(slots.end(), dead.begin(), dead.end());
+}
+
+const uint16_t *Dead_Locals::at(uintptr_t return_offset, size_t &n) const
+{
+    auto it = std::lower_bound(calls.begin(), calls.end(), return_offset,
+                               [](const Call &c, uintptr_t o) { return c.return_offset < o; });
+    if (it == calls.end() || it->return_offset != return_offset)
+    {
+        return nullptr;
+    }
+    auto end = it + 1 == calls.end() ? slots.size() : (it + 1)->first;
+    n = end - it->first;
+    return slots.data() + it->first;
+}
@@ -0,0 +1,29 @@
+#ifndef MALANG_VM_DEAD_LOCALS_HPP
+#define MALANG_VM_DEAD_LOCALS_HPP
+
+#include <vector>
+#include <stdint.h>
+
+// The locals of a function that nothing reads again once a call it makes returns, by the offset
+// into the bytecode the call returns to. Recorded by IR_To_Code from IR_Pack_Locals, the GC
+// clears them in the frames waiting on those calls so they aren't roots.
+struct Dead_Locals
+{
+    // Offsets must be added in increasing order.
+    void add(uintptr_t return_offset, const std::vector<uint16_t> &dead);
+    // The slots dead after the call returning to `return_offset' and how many there are in `n',
+    // or nullptr if none are known to be.
+    const uint16_t *at(uintptr_t return_offset, size_t &n) const;
+
+    struct Call
+    {
+        uint32_t return_offset;
+        // where its slots start in `slots', they end where the next call's start
+        uint32_t first;
+    };
+    // Sorted by `return_offset'.
+    std::vector<Call> calls;
+    std::vector<uint16_t> slots;
+};
+
+#endif /* MALANG_VM_DEAD_LOCALS_HPP */
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include "debug_info.hpp"
+
+const Function_Symbol *Debug_Info::function_at(uintptr_t offset) const
+{
+    auto it = std::upper_bound(functions.begin(), functions.end(), offset,
+                               [](uintptr_t o, const Function_Symbol &f) { return o < f.begin; });
+    // Ranges nest so walking back from the last one to start at or before `offset', the first
+    // to contain it is the innermost.
+    while (it != functions.begin())
+    {
+        --it;
+        if (offset < it->end)
+        {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+void Debug_Info::add_location(uintptr_t offset, const Source_Location &src_loc)
+{
+    auto found = m_file_index.find(src_loc.filename);
+    uint32_t file;
+    if (found != m_file_index.end())
+    {
+        file = found->second;
+    }
+    else
+    {
+        file = static_cast<uint32_t>(files.size());
+        files.push_back(src_loc.filename);
+        m_file_index[src_loc.filename] = file;
+    }
+
+    while (!m_rows.empty() && m_rows.back().offset >= offset)
+    {
+        m_rows.pop_back();
+    }
+    if (!m_rows.empty())
+    {
+        auto &&last = m_rows.back();
+        if (last.file == file && last.line_no == src_loc.line_no && last.char_no == src_loc.char_no)
+        {
+            return;
+        }
+    }
+    m_rows.push_back({offset, file, src_loc.line_no, src_loc.char_no});
+}
+
+static void put_varint(std::vector<byte> &out, uint64_t n)
+{
+    while (n >= 0x80)
+    {
+        out.push_back(static_cast<byte>(n | 0x80));
+        n >>= 7;
+    }
+    out.push_back(static_cast<byte>(n));
+}
+
+static uint64_t get_varint(const byte *&p)
+{
+    uint64_t n = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+        auto b = *p++;
+        n |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            return n;
+        }
+    }
+}
+
+// Signed deltas are zigzag encoded so small negative ones stay small.
+static uint64_t zigzag(int64_t n)
+{
+    return (static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63);
+}
+
+static int64_t unzigzag(uint64_t n)
+{
+    return static_cast<int64_t>(n >> 1) ^ -static_cast<int64_t>(n & 1);
+}
+
+void Debug_Info::finish(size_t code_size)
+{
+    while (!m_rows.empty() && m_rows.back().offset >= code_size)
+    {
+        m_rows.pop_back();
+    }
+    line_table.clear();
+    Row prev{0, 0, 0, 0};
+    for (auto &&row : m_rows)
+    {
+        auto file_changed = row.file != prev.file;
+        put_varint(line_table, (row.offset - prev.offset) << 1 | file_changed);
+        if (file_changed)
+        {
+            put_varint(line_table, row.file);
+        }
+        put_varint(line_table, zigzag(row.line_no - prev.line_no));
+        put_varint(line_table, static_cast<uint64_t>(row.char_no));
+        prev = row;
+    }
+    m_rows.clear();
+    m_rows.shrink_to_fit();
+    m_file_index.clear();
+}
+
+bool Debug_Info::location_at(uintptr_t offset, Code_Location &location) const
+{
+    auto p = line_table.data();
+    auto end = p + line_table.size();
+    Row row{0, 0, 0, 0};
+    bool found = false;
+    while (p != end)
+    {
+        auto n = get_varint(p);
+        auto next = row;
+        next.offset += n >> 1;
+        if (next.offset > offset)
+        {
+            break;
+        }
+        if (n & 1)
+        {
+            next.file = static_cast<uint32_t>(get_varint(p));
+        }
+        next.line_no += static_cast<int>(unzigzag(get_varint(p)));
+        next.char_no = static_cast<int>(get_varint(p));
+        row = next;
+        found = true;
+    }
+    if (found)
+    {
+        location = {&files[row.file], row.line_no, row.char_no};
+    }
+    return found;
+}
+
+std::string Debug_Info::describe(uintptr_t offset) const
+{
+    auto fn = function_at(offset);
+    Code_Location loc;
+    if (!location_at(offset, loc))
+    {
+        return fn ? fn->name : "";
+    }
+    auto where = *loc.filename + ":" + std::to_string(loc.line_no) + ":" + std::to_string(loc.char_no);
+    return (fn ? fn->name : "<top level>") + " (" + where + ")";
+}
@@ -0,0 +1,71 @@
+#ifndef MALANG_VM_DEBUG_INFO_HPP
+#define MALANG_VM_DEBUG_INFO_HPP
+
+#include <vector>
+#include <map>
+#include <string>
+#include <stdint.h>
+#include "../source_code.hpp"
+
+using byte = unsigned char;
+
+// The code of one function, [begin, end) are offsets into the bytecode.
+struct Function_Symbol
+{
+    uintptr_t begin;
+    uintptr_t end;
+    std::string name;
+    Source_Location src_loc;
+};
+
+// Where in the source an instruction came from.
+struct Code_Location
+{
+    const std::string *filename;
+    int line_no;
+    int char_no;
+};
+
+// What's known about the bytecode beyond the bytecode itself, recorded by IR_To_Code. Nothing
+// here is looked at while code runs.
+struct Debug_Info
+{
+    // Sorted by `begin'. Functions may be defined inside of other functions so the ranges nest.
+    std::vector<Function_Symbol> functions;
+
+    // The innermost function containing `offset', or nullptr if it is in top level code.
+    const Function_Symbol *function_at(uintptr_t offset) const;
+
+    // Records that the code from `offset' on came from `src_loc', until the next location.
+    // Offsets are expected to mostly increase, adding one at or before the last drops the
+    // locations after it since that code was rewritten by the peephole.
+    void add_location(uintptr_t offset, const Source_Location &src_loc);
+    // Encodes the locations added into `line_table', `code_size' is the size of the finished
+    // bytecode. No more locations can be added after this.
+    void finish(size_t code_size);
+
+    // Where the instruction at `offset' came from. False if there's no location for it.
+    bool location_at(uintptr_t offset, Code_Location &location) const;
+    // "name (file:line:char)" of the function and location `offset' is in, or an empty string
+    // if nothing is known about it.
+    std::string describe(uintptr_t offset) const;
+
+    std::vector<std::string> files;
+    // One entry per change of location in order of offset, each is varints of
+    //   (offset delta << 1 | file changed), [file index if changed], line delta, char
+    // where the deltas are from the previous entry.
+    std::vector<byte> line_table;
+
+private:
+    struct Row
+    {
+        uintptr_t offset;
+        uint32_t file;
+        int line_no;
+        int char_no;
+    };
+    std::vector<Row> m_rows;
+    std::map<std::string, uint32_t> m_file_index;
+};
+
+#endif /* MALANG_VM_DEBUG_INFO_HPP */
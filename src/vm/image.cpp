@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include "image.hpp"
+#include "instruction.hpp"
+#include "../type_map.hpp"
+#include "../ir/bound_function_map.hpp"
+#include "../platform/map_file.hpp"
+
+// An image is the header followed by its sections, each of which starts 8 byte aligned so the
+// code and the strings can be used where they are mapped. Everything is in the byte order of the
+// machine that wrote it, the same as the operands in the bytecode.
+static const char image_magic[4] = {'\x7f', 'M', 'B', 'C'};
+
+enum class Image_Section
+{
+    Code,
+    // the count, then the offset into the image and the length of each, then their chars
+    Strings,
+    // the count, then each type by its token, see write_types
+    Types,
+    Natives,
+    Debug_Info,
+    Dead_Locals,
+    NUM_SECTIONS
+};
+static constexpr size_t num_sections = static_cast<size_t>(Image_Section::NUM_SECTIONS);
+
+enum class Image_Type_Kind : byte
+{
+    Plain,
+    Function,
+    Array,
+};
+
+struct Image_Header
+{
+    char magic[4];
+    uint32_t version;
+    // the bytecode is only understood by a mal with the same instructions
+    uint32_t num_instructions;
+    struct
+    {
+        uint32_t offset;
+        uint32_t size;
+    } sections[num_sections];
+};
+
+struct Image_Writer
+{
+    std::vector<byte> out;
+
+    template<typename T>
+    void put(T value)
+    {
+        auto p = reinterpret_cast<const byte*>(&value);
+        out.insert(out.end(), p, p + sizeof(value));
+    }
+    void put(const std::string &s)
+    {
+        put<uint32_t>(s.size());
+        out.insert(out.end(), s.begin(), s.end());
+    }
+    void begin(Image_Header &header, Image_Section section)
+    {
+        while (out.size() % 8)
+        {
+            out.push_back(0);
+        }
+        header.sections[static_cast<size_t>(section)].offset = out.size();
+    }
+    void end(Image_Header &header, Image_Section section)
+    {
+        auto &&s = header.sections[static_cast<size_t>(section)];
+        s.size = out.size() - s.offset;
+    }
+};
+
+// Reads one section, running past its end reads zeros and clears `ok'.
+struct Image_Reader
+{
+    const byte *at;
+    const byte *end;
+    bool ok;
+
+    template<typename T>
+    T get()
+    {
+        T value{};
+        if (static_cast<size_t>(end - at) < sizeof(value))
+        {
+            ok = false;
+            at = end;
+            return value;
+        }
+        memcpy(&value, at, sizeof(value));
+        at += sizeof(value);
+        return value;
+    }
+    std::string get_string()
+    {
+        auto n = get<uint32_t>();
+        if (static_cast<size_t>(end - at) < n)
+        {
+            ok = false;
+            at = end;
+            return {};
+        }
+        std::string s(reinterpret_cast<const char*>(at), n);
+        at += n;
+        return s;
+    }
+};
+
+static void write_types(Image_Writer &w, Type_Map &types)
+{
+    auto n = types.num_types();
+    w.put<uint32_t>(n);
+    for (Type_Token i = 0; i < n; ++i)
+    {
+        auto t = types.get_type(i);
+        w.put(t->name());
+        if (auto fn = dynamic_cast<Function_Type_Info*>(t))
+        {
+            w.put<byte>(static_cast<byte>(Image_Type_Kind::Function));
+            w.put<byte>(fn->is_native());
+            w.put<Type_Token>(fn->return_type()->type_token());
+            w.put<uint32_t>(fn->parameter_types().size());
+            for (auto &&p : fn->parameter_types())
+            {
+                w.put<Type_Token>(p->type_token());
+            }
+        }
+        else if (auto arr = dynamic_cast<Array_Type_Info*>(t))
+        {
+            w.put<byte>(static_cast<byte>(Image_Type_Kind::Array));
+            w.put<Type_Token>(arr->of_type()->type_token());
+        }
+        else
+        {
+            // an alias has the fields of what it's aliased to
+            auto alias = t->aliased_to() != t;
+            w.put<byte>(static_cast<byte>(Image_Type_Kind::Plain));
+            w.put<Type_Token>(alias ? t->aliased_to()->type_token() : -1);
+            w.put<uint32_t>(alias ? 0 : t->fields().size());
+            for (size_t f = 0; !alias && f < t->fields().size(); ++f)
+            {
+                auto field = t->fields()[f];
+                w.put(field->name());
+                w.put<Type_Token>(field->type()->type_token());
+                w.put<byte>(field->is_readonly() | field->is_private() << 1);
+            }
+        }
+    }
+}
+
+bool Malang_Image::write(const std::string &path, Type_Map &types) const
+{
+    Image_Writer w;
+    Image_Header header{};
+    memcpy(header.magic, image_magic, sizeof(header.magic));
+    header.version = version;
+    header.num_instructions = static_cast<uint32_t>(Instruction::INSTRUCTION_ENUM_SIZE);
+    w.out.resize(sizeof(header));
+
+    w.begin(header, Image_Section::Code);
+    w.out.insert(w.out.end(), code, code + code_size);
+    w.end(header, Image_Section::Code);
+
+    w.begin(header, Image_Section::Strings);
+    w.put<uint32_t>(string_constants.size());
+    auto chars = w.out.size() + string_constants.size() * 2 * sizeof(uint32_t);
+    for (auto &&sc : string_constants)
+    {
+        w.put<uint32_t>(chars);
+        w.put<uint32_t>(sc.length());
+        chars += sc.length();
+    }
+    for (auto &&sc : string_constants)
+    {
+        w.out.insert(w.out.end(), sc.data(), sc.data() + sc.length());
+    }
+    w.end(header, Image_Section::Strings);
+
+    w.begin(header, Image_Section::Types);
+    write_types(w, types);
+    w.end(header, Image_Section::Types);
+
+    w.begin(header, Image_Section::Natives);
+    w.put<uint32_t>(native_names.size());
+    for (auto &&name : native_names)
+    {
+        w.put(name);
+    }
+    w.end(header, Image_Section::Natives);
+
+    w.begin(header, Image_Section::Debug_Info);
+    w.put<uint32_t>(debug_info.files.size());
+    for (auto &&file : debug_info.files)
+    {
+        w.put(file);
+    }
+    w.put<uint32_t>(debug_info.line_table.size());
+    w.out.insert(w.out.end(), debug_info.line_table.begin(), debug_info.line_table.end());
+    w.put<uint32_t>(debug_info.functions.size());
+    for (auto &&fn : debug_info.functions)
+    {
+        w.put<uint32_t>(fn.begin);
+        w.put<uint32_t>(fn.end);
+        w.put(fn.name);
+        w.put(fn.src_loc.filename);
+        w.put<int32_t>(fn.src_loc.line_no);
+        w.put<int32_t>(fn.src_loc.char_no);
+    }
+    w.end(header, Image_Section::Debug_Info);
+
+    w.begin(header, Image_Section::Dead_Locals);
+    w.put<uint32_t>(dead_locals.calls.size());
+    for (auto &&call : dead_locals.calls)
+    {
+        w.put<uint32_t>(call.return_offset);
+        w.put<uint32_t>(call.first);
+    }
+    w.put<uint32_t>(dead_locals.slots.size());
+    for (auto &&slot : dead_locals.slots)
+    {
+        w.put<uint16_t>(slot);
+    }
+    w.end(header, Image_Section::Dead_Locals);
+
+    memcpy(w.out.data(), &header, sizeof(header));
+    auto file = fopen(path.c_str(), "wb");
+    auto wrote = file && fwrite(w.out.data(), 1, w.out.size(), file) == w.out.size();
+    if (file && fclose(file) != 0)
+    {
+        wrote = false;
+    }
+    if (!wrote)
+    {
+        printf("couldn't write the image `%s'\n", path.c_str());
+    }
+    return wrote;
+}
+
+Malang_Image::~Malang_Image()
+{
+    // the strings borrowing from the mapping go first
+    string_constants.clear();
+    plat::unmap_file(m_mapping, m_mapping_size);
+}
+
+bool Malang_Image::is_image(const std::string &path)
+{
+    auto file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        return false;
+    }
+    char magic[sizeof(image_magic)];
+    auto is = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+        && memcmp(magic, image_magic, sizeof(magic)) == 0;
+    fclose(file);
+    return is;
+}
+
+// What's needed of a type that isn't the runtime's once all of them are declared.
+struct Image_Plain_Type
+{
+    struct Field
+    {
+        std::string name;
+        Type_Token type;
+        byte flags;
+    };
+    Type_Token aliased_to = -1;
+    std::vector<Field> fields;
+};
+
+// Declares the types of the image past those the runtime declared, which have to be the same as
+// the ones in the image. Fields may be of types declared after them so they're added last.
+static bool read_types(Image_Reader &r, Type_Map &types)
+{
+    auto n = r.get<uint32_t>();
+    auto num_runtime = types.num_types();
+    auto known = [&](Type_Token t) { return t >= 0 && t < types.num_types(); };
+    std::vector<Image_Plain_Type> plain(n);
+    for (uint32_t i = 0; i < n && r.ok; ++i)
+    {
+        auto name = r.get_string();
+        auto kind = static_cast<Image_Type_Kind>(r.get<byte>());
+        auto runtime = static_cast<Type_Token>(i) < num_runtime;
+        Type_Info *t = nullptr;
+        switch (kind)
+        {
+            case Image_Type_Kind::Function:
+            {
+                auto is_native = r.get<byte>() != 0;
+                auto ret = r.get<Type_Token>();
+                auto num_params = r.get<uint32_t>();
+                if (num_params > n)
+                {
+                    return false;
+                }
+                Types params(num_params);
+                for (auto &&p : params)
+                {
+                    auto token = r.get<Type_Token>();
+                    p = known(token) ? types.get_type(token) : nullptr;
+                }
+                if (runtime)
+                {
+                    t = types.get_type(i);
+                }
+                else if (r.ok && !name.empty() && known(ret)
+                         && std::find(params.begin(), params.end(), nullptr) == params.end())
+                {
+                    t = types.declare_function(name, params, types.get_type(ret), is_native);
+                }
+            } break;
+            case Image_Type_Kind::Array:
+            {
+                auto of = r.get<Type_Token>();
+                if (runtime)
+                {
+                    t = types.get_type(i);
+                }
+                else if (r.ok && known(of))
+                {
+                    t = types.get_array_type(types.get_type(of));
+                }
+            } break;
+            case Image_Type_Kind::Plain:
+            {
+                auto &&p = plain[i];
+                p.aliased_to = r.get<Type_Token>();
+                auto num_fields = r.get<uint32_t>();
+                for (uint32_t f = 0; f < num_fields && r.ok; ++f)
+                {
+                    auto field_name = r.get_string();
+                    auto type = r.get<Type_Token>();
+                    p.fields.push_back({field_name, type, r.get<byte>()});
+                }
+                if (runtime)
+                {
+                    t = types.get_type(i);
+                    if (p.aliased_to < 0 && t->fields().size() != p.fields.size())
+                    {
+                        t = nullptr;
+                    }
+                }
+                else if (r.ok && !name.empty() && !types.get_type(name))
+                {
+                    t = types.declare_type(name, nullptr);
+                }
+            } break;
+            default:
+                break;
+        }
+        if (!r.ok || !t || t->type_token() != static_cast<Type_Token>(i) || t->name() != name)
+        {
+            return false;
+        }
+    }
+    for (uint32_t i = num_runtime; i < n && r.ok; ++i)
+    {
+        auto &&p = plain[i];
+        auto t = types.get_type(i);
+        if (p.aliased_to >= 0)
+        {
+            if (!known(p.aliased_to))
+            {
+                return false;
+            }
+            t->aliased_to(types.get_type(p.aliased_to));
+        }
+        for (auto &&f : p.fields)
+        {
+            if (!known(f.type))
+            {
+                return false;
+            }
+            auto field = new Field_Info{f.name, types.get_type(f.type), (f.flags & 1) != 0, (f.flags & 2) != 0};
+            if (!t->add_field(field))
+            {
+                delete field;
+                return false;
+            }
+        }
+    }
+    return r.ok;
+}
+
+bool Malang_Image::read(const std::string &path, Type_Map &types, const Bound_Function_Map &natives,
+                        std::vector<Native_Code> &code_natives)
+{
+    m_mapping = plat::map_file(path.c_str(), m_mapping_size);
+    if (!m_mapping)
+    {
+        printf("couldn't read the image `%s'\n", path.c_str());
+        return false;
+    }
+    auto data = static_cast<byte*>(m_mapping);
+    auto size = m_mapping_size;
+    Image_Header header;
+    if (size < sizeof(header) || memcmp(data, image_magic, sizeof(image_magic)) != 0)
+    {
+        printf("`%s' isn't a malang image\n", path.c_str());
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.version != version
+        || header.num_instructions != static_cast<uint32_t>(Instruction::INSTRUCTION_ENUM_SIZE))
+    {
+        printf("`%s' was compiled by a different version of mal, it has to be compiled again\n",
+               path.c_str());
+        return false;
+    }
+    Image_Reader sections[num_sections];
+    for (size_t i = 0; i < num_sections; ++i)
+    {
+        auto &&s = header.sections[i];
+        if (s.offset > size || s.size > size - s.offset)
+        {
+            printf("`%s' is cut short\n", path.c_str());
+            return false;
+        }
+        sections[i] = {data + s.offset, data + s.offset + s.size, true};
+    }
+    auto section = [&](Image_Section s) -> Image_Reader& { return sections[static_cast<size_t>(s)]; };
+
+    auto &&c = section(Image_Section::Code);
+    if (c.at == c.end || static_cast<Instruction>(c.end[-1]) != Instruction::Halt)
+    {
+        printf("`%s' is cut short\n", path.c_str());
+        return false;
+    }
+    code = data + header.sections[static_cast<size_t>(Image_Section::Code)].offset;
+    code_size = c.end - c.at;
+
+    auto &&s = section(Image_Section::Strings);
+    auto num_strings = s.get<uint32_t>();
+    for (uint32_t i = 0; i < num_strings && s.ok; ++i)
+    {
+        auto offset = s.get<uint32_t>();
+        auto length = s.get<uint32_t>();
+        if (offset > size || length > size - offset || length > INT32_MAX)
+        {
+            s.ok = false;
+            break;
+        }
+        string_constants.push_back(String_Constant::borrow(reinterpret_cast<Char*>(data + offset), length));
+    }
+
+    if (!read_types(section(Image_Section::Types), types))
+    {
+        printf("`%s' has types that don't match the runtime of this mal\n", path.c_str());
+        return false;
+    }
+
+    auto &&n = section(Image_Section::Natives);
+    std::unordered_map<std::string, size_t> runtime_natives;
+    auto names = natives.native_names();
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        runtime_natives[names[i]] = i;
+    }
+    auto all = natives.natives();
+    auto num_natives = n.get<uint32_t>();
+    for (uint32_t i = 0; i < num_natives && n.ok; ++i)
+    {
+        native_names.push_back(n.get_string());
+        auto found = runtime_natives.find(native_names.back());
+        if (found == runtime_natives.end())
+        {
+            printf("`%s' calls the native `%s' that this mal doesn't have\n",
+                   path.c_str(), native_names.back().c_str());
+            return false;
+        }
+        code_natives.push_back(all[found->second]);
+    }
+
+    auto &&d = section(Image_Section::Debug_Info);
+    auto num_files = d.get<uint32_t>();
+    for (uint32_t i = 0; i < num_files && d.ok; ++i)
+    {
+        debug_info.files.push_back(d.get_string());
+    }
+    auto line_table_size = d.get<uint32_t>();
+    for (uint32_t i = 0; i < line_table_size && d.ok; ++i)
+    {
+        debug_info.line_table.push_back(d.get<byte>());
+    }
+    auto num_functions = d.get<uint32_t>();
+    for (uint32_t i = 0; i < num_functions && d.ok; ++i)
+    {
+        Function_Symbol fn;
+        fn.begin = d.get<uint32_t>();
+        fn.end = d.get<uint32_t>();
+        fn.name = d.get_string();
+        fn.src_loc.source_code = nullptr;
+        fn.src_loc.filename = d.get_string();
+        fn.src_loc.line_no = d.get<int32_t>();
+        fn.src_loc.char_no = d.get<int32_t>();
+        debug_info.functions.push_back(fn);
+    }
+
+    auto &&l = section(Image_Section::Dead_Locals);
+    auto num_calls = l.get<uint32_t>();
+    for (uint32_t i = 0; i < num_calls && l.ok; ++i)
+    {
+        auto return_offset = l.get<uint32_t>();
+        dead_locals.calls.push_back({return_offset, l.get<uint32_t>()});
+    }
+    auto num_slots = l.get<uint32_t>();
+    for (uint32_t i = 0; i < num_slots && l.ok; ++i)
+    {
+        dead_locals.slots.push_back(l.get<uint16_t>());
+    }
+    for (size_t i = 0; i < dead_locals.calls.size() && l.ok; ++i)
+    {
+        auto &&call = dead_locals.calls[i];
+        auto next = i + 1 < dead_locals.calls.size() ? dead_locals.calls[i + 1] : Dead_Locals::Call{UINT32_MAX, num_slots};
+        l.ok = call.return_offset < next.return_offset && call.first <= next.first && next.first <= num_slots;
+    }
+
+    if (!s.ok || !n.ok || !d.ok || !l.ok)
+    {
+        printf("`%s' is cut short\n", path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef MALANG_VM_IMAGE_HPP
+#define MALANG_VM_IMAGE_HPP
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include "runtime/primitive_types.hpp"
+#include "debug_info.hpp"
+#include "dead_locals.hpp"
+
+// A program compiled ahead of time and saved to disk so it can be run without the front end, see
+// `mal --compile'. It's what Malang_VM is given: the bytecode, the string constants, the types
+// the code allocates by token with the layouts of their fields and the natives it calls by
+// index. The natives are saved by name since their indexes depend on the runtime that made it.
+struct Malang_Image
+{
+    // Bumped whenever the layout of an image or what the bytecode in it means changes.
+    static constexpr uint32_t version = 2;
+
+    ~Malang_Image();
+    Malang_Image() = default;
+    Malang_Image(const Malang_Image&) = delete;
+    Malang_Image &operator=(const Malang_Image&) = delete;
+
+    // Once it's read the code is run from the mapping of the file and the string constants
+    // borrow their chars from it, nothing is copied. So the processes running an image share its
+    // pages except those with calls the VM has quickened.
+    byte *code = nullptr;
+    size_t code_size = 0;
+    std::vector<String_Constant> string_constants;
+    Debug_Info debug_info;
+    Dead_Locals dead_locals;
+    // By the index the code calls them by, see Bound_Function_Map::native_names.
+    std::vector<std::string> native_names;
+
+    // Whether `path' starts like an image does.
+    static bool is_image(const std::string &path);
+
+    // Writes the image with every type in `types'. Says why and returns false if it couldn't.
+    bool write(const std::string &path, struct Type_Map &types) const;
+    // Maps an image made by write into an image that's empty. `types' and `natives' are the
+    // runtime's, the types in the image past those are declared in `types' and what the code
+    // calls is put in `code_natives' by the index it calls them by. Says why and returns false if
+    // it couldn't, or if the image was made by a different version of mal.
+    bool read(const std::string &path, struct Type_Map &types, const struct Bound_Function_Map &natives,
+              std::vector<Native_Code> &code_natives);
+
+private:
+    void *m_mapping = nullptr;
+    size_t m_mapping_size = 0;
+};
+
+#endif /* MALANG_VM_IMAGE_HPP */
@@ -12,3 +12,77 @@ std::string to_string(Instruction instruction)
     }
     return "Out of range";
 }
+
+Operands operands_of(Instruction ins)
+{
+    switch (ins)
+    {
+        default:
+            return Operands::None;
+        case Instruction::Literal_8:
+        case Instruction::Return:
+            return Operands::Byte;
+        case Instruction::Literal_16:
+        case Instruction::Load_Local:
+        case Instruction::Store_Local:
+        case Instruction::Load_Field:
+        case Instruction::Store_Field:
+        case Instruction::Drop_N:
+        case Instruction::Load_Local_0_Field:
+        case Instruction::Fixnum_Increment_Store_Local:
+        case Instruction::Fixnum_Increment_Local:
+            return Operands::Short;
+        case Instruction::Alloc_Locals:
+        case Instruction::Fixnum_Add_Locals:
+        case Instruction::Fixnum_Subtract_Locals:
+            return Operands::Short_Short;
+        case Instruction::Load_Global:
+        case Instruction::Store_Global:
+        case Instruction::Literal_32:
+        case Instruction::Call_Native:
+        case Instruction::Array_New:
+        case Instruction::Alloc_Object:
+        case Instruction::Load_String_Constant:
+            return Operands::Int;
+        case Instruction::Literal_value:
+            return Operands::Value;
+        case Instruction::Branch:
+        case Instruction::Branch_If_False_Or_Pop:
+        case Instruction::Branch_If_True_Or_Pop:
+        case Instruction::Pop_Branch_If_False:
+        case Instruction::Pop_Branch_If_True:
+        case Instruction::Fixnum_Equals_Pop_Branch_If_False:
+        case Instruction::Fixnum_Not_Equals_Pop_Branch_If_False:
+        case Instruction::Fixnum_Greater_Than_Pop_Branch_If_False:
+        case Instruction::Fixnum_Greater_Than_Equals_Pop_Branch_If_False:
+        case Instruction::Fixnum_Less_Than_Pop_Branch_If_False:
+        case Instruction::Fixnum_Less_Than_Equals_Pop_Branch_If_False:
+            return Operands::Branch;
+        case Instruction::Call:
+            return Operands::Call;
+        case Instruction::Call_Dyn:
+        case Instruction::Call_Dyn_Mono:
+        case Instruction::Call_Dyn_Poly:
+            return Operands::Call_Cache;
+        case Instruction::Tail_Call:
+            return Operands::Tail_Call;
+    }
+}
+
+size_t instruction_size(Instruction ins)
+{
+    switch (operands_of(ins))
+    {
+        case Operands::None:        return 1;
+        case Operands::Byte:        return 1 + sizeof(int8_t);
+        case Operands::Short:       return 1 + sizeof(int16_t);
+        case Operands::Short_Short: return 1 + 2*sizeof(int16_t);
+        case Operands::Int:         return 1 + sizeof(int32_t);
+        case Operands::Value:       return 1 + sizeof(uint64_t);
+        case Operands::Branch:      return 1 + sizeof(int32_t);
+        case Operands::Call:        return 1 + sizeof(int32_t);
+        case Operands::Call_Cache:  return 1 + sizeof(int32_t);
+        case Operands::Tail_Call:   return 1 + sizeof(int32_t) + sizeof(int16_t);
+    }
+    return 1;
+}
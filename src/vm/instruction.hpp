@@ -2,6 +2,8 @@
 #define MALANG_VM_INSTRUCTION_HPP
 
 #include <string>
+#include <stddef.h>
+#include <stdint.h>
 
 using byte = unsigned char;
 
@@ -15,4 +17,23 @@ enum class Instruction : byte
 
 std::string to_string(Instruction instruction);
 
+// The operands that follow an instruction in the bytecode.
+enum class Operands
+{
+    None,
+    Byte,
+    Short,
+    Short_Short,
+    Int,
+    Value,
+    Branch,     // 32-bit offset relative to the start of the instruction
+    Call,       // 32-bit offset from the start of the code
+    Call_Cache, // 32-bit offset from the start of the code a dynamic call last went to, or -1
+    Tail_Call,  // 32-bit offset from the start of the code, 16-bit number of arguments
+};
+
+Operands operands_of(Instruction instruction);
+// Size in bytes of the instruction and its operands.
+size_t instruction_size(Instruction instruction);
+
 #endif /* MALANG_VM_INSTRUCTION_HPP */ 
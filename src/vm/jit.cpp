@@ -0,0 +1,1238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <initializer_list>
+#include "jit.hpp"
+#include "vm.hpp"
+#include "instruction.hpp"
+#include "runtime/gc.hpp"
+#include "../platform/stack.hpp"
+
+#if JIT_SUPPORTED
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * Native code keeps the VM's state in callee saved registers so it survives calls back into
+ * the VM:
+ *   rbx  data stack pointer, one past the top like `sp' in run_code
+ *   r12  Malang_VM *
+ *   r13  the current locals frame, like `fast_locals' in run_code
+ *   r14  Malang_Value::fixnum_tag
+ *   r15  how many more calls native code can make, see X64::prologue
+ * The helpers below are what the native code calls for anything that isn't a handful of
+ * machine instructions. They take and return the data stack pointer and keep vm->data_top in
+ * sync around anything that may look at the data stack.
+ */
+
+static inline
+void sync_out(Malang_VM *vm, Malang_Value *sp)
+{
+    vm->data_top = sp - vm->data_stack;
+}
+
+static inline
+Malang_Value *sync_in(Malang_VM *vm)
+{
+    return vm->data_stack + vm->data_top;
+}
+
+// `calls_left' is the caller's r15.
+static
+Malang_Value *jit_call(Malang_VM *vm, Malang_Value *sp, Malang_Value *locals, int32_t offset,
+                       uintptr_t calls_left)
+{
+    auto outer = vm->jit->native_depth;
+    vm->jit->native_depth = vm->max_call_depth - vm->call_frames_top - calls_left;
+    if (auto native = vm->jit->enter(offset))
+    {
+        sp = native(vm, sp, locals);
+    }
+    else
+    {
+        sync_out(vm, sp);
+        vm->call_interpreted(offset, locals);
+        sp = sync_in(vm);
+    }
+    vm->jit->native_depth = outer;
+    return sp;
+}
+
+// The native code to tail call for the function at `offset', or null to call it through
+// jit_call instead.
+static
+Jit_Code jit_tail_call_target(Malang_VM *vm, int32_t offset)
+{
+    return vm->jit->enter(offset);
+}
+
+static
+Malang_Value *jit_call_dyn(Malang_VM *vm, Malang_Value *sp, Malang_Value *locals,
+                           uintptr_t calls_left)
+{
+    auto offset = (--sp)->as_fixnum();
+    return jit_call(vm, sp, locals, offset, calls_left);
+}
+
+// Native code that would be called deeper than the VM's call depth calls this instead, so it
+// panics where the interpreter runs into the call stack's guard page.
+static
+void jit_call_stack_overflow(Malang_VM *vm, Malang_Value *sp)
+{
+    sync_out(vm, sp);
+    vm->panic("call stack overflowed.");
+}
+
+static
+Malang_Value *jit_call_native(Malang_VM *vm, Malang_Value *sp, int32_t idx)
+{
+    sync_out(vm, sp);
+    vm->natives[idx](*vm);
+    return sync_in(vm);
+}
+
+static
+Malang_Value *jit_call_native_dyn(Malang_VM *vm, Malang_Value *sp, int32_t)
+{
+    auto idx = (--sp)->as_fixnum();
+    return jit_call_native(vm, sp, idx);
+}
+
+static
+Malang_Value *jit_store_global(Malang_VM *vm, Malang_Value *sp, int32_t n)
+{
+    if (n > (int)vm->globals_top)
+    {
+        vm->globals_top = n;
+    }
+    vm->globals[n] = *--sp;
+    return sp;
+}
+
+static
+Malang_Value *jit_alloc_object(Malang_VM *vm, Malang_Value *sp, int32_t type_token)
+{
+    sync_out(vm, sp);
+    auto obj_ref = vm->gc->allocate_object(type_token);
+    *sp++ = obj_ref;
+    return sp;
+}
+
+static
+Malang_Value *jit_array_new(Malang_VM *vm, Malang_Value *sp, int32_t type_token)
+{
+    auto size = (--sp)->as_fixnum();
+    sync_out(vm, sp);
+    auto array_ref = vm->gc->allocate_array(type_token, size);
+    *sp++ = array_ref;
+    return sp;
+}
+
+static
+Malang_Value *jit_array_load_checked(Malang_VM *vm, Malang_Value *sp, int32_t offset)
+{
+    auto idx = (--sp)->as_fixnum();
+    auto obj_ref = (--sp)->as_object();
+    assert(obj_ref->object_tag == Array);
+    auto array = reinterpret_cast<Malang_Array*>(obj_ref);
+    if (idx < 0 || idx >= array->size)
+    {
+        sync_out(vm, sp);
+        vm->panic_at(offset, "array load: index out of bounds. index was %d but array size is %d",
+                     idx, array->size);
+    }
+    *sp++ = array->data[idx];
+    return sp;
+}
+
+static
+Malang_Value *jit_array_store_checked(Malang_VM *vm, Malang_Value *sp, int32_t offset)
+{
+    auto value = *--sp;
+    auto idx = (--sp)->as_fixnum();
+    auto obj_ref = (--sp)->as_object();
+    assert(obj_ref->object_tag == Array);
+    auto array = reinterpret_cast<Malang_Array*>(obj_ref);
+    if (idx < 0 || idx >= array->size)
+    {
+        sync_out(vm, sp);
+        vm->panic_at(offset, "array store: index out of bounds. index was %d but array size is %d",
+                     idx, array->size);
+    }
+    array->data[idx] = value;
+    return sp;
+}
+
+static
+Malang_Value *jit_array_load_unchecked(Malang_VM *, Malang_Value *sp, int32_t)
+{
+    auto idx = (--sp)->as_fixnum();
+    auto obj_ref = (--sp)->as_object();
+    assert(obj_ref->object_tag == Array);
+    auto array = reinterpret_cast<Malang_Array*>(obj_ref);
+    *sp++ = array->data[idx];
+    return sp;
+}
+
+static
+Malang_Value *jit_array_store_unchecked(Malang_VM *, Malang_Value *sp, int32_t)
+{
+    auto value = *--sp;
+    auto idx = (--sp)->as_fixnum();
+    auto obj_ref = (--sp)->as_object();
+    assert(obj_ref->object_tag == Array);
+    auto array = reinterpret_cast<Malang_Array*>(obj_ref);
+    array->data[idx] = value;
+    return sp;
+}
+
+static
+Malang_Value *jit_array_length(Malang_VM *, Malang_Value *sp, int32_t)
+{
+    auto obj_ref = (--sp)->as_object();
+    assert(obj_ref->object_tag == Array);
+    auto array = reinterpret_cast<Malang_Array*>(obj_ref);
+    *sp++ = array->size;
+    return sp;
+}
+
+static
+Malang_Value *jit_buffer_new(Malang_VM *vm, Malang_Value *sp, int32_t)
+{
+    auto size = (--sp)->as_fixnum();
+    sync_out(vm, sp);
+    auto buff_ref = vm->gc->allocate_buffer(size);
+    *sp++ = buff_ref;
+    return sp;
+}
+
+static
+Malang_Value *jit_buffer_copy(Malang_VM *vm, Malang_Value *sp, int32_t)
+{
+    auto obj_a = (--sp)->as_object();
+    assert(obj_a->object_tag == Buffer);
+    auto buff_a = reinterpret_cast<Malang_Buffer*>(obj_a);
+    sync_out(vm, sp);
+    auto obj_b = vm->gc->allocate_buffer(buff_a->size);
+    auto buff_b = reinterpret_cast<Malang_Buffer*>(obj_b);
+    memcpy(buff_b->data, buff_a->data, buff_b->size);
+    *sp++ = obj_b;
+    return sp;
+}
+
+static
+Malang_Value *jit_buffer_load_checked(Malang_VM *vm, Malang_Value *sp, int32_t offset)
+{
+    auto idx = (--sp)->as_fixnum();
+    auto obj_ref = (--sp)->as_object();
+    assert(obj_ref->object_tag == Buffer);
+    auto buffer = reinterpret_cast<Malang_Buffer*>(obj_ref);
+    if (idx < 0 || idx >= buffer->size)
+    {
+        sync_out(vm, sp);
+        vm->panic_at(offset, "buffer load: index out of bounds. index was %d but buffer size is %d",
+                     idx, buffer->size);
+    }
+    *sp++ = buffer->data[idx];
+    return sp;
+}
+
+static
+Malang_Value *jit_buffer_store_checked(Malang_VM *vm, Malang_Value *sp, int32_t offset)
+{
+    auto value = (--sp)->as_fixnum();
+    auto idx = (--sp)->as_fixnum();
+    auto obj_ref = (--sp)->as_object();
+    assert(obj_ref->object_tag == Buffer);
+    auto buffer = reinterpret_cast<Malang_Buffer*>(obj_ref);
+    if (idx < 0 || idx >= buffer->size)
+    {
+        sync_out(vm, sp);
+        vm->panic_at(offset, "buffer store: index out of bounds. index was %d but buffer size is %d",
+                     idx, buffer->size);
+    }
+    buffer->data[idx] = value;
+    return sp;
+}
+
+static
+Malang_Value *jit_buffer_load_unchecked(Malang_VM *, Malang_Value *sp, int32_t)
+{
+    auto idx = (--sp)->as_fixnum();
+    auto obj_ref = (--sp)->as_object();
+    assert(obj_ref->object_tag == Buffer);
+    auto buffer = reinterpret_cast<Malang_Buffer*>(obj_ref);
+    *sp++ = buffer->data[idx];
+    return sp;
+}
+
+static
+Malang_Value *jit_buffer_store_unchecked(Malang_VM *, Malang_Value *sp, int32_t)
+{
+    auto value = (--sp)->as_fixnum();
+    auto idx = (--sp)->as_fixnum();
+    auto obj_ref = (--sp)->as_object();
+    assert(obj_ref->object_tag == Buffer);
+    auto buffer = reinterpret_cast<Malang_Buffer*>(obj_ref);
+    buffer->data[idx] = value;
+    return sp;
+}
+
+static
+Malang_Value *jit_buffer_length(Malang_VM *, Malang_Value *sp, int32_t)
+{
+    auto obj = (--sp)->as_object();
+    assert(obj->object_tag == Buffer);
+    auto buff = reinterpret_cast<Malang_Buffer*>(obj);
+    *sp++ = buff->size;
+    return sp;
+}
+
+static
+Malang_Value *jit_double_modulo(Malang_VM *, Malang_Value *sp, int32_t)
+{
+    auto b = (--sp)->as_double();
+    auto a = (--sp)->as_double();
+    *sp++ = std::fmod(a, b);
+    return sp;
+}
+
+// `operand' is the instruction's operand, or for an instruction that may panic its offset into
+// the bytecode so the panic says where it came from like the interpreter's does.
+using Jit_Helper = Malang_Value *(*)(Malang_VM *vm, Malang_Value *sp, int32_t operand);
+
+// Instructions that are nothing more than a call to their helper.
+static
+Jit_Helper helper_for(Instruction ins)
+{
+    switch (ins)
+    {
+        default:                                   return nullptr;
+        case Instruction::Call_Native:             return jit_call_native;
+        case Instruction::Call_Native_Dyn:         return jit_call_native_dyn;
+        case Instruction::Store_Global:            return jit_store_global;
+        case Instruction::Double_Modulo:           return jit_double_modulo;
+        case Instruction::Alloc_Object:            return jit_alloc_object;
+        case Instruction::Array_New:               return jit_array_new;
+        case Instruction::Array_Load_Checked:      return jit_array_load_checked;
+        case Instruction::Array_Store_Checked:     return jit_array_store_checked;
+        case Instruction::Array_Load_Unchecked:    return jit_array_load_unchecked;
+        case Instruction::Array_Store_Unchecked:   return jit_array_store_unchecked;
+        case Instruction::Array_Length:            return jit_array_length;
+        case Instruction::Buffer_New:              return jit_buffer_new;
+        case Instruction::Buffer_Copy:             return jit_buffer_copy;
+        case Instruction::Buffer_Load_Checked:     return jit_buffer_load_checked;
+        case Instruction::Buffer_Store_Checked:    return jit_buffer_store_checked;
+        case Instruction::Buffer_Load_Unchecked:   return jit_buffer_load_unchecked;
+        case Instruction::Buffer_Store_Unchecked:  return jit_buffer_store_unchecked;
+        case Instruction::Buffer_Length:           return jit_buffer_length;
+    }
+}
+
+static
+bool panics_at_offset(Instruction ins)
+{
+    switch (ins)
+    {
+        case Instruction::Array_Load_Checked:
+        case Instruction::Array_Store_Checked:
+        case Instruction::Buffer_Load_Checked:
+        case Instruction::Buffer_Store_Checked:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static
+bool has_template(Instruction ins)
+{
+    switch (ins)
+    {
+        case Instruction::Halt:
+        case Instruction::Get_Type:
+        case Instruction::INSTRUCTION_ENUM_SIZE:
+            return false;
+        default:
+            return ins < Instruction::INSTRUCTION_ENUM_SIZE;
+    }
+}
+
+template<typename T>
+static inline
+T fetch(const byte *p)
+{
+    return *reinterpret_cast<const T*>(p);
+}
+
+// Condition codes
+static constexpr byte cc_b  = 0x2;
+static constexpr byte cc_ae = 0x3;
+static constexpr byte cc_e  = 0x4;
+static constexpr byte cc_ne = 0x5;
+static constexpr byte cc_a  = 0x7;
+static constexpr byte cc_ns = 0x9;
+static constexpr byte cc_p  = 0xa;
+static constexpr byte cc_np = 0xb;
+static constexpr byte cc_l  = 0xc;
+static constexpr byte cc_ge = 0xd;
+static constexpr byte cc_le = 0xe;
+static constexpr byte cc_g  = 0xf;
+
+// The machine code templates. Each method emits a fixed sequence of x86-64 instructions, the
+// disassembly is in the comments.
+struct X64
+{
+    std::vector<byte> code;
+    // The VM the code is for, r12 points to it.
+    const Malang_VM *vm;
+
+    explicit X64(const Malang_VM *vm = nullptr)
+        : vm(vm)
+    {}
+
+    // Where `field' of `vm' is relative to r12.
+    int32_t vm_field(const void *field) const
+    {
+        return static_cast<const char*>(field) - reinterpret_cast<const char*>(vm);
+    }
+
+    size_t here() const { return code.size(); }
+
+    void emit(std::initializer_list<byte> bytes)
+    {
+        code.insert(code.end(), bytes);
+    }
+    void emit32(int32_t n)
+    {
+        auto p = reinterpret_cast<const byte*>(&n);
+        code.insert(code.end(), p, p + sizeof(n));
+    }
+    void emit64(uint64_t n)
+    {
+        auto p = reinterpret_cast<const byte*>(&n);
+        code.insert(code.end(), p, p + sizeof(n));
+    }
+    void patch32(size_t at, int32_t n)
+    {
+        memcpy(&code[at], &n, sizeof(n));
+    }
+
+    // Native calls don't push call frames, instead r15 counts down the calls left until the
+    // VM's call depth and running out panics like the interpreter's call stack overflowing.
+    // C++ enters native code at the start, which works r15 out from the call frames and
+    // `native_depth', and native code calls the returned offset with its r15.
+    size_t prologue(const uintptr_t *native_depth)
+    {
+        push_registers();
+        emit({0x4c, 0x8b, 0xbf});       // mov r15, [rdi + max_call_depth]
+        emit32(vm_field(&vm->max_call_depth));
+        emit({0x4c, 0x2b, 0xbf});       // sub r15, [rdi + call_frames_top]
+        emit32(vm_field(&vm->call_frames_top));
+        mov_rax(reinterpret_cast<uintptr_t>(native_depth));
+        emit({0x4c, 0x2b, 0x38});       // sub r15, [rax]
+        emit({0xeb, 9});                // jmp past the pushes below
+        auto inner = here();
+        push_registers();
+        emit({0x49, 0x89, 0xfc});       // mov r12, rdi
+        emit({0x48, 0x89, 0xf3});       // mov rbx, rsi
+        emit({0x49, 0x89, 0xd5});       // mov r13, rdx
+        emit({0x49, 0xbe});             // mov r14, fixnum_tag
+        emit64(Malang_Value::fixnum_tag);
+        emit({0x49, 0xff, 0xcf});       // dec r15
+        auto within = jcc(cc_ns);
+        call_args_vm_sp();
+        call(reinterpret_cast<uintptr_t>(jit_call_stack_overflow));
+        patch32(within, static_cast<int32_t>(here() - (within + 4)));
+        return inner;
+    }
+    void push_registers()
+    {
+        emit({0x53});                   // push rbx
+        emit({0x41, 0x54});             // push r12
+        emit({0x41, 0x55});             // push r13
+        emit({0x41, 0x56});             // push r14
+        emit({0x41, 0x57});             // push r15
+    }
+    void epilogue()
+    {
+        emit({0x48, 0x89, 0xd8});       // mov rax, rbx
+        emit({0x41, 0x5f});             // pop r15
+        emit({0x41, 0x5e});             // pop r14
+        emit({0x41, 0x5d});             // pop r13
+        emit({0x41, 0x5c});             // pop r12
+        emit({0x5b});                   // pop rbx
+        emit({0xc3});                   // ret
+    }
+
+    // Leaves like epilogue but jumps to rax with the registers the arguments were set in
+    // instead of returning. rax is where C++ enters native code, so `native_depth' is set to
+    // the depth of our caller first.
+    void tail_jump_rax(const uintptr_t *native_depth)
+    {
+        emit({0x4d, 0x8b, 0x84, 0x24}); // mov r8, [r12 + max_call_depth]
+        emit32(vm_field(&vm->max_call_depth));
+        emit({0x4d, 0x2b, 0x84, 0x24}); // sub r8, [r12 + call_frames_top]
+        emit32(vm_field(&vm->call_frames_top));
+        emit({0x4d, 0x29, 0xf8});       // sub r8, r15
+        emit({0x49, 0xff, 0xc8});       // dec r8
+        emit({0x48, 0xb9});             // mov rcx, native_depth
+        emit64(reinterpret_cast<uintptr_t>(native_depth));
+        emit({0x4c, 0x89, 0x01});       // mov [rcx], r8
+        emit({0x41, 0x5f});             // pop r15
+        emit({0x41, 0x5e});             // pop r14
+        emit({0x41, 0x5d});             // pop r13
+        emit({0x41, 0x5c});             // pop r12
+        emit({0x5b});                   // pop rbx
+        emit({0xff, 0xe0});             // jmp rax
+    }
+
+    void push_rax()
+    {
+        emit({0x48, 0x89, 0x03});       // mov [rbx], rax
+        emit({0x48, 0x83, 0xc3, 0x08}); // add rbx, 8
+    }
+    void pop_rax()
+    {
+        emit({0x48, 0x83, 0xeb, 0x08}); // sub rbx, 8
+        emit({0x48, 0x8b, 0x03});       // mov rax, [rbx]
+    }
+    void tag_fixnum_rax()
+    {
+        emit({0x4c, 0x09, 0xf0});       // or rax, r14
+    }
+    void mov_rax(uint64_t n)
+    {
+        emit({0x48, 0xb8});             // mov rax, n
+        emit64(n);
+    }
+    void push_value(Malang_Value value)
+    {
+        mov_rax(value.bits());
+        push_rax();
+    }
+    void drop(int32_t n)
+    {
+        emit({0x48, 0x81, 0xeb});       // sub rbx, n*8
+        emit32(n * sizeof(Malang_Value));
+    }
+
+    void load_local(int32_t n)
+    {
+        emit({0x49, 0x8b, 0x85});       // mov rax, [r13 + n*8]
+        emit32(n * sizeof(Malang_Value));
+    }
+    void store_local(int32_t n)
+    {
+        emit({0x49, 0x89, 0x85});       // mov [r13 + n*8], rax
+        emit32(n * sizeof(Malang_Value));
+    }
+    void load_local_fixnum(byte op, int32_t n)
+    {
+        emit({0x41, op, 0x85});         // <op> eax, [r13 + n*8]
+        emit32(n * sizeof(Malang_Value));
+    }
+
+    // rax holds an object reference, leaves its fields pointer in rax
+    void fields_of_rax()
+    {
+        emit({0x48, 0xb9});             // mov rcx, ~object_tag
+        emit64(~Malang_Value::object_tag);
+        emit({0x48, 0x21, 0xc8});       // and rax, rcx
+        emit({0x48, 0x8b, 0x80});       // mov rax, [rax + offsetof(fields)]
+        emit32(offsetof(Malang_Object_Body, fields));
+    }
+
+    // `op' is the opcode of `<op> eax, r/m32', both operands are popped
+    void fixnum_binary(std::initializer_list<byte> op)
+    {
+        emit({0x8b, 0x43, 0xf0});       // mov eax, [rbx-16]
+        emit(op); emit({0x43, 0xf8});   // <op> eax, [rbx-8]
+        tag_fixnum_rax();
+        emit({0x48, 0x89, 0x43, 0xf0}); // mov [rbx-16], rax
+        emit({0x48, 0x83, 0xeb, 0x08}); // sub rbx, 8
+    }
+    void fixnum_divide(bool modulo)
+    {
+        emit({0x8b, 0x43, 0xf0});       // mov eax, [rbx-16]
+        emit({0x99});                   // cdq
+        emit({0xf7, 0x7b, 0xf8});       // idiv dword [rbx-8]
+        if (modulo)
+        {
+            emit({0x89, 0xd0});         // mov eax, edx
+        }
+        tag_fixnum_rax();
+        emit({0x48, 0x89, 0x43, 0xf0}); // mov [rbx-16], rax
+        emit({0x48, 0x83, 0xeb, 0x08}); // sub rbx, 8
+    }
+    // `ext' is the /digit of the shift: 4 for shl, 7 for sar
+    void fixnum_shift(byte ext)
+    {
+        emit({0x8b, 0x4b, 0xf8});       // mov ecx, [rbx-8]
+        emit({0x8b, 0x43, 0xf0});       // mov eax, [rbx-16]
+        emit({0xd3, static_cast<byte>(0xc0 | ext << 3)}); // shl/sar eax, cl
+        tag_fixnum_rax();
+        emit({0x48, 0x89, 0x43, 0xf0}); // mov [rbx-16], rax
+        emit({0x48, 0x83, 0xeb, 0x08}); // sub rbx, 8
+    }
+    // `ext' is the /digit of the unary op: 3 for neg, 2 for not
+    void fixnum_unary(byte ext)
+    {
+        emit({0x8b, 0x43, 0xf8});       // mov eax, [rbx-8]
+        emit({0xf7, static_cast<byte>(0xc0 | ext << 3)}); // neg/not eax
+        tag_fixnum_rax();
+        emit({0x48, 0x89, 0x43, 0xf8}); // mov [rbx-8], rax
+    }
+    void fixnum_compare()
+    {
+        emit({0x8b, 0x43, 0xf0});       // mov eax, [rbx-16]
+        emit({0x3b, 0x43, 0xf8});       // cmp eax, [rbx-8]
+    }
+    // `cc' is the condition code as used by setcc and jcc
+    void fixnum_compare_push(byte cc)
+    {
+        fixnum_compare();
+        setcc_al(cc);
+        push_al_over_operands();
+    }
+    void setcc_al(byte cc)
+    {
+        emit({0x0f, static_cast<byte>(0x90 | cc), 0xc0}); // setcc al
+    }
+    // al is the result of a comparison of the 2 values on top of the stack, replaces them
+    void push_al_over_operands()
+    {
+        emit({0x0f, 0xb6, 0xc0});       // movzx eax, al
+        tag_fixnum_rax();
+        emit({0x48, 0x89, 0x43, 0xf0}); // mov [rbx-16], rax
+        emit({0x48, 0x83, 0xeb, 0x08}); // sub rbx, 8
+    }
+
+    // `op' is the opcode of `<op>sd xmm0, m64', both operands are popped
+    void double_binary(byte op)
+    {
+        emit({0xf3, 0x0f, 0x7e, 0x43, 0xf0});   // movq xmm0, [rbx-16]
+        emit({0xf2, 0x0f, op, 0x43, 0xf8});     // <op>sd xmm0, [rbx-8]
+        emit({0x66, 0x0f, 0xd6, 0x43, 0xf0});   // movq [rbx-16], xmm0
+        emit({0x48, 0x83, 0xeb, 0x08});         // sub rbx, 8
+    }
+    // Unordered compares set CF, so a < b is done as b > a to be false for NaN like in C++.
+    void double_compare_push(Instruction ins)
+    {
+        auto swapped = ins == Instruction::Double_Less_Than
+            || ins == Instruction::Double_Less_Than_Equals;
+        byte first = swapped ? 0xf8 : 0xf0;
+        byte second = swapped ? 0xf0 : 0xf8;
+        emit({0xf3, 0x0f, 0x7e, 0x43, first});  // movq xmm0, [rbx-16]    ; or [rbx-8]
+        emit({0x66, 0x0f, 0x2e, 0x43, second}); // ucomisd xmm0, [rbx-8]  ; or [rbx-16]
+        switch (ins)
+        {
+            default:
+                assert(false);
+            case Instruction::Double_Greater_Than:
+            case Instruction::Double_Less_Than:
+                setcc_al(cc_a);
+                break;
+            case Instruction::Double_Greater_Than_Equals:
+            case Instruction::Double_Less_Than_Equals:
+                setcc_al(cc_ae);
+                break;
+            case Instruction::Double_Equals:
+                setcc_al(cc_e);
+                emit({0x0f, 0x90 | cc_np, 0xc1});   // setnp cl
+                emit({0x20, 0xc8});                 // and al, cl
+                break;
+            case Instruction::Double_Not_Equals:
+                setcc_al(cc_ne);
+                emit({0x0f, 0x90 | cc_p, 0xc1});    // setp cl
+                emit({0x08, 0xc8});                 // or al, cl
+                break;
+        }
+        push_al_over_operands();
+    }
+
+    // The jumps leave their rel32 to be patched, returning where it is.
+    size_t jmp()
+    {
+        emit({0xe9});                   // jmp rel32
+        emit32(0);
+        return here() - 4;
+    }
+    size_t jcc(byte cc)
+    {
+        emit({0x0f, static_cast<byte>(0x80 | cc)}); // jcc rel32
+        emit32(0);
+        return here() - 4;
+    }
+
+    void call_args_vm_sp()
+    {
+        emit({0x4c, 0x89, 0xe7});       // mov rdi, r12
+        emit({0x48, 0x89, 0xde});       // mov rsi, rbx
+    }
+    void call_args_vm_sp_locals()
+    {
+        call_args_vm_sp();
+        emit({0x4c, 0x89, 0xea});       // mov rdx, r13
+    }
+    void call(uintptr_t address)
+    {
+        mov_rax(address);
+        emit({0xff, 0xd0});             // call rax
+    }
+    void call_helper(Jit_Helper helper, int32_t operand)
+    {
+        call_args_vm_sp();
+        emit({0xba});                   // mov edx, operand
+        emit32(operand);
+        call(reinterpret_cast<uintptr_t>(helper));
+        emit({0x48, 0x89, 0xc3});       // mov rbx, rax
+    }
+};
+
+Malang_JIT::~Malang_JIT()
+{
+    for (auto &&m : m_mappings)
+    {
+        munmap(m.first, m.second);
+    }
+    plat::stack_release(m_stack);
+}
+
+Malang_JIT::Malang_JIT(Malang_VM *vm)
+    : native_depth(0)
+    , num_compiled(0)
+    , num_failed(0)
+    , m_vm(vm)
+    , m_functions(vm->code_size)
+{
+    // Native code recurses on the machine stack, so it gets a stack of its own that is sized
+    // for the VM's call depth and guarded like the VM's stacks. The prologue keeps native code
+    // within the call depth. Helpers that call back into the interpreter run on it too, hence
+    // the generous size per call and the room left for the helpers.
+    auto size = vm->max_call_depth * stack_per_call + (256 << 10);
+    m_stack = plat::stack_reserve(size, 64 << 10, "native stack");
+    if (!m_stack)
+    {
+        printf("couldn't reserve %zu bytes for the JIT's native stack, try a smaller --call-depth\n", size);
+        exit(-1);
+    }
+    auto lo = reinterpret_cast<uintptr_t>(m_stack);
+    auto hi = lo + size;
+
+    // run(code, vm, sp, locals) calls `code' on the native stack unless it's already on it,
+    // which it is when the interpreter was entered from native code.
+    X64 x;
+    x.mov_rax(lo);
+    x.emit({0x48, 0x39, 0xc4});         // cmp rsp, rax
+    auto below = x.jcc(cc_b);
+    x.mov_rax(hi);
+    x.emit({0x48, 0x39, 0xc4});         // cmp rsp, rax
+    auto above = x.jcc(cc_ae);
+    x.emit({0xff, 0xe1});               // jmp rcx
+    x.patch32(below, static_cast<int32_t>(x.here() - (below + 4)));
+    x.patch32(above, static_cast<int32_t>(x.here() - (above + 4)));
+    x.emit({0x55});                     // push rbp
+    x.emit({0x48, 0x89, 0xe5});         // mov rbp, rsp
+    x.mov_rax(hi);
+    x.emit({0x48, 0x89, 0xc4});         // mov rsp, rax
+    x.emit({0xff, 0xd1});               // call rcx
+    x.emit({0x48, 0x89, 0xec});         // mov rsp, rbp
+    x.emit({0x5d});                     // pop rbp
+    x.emit({0xc3});                     // ret
+    m_run = reinterpret_cast<Run_Stub>(install(x.code));
+    if (!m_run)
+    {
+        printf("couldn't map the JIT's entry stub\n");
+        abort();
+    }
+}
+
+Jit_Code Malang_JIT::compile(uintptr_t entry)
+{
+    auto &&f = m_functions[entry];
+    auto code = m_vm->code;
+    auto size = m_vm->code_size;
+    auto fail = [&]() -> Jit_Code {
+        f.failed = true;
+        ++num_failed;
+        return nullptr;
+    };
+
+    // The body of the function is every instruction reachable from `entry' without following
+    // calls.
+    std::vector<bool> in_body(size, false);
+    std::vector<uintptr_t> work{entry};
+    while (!work.empty())
+    {
+        auto offset = work.back();
+        work.pop_back();
+        while (offset < size && !in_body[offset])
+        {
+            auto ins = static_cast<Instruction>(code[offset]);
+            if (!has_template(ins))
+            {
+                return fail();
+            }
+            in_body[offset] = true;
+            if (operands_of(ins) == Operands::Branch)
+            {
+                work.push_back(offset + fetch<int32_t>(code + offset + 1));
+            }
+            if (ins == Instruction::Branch
+                || ins == Instruction::Return
+                || ins == Instruction::Return_Fast
+                || ins == Instruction::Tail_Call)
+            {
+                break;
+            }
+            offset += instruction_size(ins);
+        }
+        if (offset >= size)
+        {
+            return fail();
+        }
+    }
+
+    struct Fixup
+    {
+        size_t at;
+        uintptr_t destination;
+    };
+    std::vector<Fixup> fixups;
+    std::vector<int32_t> native_at(size, -1);
+    X64 x{m_vm};
+    // where native code calls this function, see X64::prologue
+    size_t inner = 0;
+
+    auto call_code = [&](int32_t target) {
+        x.call_args_vm_sp_locals();
+        if (static_cast<uintptr_t>(target) == entry)
+        {
+            x.emit({0xe8});                       // call <this function>
+            x.emit32(static_cast<int32_t>(inner - (x.here() + 4)));
+        }
+        else if (auto native = m_functions[target].inner)
+        {
+            x.call(reinterpret_cast<uintptr_t>(native));
+        }
+        else
+        {
+            x.emit({0xb9});                       // mov ecx, target
+            x.emit32(target);
+            x.emit({0x4d, 0x89, 0xf8});           // mov r8, r15
+            x.call(reinterpret_cast<uintptr_t>(jit_call));
+        }
+        x.emit({0x48, 0x89, 0xc3});               // mov rbx, rax
+    };
+    auto call_code_dyn = [&]() {
+        x.call_args_vm_sp_locals();
+        x.emit({0x4c, 0x89, 0xf9});               // mov rcx, r15
+        x.call(reinterpret_cast<uintptr_t>(jit_call_dyn));
+        x.emit({0x48, 0x89, 0xc3});               // mov rbx, rax
+    };
+    // Compares the top of the stack to the fixnum an inline cache holds, returns the jump
+    // taken when they differ.
+    auto guard_top = [&](int32_t cached) {
+        x.mov_rax(Malang_Value(static_cast<Fixnum>(cached)).bits());
+        x.emit({0x48, 0x39, 0x43, 0xf8});         // cmp [rbx-8], rax
+        return x.jcc(cc_ne);
+    };
+
+    inner = x.prologue(&native_depth);
+    auto first = std::find(in_body.begin(), in_body.end(), true) - in_body.begin();
+    if (static_cast<uintptr_t>(first) != entry)
+    {
+        fixups.push_back({x.jmp(), entry});
+    }
+    for (uintptr_t offset = first; offset < size; ++offset)
+    {
+        if (!in_body[offset])
+        {
+            continue;
+        }
+        native_at[offset] = x.here();
+        auto ip = code + offset;
+        auto ins = static_cast<Instruction>(*ip);
+        auto op8 = fetch<byte>(ip + 1);
+        auto op16 = fetch<int16_t>(ip + 1);
+        auto op16_2 = fetch<int16_t>(ip + 3);
+        auto op32 = fetch<int32_t>(ip + 1);
+        auto branch_to = offset + op32;
+        auto falls_through = true;
+
+        if (auto helper = helper_for(ins))
+        {
+            x.call_helper(helper, panics_at_offset(ins) ? static_cast<int32_t>(offset) : op32);
+        }
+        else switch (ins)
+        {
+            default:
+                printf("jit: no template for %s\n", to_string(ins).c_str());
+                abort();
+            case Instruction::Fixnum_Add:      x.fixnum_binary({0x03}); break;
+            case Instruction::Fixnum_Subtract: x.fixnum_binary({0x2b}); break;
+            case Instruction::Fixnum_Multiply: x.fixnum_binary({0x0f, 0xaf}); break;
+            case Instruction::Fixnum_And:      x.fixnum_binary({0x23}); break;
+            case Instruction::Fixnum_Or:       x.fixnum_binary({0x0b}); break;
+            case Instruction::Fixnum_Xor:      x.fixnum_binary({0x33}); break;
+            case Instruction::Fixnum_Divide:   x.fixnum_divide(false); break;
+            case Instruction::Fixnum_Modulo:   x.fixnum_divide(true); break;
+            case Instruction::Fixnum_Left_Shift:  x.fixnum_shift(4); break;
+            case Instruction::Fixnum_Right_Shift: x.fixnum_shift(7); break;
+            case Instruction::Fixnum_Equals:              x.fixnum_compare_push(cc_e); break;
+            case Instruction::Fixnum_Not_Equals:          x.fixnum_compare_push(cc_ne); break;
+            case Instruction::Fixnum_Greater_Than:        x.fixnum_compare_push(cc_g); break;
+            case Instruction::Fixnum_Greater_Than_Equals: x.fixnum_compare_push(cc_ge); break;
+            case Instruction::Fixnum_Less_Than:           x.fixnum_compare_push(cc_l); break;
+            case Instruction::Fixnum_Less_Than_Equals:    x.fixnum_compare_push(cc_le); break;
+            case Instruction::Fixnum_Negate: x.fixnum_unary(3); break;
+            case Instruction::Fixnum_Invert: x.fixnum_unary(2); break;
+            case Instruction::Double_Add:      x.double_binary(0x58); break;
+            case Instruction::Double_Subtract: x.double_binary(0x5c); break;
+            case Instruction::Double_Multiply: x.double_binary(0x59); break;
+            case Instruction::Double_Divide:   x.double_binary(0x5e); break;
+            case Instruction::Double_Equals:
+            case Instruction::Double_Not_Equals:
+            case Instruction::Double_Greater_Than:
+            case Instruction::Double_Greater_Than_Equals:
+            case Instruction::Double_Less_Than:
+            case Instruction::Double_Less_Than_Equals:
+                x.double_compare_push(ins);
+                break;
+            case Instruction::Double_Negate:
+                x.emit({0x48, 0x8b, 0x43, 0xf8});       // mov rax, [rbx-8]
+                x.emit({0x48, 0x0f, 0xba, 0xf8, 0x3f}); // btc rax, 63
+                x.emit({0x48, 0x89, 0x43, 0xf8});       // mov [rbx-8], rax
+                break;
+            case Instruction::Fixnum_To_Double:
+                x.emit({0xf2, 0x0f, 0x2a, 0x43, 0xf8}); // cvtsi2sd xmm0, dword [rbx-8]
+                x.emit({0x66, 0x0f, 0xd6, 0x43, 0xf8}); // movq [rbx-8], xmm0
+                break;
+            case Instruction::Noop:
+                break;
+            case Instruction::Literal_8:
+                x.push_value(static_cast<Fixnum>(op8));
+                break;
+            case Instruction::Literal_16:
+                x.push_value(static_cast<Fixnum>(op16));
+                break;
+            case Instruction::Literal_32:
+                x.push_value(static_cast<Fixnum>(op32));
+                break;
+            case Instruction::Literal_value:
+                x.push_value(Malang_Value::with_bits(fetch<uint64_t>(ip + 1)));
+                break;
+            case Instruction::Literal_Double_m1: x.push_value(-1.0); break;
+            case Instruction::Literal_Double_0:  x.push_value(0.0); break;
+            case Instruction::Literal_Double_1:  x.push_value(1.0); break;
+            case Instruction::Literal_Double_2:  x.push_value(2.0); break;
+            case Instruction::Literal_Fixnum_m1: x.push_value(-1); break;
+            case Instruction::Literal_Fixnum_0:  x.push_value(0); break;
+            case Instruction::Literal_Fixnum_1:  x.push_value(1); break;
+            case Instruction::Literal_Fixnum_2:  x.push_value(2); break;
+            case Instruction::Literal_Fixnum_3:  x.push_value(3); break;
+            case Instruction::Literal_Fixnum_4:  x.push_value(4); break;
+            case Instruction::Literal_Fixnum_5:  x.push_value(5); break;
+            case Instruction::Load_String_Constant:
+                // string constants are unmanaged and never move
+                x.push_value(m_vm->string_constants_objects[op32]);
+                break;
+            case Instruction::Branch:
+                fixups.push_back({x.jmp(), branch_to});
+                falls_through = false;
+                break;
+            case Instruction::Pop_Branch_If_False:
+            case Instruction::Pop_Branch_If_True:
+                x.emit({0x48, 0x83, 0xeb, 0x08}); // sub rbx, 8
+                x.emit({0x83, 0x3b, 0x00});       // cmp dword [rbx], 0
+                fixups.push_back({x.jcc(ins == Instruction::Pop_Branch_If_False ? cc_e : cc_ne),
+                                  branch_to});
+                break;
+            case Instruction::Branch_If_False_Or_Pop:
+            case Instruction::Branch_If_True_Or_Pop:
+                x.emit({0x83, 0x7b, 0xf8, 0x00}); // cmp dword [rbx-8], 0
+                fixups.push_back({x.jcc(ins == Instruction::Branch_If_False_Or_Pop ? cc_e : cc_ne),
+                                  branch_to});
+                x.drop(1);
+                break;
+            case Instruction::Fixnum_Equals_Pop_Branch_If_False:
+            case Instruction::Fixnum_Not_Equals_Pop_Branch_If_False:
+            case Instruction::Fixnum_Greater_Than_Pop_Branch_If_False:
+            case Instruction::Fixnum_Greater_Than_Equals_Pop_Branch_If_False:
+            case Instruction::Fixnum_Less_Than_Pop_Branch_If_False:
+            case Instruction::Fixnum_Less_Than_Equals_Pop_Branch_If_False:
+            {
+                byte cc_false =
+                    ins == Instruction::Fixnum_Equals_Pop_Branch_If_False ? cc_ne :
+                    ins == Instruction::Fixnum_Not_Equals_Pop_Branch_If_False ? cc_e :
+                    ins == Instruction::Fixnum_Greater_Than_Pop_Branch_If_False ? cc_le :
+                    ins == Instruction::Fixnum_Greater_Than_Equals_Pop_Branch_If_False ? cc_l :
+                    ins == Instruction::Fixnum_Less_Than_Pop_Branch_If_False ? cc_ge :
+                    cc_g;
+                x.fixnum_compare();
+                x.emit({0x48, 0x8d, 0x5b, 0xf0}); // lea rbx, [rbx-16]   ; leaves the flags alone
+                fixups.push_back({x.jcc(cc_false), branch_to});
+                break;
+            }
+            case Instruction::Return:
+                // the results go where the locals started, the caller's r13 comes back with the
+                // epilogue
+                for (int i = 0; i < op8; ++i)
+                {
+                    x.emit({0x48, 0x8b, 0x83});   // mov rax, [rbx - (n-i)*8]
+                    x.emit32(-(op8 - i) * static_cast<int32_t>(sizeof(Malang_Value)));
+                    x.store_local(i);
+                }
+                x.emit({0x49, 0x8d, 0x9d});       // lea rbx, [r13 + n*8]
+                x.emit32(op8 * sizeof(Malang_Value));
+                x.epilogue();
+                falls_through = false;
+                break;
+            case Instruction::Return_Fast:
+                x.epilogue();
+                falls_through = false;
+                break;
+            case Instruction::Tail_Call:
+            {
+                // the arguments are moved to where the locals start and become the callee's
+                auto n_args = fetch<int16_t>(ip + 5);
+                for (int i = 0; i < n_args; ++i)
+                {
+                    x.emit({0x48, 0x8b, 0x83});   // mov rax, [rbx - (n_args-i)*8]
+                    x.emit32(-(n_args - i) * static_cast<int32_t>(sizeof(Malang_Value)));
+                    x.store_local(i);
+                }
+                x.emit({0x49, 0x8d, 0x9d});       // lea rbx, [r13 + n_args*8]
+                x.emit32(n_args * sizeof(Malang_Value));
+                falls_through = false;
+                if (static_cast<uintptr_t>(op32) == entry)
+                {
+                    fixups.push_back({x.jmp(), entry});
+                    break;
+                }
+                // jump to the callee's native code as if it was called by our caller, or call
+                // it and return its results when it isn't compiled
+                x.emit({0x4c, 0x89, 0xe7});       // mov rdi, r12
+                x.emit({0xbe});                   // mov esi, target
+                x.emit32(op32);
+                x.call(reinterpret_cast<uintptr_t>(jit_tail_call_target));
+                x.emit({0x48, 0x85, 0xc0});       // test rax, rax
+                auto interpreted = x.jcc(cc_e);
+                x.call_args_vm_sp_locals();
+                x.tail_jump_rax(&native_depth);
+                x.patch32(interpreted, static_cast<int32_t>(x.here() - (interpreted + 4)));
+                call_code(op32);
+                x.epilogue();
+                break;
+            }
+            case Instruction::Call:
+                call_code(op32);
+                break;
+            case Instruction::Call_Dyn:
+            case Instruction::Call_Dyn_Poly:
+                call_code_dyn();
+                break;
+            case Instruction::Call_Dyn_Mono:
+            {
+                // called like Call while the popped value is the cached one
+                auto miss = guard_top(op32);
+                x.drop(1);
+                call_code(op32);
+                auto done = x.jmp();
+                x.patch32(miss, static_cast<int32_t>(x.here() - (miss + 4)));
+                call_code_dyn();
+                x.patch32(done, static_cast<int32_t>(x.here() - (done + 4)));
+                break;
+            }
+            case Instruction::Load_Global:
+                x.mov_rax(reinterpret_cast<uintptr_t>(&m_vm->globals[op32]));
+                x.emit({0x48, 0x8b, 0x00});       // mov rax, [rax]
+                x.push_rax();
+                break;
+            case Instruction::Load_Field:
+                x.pop_rax();
+                x.fields_of_rax();
+                x.emit({0x48, 0x8b, 0x80});       // mov rax, [rax + idx*8]
+                x.emit32(op16 * sizeof(Malang_Value));
+                x.push_rax();
+                break;
+            case Instruction::Load_Local_0_Field:
+                x.load_local(0);
+                x.fields_of_rax();
+                x.emit({0x48, 0x8b, 0x80});       // mov rax, [rax + idx*8]
+                x.emit32(op16 * sizeof(Malang_Value));
+                x.push_rax();
+                break;
+            case Instruction::Store_Field:
+                x.emit({0x48, 0x8b, 0x43, 0xf8}); // mov rax, [rbx-8]
+                x.emit({0x48, 0x8b, 0x53, 0xf0}); // mov rdx, [rbx-16]
+                x.drop(2);
+                x.fields_of_rax();
+                x.emit({0x48, 0x89, 0x90});       // mov [rax + idx*8], rdx
+                x.emit32(op16 * sizeof(Malang_Value));
+                break;
+            case Instruction::Load_Local:
+                x.load_local(op16);
+                x.push_rax();
+                break;
+            case Instruction::Load_Local_0: case Instruction::Load_Local_1:
+            case Instruction::Load_Local_2: case Instruction::Load_Local_3:
+            case Instruction::Load_Local_4: case Instruction::Load_Local_5:
+            case Instruction::Load_Local_6: case Instruction::Load_Local_7:
+            case Instruction::Load_Local_8: case Instruction::Load_Local_9:
+                x.load_local(static_cast<int>(ins) - static_cast<int>(Instruction::Load_Local_0));
+                x.push_rax();
+                break;
+            case Instruction::Store_Local:
+                x.pop_rax();
+                x.store_local(op16);
+                break;
+            case Instruction::Store_Local_0: case Instruction::Store_Local_1:
+            case Instruction::Store_Local_2: case Instruction::Store_Local_3:
+            case Instruction::Store_Local_4: case Instruction::Store_Local_5:
+            case Instruction::Store_Local_6: case Instruction::Store_Local_7:
+            case Instruction::Store_Local_8: case Instruction::Store_Local_9:
+                x.pop_rax();
+                x.store_local(static_cast<int>(ins) - static_cast<int>(Instruction::Store_Local_0));
+                break;
+            case Instruction::Alloc_Locals:
+                // the locals start at the arguments on the data stack and go in r13
+                x.emit({0x4c, 0x8d, 0xab});       // lea r13, [rbx - n_args*8]
+                x.emit32(-op16 * static_cast<int32_t>(sizeof(Malang_Value)));
+                x.emit({0x49, 0x8d, 0x9d});       // lea rbx, [r13 + n*8]
+                x.emit32(op16_2 * sizeof(Malang_Value));
+                break;
+            case Instruction::Dup_1:
+                x.emit({0x48, 0x8b, 0x43, 0xf8}); // mov rax, [rbx-8]
+                x.push_rax();
+                break;
+            case Instruction::Dup_2:
+                x.emit({0x48, 0x8b, 0x43, 0xf0}); // mov rax, [rbx-16]
+                x.emit({0x48, 0x8b, 0x4b, 0xf8}); // mov rcx, [rbx-8]
+                x.emit({0x48, 0x89, 0x03});       // mov [rbx], rax
+                x.emit({0x48, 0x89, 0x4b, 0x08}); // mov [rbx+8], rcx
+                x.emit({0x48, 0x83, 0xc3, 0x10}); // add rbx, 16
+                break;
+            case Instruction::Swap_1:
+                x.emit({0x48, 0x8b, 0x43, 0xf0}); // mov rax, [rbx-16]
+                x.emit({0x48, 0x8b, 0x4b, 0xf8}); // mov rcx, [rbx-8]
+                x.emit({0x48, 0x89, 0x4b, 0xf0}); // mov [rbx-16], rcx
+                x.emit({0x48, 0x89, 0x43, 0xf8}); // mov [rbx-8], rax
+                break;
+            case Instruction::Over_1:
+                x.emit({0x48, 0x8b, 0x43, 0xf0}); // mov rax, [rbx-16]
+                x.push_rax();
+                break;
+            case Instruction::Drop_1: x.drop(1); break;
+            case Instruction::Drop_2: x.drop(2); break;
+            case Instruction::Drop_3: x.drop(3); break;
+            case Instruction::Drop_4: x.drop(4); break;
+            case Instruction::Drop_N: x.drop(op16); break;
+            case Instruction::Fixnum_Add_Locals:
+                x.load_local_fixnum(0x8b, op16);  // mov eax, [r13 + n*8]
+                x.load_local_fixnum(0x03, op16_2);// add eax, [r13 + m*8]
+                x.tag_fixnum_rax();
+                x.push_rax();
+                break;
+            case Instruction::Fixnum_Subtract_Locals:
+                x.load_local_fixnum(0x8b, op16);  // mov eax, [r13 + n*8]
+                x.load_local_fixnum(0x2b, op16_2);// sub eax, [r13 + m*8]
+                x.tag_fixnum_rax();
+                x.push_rax();
+                break;
+            case Instruction::Fixnum_Increment_Store_Local:
+                x.emit({0x48, 0x83, 0xeb, 0x08}); // sub rbx, 8
+                x.emit({0x8b, 0x03});             // mov eax, [rbx]
+                x.emit({0xff, 0xc0});             // inc eax
+                x.tag_fixnum_rax();
+                x.store_local(op16);
+                break;
+            case Instruction::Fixnum_Increment_Local:
+                x.load_local_fixnum(0x8b, op16);  // mov eax, [r13 + n*8]
+                x.emit({0xff, 0xc0});             // inc eax
+                x.tag_fixnum_rax();
+                x.store_local(op16);
+                break;
+        }
+
+        // keep the fall through when the next instruction of the body isn't next in the code
+        if (falls_through)
+        {
+            auto next = offset + instruction_size(ins);
+            auto next_in_body = offset + 1;
+            while (next_in_body < size && !in_body[next_in_body])
+            {
+                ++next_in_body;
+            }
+            if (next != next_in_body)
+            {
+                fixups.push_back({x.jmp(), next});
+            }
+        }
+    }
+    for (auto &&fix : fixups)
+    {
+        assert(native_at[fix.destination] >= 0);
+        x.patch32(fix.at, native_at[fix.destination] - static_cast<int32_t>(fix.at + 4));
+    }
+
+    auto mem = install(x.code);
+    if (!mem)
+    {
+        return fail();
+    }
+    ++num_compiled;
+    f.native = reinterpret_cast<Jit_Code>(mem);
+    f.inner = static_cast<byte*>(mem) + inner;
+    return f.native;
+}
+
+void *Malang_JIT::install(const std::vector<byte> &code)
+{
+    // Code is written before the pages are made executable so they're never both.
+    auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    auto map_size = (code.size() + page_size - 1) / page_size * page_size;
+    auto mem = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    memcpy(mem, code.data(), code.size());
+    if (mprotect(mem, map_size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(mem, map_size);
+        return nullptr;
+    }
+    m_mappings.push_back({mem, map_size});
+    return mem;
+}
+
+#else
+
+Malang_JIT::~Malang_JIT()
+{}
+
+Malang_JIT::Malang_JIT(Malang_VM *vm)
+    : native_depth(0)
+    , num_compiled(0)
+    , num_failed(0)
+    , m_vm(vm)
+    , m_functions(vm->code_size)
+    , m_run(nullptr)
+    , m_stack(nullptr)
+{}
+
+Jit_Code Malang_JIT::compile(uintptr_t offset)
+{
+    m_functions[offset].failed = true;
+    ++num_failed;
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef MALANG_VM_JIT_HPP
+#define MALANG_VM_JIT_HPP
+
+#include <vector>
+#include <stdint.h>
+#include "runtime/primitive_types.hpp"
+
+using byte = unsigned char;
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+struct Malang_VM;
+
+// Native code for a single function. It's called with the data stack pointer (one past the
+// top) and the caller's locals and returns the data stack pointer after the function returned.
+using Jit_Code = Malang_Value *(*)(Malang_VM *vm, Malang_Value *sp, Malang_Value *locals);
+
+// Baseline template JIT. Once a function has been called `hot_call_threshold' times its bytecode
+// is translated one instruction at a time into x86-64 where each instruction is a fixed piece of
+// machine code. Natives, allocations and anything that may panic call back into the VM. If a
+// function uses an instruction that has no template it's left to the interpreter.
+struct Malang_JIT
+{
+    static constexpr uint32_t hot_call_threshold = 100;
+    // Bytes of native stack each call may use, --call-depth is bounded by it.
+    static constexpr size_t stack_per_call = 256;
+
+    ~Malang_JIT();
+    Malang_JIT(Malang_VM *vm);
+
+    // Called for each call to the function at `offset' into the bytecode. Returns the native
+    // code for it once it's been compiled, otherwise nullptr and the caller interprets it.
+    inline
+    Jit_Code enter(uintptr_t offset)
+    {
+        auto &&f = m_functions[offset];
+        if (f.native || f.failed || ++f.calls < hot_call_threshold)
+        {
+            return f.native;
+        }
+        return compile(offset);
+    }
+
+    // Calls native code returned by enter.
+    inline
+    Malang_Value *run(Jit_Code code, Malang_VM *vm, Malang_Value *sp, Malang_Value *locals)
+    {
+        // a tail call in native code leaves the depth it was at behind
+        auto depth = native_depth;
+        auto was_in_native = in_native;
+        in_native = true;
+        sp = m_run(vm, sp, locals, code);
+        in_native = was_in_native;
+        native_depth = depth;
+        return sp;
+    }
+
+    // How many calls deep native code entered from C++ is called at. It counts towards the
+    // VM's call depth, native calls don't push call frames.
+    uintptr_t native_depth;
+    // Set while native code runs and cleared while the interpreter runs for it. A panic can't
+    // unwind through native code, so then it aborts instead of throwing to the debugger.
+    bool in_native = false;
+    size_t num_compiled;
+    size_t num_failed;
+
+private:
+    Jit_Code compile(uintptr_t offset);
+    // Copies `code' into executable memory, returns nullptr on failure.
+    void *install(const std::vector<byte> &code);
+
+    struct Function
+    {
+        Jit_Code native = nullptr;
+        // where native code calls it
+        const byte *inner = nullptr;
+        uint32_t calls = 0;
+        bool failed = false;
+    };
+
+    Malang_VM *m_vm;
+    std::vector<Function> m_functions;
+    std::vector<std::pair<void*, size_t>> m_mappings;
+    // Switches to `m_stack' to call native code, see the constructor.
+    using Run_Stub = Malang_Value *(*)(Malang_VM*, Malang_Value*, Malang_Value*, Jit_Code);
+    Run_Stub m_run;
+    void *m_stack;
+};
+
+#endif /* MALANG_VM_JIT_HPP */
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include "op_profile.hpp"
+
+struct Pair_Count
+{
+    byte first;
+    byte second;
+    uint64_t count;
+};
+
+static std::vector<Pair_Count> sorted_pairs(const Op_Profile &p)
+{
+    std::vector<Pair_Count> res;
+    for (size_t a = 0; a < Op_Profile::n_instructions; ++a)
+    {
+        for (size_t b = 0; b < Op_Profile::n_instructions; ++b)
+        {
+            if (p.pairs[a][b])
+            {
+                res.push_back({static_cast<byte>(a), static_cast<byte>(b), p.pairs[a][b]});
+            }
+        }
+    }
+    std::stable_sort(res.begin(), res.end(),
+                     [](const Pair_Count &a, const Pair_Count &b) { return a.count > b.count; });
+    return res;
+}
+
+static std::vector<byte> sorted_instructions(const Op_Profile &p)
+{
+    std::vector<byte> res;
+    for (size_t i = 0; i < Op_Profile::n_instructions; ++i)
+    {
+        if (p.counts[i])
+        {
+            res.push_back(static_cast<byte>(i));
+        }
+    }
+    std::stable_sort(res.begin(), res.end(),
+                     [&](byte a, byte b) { return p.counts[a] > p.counts[b]; });
+    return res;
+}
+
+static const char *name_of(byte ins)
+{
+    static std::string names[Op_Profile::n_instructions];
+    auto &&name = names[ins];
+    if (name.empty())
+    {
+        name = to_string(static_cast<Instruction>(ins));
+    }
+    return name.c_str();
+}
+
+void Op_Profile::print(size_t max_pairs) const
+{
+    auto out = stderr;
+    uint64_t total = 0;
+    for (auto &&c : counts)
+    {
+        total += c;
+    }
+    if (total == 0)
+    {
+        fprintf(out, "\nop profile: no instructions ran.\n");
+        return;
+    }
+    fprintf(out, "\nop profile: %lu instructions\n", total);
+    for (auto &&ins : sorted_instructions(*this))
+    {
+        fprintf(out, "%14lu %6.2f%%  %s\n", counts[ins], 100.0 * counts[ins] / total, name_of(ins));
+    }
+
+    auto pairs = sorted_pairs(*this);
+    fprintf(out, "\nop profile: top %zu of %zu pairs\n", std::min(max_pairs, pairs.size()), pairs.size());
+    for (size_t i = 0; i < pairs.size() && i < max_pairs; ++i)
+    {
+        auto &&p = pairs[i];
+        fprintf(out, "%14lu %6.2f%%  %s -> %s\n", p.count, 100.0 * p.count / total,
+                name_of(p.first), name_of(p.second));
+    }
+}
+
+bool Op_Profile::write_json(const char *filename) const
+{
+    auto out = fopen(filename, "w");
+    if (!out)
+    {
+        return false;
+    }
+    fprintf(out, "{\n  \"instructions\": [");
+    auto sep = "";
+    for (auto &&ins : sorted_instructions(*this))
+    {
+        fprintf(out, "%s\n    {\"op\": \"%s\", \"count\": %lu}", sep, name_of(ins), counts[ins]);
+        sep = ",";
+    }
+    fprintf(out, "\n  ],\n  \"pairs\": [");
+    sep = "";
+    for (auto &&p : sorted_pairs(*this))
+    {
+        fprintf(out, "%s\n    {\"first\": \"%s\", \"second\": \"%s\", \"count\": %lu}",
+                sep, name_of(p.first), name_of(p.second), p.count);
+        sep = ",";
+    }
+    fprintf(out, "\n  ]\n}\n");
+    fclose(out);
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef MALANG_VM_OP_PROFILE_HPP
+#define MALANG_VM_OP_PROFILE_HPP
+
+#include <stdint.h>
+#include "instruction.hpp"
+
+// Counts of how many times each instruction ran and how often each pair of instructions ran
+// back to back. Only the profiling build of run_code calls `count', see Malang_VM::run.
+struct Op_Profile
+{
+    static constexpr size_t n_instructions = static_cast<size_t>(Instruction::INSTRUCTION_ENUM_SIZE);
+
+    inline
+    void count(byte ins)
+    {
+        ++counts[ins];
+        ++pairs[previous][ins];
+        previous = ins;
+    }
+
+    // Prints sorted histograms of the instructions and the `max_pairs' most common pairs to
+    // stderr, so they don't mix with the program's output.
+    void print(size_t max_pairs = 40) const;
+    // Writes both histograms in full as JSON, returns false if `filename' couldn't be written.
+    bool write_json(const char *filename) const;
+
+    uint64_t counts[n_instructions] = {};
+    // pairs[a][b] is how many times b ran right after a.
+    uint64_t pairs[n_instructions][n_instructions] = {};
+    byte previous = static_cast<byte>(Instruction::Halt);
+};
+
+#endif /* MALANG_VM_OP_PROFILE_HPP */
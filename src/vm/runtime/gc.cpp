@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include "../vm.hpp"
+#include "../dead_locals.hpp"
 #include "../../type_map.hpp"
 #include "gc.hpp"
 
@@ -156,7 +157,7 @@ void Malang_GC::mark()
         printf("GC: total allocated: %ld freed:%ld\n", m_total_allocated, m_total_freed);
     }
     _mark(m_vm->globals_top, m_vm->globals);
-    _mark(m_vm->locals_top, m_vm->locals);
+    clear_dead_locals();
     _mark(m_vm->data_top, m_vm->data_stack);
     if (m_args->noisy)
     {
@@ -166,6 +167,37 @@ void Malang_GC::mark()
 
 }
 
+// The locals of a frame waiting on a call that aren't read again once it returns are never
+// looked at again, they're cleared so what they held isn't kept alive by them. The frame that's
+// running, and those of calls that aren't known, like from natives, are marked as they are.
+void Malang_GC::clear_dead_locals()
+{
+    if (!m_vm->dead_locals)
+    {
+        return;
+    }
+    size_t cleared = 0;
+    for (uintptr_t f = 0; f < m_vm->call_frames_top; ++f)
+    {
+        auto &&frame = m_vm->call_frames[f];
+        size_t n;
+        auto dead = m_vm->dead_locals->at(m_vm->code_offset_of(frame.return_ip), n);
+        for (size_t i = 0; dead && i < n; ++i)
+        {
+            auto local = frame.locals + dead[i];
+            if (local < m_vm->data_stack + m_vm->data_top)
+            {
+                *local = Malang_Value{};
+                ++cleared;
+            }
+        }
+    }
+    if (m_args->noisy)
+    {
+        printf("GC: cleared %ld dead locals\n", cleared);
+    }
+}
+
 void Malang_GC::sweep()
 {
     assert(m_vm);
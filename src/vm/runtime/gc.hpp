@@ -66,6 +66,7 @@ private:
     void construct_buffer(Malang_Buffer &buff, Fixnum size);
 
     void mark();
+    void clear_dead_locals();
     void sweep();
     void mark_and_sweep();
     bool m_is_paused;
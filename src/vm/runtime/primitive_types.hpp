@@ -15,17 +15,22 @@ struct String_Constant
 {
     ~String_Constant()
     {
+        if (m_owned)
+        {
+            delete[] m_data;
+        }
         m_length = 0;
-        delete[] m_data;
         m_data = nullptr;
     }
 
     String_Constant()
         : m_length(0)
+        , m_owned(true)
         , m_data(nullptr)
         {}
 
     String_Constant(const std::string &string)
+        : m_owned(true)
     {
         m_length = string.size();
         if (!string.empty())
@@ -42,10 +47,22 @@ struct String_Constant
         }
     }
 
+    // Refers to the `length' chars at `data' without copying them, like the strings in the
+    // mapping of a Malang_Image. They have to outlive it and its copies, which refer to them too.
+    static String_Constant borrow(const Char *data, Fixnum length)
+    {
+        String_Constant sc;
+        sc.m_length = length;
+        sc.m_owned = false;
+        sc.m_data = const_cast<Char*>(data);
+        return sc;
+    }
+
     String_Constant(const String_Constant &copy)
     {
         m_length = copy.m_length;
-        if (m_length)
+        m_owned = copy.m_owned;
+        if (m_length && m_owned)
         {
             m_data = new Char[m_length];
             for (Fixnum i = 0; i < copy.m_length; ++i)
@@ -55,12 +72,13 @@ struct String_Constant
         }
         else
         {
-            m_data = nullptr;
+            m_data = m_length ? copy.m_data : nullptr;
         }
     }
 
     String_Constant(String_Constant &&move) noexcept
         : m_length(move.m_length)
+        , m_owned(move.m_owned)
         , m_data(move.m_data)
     {
         move.m_length = 0;
@@ -83,11 +101,15 @@ struct String_Constant
 
     String_Constant &operator=(String_Constant &&move)
     {
-        delete m_data;
+        if (m_owned)
+        {
+            delete[] m_data;
+        }
         m_length = move.m_length;
+        m_owned = move.m_owned;
         m_data = move.m_data;
         move.m_length = 0;
-        m_data = 0;
+        move.m_data = nullptr;
         return *this;
     }
 
@@ -116,6 +138,7 @@ private:
         return os;
     }
     Fixnum m_length;
+    bool m_owned;
     Char *m_data;
 };
 
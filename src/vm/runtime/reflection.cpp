@@ -218,12 +218,14 @@ void Type_Info::aliased_to(Type_Info *type)
     if (type == this)
     {
         printf("cannot alias %s itself\n", m_name.c_str());
+        fflush(stdout);
         abort();
     }
     if (m_aliased_to)
     {
         printf("cannot alias %s to %s because it is already aliased to %s\n",
                m_name.c_str(), m_aliased_to->m_name.c_str(), type->m_name.c_str());
+        fflush(stdout);
         abort();
     }
 
@@ -236,6 +238,7 @@ void Type_Info::aliased_to(Type_Info *type)
             printf("Cyclic type alias detected for %s and %s\n",
                    name().c_str(),
                    type->name().c_str());
+            fflush(stdout);
             abort();
         }
         t->m_cycle = true;
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include "sampler.hpp"
+#include "vm.hpp"
+#include "../platform/profile_timer.hpp"
+
+// The sampler on_tick records into, there's only one timer.
+static Malang_Sampler *volatile g_sampler = nullptr;
+
+Malang_Sampler::~Malang_Sampler()
+{
+    stop();
+    free(m_samples);
+}
+
+Malang_Sampler::Malang_Sampler(Malang_VM *vm, const Debug_Info *debug_info)
+    : num_samples(0)
+    , num_dropped(0)
+    , m_vm(vm)
+    , m_debug_info(debug_info)
+    , m_size(0)
+    // 128MB of address space, which is only backed by memory as samples fill it
+    , m_capacity(1 << 24)
+{
+    m_samples = static_cast<uintptr_t*>(malloc(m_capacity * sizeof(uintptr_t)));
+    if (!m_samples)
+    {
+        m_capacity = 0;
+    }
+}
+
+bool Malang_Sampler::start(unsigned hz)
+{
+    if (g_sampler || !m_vm->use_sampler)
+    {
+        return false;
+    }
+    g_sampler = this;
+    if (!plat::start_profile_timer(hz, on_tick))
+    {
+        g_sampler = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void Malang_Sampler::stop()
+{
+    if (g_sampler == this)
+    {
+        plat::stop_profile_timer();
+        g_sampler = nullptr;
+    }
+}
+
+void Malang_Sampler::on_tick()
+{
+    if (auto sampler = g_sampler)
+    {
+        sampler->take_sample();
+    }
+}
+
+// Runs in the signal handler so it only reads the VM and writes to memory that's already there.
+void Malang_Sampler::take_sample()
+{
+    // run() records a call before pushing its frame, see TRACK_CALL
+    auto top = m_vm->call_frames_top;
+    std::atomic_signal_fence(std::memory_order_acquire);
+    auto truncated = top > max_depth;
+    auto depth = truncated ? max_depth : top;
+    auto n = truncated ? depth : depth + 1;
+    if (m_size + 1 + n > m_capacity)
+    {
+        ++num_dropped;
+        return;
+    }
+    auto out = m_samples + m_size;
+    *out++ = truncated ? n | truncated_flag : n;
+    for (size_t i = 1; i <= depth; ++i)
+    {
+        *out++ = reinterpret_cast<uintptr_t>(m_vm->called_ips[top - i]);
+    }
+    if (!truncated)
+    {
+        *out++ = 0; // top level code
+    }
+    m_size += 1 + n;
+    ++num_samples;
+}
+
+bool Malang_Sampler::write_folded(const char *filename) const
+{
+    // A frame is named after the function its instruction pointer is in.
+    std::unordered_map<uintptr_t, const std::string*> name_of_ip;
+    std::unordered_map<const Function_Symbol*, std::string> name_of_fn;
+    auto name_of = [&](uintptr_t ip) -> const std::string&
+        {
+            auto &&name = name_of_ip[ip];
+            if (!name)
+            {
+                auto fn = ip ? m_debug_info->function_at(m_vm->code_offset_of(reinterpret_cast<void*>(ip)))
+                             : nullptr;
+                auto &&fn_name = name_of_fn[fn];
+                if (fn_name.empty())
+                {
+                    fn_name = fn
+                        ? fn->name + " (" + fn->src_loc.filename + ":" + std::to_string(fn->src_loc.line_no) + ")"
+                        : "<top level>";
+                }
+                name = &fn_name;
+            }
+            return *name;
+        };
+
+    std::map<std::string, size_t> stacks;
+    std::string stack;
+    for (size_t i = 0; i < m_size;)
+    {
+        auto n = m_samples[i] & ~truncated_flag;
+        auto truncated = (m_samples[i] & truncated_flag) != 0;
+        auto frames = m_samples + i + 1;
+        stack = truncated ? "..." : "";
+        for (auto f = n; f-- != 0;)
+        {
+            if (!stack.empty())
+            {
+                stack += ';';
+            }
+            stack += name_of(frames[f]);
+        }
+        ++stacks[stack];
+        i += 1 + n;
+    }
+
+    auto out = fopen(filename, "w");
+    if (!out)
+    {
+        return false;
+    }
+    for (auto &&s : stacks)
+    {
+        fprintf(out, "%s %zu\n", s.first.c_str(), s.second);
+    }
+    fclose(out);
+    return true;
+}
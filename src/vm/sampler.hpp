@@ -0,0 +1,48 @@
+#ifndef MALANG_VM_SAMPLER_HPP
+#define MALANG_VM_SAMPLER_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include "debug_info.hpp"
+
+// Samples which functions the VM is running on a CPU time timer, for --profile. A sample is
+// the functions called by the frames on the call stack, see Malang_VM::called_ips. Samples are
+// only recorded as raw instruction pointers while the timer runs and are turned into function
+// names by `write_folded' afterwards.
+struct Malang_Sampler
+{
+    ~Malang_Sampler();
+    // `vm' has to have been created with `use_sampler' set. Only one sampler may be started
+    // at a time.
+    Malang_Sampler(struct Malang_VM *vm, const Debug_Info *debug_info);
+
+    bool start(unsigned hz = 1000);
+    void stop();
+
+    // Writes one line per distinct stack with the functions from the outermost in, separated by
+    // semicolons, then the number of samples of it. This is the format flamegraph.pl reads.
+    bool write_folded(const char *filename) const;
+
+    // Samples deeper than this keep only the innermost frames.
+    static constexpr size_t max_depth = 256;
+
+    size_t num_samples;
+    // Samples that didn't fit after the buffer filled up.
+    size_t num_dropped;
+
+private:
+    static void on_tick();
+    void take_sample();
+
+    struct Malang_VM *m_vm;
+    const Debug_Info *m_debug_info;
+    // Each sample is its number of frames, with truncated_flag set if it was cut at
+    // max_depth, followed by that many instruction pointers from the innermost frame out. The
+    // outermost is null for top level code.
+    uintptr_t *m_samples;
+    size_t m_size;
+    size_t m_capacity;
+    static constexpr uintptr_t truncated_flag = uintptr_t(1) << 63;
+};
+
+#endif /* MALANG_VM_SAMPLER_HPP */
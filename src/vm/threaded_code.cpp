@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <cassert>
+#include "threaded_code.hpp"
+#include "instruction.hpp"
+
+template<typename T>
+static inline
+T fetch(const byte *p)
+{
+    return *reinterpret_cast<const T*>(p);
+}
+
+void Threaded_Code::clear()
+{
+    cells.clear();
+    m_cell_at.clear();
+    m_offset_of.clear();
+}
+
+void Threaded_Code::translate(const byte *code, size_t size, void *const *handlers)
+{
+    struct Fixup
+    {
+        size_t cell;
+        uintptr_t destination;
+    };
+    std::vector<Fixup> fixups;
+
+    clear();
+    m_cell_at.assign(size, -1);
+    auto p = code;
+    auto end = p + size;
+    while (p != end)
+    {
+        auto offset = static_cast<uintptr_t>(p - code);
+        auto ins = static_cast<Instruction>(*p);
+        assert(ins < Instruction::INSTRUCTION_ENUM_SIZE);
+        m_cell_at[offset] = cells.size();
+        auto push = [&](Threaded_Cell cell) {
+            cells.push_back(cell);
+            m_offset_of.push_back(offset);
+        };
+        Threaded_Cell cell;
+        cell.handler = handlers[*p];
+        push(cell);
+        ++p;
+        switch (operands_of(ins))
+        {
+            case Operands::None:
+                break;
+            case Operands::Byte:
+                cell.operand = fetch<byte>(p);
+                p += sizeof(byte);
+                push(cell);
+                break;
+            case Operands::Short:
+                cell.operand = fetch<int16_t>(p);
+                p += sizeof(int16_t);
+                push(cell);
+                break;
+            case Operands::Short_Short:
+                cell.operand = fetch<int16_t>(p);
+                p += sizeof(int16_t);
+                push(cell);
+                cell.operand = fetch<int16_t>(p);
+                p += sizeof(int16_t);
+                push(cell);
+                break;
+            case Operands::Int:
+                cell.operand = fetch<int32_t>(p);
+                p += sizeof(int32_t);
+                push(cell);
+                break;
+            case Operands::Value:
+                cell.value_bits = fetch<uint64_t>(p);
+                p += sizeof(uint64_t);
+                push(cell);
+                break;
+            case Operands::Branch:
+                fixups.push_back({cells.size(), offset + fetch<int32_t>(p)});
+                p += sizeof(int32_t);
+                push(cell);
+                break;
+            case Operands::Call:
+                fixups.push_back({cells.size(), static_cast<uintptr_t>(fetch<int32_t>(p))});
+                p += sizeof(int32_t);
+                push(cell);
+                break;
+            case Operands::Tail_Call:
+                fixups.push_back({cells.size(), static_cast<uintptr_t>(fetch<int32_t>(p))});
+                p += sizeof(int32_t);
+                push(cell);
+                cell.operand = fetch<int16_t>(p);
+                p += sizeof(int16_t);
+                push(cell);
+                break;
+            case Operands::Call_Cache:
+            {
+                // the cached offset, then where it goes once there is one
+                auto cached = fetch<int32_t>(p);
+                p += sizeof(int32_t);
+                cell.operand = cached;
+                push(cell);
+                if (cached >= 0)
+                {
+                    fixups.push_back({cells.size(), static_cast<uintptr_t>(cached)});
+                }
+                cell.target = nullptr;
+                push(cell);
+            } break;
+        }
+    }
+
+    // `cells' won't be resized anymore so pointers into it are now stable.
+    for (auto &&f : fixups)
+    {
+        cells[f.cell].target = at(f.destination);
+    }
+}
+
+Threaded_Cell *Threaded_Code::at(uintptr_t offset)
+{
+    if (offset >= m_cell_at.size() || m_cell_at[offset] < 0)
+    {
+        printf("threaded code: %lx is not the start of an instruction\n", offset);
+        abort();
+    }
+    return &cells[m_cell_at[offset]];
+}
+
+uintptr_t Threaded_Code::offset_of(const Threaded_Cell *cell) const
+{
+    assert(cell >= cells.data() && cell < cells.data() + cells.size());
+    return m_offset_of[cell - cells.data()];
+}
@@ -0,0 +1,42 @@
+#ifndef MALANG_VM_THREADED_CODE_HPP
+#define MALANG_VM_THREADED_CODE_HPP
+
+#include <vector>
+#include <stdint.h>
+
+using byte = unsigned char;
+
+// One aligned slot of direct-threaded code. An instruction is a handler cell followed by one
+// cell for each of its operands, already decoded. Branch and call operands are pointers to
+// the handler cell of their destination. The inline cache of a dynamic call is two cells, the
+// cached offset and the pointer for it.
+union Threaded_Cell
+{
+    void *handler;
+    Threaded_Cell *target;
+    int64_t operand;
+    uint64_t value_bits;
+};
+
+static_assert(sizeof(Threaded_Cell) == sizeof(uint64_t), "Threaded_Cell should be a single word");
+
+struct Threaded_Code
+{
+    // Translates the `size' bytes of `code' into direct-threaded code where `handlers' is the
+    // table of handler addresses indexed by Instruction.
+    void translate(const byte *code, size_t size, void *const *handlers);
+    void clear();
+    bool empty() const { return cells.empty(); }
+
+    // The handler cell for the instruction at `offset' into the bytecode.
+    Threaded_Cell *at(uintptr_t offset);
+    // The offset into the bytecode of the instruction `cell' belongs to.
+    uintptr_t offset_of(const Threaded_Cell *cell) const;
+
+    std::vector<Threaded_Cell> cells;
+private:
+    std::vector<int32_t> m_cell_at;
+    std::vector<uint32_t> m_offset_of;
+};
+
+#endif /* MALANG_VM_THREADED_CODE_HPP */
@@ -3,13 +3,18 @@
 #include <stdlib.h>
 #include <algorithm>
 #include <string.h>
+#include <cmath>
 #include <sstream>
 #include <iostream>
+#include <atomic>
 #include "vm.hpp"
 #include "instruction.hpp"
+#include "op_profile.hpp"
+#include "debug_info.hpp"
 #include "runtime/gc.hpp"
 #include "runtime.hpp"
 #include "../codegen/disassm.hpp"
+#include "../platform/stack.hpp"
 
 
 static void vprint(const char *fmt, va_list vargs)
@@ -27,12 +32,28 @@ static void print(const char *fmt, ...)
 
 Malang_VM::~Malang_VM()
 {
-    locals_frames_top = 0;
     call_frames_top = 0;
     globals_top = 0;
-    locals_top = 0;
     data_top = 0;
+    delete jit;
+    delete op_profile;
     delete gc;
+    plat::stack_release(call_frames);
+    plat::stack_release(called_ips);
+    plat::stack_release(globals);
+    plat::stack_release(data_stack);
+}
+
+template<typename T>
+static T *reserve_stack(size_t n, size_t n_guard, const char *name, const char *flag)
+{
+    auto stack = plat::stack_reserve(n * sizeof(T), n_guard * sizeof(T), name);
+    if (!stack)
+    {
+        printf("couldn't reserve %zu entries for the %s, try a smaller %s\n", n, name, flag);
+        exit(-1);
+    }
+    return static_cast<T*>(stack);
 }
 
 Malang_VM::Malang_VM(Args *args,
@@ -40,41 +61,165 @@ Malang_VM::Malang_VM(Args *args,
                      const std::vector<Native_Code> &natives,
                      const std::vector<String_Constant> &string_constants,
                      size_t gc_run_interval, size_t max_num_objects)
-    : natives(natives)
+    : code(nullptr)
+    , code_size(0)
+    , debug_info(nullptr)
+    , use_threaded_code(args->threaded_code)
+    , jit(nullptr)
+    // native code isn't counted so profiling sticks to the interpreter
+    , use_jit(args->jit && !args->profile_ops && args->profile_file.empty())
+    , op_profile(args->profile_ops ? new Op_Profile : nullptr)
+    , use_sampler(!args->profile_file.empty())
+    , called_ips(nullptr)
+    , natives(natives)
     , string_constants(string_constants)
     , types(types)
     , breaking(false)
+    , dead_locals(nullptr)
+    , call_frames_top(0)
+    , globals_top(0)
+    , data_top(0)
+    , max_call_depth(args->max_call_depth)
 {
+    call_frames = reserve_stack<Malang_Frame>(args->max_call_depth, 1, "call stack", "--call-depth");
+    if (use_sampler)
+    {
+        called_ips = reserve_stack<void*>(args->max_call_depth, 1, "call stack", "--call-depth");
+    }
+    globals = reserve_stack<Malang_Value>(args->globals_size, 1, "globals", "--globals");
+    // Local indices are 16 bits so a function can reach up to 64k slots past the top of the data
+    // stack, the guard after it has to be at least that big to catch it.
+    data_stack = reserve_stack<Malang_Value>(args->data_stack_size, 1 << 16, "data stack", "--data-stack");
+
     gc = new Malang_GC{args, this, types, gc_run_interval, max_num_objects};
     auto str_ty = types->get_string();
-    for (auto &&sc : string_constants)
+    for (auto &&sc : this->string_constants)
     {
         auto obj = gc->allocate_unmanaged_object(str_ty->type_token());
         if (!obj)
         {
             panic("GC couldn't allocate unmanaged string constant.\n");
         }
-        Malang_Runtime::string_construct_intern(obj, sc);
+        // strings are never written to and the VM's constants outlive the objects made from
+        // them, so those share their chars instead of each having a copy
+        Malang_Runtime::string_construct_intern(obj, sc.size(), const_cast<Char*>(sc.data()));
         string_constants_objects.push_back(obj);
     }
 }
 
-void Malang_VM::load_code(const std::vector<byte> &code)
+// What an instantiation of run_code keeps track of on top of running the code. Each is a
+// separate instantiation so the normal one doesn't pay for the others.
+enum class Run_Mode
+{
+    Normal,
+    // count every instruction in `op_profile'
+    Count_Ops,
+    // record where calls go in `called_ips' for the sampler
+    Sample,
+};
+
+// Aligned so the dispatch jumps land the same way relative to cache lines no matter what ends up
+// before run_code in the binary, its speed swung by 15% with unrelated changes without this.
+template<typename Code_Pointer, Run_Mode Mode = Run_Mode::Normal>
+__attribute__((aligned(64))) static void run_code(Malang_VM&, void *const **handlers = nullptr, uintptr_t entry = 0,
+                     Malang_Value *locals = nullptr);
+
+template<typename Code_Pointer>
+static void run_code_in_mode(Malang_VM &vm, void *const **handlers = nullptr)
+{
+    if (vm.op_profile)
+        run_code<Code_Pointer, Run_Mode::Count_Ops>(vm, handlers);
+    else if (vm.use_sampler)
+        run_code<Code_Pointer, Run_Mode::Sample>(vm, handlers);
+    else
+        run_code<Code_Pointer>(vm, handlers);
+}
+
+void Malang_VM::load_code(byte *code, size_t code_size, const Debug_Info *debug_info,
+                          const Dead_Locals *dead_locals)
 {
-    this->code.clear();
-    this->code.insert(this->code.begin(), code.begin(), code.end());
+    assert(code_size && static_cast<Instruction>(code[code_size - 1]) == Instruction::Halt);
+    this->debug_info = debug_info;
+    this->dead_locals = dead_locals;
+    this->code = code;
+    this->code_size = code_size;
+    delete jit;
+    jit = nullptr;
+#if JIT_SUPPORTED
+    if (use_jit)
+    {
+        jit = new Malang_JIT(this);
+    }
+#endif
+    threaded_code.clear();
+#if USE_COMPUTED_GOTO
+    if (use_threaded_code)
+    {
+        // the cells hold label addresses so they have to come from the run_code that runs them
+        void *const *handlers;
+        run_code_in_mode<Threaded_Cell*>(*this, &handlers);
+        threaded_code.translate(code, code_size, handlers);
+    }
+#endif
 }
 
-static void run_code(Malang_VM&);
 void Malang_VM::run()
 {
-    locals_frames_top = 0;
     call_frames_top = 0;
     globals_top = 0;
-    locals_top = 0;
     data_top = 0;
 
-    run_code(*this);
+#if USE_COMPUTED_GOTO
+    if (!threaded_code.empty())
+    {
+        run_code_in_mode<Threaded_Cell*>(*this);
+        return;
+    }
+#endif
+    run_code_in_mode<byte*>(*this);
+}
+
+void Malang_VM::call_interpreted(uintptr_t offset, Malang_Value *locals)
+{
+    // the Halt the code ends with makes run_code return once the function returns
+    auto halt = code_size - 1;
+    assert(static_cast<Instruction>(code[halt]) == Instruction::Halt);
+    // a panic in there is caught by the run_code below rather than unwinding into native code
+    auto was_in_native = jit && jit->in_native;
+    if (jit)
+    {
+        jit->in_native = false;
+    }
+#if USE_COMPUTED_GOTO
+    if (!threaded_code.empty())
+    {
+        push_call_frame({threaded_code.at(halt), locals});
+        run_code<Threaded_Cell*>(*this, nullptr, offset, locals);
+    }
+    else
+#endif
+    {
+        push_call_frame({&code[halt], locals});
+        run_code<byte*>(*this, nullptr, offset, locals);
+    }
+    if (jit)
+    {
+        jit->in_native = was_in_native;
+    }
+}
+
+uintptr_t Malang_VM::code_offset_of(const void *ip) const
+{
+    if (threaded_code.empty())
+    {
+        return static_cast<const byte*>(ip) - code;
+    }
+    return threaded_code.offset_of(static_cast<const Threaded_Cell*>(ip));
+}
+
+std::string Malang_VM::describe(uintptr_t offset) const
+{
+    return debug_info ? debug_info->describe(offset) : "";
 }
 
 void Malang_VM::panic(const char *fmt, ...)
@@ -87,10 +232,37 @@ void Malang_VM::panic(const char *fmt, ...)
     print("\n");
     stack_trace();
 #if DEBUG_MODE
-    throw "panic";
-#else
+    if (!jit || !jit->in_native)
+    {
+        throw "panic";
+    }
+#endif
+    fflush(stdout);
     abort();
+}
+
+void Malang_VM::panic_at(uintptr_t offset, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    print("runtime panic trigger!\n    ");
+    vprint(fmt, args);
+    va_end(args);
+    print("\n");
+    auto where = describe(offset);
+    if (!where.empty())
+    {
+        print("    in %s\n", where.c_str());
+    }
+    stack_trace();
+#if DEBUG_MODE
+    if (!jit || !jit->in_native)
+    {
+        throw "panic";
+    }
 #endif
+    fflush(stdout);
+    abort();
 }
 
 static inline
@@ -159,24 +331,16 @@ void Malang_VM::stack_trace() const
             }
         }
     }
-    print("\nLOCALS:\n");
-
-
-    auto tmp_locals_frames_top = locals_frames_top;
-    uintptr_t this_frame_ends_at = 0;
-    for (auto i = locals_top-1; i != static_cast<uintptr_t>(-1); --i)
+    print("\nFRAMES:\n");
+    for (auto f = call_frames_top; f-- != 0;)
     {
-        if (tmp_locals_frames_top > 0)
-        {
-            this_frame_ends_at = locals_frames[tmp_locals_frames_top-1];
-        }
-        auto local = locals[i];
-        print("%d: %s\n", i-this_frame_ends_at, to_string(local).c_str());
-        if (i == this_frame_ends_at)
-        {
-            tmp_locals_frames_top--;
-            print("~~~~~~~~~\n");
-        }
+        auto &&frame = call_frames[f];
+        auto return_offset = code_offset_of(frame.return_ip);
+        // the return address is just past the call, one before it is the call itself
+        auto where = describe(return_offset - 1);
+        print("%ld: returns to %lx%s%s, caller's locals start at data stack %ld\n",
+              f, return_offset, where.empty() ? "" : " in ", where.c_str(),
+              frame.locals - data_stack);
     }
 
 
@@ -192,11 +356,16 @@ void Malang_VM::stack_trace() const
 void Malang_VM::trace(uintptr_t ip) const
 {
     auto x = std::min(static_cast<uintptr_t>(64ul), ip);
-    auto y = std::min(static_cast<uintptr_t>(64ul), code.size() - ip);
+    auto y = std::min(static_cast<uintptr_t>(64ul), code_size - ip);
 
     auto start = ip - x;
     auto end = ip + y;
     auto p = start;
+    auto where = describe(ip);
+    if (!where.empty())
+    {
+        print("\nIN %s\n", where.c_str());
+    }
     print("\nCODE:\n");
     for (int i = 1; p != end; ++p, ++i)
     {
@@ -222,8 +391,8 @@ void Malang_VM::trace_abort(uintptr_t ip, const char *fmt, ...) const
 
 void Malang_VM::dump_code(uintptr_t ip, size_t n, int width) const
 {
-    auto mem = code.data() + ip;
-    n = std::min(ip+n, code.size());
+    auto mem = code + ip;
+    n = std::min(ip+n, code_size);
     for (size_t i = 0; i < n; ++i)
     {
         if (i % width == 0)
@@ -239,10 +408,6 @@ void Malang_VM::dump_code(uintptr_t ip, size_t n, int width) const
     print("\n");
 }
 
-void Malang_VM::add_local(Malang_Value value)
-{
-    locals[locals_top++] = value;
-}
 void Malang_VM::add_global(Malang_Value value)
 {
     globals[globals_top++] = value;
@@ -253,7 +418,7 @@ void Malang_VM::add_data(Malang_Value value)
 }
 
 
-#define NOT_IMPL {vm.trace_abort(ip-vm.code.data(), "%s:%d `%s()` not implemented\n", __FILE__, __LINE__, __FUNCTION__);}
+#define NOT_IMPL {vm.trace_abort(code_offset(vm, ip), "%s:%d `%s()` not implemented\n", __FILE__, __LINE__, __FUNCTION__);}
 
 static inline
 byte fetch8(byte *p)
@@ -279,20 +444,183 @@ Malang_Value fetch_value(byte *p)
     return *reinterpret_cast<Malang_Value*>(p);
 }
 
+// run_code is written once for both bytecode and threaded code, these read an operand and
+// step past it for either kind of code.
+static inline
+byte read8(byte *&ip)
+{
+    auto n = fetch8(ip);
+    ip += sizeof(n);
+    return n;
+}
+static inline
+int16_t read16(byte *&ip)
+{
+    auto n = fetch16(ip);
+    ip += sizeof(n);
+    return n;
+}
+static inline
+int32_t read32(byte *&ip)
+{
+    auto n = fetch32(ip);
+    ip += sizeof(n);
+    return n;
+}
+static inline
+Malang_Value read_value(byte *&ip)
+{
+    auto n = fetch_value(ip);
+    ip += sizeof(n);
+    return n;
+}
+static inline
+byte read8(Threaded_Cell *&ip)
+{
+    return static_cast<byte>((ip++)->operand);
+}
+static inline
+int16_t read16(Threaded_Cell *&ip)
+{
+    return static_cast<int16_t>((ip++)->operand);
+}
+static inline
+int32_t read32(Threaded_Cell *&ip)
+{
+    return static_cast<int32_t>((ip++)->operand);
+}
+static inline
+Malang_Value read_value(Threaded_Cell *&ip)
+{
+    return Malang_Value::with_bits((ip++)->value_bits);
+}
+
+// `ip' is at the operand of a branch instruction
+static inline
+void take_branch(byte *&ip)
+{
+    // relative to the start of the instruction
+    ip += fetch32(ip) - 1;
+}
+static inline
+void skip_branch(byte *&ip)
+{
+    ip += sizeof(int32_t);
+}
+static inline
+void take_branch(Threaded_Cell *&ip)
+{
+    ip = ip->target;
+}
+static inline
+void skip_branch(Threaded_Cell *&ip)
+{
+    ip++;
+}
+
+// `ip' is at the operand of a Call instruction, returns the destination and leaves `ip' at
+// the return address.
+static inline
+byte *read_call(byte *&ip, byte *first_ip)
+{
+    return first_ip + read32(ip);
+}
+static inline
+Threaded_Cell *read_call(Threaded_Cell *&ip, Threaded_Cell *)
+{
+    return (ip++)->target;
+}
+
+// `ip' is at the inline cache of a Call_Dyn, returns the destination it holds if that is
+// `offset' or else null, and leaves `ip' at the return address.
+static inline
+byte *read_call_cache(byte *&ip, byte *first_ip, int32_t offset)
+{
+    auto cached = read32(ip);
+    return cached == offset ? first_ip + cached : nullptr;
+}
+static inline
+Threaded_Cell *read_call_cache(Threaded_Cell *&ip, Threaded_Cell *, int32_t offset)
+{
+    auto cached = (ip++)->operand;
+    auto target = (ip++)->target;
+    return cached == offset ? target : nullptr;
+}
+static inline
+void skip_call_cache(byte *&ip)
+{
+    ip += sizeof(int32_t);
+}
+static inline
+void skip_call_cache(Threaded_Cell *&ip)
+{
+    ip += 2;
+}
+
+// Rewrites the instruction whose operand `ip' is at into `ins' with `cache' as its operand.
+// Threaded code is rewritten along with the bytecode, which the JIT compiles from.
+static inline
+void quicken(Malang_VM &, byte *ip, void *const *, Instruction ins, int32_t cache)
+{
+    ip[-1] = static_cast<byte>(ins);
+    memcpy(ip, &cache, sizeof(cache));
+}
+static inline
+void quicken(Malang_VM &vm, Threaded_Cell *ip, void *const *handlers, Instruction ins, int32_t cache)
+{
+    quicken(vm, vm.code + vm.threaded_code.offset_of(ip) + 1, handlers, ins, cache);
+    ip[-1].handler = handlers[static_cast<byte>(ins)];
+    ip[0].operand = cache;
+    if (operands_of(ins) == Operands::Call_Cache && cache >= 0)
+    {
+        ip[1].target = vm.threaded_code.at(cache);
+    }
+}
+
+// The code at `offset' into the bytecode, the pointer argument only selects the kind of code.
+static inline
+byte *code_at(Malang_VM &vm, byte *, uintptr_t offset)
+{
+    return vm.code + offset;
+}
+static inline
+Threaded_Cell *code_at(Malang_VM &vm, Threaded_Cell *, uintptr_t offset)
+{
+    return vm.threaded_code.at(offset);
+}
+
+static inline
+uintptr_t code_offset(const Malang_VM &vm, const byte *ip)
+{
+    return ip - vm.code;
+}
+static inline
+uintptr_t code_offset(const Malang_VM &vm, const Threaded_Cell *ip)
+{
+    return vm.threaded_code.offset_of(ip);
+}
+
 static
 void dbg_dis(Malang_VM &vm, byte *ip, int n)
 {
+    static std::string last_where;
     std::string str;
     for (int i = 0; i < n; ++i)
     {
-        auto offset = ip - vm.code.data();
+        auto offset = ip - vm.code;
+        auto where = vm.describe(offset);
+        if (where != last_where)
+        {
+            print("-- %s\n", where.c_str());
+            last_where = where;
+        }
         ip = Disassembler::dis1(ip, offset, str);
         print("%s\n", str.c_str());
     }
 }
 
 static
-void debugger(Malang_VM &vm, byte *ip)
+void debugger(Malang_VM &vm, byte *ip, Malang_Value *locals)
 {
     static std::string last_cmd;
     static int step_n;
@@ -302,7 +630,8 @@ void debugger(Malang_VM &vm, byte *ip)
     {
         dbg_dis(vm, ip, 1);
         auto ins = static_cast<Instruction>(fetch8(ip));
-        if (ins == Instruction::Return || ins == Instruction::Return_Fast)
+        if (ins == Instruction::Return || ins == Instruction::Return_Fast
+            || ins == Instruction::Tail_Call)
         {
             waiting_for_return = false;
         }
@@ -381,7 +710,7 @@ void debugger(Malang_VM &vm, byte *ip)
                 auto n = arg0 > 0 ? arg0 : 1;
                 if (arg1)
                 {
-                    dbg_dis(vm, vm.code.data() + arg1, n);
+                    dbg_dis(vm, vm.code + arg1, n);
                 }
                 else
                 {
@@ -390,7 +719,7 @@ void debugger(Malang_VM &vm, byte *ip)
             }
             else if (cmd_str == "local")
             {
-                print("LOCAL %x: %s\n", arg0, to_string(vm.get_local(arg0)).c_str());
+                print("LOCAL %x: %s\n", arg0, to_string(locals[arg0]).c_str());
             }
             else if (cmd_str == "stack")
             {
@@ -416,8 +745,24 @@ void debugger(Malang_VM &vm, byte *ip)
     }
 }
 
+static inline
+void *handler_of(byte *ip, void *const *handlers)
+{
+    return handlers[fetch8(ip)];
+}
+static inline
+void *handler_of(Threaded_Cell *ip, void *const *)
+{
+    return ip->handler;
+}
+
+// Code_Pointer is either byte* to interpret `vm.code' or Threaded_Cell* to run
+// `vm.threaded_code', the latter requires USE_COMPUTED_GOTO. If `handlers' is not null then
+// nothing is run and it is set to the table of handler addresses instead. `entry' is the offset
+// into the bytecode to start at. `Mode' picks what is tracked while running, see Run_Mode.
+template<typename Code_Pointer, Run_Mode Mode>
 static
-void run_code(Malang_VM &vm)
+void run_code(Malang_VM &vm, void *const **handlers, uintptr_t entry, Malang_Value *locals)
 {
 #ifndef USE_COMPUTED_GOTO
 #define USE_COMPUTED_GOTO 0
@@ -426,26 +771,35 @@ void run_code(Malang_VM &vm)
 #if USE_COMPUTED_GOTO
 
 #define ITEM(X) &&computed_##X,
-    void *computed_gotos[] =
+    // static so the label addresses may be handed out for threaded code
+    static void *const computed_gotos[] =
         {
             &&computed_Halt,
 #include "instruction.def"
         };
+    if (handlers)
+    {
+        *handlers = computed_gotos;
+        return;
+    }
 
 #define EXEC                               \
-    goto *computed_gotos[fetch8(ip)];
+    COUNT_OP;                              \
+    goto *handler_of(ip, computed_gotos);
   
 #define DISPATCH(X) computed_##X:
   
 #define HALT                                    \
     computed_Halt:                              \
-        { return; }
+        { SYNC_SP_OUT; return; }
 
 #define DISPATCH_NEXT \
-        goto *computed_gotos[fetch8(ip)]
+        do { COUNT_OP; goto *handler_of(ip, computed_gotos); } while (0)
 
 #define VM_INIT // empty
 
+#define HANDLER_TABLE computed_gotos
+
 #else
 
 #define DISPATCH(X) case Instruction::X: 
@@ -453,23 +807,119 @@ void run_code(Malang_VM &vm)
 #define DISPATCH_NEXT continue
 
 #define EXEC                                       \
+    COUNT_OP;                                           \
     auto ins = static_cast<Instruction>(fetch8(ip));    \
-    if (vm.breaking) { debugger(vm, ip); }                \
+    if (vm.breaking) { SYNC_SP_OUT; debugger(vm, ip, fast_locals); }   \
     switch (ins)
   
 #define HALT                                            \
-    default: vm.trace_abort(ip - first_ip, "Unknown instruction");   \
-    case Instruction::Halt: return;                     \
+    default: SYNC_SP_OUT; vm.trace_abort(code_offset(vm, ip), "Unknown instruction"); \
+    case Instruction::Halt: SYNC_SP_OUT; return;        \
 
 #define VM_INIT for (;;)
+
+#define HANDLER_TABLE nullptr
+#endif
+
+#define COUNT_OP                                                \
+    if (Mode == Run_Mode::Count_Ops) vm.op_profile->count(vm.code[code_offset(vm, ip)])
+    // The sampler's signal handler reads `called_ips' up to call_frames_top, so the callee is
+    // recorded before the frame for it is pushed and a return is done before whatever comes
+    // after it. The fences keep the compiler from moving them around.
+#define TRACK_CALL(new_ip)                                      \
+    if (Mode == Run_Mode::Sample)                               \
+    {                                                           \
+        vm.called_ips[vm.call_frames_top] = (new_ip);           \
+        std::atomic_signal_fence(std::memory_order_release);    \
+    }
+#define TRACK_TAIL_CALL(new_ip)                                 \
+    if (Mode == Run_Mode::Sample)                               \
+    {                                                           \
+        vm.called_ips[vm.call_frames_top - 1] = (new_ip);       \
+        std::atomic_signal_fence(std::memory_order_release);    \
+    }
+#define TRACK_RETURN                                            \
+    if (Mode == Run_Mode::Sample) std::atomic_signal_fence(std::memory_order_release)
+
+#ifndef USE_CACHED_DATA_TOP
+#define USE_CACHED_DATA_TOP 1
+#endif
+
+#if USE_CACHED_DATA_TOP
+    // `sp' mirrors vm.data_top as a pointer one past the top of the datastack so it can live
+    // in a register for the duration of the loop. Anything that can observe the datastack
+    // from outside of this function (natives, the GC, panics, the debugger) must be preceded
+    // by SYNC_SP_OUT and, if it may push or pop, followed by SYNC_SP_IN.
+#define PUSH(x) (*sp++ = (x))
+#define POP() (*--sp)
+#define PEEK(n) (sp[-1-(n)])
+#define DROP(n) (sp -= (n))
+#define TOP() (sp)
+#define SET_TOP(p) (sp = (p))
+#define SYNC_SP_OUT (vm.data_top = sp - vm.data_stack)
+#define SYNC_SP_IN (sp = vm.data_stack + vm.data_top)
+#else
+#define PUSH(x) vm.push_data(x)
+#define POP() vm.pop_data()
+#define PEEK(n) vm.peek_data(n)
+#define DROP(n) (vm.data_top -= (n))
+#define TOP() (vm.data_stack + vm.data_top)
+#define SET_TOP(p) (vm.data_top = (p) - vm.data_stack)
+#define SYNC_SP_OUT
+#define SYNC_SP_IN
 #endif
 
-    if (vm.code.empty())
+#if JIT_SUPPORTED
+    // Runs the function at `offset' as native code instead if the JIT has compiled it, which it
+    // does once the function is hot.
+#define JIT_ENTER(offset)                                               \
+    if (vm.jit)                                                         \
+    {                                                                   \
+        if (auto native = vm.jit->enter(offset))                        \
+        {                                                               \
+            SYNC_SP_OUT;                                                \
+            auto new_top = vm.jit->run(native, &vm,                    \
+                                       vm.data_stack + vm.data_top, fast_locals); \
+            vm.data_top = new_top - vm.data_stack;                      \
+            SYNC_SP_IN;                                                 \
+            DISPATCH_NEXT;                                              \
+        }                                                               \
+    }
+    // The same for a Tail_Call, which then returns from the current function since the native
+    // code has returned from the callee. The callee takes over our call frame so it's as deep
+    // as it would be interpreted.
+#define JIT_TAIL_ENTER(offset)                                          \
+    if (vm.jit)                                                         \
+    {                                                                   \
+        if (auto native = vm.jit->enter(offset))                        \
+        {                                                               \
+            auto frame = vm.pop_call_frame();                           \
+            SYNC_SP_OUT;                                                \
+            auto new_top = vm.jit->run(native, &vm,                    \
+                                       vm.data_stack + vm.data_top, fast_locals); \
+            vm.data_top = new_top - vm.data_stack;                      \
+            SYNC_SP_IN;                                                 \
+            ip = static_cast<Code_Pointer>(frame.return_ip);            \
+            fast_locals = frame.locals;                                 \
+            DISPATCH_NEXT;                                              \
+        }                                                               \
+    }
+#else
+#define JIT_ENTER(offset)
+#define JIT_TAIL_ENTER(offset)
+#endif
+
+    if (!vm.code_size)
         return;
-    auto ip = vm.code.data();
-    auto first_ip = ip;
-    auto fast_locals = vm.locals;
+    auto ip = code_at(vm, Code_Pointer{}, entry);
+    auto first_ip = code_at(vm, Code_Pointer{}, 0);
+    auto fast_locals = locals ? locals : vm.data_stack;
+#if DEBUG_MODE
     auto prev_ins_ip = ip;
+#endif
+#if USE_CACHED_DATA_TOP
+    auto sp = vm.data_stack + vm.data_top;
+#endif
     #if DEBUG_MODE
     try
     {
@@ -477,150 +927,254 @@ void run_code(Malang_VM &vm)
 
     VM_INIT
     {
+#if DEBUG_MODE
         prev_ins_ip = ip;
+#endif
         EXEC
         {
             HALT;
             DISPATCH(Fixnum_Add)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a+b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a+b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Subtract)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a-b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a-b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Multiply)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a*b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a*b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Divide)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a/b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a/b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Modulo)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a%b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a%b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_And)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a&b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a&b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Or)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a|b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a|b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Xor)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a^b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a^b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Left_Shift)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a<<b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a<<b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Right_Shift)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a>>b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a>>b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Equals)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a==b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a==b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Not_Equals)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a!=b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a!=b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Greater_Than)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a>b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a>b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Greater_Than_Equals)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a>=b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a>=b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Less_Than)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a<b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a<b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Less_Than_Equals)
             {
                 ip++;
-                auto b = vm.pop_data().as_fixnum();
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(a<=b);
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                PUSH(a<=b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Negate)
             {
                 ip++;
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(-a);
+                auto a = POP().as_fixnum();
+                PUSH(-a);
                 DISPATCH_NEXT;
             }
             DISPATCH(Fixnum_Invert)
             {
                 ip++;
-                auto a = vm.pop_data().as_fixnum();
-                vm.push_data(~a);
+                auto a = POP().as_fixnum();
+                PUSH(~a);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Double_Add)
+            {
+                ip++;
+                auto b = POP().as_double();
+                auto a = POP().as_double();
+                PUSH(a+b);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Double_Subtract)
+            {
+                ip++;
+                auto b = POP().as_double();
+                auto a = POP().as_double();
+                PUSH(a-b);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Double_Multiply)
+            {
+                ip++;
+                auto b = POP().as_double();
+                auto a = POP().as_double();
+                PUSH(a*b);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Double_Divide)
+            {
+                ip++;
+                auto b = POP().as_double();
+                auto a = POP().as_double();
+                PUSH(a/b);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Double_Modulo)
+            {
+                ip++;
+                auto b = POP().as_double();
+                auto a = POP().as_double();
+                PUSH(std::fmod(a, b));
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Double_Equals)
+            {
+                ip++;
+                auto b = POP().as_double();
+                auto a = POP().as_double();
+                PUSH(a==b);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Double_Not_Equals)
+            {
+                ip++;
+                auto b = POP().as_double();
+                auto a = POP().as_double();
+                PUSH(a!=b);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Double_Greater_Than)
+            {
+                ip++;
+                auto b = POP().as_double();
+                auto a = POP().as_double();
+                PUSH(a>b);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Double_Greater_Than_Equals)
+            {
+                ip++;
+                auto b = POP().as_double();
+                auto a = POP().as_double();
+                PUSH(a>=b);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Double_Less_Than)
+            {
+                ip++;
+                auto b = POP().as_double();
+                auto a = POP().as_double();
+                PUSH(a<b);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Double_Less_Than_Equals)
+            {
+                ip++;
+                auto b = POP().as_double();
+                auto a = POP().as_double();
+                PUSH(a<=b);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Double_Negate)
+            {
+                ip++;
+                auto a = POP().as_double();
+                PUSH(-a);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Fixnum_To_Double)
+            {
+                ip++;
+                auto a = POP().as_fixnum();
+                PUSH(static_cast<Double>(a));
                 DISPATCH_NEXT;
             }
             DISPATCH(Noop)
@@ -631,520 +1185,558 @@ void run_code(Malang_VM &vm)
             DISPATCH(Literal_8)
             {
                 ip++;
-                auto n = fetch8(ip);
-                ip += sizeof(n);
-                vm.push_data(static_cast<Fixnum>(n));
+                auto n = read8(ip);
+                PUSH(static_cast<Fixnum>(n));
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_16)
             {
                 ip++;
-                auto n = fetch16(ip);
-                ip += sizeof(n);
-                vm.push_data(static_cast<Fixnum>(n));
+                auto n = read16(ip);
+                PUSH(static_cast<Fixnum>(n));
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_32)
             {
                 ip++;
-                auto n = fetch32(ip);
-                ip += sizeof(n);
-                vm.push_data(static_cast<Fixnum>(n));
+                auto n = read32(ip);
+                PUSH(static_cast<Fixnum>(n));
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_value)
             {
                 ip++;
-                auto n = fetch_value(ip);
-                ip += sizeof(n);
-                vm.push_data(n);
+                auto n = read_value(ip);
+                PUSH(n);
                 DISPATCH_NEXT;
             }
             DISPATCH(Get_Type)
             {
+                SYNC_SP_OUT;
                 NOT_IMPL;
             }
             DISPATCH(Branch)
             {
                 ip++;
-                ip += fetch32(ip) - 1;
+                take_branch(ip);
                 DISPATCH_NEXT;
             }
             DISPATCH(Pop_Branch_If_False)
             {
                 ip++;
-                if (vm.pop_data().as_fixnum() == 0)
+                if (POP().as_fixnum() == 0)
                 {
-                    ip += fetch32(ip) - 1;
+                    take_branch(ip);
                 }
                 else
                 {
-                    ip += 4;
+                    skip_branch(ip);
                 }
                 DISPATCH_NEXT;
             }
             DISPATCH(Pop_Branch_If_True)
             {
                 ip++;
-                if (vm.pop_data().as_fixnum() != 0)
+                if (POP().as_fixnum() != 0)
                 {
-                    ip += fetch32(ip) - 1;
+                    take_branch(ip);
                 }
                 else
                 {
-                    ip += 4;
+                    skip_branch(ip);
                 }
                 DISPATCH_NEXT;
             }
             DISPATCH(Branch_If_False_Or_Pop)
             {
                 ip++;
-                if (vm.peek_data().as_fixnum() == 0)
+                if (PEEK(0).as_fixnum() == 0)
                 {
-                    ip += fetch32(ip) - 1;
+                    take_branch(ip);
                 }
                 else
                 {
-                    vm.pop_data();
-                    ip += 4;
+                    DROP(1);
+                    skip_branch(ip);
                 }
                 DISPATCH_NEXT;
             }
             DISPATCH(Branch_If_True_Or_Pop)
             {
                 ip++;
-                if (vm.peek_data().as_fixnum() != 0)
+                if (PEEK(0).as_fixnum() != 0)
                 {
-                    ip += fetch32(ip) - 1;
+                    take_branch(ip);
                 }
                 else
                 {
-                    vm.pop_data();
-                    ip += 4;
+                    DROP(1);
+                    skip_branch(ip);
                 }
                 DISPATCH_NEXT;
             }
             DISPATCH(Return)
             {
-                vm.locals_top = vm.pop_locals_frame();
-                fast_locals = vm.current_locals();
-                ip = vm.pop_call_frame();
+                ip++;
+                auto n = read8(ip);
+                // the results go where the arguments were and the rest of the window is dropped
+                auto results = TOP() - n;
+                for (int i = 0; i < n; ++i)
+                {
+                    fast_locals[i] = results[i];
+                }
+                SET_TOP(fast_locals + n);
+                auto &&frame = vm.pop_call_frame();
+                TRACK_RETURN;
+                ip = static_cast<Code_Pointer>(frame.return_ip);
+                fast_locals = frame.locals;
                 DISPATCH_NEXT;
             }
             DISPATCH(Return_Fast)
             {
-                ip = vm.pop_call_frame();
+                // there were no locals allocated, the caller's are restored anyway since this
+                // may have been reached by a Tail_Call from a function that had some
+                auto &&frame = vm.pop_call_frame();
+                TRACK_RETURN;
+                ip = static_cast<Code_Pointer>(frame.return_ip);
+                fast_locals = frame.locals;
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Tail_Call)
+            {
+                ip++;
+                auto new_ip = read_call(ip, first_ip);
+                auto n_args = read16(ip);
+                // the arguments become the callee's first locals where this function's were,
+                // the call frame is left as it is so the callee returns to our caller
+                auto args = TOP() - n_args;
+                for (int i = 0; i < n_args; ++i)
+                {
+                    fast_locals[i] = args[i];
+                }
+                SET_TOP(fast_locals + n_args);
+                JIT_TAIL_ENTER(code_offset(vm, new_ip));
+                TRACK_TAIL_CALL(new_ip);
+                ip = new_ip;
                 DISPATCH_NEXT;
             }
             DISPATCH(Call)
             {
                 ip++;
-                auto idx = fetch32(ip);
-                vm.push_call_frame(ip + sizeof(idx));
-                ip = first_ip + idx;
+                auto new_ip = read_call(ip, first_ip);
+                JIT_ENTER(code_offset(vm, new_ip));
+                TRACK_CALL(new_ip);
+                vm.push_call_frame({ip, fast_locals});
+                ip = new_ip;
                 DISPATCH_NEXT;
             }
             DISPATCH(Call_Native)
             {
                 ip++;
-                auto idx = fetch32(ip);
-                ip += sizeof(idx);
+                auto idx = read32(ip);
+                SYNC_SP_OUT;
                 vm.natives[idx](vm);
+                SYNC_SP_IN;
                 DISPATCH_NEXT;
             }
             DISPATCH(Call_Dyn)
             {
-                auto new_ip = vm.pop_data().as_fixnum();
-                vm.push_call_frame(ip + 1);
-                ip = first_ip + new_ip;
+                ip++;
+                auto offset = POP().as_fixnum();
+                // the first call from here, guess the next ones go to the same place
+                quicken(vm, ip, HANDLER_TABLE, Instruction::Call_Dyn_Mono, offset);
+                auto new_ip = read_call_cache(ip, first_ip, offset);
+                JIT_ENTER(offset);
+                TRACK_CALL(new_ip);
+                vm.push_call_frame({ip, fast_locals});
+                ip = new_ip;
                 DISPATCH_NEXT;
             }
             DISPATCH(Call_Native_Dyn)
             {
                 ip++;
-                auto idx = vm.pop_data().as_fixnum();
+                auto idx = POP().as_fixnum();
+                SYNC_SP_OUT;
                 vm.natives[idx](vm);
+                SYNC_SP_IN;
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Global)
             {
                 ip++;
-                auto n = fetch32(ip);
-                ip += sizeof(n);
+                auto n = read32(ip);
                 auto v = vm.globals[n];
-                vm.push_data(v);
+                PUSH(v);
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Global)
             {
                 ip++;
-                auto n = fetch32(ip);
+                auto n = read32(ip);
                 if (n > (int)vm.globals_top)
                 {
                     vm.globals_top = n;
                 }
-                ip += sizeof(n);
-                auto v = vm.pop_data();
+                auto v = POP();
                 vm.globals[n] = v;
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Field)
             {
                 ip++;
-                auto idx = fetch16(ip);
-                ip += sizeof(idx);
-                auto obj = reinterpret_cast<Malang_Object_Body*>(vm.pop_data().as_object());
-                vm.push_data(obj->fields[idx]);
+                auto idx = read16(ip);
+                auto obj = reinterpret_cast<Malang_Object_Body*>(POP().as_object());
+                PUSH(obj->fields[idx]);
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Field)
             {
                 ip++;
-                auto idx = fetch16(ip);
-                ip += sizeof(idx);
-                auto obj = reinterpret_cast<Malang_Object_Body*>(vm.pop_data().as_object());
-                auto value = vm.pop_data();
+                auto idx = read16(ip);
+                auto obj = reinterpret_cast<Malang_Object_Body*>(POP().as_object());
+                auto value = POP();
                 obj->fields[idx] = value;
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Local)
             {
                 ip++;
-                auto n = fetch16(ip);
-                ip += sizeof(n);
+                auto n = read16(ip);
                 auto v = fast_locals[n];
-                vm.push_data(v);
+                PUSH(v);
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Local_0)
             {
                 ip++;
                 auto v = fast_locals[0];
-                vm.push_data(v);
+                PUSH(v);
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Local_1)
             {
                 ip++;
                 auto v = fast_locals[1];
-                vm.push_data(v);
+                PUSH(v);
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Local_2)
             {
                 ip++;
                 auto v = fast_locals[2];
-                vm.push_data(v);
+                PUSH(v);
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Local_3)
             {
                 ip++;
                 auto v = fast_locals[3];
-                vm.push_data(v);
+                PUSH(v);
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Local_4)
             {
                 ip++;
                 auto v = fast_locals[4];
-                vm.push_data(v);
+                PUSH(v);
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Local_5)
             {
                 ip++;
                 auto v = fast_locals[5];
-                vm.push_data(v);
+                PUSH(v);
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Local_6)
             {
                 ip++;
                 auto v = fast_locals[6];
-                vm.push_data(v);
+                PUSH(v);
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Local_7)
             {
                 ip++;
                 auto v = fast_locals[7];
-                vm.push_data(v);
+                PUSH(v);
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Local_8)
             {
                 ip++;
                 auto v = fast_locals[8];
-                vm.push_data(v);
+                PUSH(v);
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_Local_9)
             {
                 ip++;
                 auto v = fast_locals[9];
-                vm.push_data(v);
+                PUSH(v);
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Local)
             {
                 ip++;
-                auto n = fetch16(ip);
-                ip += sizeof(n);
-                auto v = vm.pop_data();
+                auto n = read16(ip);
+                auto v = POP();
                 fast_locals[n] = v;
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Local_0)
             {
                 ip++;
-                auto v = vm.pop_data();
+                auto v = POP();
                 fast_locals[0] = v;
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Local_1)
             {
                 ip++;
-                auto v = vm.pop_data();
+                auto v = POP();
                 fast_locals[1] = v;
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Local_2)
             {
                 ip++;
-                auto v = vm.pop_data();
+                auto v = POP();
                 fast_locals[2] = v;
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Local_3)
             {
                 ip++;
-                auto v = vm.pop_data();
+                auto v = POP();
                 fast_locals[3] = v;
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Local_4)
             {
                 ip++;
-                auto v = vm.pop_data();
+                auto v = POP();
                 fast_locals[4] = v;
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Local_5)
             {
                 ip++;
-                auto v = vm.pop_data();
+                auto v = POP();
                 fast_locals[5] = v;
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Local_6)
             {
                 ip++;
-                auto v = vm.pop_data();
+                auto v = POP();
                 fast_locals[6] = v;
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Local_7)
             {
                 ip++;
-                auto v = vm.pop_data();
+                auto v = POP();
                 fast_locals[7] = v;
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Local_8)
             {
                 ip++;
-                auto v = vm.pop_data();
+                auto v = POP();
                 fast_locals[8] = v;
                 DISPATCH_NEXT;
             }
             DISPATCH(Store_Local_9)
             {
                 ip++;
-                auto v = vm.pop_data();
+                auto v = POP();
                 fast_locals[9] = v;
                 DISPATCH_NEXT;
             }
             DISPATCH(Alloc_Locals)
             {
                 ip++;
-                vm.push_locals_frame(vm.locals_top);
-                auto n = fetch16(ip);
-                ip += sizeof(n);
-                vm.locals_top += n;
-                fast_locals = vm.current_locals();
+                auto n_args = read16(ip);
+                auto n = read16(ip);
+                // the arguments on top of the data stack are the first locals
+                fast_locals = TOP() - n_args;
+                SET_TOP(fast_locals + n);
                 DISPATCH_NEXT;
             }
             DISPATCH(Dup_1)
             {
                 ip++;
-                auto a = vm.pop_data();
-                vm.push_data(a);
-                vm.push_data(a);
+                auto a = POP();
+                PUSH(a);
+                PUSH(a);
                 DISPATCH_NEXT;
             }
             DISPATCH(Dup_2)
             {
                 ip++;
-                auto b = vm.pop_data();
-                auto a = vm.pop_data();
-                vm.push_data(a);
-                vm.push_data(b);
-                vm.push_data(a);
-                vm.push_data(b);
+                auto b = POP();
+                auto a = POP();
+                PUSH(a);
+                PUSH(b);
+                PUSH(a);
+                PUSH(b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Swap_1)
             {
                 ip++;
-                auto b = vm.pop_data();
-                auto a = vm.pop_data();
-                vm.push_data(b);
-                vm.push_data(a);
+                auto b = POP();
+                auto a = POP();
+                PUSH(b);
+                PUSH(a);
                 DISPATCH_NEXT;
             }
             DISPATCH(Over_1)
             {
                 ip++;
-                auto a = vm.data_stack[vm.data_top-2];
-                vm.push_data(a);
+                auto a = PEEK(1);
+                PUSH(a);
                 DISPATCH_NEXT;
             }
             DISPATCH(Drop_1)
             {
                 ip++;
-                vm.data_top -= 1;
+                DROP(1);
                 DISPATCH_NEXT;
             }
             DISPATCH(Drop_2)
             {
                 ip++;
-                vm.data_top -= 2;
+                DROP(2);
                 DISPATCH_NEXT;
             }
             DISPATCH(Drop_3)
             {
                 ip++;
-                vm.data_top -= 3;
+                DROP(3);
                 DISPATCH_NEXT;
             }
             DISPATCH(Drop_4)
             {
                 ip++;
-                vm.data_top -= 4;
+                DROP(4);
                 DISPATCH_NEXT;
             }
             DISPATCH(Drop_N)
             {
                 ip++;
-                auto n = fetch16(ip);
-                ip += sizeof(n);
-                vm.data_top -= n;
+                auto n = read16(ip);
+                DROP(n);
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_Double_m1)
             {
                 ip++;
-                vm.push_data(-1.0);
+                PUSH(-1.0);
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_Double_0)
             {
                 ip++;
-                vm.push_data(0.0);
+                PUSH(0.0);
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_Double_1)
             {
                 ip++;
-                vm.push_data(1.0);
+                PUSH(1.0);
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_Double_2)
             {
                 ip++;
-                vm.push_data(2.0);
+                PUSH(2.0);
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_Fixnum_m1)
             {
                 ip++;
-                vm.push_data(-1);
+                PUSH(-1);
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_Fixnum_0)
             {
                 ip++;
-                vm.push_data(0);
+                PUSH(0);
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_Fixnum_1)
             {
                 ip++;
-                vm.push_data(1);
+                PUSH(1);
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_Fixnum_2)
             {
                 ip++;
-                vm.push_data(2);
+                PUSH(2);
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_Fixnum_3)
             {
                 ip++;
-                vm.push_data(3);
+                PUSH(3);
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_Fixnum_4)
             {
                 ip++;
-                vm.push_data(4);
+                PUSH(4);
                 DISPATCH_NEXT;
             }
             DISPATCH(Literal_Fixnum_5)
             {
                 ip++;
-                vm.push_data(5);
+                PUSH(5);
                 DISPATCH_NEXT;
             }
             DISPATCH(Array_New)
             {
                 ip++;
-                auto type_token = fetch32(ip);
-                ip += sizeof(type_token);
-                auto size = vm.pop_data();
+                auto type_token = read32(ip);
+                auto size = POP();
+                SYNC_SP_OUT;
                 auto array_ref = vm.gc->allocate_array(type_token, size.as_fixnum());
-                vm.push_data(array_ref);
+                PUSH(array_ref);
                 DISPATCH_NEXT;
             }
             DISPATCH(Array_Load_Checked)
             {
                 ip++;
-                auto idx = vm.pop_data().as_fixnum();
-                auto obj_ref = vm.pop_data().as_object();
+                auto idx = POP().as_fixnum();
+                auto obj_ref = POP().as_object();
                 assert(obj_ref->object_tag == Array);
                 auto array = reinterpret_cast<Malang_Array*>(obj_ref);
                 if (idx < 0 || idx >= array->size)
                 {
-                    vm.panic("array load: index out of bounds. index was %d but array size is %d",
-                          idx, array->size);
+                    SYNC_SP_OUT;
+                    vm.panic_at(code_offset(vm, ip - 1),
+                                "array load: index out of bounds. index was %d but array size is %d",
+                                idx, array->size);
                 }
-                vm.push_data(array->data[idx]);
+                PUSH(array->data[idx]);
                 DISPATCH_NEXT;
             }
             DISPATCH(Array_Store_Checked)
             {
                 ip++;
-                auto value = vm.pop_data();
-                auto idx = vm.pop_data().as_fixnum();
-                auto obj_ref = vm.pop_data().as_object();
+                auto value = POP();
+                auto idx = POP().as_fixnum();
+                auto obj_ref = POP().as_object();
                 assert(obj_ref->object_tag == Array);
                 auto array = reinterpret_cast<Malang_Array*>(obj_ref);
                 if (idx < 0 || idx >= array->size)
                 {
-                    vm.panic("array store: index out of bounds. index was %d but array size is %d",
-                          idx, array->size);
+                    SYNC_SP_OUT;
+                    vm.panic_at(code_offset(vm, ip - 1),
+                                "array store: index out of bounds. index was %d but array size is %d",
+                                idx, array->size);
                 }
                 array->data[idx] = value;
                 DISPATCH_NEXT;
@@ -1152,19 +1744,19 @@ void run_code(Malang_VM &vm)
             DISPATCH(Array_Load_Unchecked)
             {
                 ip++;
-                auto idx = vm.pop_data().as_fixnum();
-                auto obj_ref = vm.pop_data().as_object();
+                auto idx = POP().as_fixnum();
+                auto obj_ref = POP().as_object();
                 assert(obj_ref->object_tag == Array);
                 auto array = reinterpret_cast<Malang_Array*>(obj_ref);
-                vm.push_data(array->data[idx]);
+                PUSH(array->data[idx]);
                 DISPATCH_NEXT;
             }
             DISPATCH(Array_Store_Unchecked)
             {
                 ip++;
-                auto value = vm.pop_data();
-                auto idx = vm.pop_data().as_fixnum();
-                auto obj_ref = vm.pop_data().as_object();
+                auto value = POP();
+                auto idx = POP().as_fixnum();
+                auto obj_ref = POP().as_object();
                 assert(obj_ref->object_tag == Array);
                 auto array = reinterpret_cast<Malang_Array*>(obj_ref);
                 array->data[idx] = value;
@@ -1173,59 +1765,65 @@ void run_code(Malang_VM &vm)
             DISPATCH(Array_Length)
             {
                 ip++;
-                auto obj_ref = vm.pop_data().as_object();
+                auto obj_ref = POP().as_object();
                 assert(obj_ref->object_tag == Array);
                 auto array = reinterpret_cast<Malang_Array*>(obj_ref);
-                vm.push_data(array->size);
+                PUSH(array->size);
                 DISPATCH_NEXT;
             }
             DISPATCH(Buffer_New)
             {
                 ip++;
-                auto size = vm.pop_data().as_fixnum();
+                auto size = POP().as_fixnum();
+                SYNC_SP_OUT;
                 auto buff_ref = vm.gc->allocate_buffer(size);
-                vm.push_data(buff_ref);
+                PUSH(buff_ref);
                 DISPATCH_NEXT;
             }
             DISPATCH(Buffer_Copy)
             {
                 ip++;
-                auto obj_a = vm.pop_data().as_object();
+                auto obj_a = POP().as_object();
                 assert(obj_a->object_tag == Buffer);
                 auto buff_a = reinterpret_cast<Malang_Buffer*>(obj_a);
+                SYNC_SP_OUT;
                 auto obj_b = vm.gc->allocate_buffer(buff_a->size);
                 auto buff_b = reinterpret_cast<Malang_Buffer*>(obj_b);
                 memcpy(buff_b->data, buff_a->data, buff_b->size);
-                vm.push_data(obj_b);
+                PUSH(obj_b);
                 DISPATCH_NEXT;
             }
             DISPATCH(Buffer_Load_Checked)
             {
                 ip++;
-                auto idx = vm.pop_data().as_fixnum();
-                auto obj_ref = vm.pop_data().as_object();
+                auto idx = POP().as_fixnum();
+                auto obj_ref = POP().as_object();
                 assert(obj_ref->object_tag == Buffer);
                 auto buffer = reinterpret_cast<Malang_Buffer*>(obj_ref);
                 if (idx < 0 || idx >= buffer->size)
                 {
-                    vm.panic("buffer load: index out of bounds. index was %d but buffer size is %d",
-                          idx, buffer->size);
+                    SYNC_SP_OUT;
+                    vm.panic_at(code_offset(vm, ip - 1),
+                                "buffer load: index out of bounds. index was %d but buffer size is %d",
+                                idx, buffer->size);
                 }
-                vm.push_data(buffer->data[idx]);
+                PUSH(buffer->data[idx]);
                 DISPATCH_NEXT;
             }
             DISPATCH(Buffer_Store_Checked)
             {
                 ip++;
-                auto value = vm.pop_data().as_fixnum();
-                auto idx = vm.pop_data().as_fixnum();
-                auto obj_ref = vm.pop_data().as_object();
+                auto value = POP().as_fixnum();
+                auto idx = POP().as_fixnum();
+                auto obj_ref = POP().as_object();
                 assert(obj_ref->object_tag == Buffer);
                 auto buffer = reinterpret_cast<Malang_Buffer*>(obj_ref);
                 if (idx < 0 || idx >= buffer->size)
                 {
-                    vm.panic("buffer store: index out of bounds. index was %d but buffer size is %d",
-                          idx, buffer->size);
+                    SYNC_SP_OUT;
+                    vm.panic_at(code_offset(vm, ip - 1),
+                                "buffer store: index out of bounds. index was %d but buffer size is %d",
+                                idx, buffer->size);
                 }
                 buffer->data[idx] = value;
                 DISPATCH_NEXT;
@@ -1233,19 +1831,19 @@ void run_code(Malang_VM &vm)
             DISPATCH(Buffer_Load_Unchecked)
             {
                 ip++;
-                auto idx = vm.pop_data().as_fixnum();
-                auto obj_ref = vm.pop_data().as_object();
+                auto idx = POP().as_fixnum();
+                auto obj_ref = POP().as_object();
                 assert(obj_ref->object_tag == Buffer);
                 auto buffer = reinterpret_cast<Malang_Buffer*>(obj_ref);
-                vm.push_data(buffer->data[idx]);
+                PUSH(buffer->data[idx]);
                 DISPATCH_NEXT;
             }
             DISPATCH(Buffer_Store_Unchecked)
             {
                 ip++;
-                auto value = vm.pop_data().as_fixnum();
-                auto idx = vm.pop_data().as_fixnum();
-                auto obj_ref = vm.pop_data().as_object();
+                auto value = POP().as_fixnum();
+                auto idx = POP().as_fixnum();
+                auto obj_ref = POP().as_object();
                 assert(obj_ref->object_tag == Buffer);
                 auto buffer = reinterpret_cast<Malang_Buffer*>(obj_ref);
                 buffer->data[idx] = value;
@@ -1254,28 +1852,186 @@ void run_code(Malang_VM &vm)
             DISPATCH(Buffer_Length)
             {
                 ip++;
-                auto obj = vm.pop_data().as_object();
+                auto obj = POP().as_object();
                 assert(obj->object_tag == Buffer);
                 auto buff = reinterpret_cast<Malang_Buffer*>(obj);
-                vm.push_data(buff->size);
+                PUSH(buff->size);
                 DISPATCH_NEXT;
             }
             DISPATCH(Load_String_Constant)
             {
                 ip++;
-                auto idx = fetch32(ip);
-                ip += sizeof(idx);
+                auto idx = read32(ip);
                 auto obj = vm.string_constants_objects[idx];
-                vm.push_data(obj);
+                PUSH(obj);
                 DISPATCH_NEXT;
             }
             DISPATCH(Alloc_Object)
             {
                 ip++;
-                auto type_token = fetch32(ip);
-                ip += sizeof(type_token);
+                auto type_token = read32(ip);
+                SYNC_SP_OUT;
                 auto obj_ref = vm.gc->allocate_object(type_token);
-                vm.push_data(obj_ref);
+                PUSH(obj_ref);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Fixnum_Add_Locals)
+            {
+                ip++;
+                auto n = read16(ip);
+                auto m = read16(ip);
+                PUSH(fast_locals[n].as_fixnum() + fast_locals[m].as_fixnum());
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Fixnum_Subtract_Locals)
+            {
+                ip++;
+                auto n = read16(ip);
+                auto m = read16(ip);
+                PUSH(fast_locals[n].as_fixnum() - fast_locals[m].as_fixnum());
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Load_Local_0_Field)
+            {
+                ip++;
+                auto idx = read16(ip);
+                auto obj = reinterpret_cast<Malang_Object_Body*>(fast_locals[0].as_object());
+                PUSH(obj->fields[idx]);
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Fixnum_Increment_Store_Local)
+            {
+                ip++;
+                auto n = read16(ip);
+                auto v = POP().as_fixnum();
+                fast_locals[n] = v+1;
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Fixnum_Increment_Local)
+            {
+                ip++;
+                auto n = read16(ip);
+                fast_locals[n] = fast_locals[n].as_fixnum()+1;
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Fixnum_Equals_Pop_Branch_If_False)
+            {
+                ip++;
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                if (!(a==b))
+                {
+                    take_branch(ip);
+                }
+                else
+                {
+                    skip_branch(ip);
+                }
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Fixnum_Not_Equals_Pop_Branch_If_False)
+            {
+                ip++;
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                if (!(a!=b))
+                {
+                    take_branch(ip);
+                }
+                else
+                {
+                    skip_branch(ip);
+                }
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Fixnum_Greater_Than_Pop_Branch_If_False)
+            {
+                ip++;
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                if (!(a>b))
+                {
+                    take_branch(ip);
+                }
+                else
+                {
+                    skip_branch(ip);
+                }
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Fixnum_Greater_Than_Equals_Pop_Branch_If_False)
+            {
+                ip++;
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                if (!(a>=b))
+                {
+                    take_branch(ip);
+                }
+                else
+                {
+                    skip_branch(ip);
+                }
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Fixnum_Less_Than_Pop_Branch_If_False)
+            {
+                ip++;
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                if (!(a<b))
+                {
+                    take_branch(ip);
+                }
+                else
+                {
+                    skip_branch(ip);
+                }
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Fixnum_Less_Than_Equals_Pop_Branch_If_False)
+            {
+                ip++;
+                auto b = POP().as_fixnum();
+                auto a = POP().as_fixnum();
+                if (!(a<=b))
+                {
+                    take_branch(ip);
+                }
+                else
+                {
+                    skip_branch(ip);
+                }
+                DISPATCH_NEXT;
+            }
+            // The quickened forms of Call_Dyn are kept down here, having them next to Call_Dyn
+            // moved the handlers around enough to slow down unrelated loops.
+            DISPATCH(Call_Dyn_Mono)
+            {
+                ip++;
+                auto offset = POP().as_fixnum();
+                auto cache = ip;
+                auto new_ip = read_call_cache(ip, first_ip, offset);
+                if (!new_ip)
+                {
+                    quicken(vm, cache, HANDLER_TABLE, Instruction::Call_Dyn_Poly, -1);
+                    new_ip = code_at(vm, first_ip, offset);
+                }
+                JIT_ENTER(offset);
+                TRACK_CALL(new_ip);
+                vm.push_call_frame({ip, fast_locals});
+                ip = new_ip;
+                DISPATCH_NEXT;
+            }
+            DISPATCH(Call_Dyn_Poly)
+            {
+                ip++;
+                auto offset = POP().as_fixnum();
+                skip_call_cache(ip);
+                JIT_ENTER(offset);
+                TRACK_CALL(code_at(vm, first_ip, offset));
+                vm.push_call_frame({ip, fast_locals});
+                ip = code_at(vm, first_ip, offset);
                 DISPATCH_NEXT;
             }
         }
@@ -1285,7 +2041,8 @@ void run_code(Malang_VM &vm)
     } // close try
     catch (...)
     {
-        debugger(vm, prev_ins_ip);
+        SYNC_SP_OUT;
+        debugger(vm, vm.code + code_offset(vm, prev_ins_ip), fast_locals);
     }
     #endif
 }
@@ -5,11 +5,23 @@
 #include <stdint.h>
 #include "runtime/primitive_types.hpp"
 #include "runtime/reflection.hpp"
+#include "threaded_code.hpp"
+#include "jit.hpp"
 #include "../type_map.hpp"
 #include "../system_args.hpp"
 
 using byte = unsigned char;
 
+// Pushed by a call with everything needed to resume the caller, so returning restores it from a
+// single record.
+struct Malang_Frame
+{
+    // Points into either `code' or `threaded_code'.
+    void *return_ip;
+    // The caller's locals.
+    Malang_Value *locals;
+};
+
 struct Malang_VM
 {
     ~Malang_VM();
@@ -19,96 +31,88 @@ struct Malang_VM
               const std::vector<String_Constant> &string_constants,
               size_t gc_run_interval = 50, size_t max_num_objects = 1000);
 
-    void load_code(const std::vector<byte> &code);
+    // `code' isn't copied, it has to outlive the VM and end with a Halt. It's written to as
+    // instructions are quickened, so it can be in a copy on write mapping of an image.
+    // `debug_info' is optional and has to outlive the VM, it's only used to say where in the
+    // source things are when something goes wrong. So is `dead_locals', without it the GC
+    // marks every local of every frame.
+    void load_code(byte *code, size_t code_size, const struct Debug_Info *debug_info = nullptr,
+                   const struct Dead_Locals *dead_locals = nullptr);
     void run();
+    // Runs the function at `offset' in the interpreter until it returns, for callers outside
+    // of the interpreter like the JIT. `locals' are the caller's.
+    void call_interpreted(uintptr_t offset, Malang_Value *locals);
+    // The offset into `code' of an instruction pointer into either `code' or `threaded_code'.
+    uintptr_t code_offset_of(const void *ip) const;
 
     struct Malang_GC *gc;
 
-    std::vector<byte> code;
+    // See load_code.
+    byte *code;
+    size_t code_size;
+    const struct Debug_Info *debug_info;
+    // Only used when `use_threaded_code' is set, see load_code.
+    Threaded_Code threaded_code;
+    bool use_threaded_code;
+    // Only created when `use_jit' is set, see load_code.
+    Malang_JIT *jit;
+    bool use_jit;
+    // Only created when Args::profile_ops is set, the instruction counts of run().
+    struct Op_Profile *op_profile;
+    // Set when a Malang_Sampler will be watching, run() then records where each call went in
+    // `called_ips': called_ips[i] is the function call_frames[i] was pushed to call, so the
+    // function running is called_ips[call_frames_top-1] or top level code if there are no
+    // frames. It's a separate stack so calls pay for it only when sampling.
+    bool use_sampler;
+    void **called_ips;
     std::vector<Native_Code> natives;
     std::vector<String_Constant> string_constants;
     std::vector<Malang_Object*> string_constants_objects;
     Type_Map *types;
     bool breaking;
+    // Only looked at by the GC, see load_code.
+    const struct Dead_Locals *dead_locals;
 
-    uintptr_t locals_frames_top;
     uintptr_t call_frames_top;
 
     uintptr_t globals_top;
-    uintptr_t locals_top;
     uintptr_t data_top;
 
-    static constexpr size_t n_frames = 256;
-    static constexpr size_t n_vars = 16000;
-
-    uintptr_t locals_frames[n_frames];
-    byte *call_frames[n_frames];
+    // The stacks are reserved with guard pages on both ends when the VM is created, see
+    // plat::stack_reserve. They only take up memory as they grow and running past the end of one
+    // is caught by the guard page. Their sizes come from Args.
+    size_t max_call_depth;
+    Malang_Frame *call_frames;
 
-    Malang_Value globals[n_vars];
-    Malang_Value locals[n_vars];
-    Malang_Value data_stack[n_vars];
+    Malang_Value *globals;
+    // A function's locals live in the data stack as a window that starts with the arguments
+    // the caller pushed, see Alloc_Locals. The operands of the function are above it.
+    Malang_Value *data_stack;
 
     void panic(const char *fmt, ...);
+    // Like panic but it also says where the instruction at `offset' into `code' came from.
+    void panic_at(uintptr_t offset, const char *fmt, ...);
+    // "name (file:line:char)" of `offset' into `code', or an empty string if it isn't known.
+    std::string describe(uintptr_t offset) const;
 
     void dump_code(uintptr_t ip, size_t n, int width=30) const;
     void trace(uintptr_t ip) const;
     void trace_abort(uintptr_t ip, const char *fmt, ...) const;
     void stack_trace() const;
 
-    void add_local(Malang_Value value);
     void add_global(Malang_Value value);
     void add_data(Malang_Value value);
 
     inline
-    void push_locals_frame(uintptr_t frame)
-    {
-        assert(locals_frames_top+1 < n_frames);
-        locals_frames[locals_frames_top++] = frame;
-    }
-    inline
-    uintptr_t pop_locals_frame()
-    {
-        assert(locals_frames_top > 0);
-        auto frame = locals_frames[--locals_frames_top];
-        return frame;
-    }
-    inline
-    Malang_Value *current_locals()
-    {
-        //assert(locals_frames_top > 0);
-        auto frame = locals_frames[locals_frames_top-1];
-        return &locals[frame];
-    }
-    inline
-    Malang_Value get_local(intptr_t n)
-    {
-        return current_locals()[0+n];
-    }
-    inline
-    void set_local(intptr_t n, Malang_Value value)
-    {
-        current_locals()[0+n] = value;
-    }
-
-    inline
-    void push_call_frame(byte *frame)
+    void push_call_frame(const Malang_Frame &frame)
     {
-        assert(call_frames_top+1 < n_frames);
         call_frames[call_frames_top++] = frame;
     }
     inline
-    byte *pop_call_frame()
+    const Malang_Frame &pop_call_frame()
     {
         assert(call_frames_top > 0);
-        auto frame = call_frames[--call_frames_top];
-        return frame;
-    }
-    inline
-    byte *current_call_frame()
-    {
-        assert(call_frames_top > 0);
-        auto frame = call_frames[call_frames_top-1];
-        return frame;
+        return call_frames[--call_frames_top];
     }
 
     inline
@@ -123,17 +127,6 @@ struct Malang_VM
         return global;
     }
     inline
-    void push_locals(Malang_Value value)
-    {
-        locals[locals_top++] = value;
-    }
-    inline
-    Malang_Value pop_locals()
-    {
-        auto local = locals[--locals_top];
-        return local;
-    }
-    inline
     void push_data(Malang_Value value)
     {
         data_stack[data_top++] = value;